@@ -0,0 +1,154 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+#ifndef TYPE_V_BENCH_H
+#define TYPE_V_BENCH_H
+
+/**
+ * Helpers shared by the benchmarks: timing, memory use, and a small assembler which writes bytecode directly,
+ * so that the benchmarks need neither the compiler nor an image.
+ *
+ * Benchmarks, and the tests named *_test.c, are standalone programs, built against the static library of a
+ * Release build:
+ *   cmake -S . -B build -DCMAKE_BUILD_TYPE=Release && cmake --build build --target typev_static
+ *   cc -O2 -Isource bench/<name>.c build/libtypev.a -lm -ldl -lpthread -o <name>
+ * Engine threads come from TYPEV_ENGINE_THREADS, GC workers from TYPEV_GC_WORKERS.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "engine.h"
+#include "api/typev_api.h"
+#include "instructions/opcodes.h"
+#include "platform/threads.h"
+
+#define BENCH_CODE_SIZE 8192
+
+static uint8_t bench_code[BENCH_CODE_SIZE];
+static uint32_t bench_ip = 0;
+
+/** Moves the assembler to ip, where the next instructions are written */
+static inline void bench_at(uint32_t ip) {
+    bench_ip = ip;
+}
+
+/** @return ip of the next instruction, to jump back to */
+static inline uint32_t bench_here(void) {
+    return bench_ip;
+}
+
+static inline void bench_u8(uint8_t value) {
+    bench_code[bench_ip++] = value;
+}
+
+static inline void bench_u32(uint32_t value) {
+    memcpy(bench_code + bench_ip, &value, 4);
+    bench_ip += 4;
+}
+
+static inline void bench_u64(uint64_t value) {
+    memcpy(bench_code + bench_ip, &value, 8);
+    bench_ip += 8;
+}
+
+/** OP_MV_REG_I reg, 8 bytes value */
+static inline void bench_mv_i(uint8_t reg, uint64_t value) {
+    bench_u8(OP_MV_REG_I);
+    bench_u8(reg);
+    bench_u8(8);
+    bench_u64(value);
+}
+
+/** An instruction taking one register */
+static inline void bench_op1(uint8_t op, uint8_t a) {
+    bench_u8(op);
+    bench_u8(a);
+}
+
+/** An instruction taking two registers */
+static inline void bench_op2(uint8_t op, uint8_t a, uint8_t b) {
+    bench_op1(op, a);
+    bench_u8(b);
+}
+
+/** An instruction taking three registers, such as OP_ADD_U64 dest, a, b */
+static inline void bench_op3(uint8_t op, uint8_t a, uint8_t b, uint8_t c) {
+    bench_op2(op, a, b);
+    bench_u8(c);
+}
+
+/** OP_J_CMP_U64 a, b, cmp, target: cmp 0 ==, 1 !=, 2 >, 3 >=, 4 <, 5 <= */
+static inline void bench_j_cmp_u64(uint8_t a, uint8_t b, uint8_t cmp, uint32_t target) {
+    bench_op3(OP_J_CMP_U64, a, b, cmp);
+    bench_u32(target);
+}
+
+/** OP_HALT with exit code 0, the main core ends the process */
+static inline void bench_exit(uint8_t scratch) {
+    bench_mv_i(scratch, 0);
+    bench_op1(OP_HALT, scratch);
+}
+
+/** OP_CALL_FFI of function fn of the library registered by bench_engine_ffi */
+static inline void bench_call_ffi(uint16_t fn) {
+    uint16_t libID = 0;
+    bench_u8(OP_CALL_FFI);
+    memcpy(bench_code + bench_ip, &libID, 2);
+    memcpy(bench_code + bench_ip + 2, &fn, 2);
+    bench_ip += 4;
+}
+
+/**
+ * Loads the assembled code as the program of a new engine, with empty constants, globals and templates
+ * @param mainIp Where the main core starts
+ */
+static inline void bench_engine_init(TypeV_Engine* engine, uint32_t mainIp) {
+    static uint8_t pool[16];
+    engine_init(engine, 0, NULL);
+    engine_setmain(engine, bench_code, sizeof(bench_code), pool, sizeof(pool), pool, sizeof(pool), pool, sizeof(pool),
+                   (uint8_t*)"{}", 2, 1024, 1024);
+    engine->coreIterator->core->ip = mainIp;
+}
+
+/**
+ * Registers lib as library 0 of the engine, already loaded, for bench_call_ffi
+ * @param lib NULL-terminated
+ */
+static inline void bench_engine_ffi(TypeV_Engine* engine, const TypeV_FFIFunc lib[]) {
+    TypeV_EngineFFI* ffi = malloc(sizeof(TypeV_EngineFFI));
+    ffi->dynlibName = "bench";
+    // registered in place, nothing to load
+    ffi->dynlibHandle = (TV_LibraryHandle)1;
+    ffi->ffi = (TypeV_FFI*)typev_api_register_lib(lib);
+    engine->ffi[0] = ffi;
+    engine->ffiCount = 1;
+}
+
+static inline double bench_seconds_since(uint64_t start_ns) {
+    return (double)(typev_now_ns() - start_ns) / 1e9;
+}
+
+/**
+ * @param field "VmRSS:" for the resident set, "VmHWM:" for its peak
+ * @return Megabytes, 0 where /proc is not available
+ */
+static inline double bench_memory_mb(const char* field) {
+    FILE* status = fopen("/proc/self/status", "r");
+    if(status == NULL) {
+        return 0;
+    }
+    char line[256];
+    long kb = 0;
+    size_t len = strlen(field);
+    while(fgets(line, sizeof(line), status)) {
+        if(strncmp(line, field, len) == 0) {
+            kb = atol(line + len);
+        }
+    }
+    fclose(status);
+    return kb / 1024.0;
+}
+
+#endif //TYPE_V_BENCH_H
@@ -0,0 +1,70 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+/**
+ * Heap use and GC frequency of small allocations: bytes taken in the nursery by the smallest objects of each
+ * kind, then a mix of them with a small live set, counting minor GCs.
+ *
+ * Usage: gc_alloc [allocations, default 20000000]
+ *
+ * Release build, 1 CPU, 20M allocations. "64-byte cells" is the same tree built with CELL_SIZE 64 and the
+ * cell counts of gc.h and policy.h divided by 4, so that both heaps have the same size in bytes:
+ *                                 64-byte cells        16-byte cells
+ *   empty array                        64                   48
+ *   closure, 2 upvalues               128                   80
+ *   struct, 2 fields                  128                   96
+ *   class, 3 fields, 2 methods        192                  144
+ *   20M mixed allocations      2560 MB allocated    1840 MB allocated
+ *                              129 minor GCs        95 minor GCs
+ *                              0.71-0.80 s          0.68-0.75 s
+ */
+
+#include "bench.h"
+#include "core.h"
+#include "gc/gc.h"
+#include "gc/stats.h"
+#include "api/typev_api.h"
+
+static uintptr_t alloc_kind(TypeV_Core* core, uint32_t kind) {
+    switch(kind) {
+        case 0: return core_array_alloc(core, 0, 0, 1);
+        case 1: return core_closure_alloc(core, 0, 0, 2);
+        case 2: return core_struct_alloc(core, 2, 16);
+        default: return core_class_alloc(core, 2, 3, 24, 1);
+    }
+}
+
+int main(int argc, char** argv) {
+    uint64_t n = argc > 1 ? strtoull(argv[1], NULL, 10) : 20000000;
+    static const char* names[] = {"empty array", "closure, 2 upvalues", "struct, 2 fields", "class, 3 fields, 2 methods"};
+
+    TypeV_Engine engine;
+    bench_engine_init(&engine, 0);
+    TypeV_Core* core = engine.coreIterator->core;
+    SET_REG_PTR(core->funcState, 0);
+
+    printf("cell size %d bytes\n", CELL_SIZE);
+    for(uint32_t kind = 0; kind < 4; kind++) {
+        uint64_t before = typev_api_gc_stat(core, GC_STAT_ALLOCATED_BYTES);
+        alloc_kind(core, kind);
+        printf("  %-28s %4llu bytes\n", names[kind],
+               (unsigned long long)(typev_api_gc_stat(core, GC_STAT_ALLOCATED_BYTES) - before));
+    }
+
+    uint64_t minors = typev_api_gc_stat(core, GC_STAT_MINOR_COUNT);
+    uint64_t allocated = typev_api_gc_stat(core, GC_STAT_ALLOCATED_BYTES);
+    uint64_t start = typev_now_ns();
+    for(uint64_t i = 0; i < n; i++) {
+        uintptr_t object = alloc_kind(core, i & 3);
+        // keep one object in a thousand alive until the next one replaces it
+        if(i % 1000 == 0) {
+            core->regs[0].ptr = object;
+        }
+    }
+    printf("  %llu mixed allocations: %.1f MB allocated, %llu minor GCs, nursery limit %.1f MB, %.3f s\n",
+           (unsigned long long)n, (typev_api_gc_stat(core, GC_STAT_ALLOCATED_BYTES) - allocated) / 1e6,
+           (unsigned long long)(typev_api_gc_stat(core, GC_STAT_MINOR_COUNT) - minors),
+           typev_api_gc_stat(core, GC_STAT_NURSERY_LIMIT_BYTES) / 1e6, bench_seconds_since(start));
+    return 0;
+}
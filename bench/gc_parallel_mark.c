@@ -0,0 +1,84 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+/**
+ * Major GC pause against the number of GC workers. The old generation holds linked lists of two-field structs,
+ * half of which are dropped before the measured collections, and every worker count runs the same majors on
+ * the same heap.
+ *
+ * Usage: gc_parallel_mark [live structs, default 3000000] [majors per worker count, default 5]
+ *
+ * Release build, 3M structs (144 MB live after the drop), 5 majors per worker count, two runs. This machine has
+ * a single CPU, so the numbers show the overhead of the pool and not its speedup:
+ *   workers 1: pause min 285-315 ms, max 339-366 ms
+ *   workers 2: pause min 291-343 ms, max 337-383 ms
+ *   workers 4: pause min 309-341 ms, max 374-385 ms
+ *   workers 8: pause min 325-336 ms, max 388-389 ms
+ */
+
+#include "bench.h"
+#include "core.h"
+#include "gc/gc.h"
+#include "gc/workers.h"
+#include "gc/stats.h"
+#include "api/typev_api.h"
+
+#define LISTS 128
+
+static TypeV_Struct* node(TypeV_Core* core, uint64_t value) {
+    TypeV_Struct* s = (TypeV_Struct*)core_struct_alloc(core, 2, 16);
+    s->globalFields[0] = 0;
+    s->globalFields[1] = 1;
+    s->fieldOffsets[0] = 0;
+    s->fieldOffsets[1] = 8;
+    s->pointerBitmask[0] = 1;
+    memset(s->data, 0, 8);
+    memcpy(s->data + 8, &value, 8);
+    return s;
+}
+
+int main(int argc, char** argv) {
+    uint64_t live = argc > 1 ? strtoull(argv[1], NULL, 10) : 3000000;
+    uint32_t majors = argc > 2 ? (uint32_t)atoi(argv[2]) : 5;
+    static const uint32_t workerCounts[] = {1, 2, 4, 8};
+
+    TypeV_Engine engine;
+    bench_engine_init(&engine, 0);
+    TypeV_Core* core = engine.coreIterator->core;
+    for(uint32_t r = 0; r < LISTS; r++) {
+        SET_REG_PTR(core->funcState, r);
+        core->regs[r].ptr = 0;
+    }
+
+    for(uint64_t i = 0; i < live; i++) {
+        uint32_t r = i % LISTS;
+        TypeV_Struct* n = node(core, i);
+        memcpy(n->data, &core->regs[r].ptr, 8);
+        core->regs[r].ptr = (uintptr_t)n;
+    }
+    // promote everything, then drop half of the lists so that the old generation holds garbage too
+    for(uint32_t k = 0; k < GC_MAX_AGE + 1; k++) {
+        perform_minor_gc(core);
+    }
+    for(uint32_t r = 0; r < LISTS; r += 2) {
+        core->regs[r].ptr = 0;
+    }
+    perform_major_gc(core);
+    printf("old generation: %.1f MB live, %.1f MB nursery\n", typev_api_gc_stat(core, GC_STAT_OLD_LIVE_BYTES) / 1e6,
+           typev_api_gc_stat(core, GC_STAT_NURSERY_USED_BYTES) / 1e6);
+
+    for(uint32_t w = 0; w < sizeof(workerCounts) / sizeof(workerCounts[0]); w++) {
+        gc_workers_set_count(workerCounts[w]);
+        double best = 1e9, worst = 0;
+        for(uint32_t k = 0; k < majors; k++) {
+            uint64_t start = typev_now_ns();
+            perform_major_gc(core);
+            double ms = bench_seconds_since(start) * 1e3;
+            best = ms < best ? ms : best;
+            worst = ms > worst ? ms : worst;
+        }
+        printf("workers %u: pause min %.1f ms, max %.1f ms\n", workerCounts[w], best, worst);
+    }
+    return 0;
+}
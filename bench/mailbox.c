@@ -0,0 +1,125 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+/**
+ * Message passing between cores: latency of a ping-pong between two cores, throughput of producers sending to a
+ * single consumer.
+ *
+ * Usage: mailbox pingpong [round trips, default 1000000] [payload bytes, default 0]
+ *        mailbox fanin [messages per producer, default 1000000] [producers, default 4] [payload bytes, default 0]
+ *
+ * A payload of 0 sends a scalar, otherwise an array of that many bytes, deep-copied by every send.
+ *
+ * Release build, 1 CPU, current tree, ranges of three runs with TYPEV_ENGINE_THREADS=1 and 4:
+ *                                  1 thread                 4 threads
+ *   pingpong, scalar, 1M          590-731 ns per round trip   2650-2990 ns
+ *   pingpong, 64 B array, 300k   1140-1690 ns per round trip  6150-6390 ns
+ *   fanin 4 -> 1, scalar, 4M      6.4-9.6 M msg/s             4.9-5.2 M msg/s
+ *   fanin 4 -> 1, 64 B, 1.2M      1.7-2.6 M msg/s             1.5-2.1 M msg/s
+ * Extra threads only add contention on a single CPU.
+ */
+
+#include "bench.h"
+
+static const char* mode;
+static uint64_t count;
+static uint32_t producers;
+static uint64_t payload;
+static uint32_t threads;
+static uint64_t start;
+
+static void report(void) {
+    double seconds = bench_seconds_since(start);
+    if(strcmp(mode, "pingpong") == 0) {
+        printf("pingpong, %u threads, payload %llu B: %llu round trips in %.3f s, %.0f ns per round trip\n", threads,
+               (unsigned long long)payload, (unsigned long long)count, seconds, seconds * 1e9 / count);
+    }
+    else {
+        uint64_t messages = count * producers;
+        printf("fanin %u -> 1, %u threads, payload %llu B: %llu messages in %.3f s, %.2f M msg/s\n", producers, threads,
+               (unsigned long long)payload, (unsigned long long)messages, seconds, messages / seconds / 1e6);
+    }
+}
+
+/** Register r holds the message to send: the scalar in r0, or a new array */
+static uint8_t emit_message(uint8_t r) {
+    if(payload == 0) {
+        return 0;
+    }
+    bench_op2(OP_A_ALLOC, r, 0);
+    bench_u64(payload);
+    bench_u8(1);
+    return r;
+}
+
+int main(int argc, char** argv) {
+    mode = argc > 1 ? argv[1] : "pingpong";
+    count = argc > 2 ? strtoull(argv[2], NULL, 10) : 1000000;
+    uint32_t mainIp = 1024;
+
+    if(strcmp(mode, "fanin") == 0) {
+        producers = argc > 3 ? (uint32_t)atoi(argv[3]) : 4;
+        payload = argc > 4 ? strtoull(argv[4], NULL, 10) : 0;
+        // producer at 0: send count messages to the main core, whose ID is 1
+        bench_mv_i(7, 1);
+        bench_mv_i(0, 0);
+        bench_mv_i(1, count);
+        bench_mv_i(2, 1);
+        uint8_t message = emit_message(10);
+        uint32_t loop = bench_here();
+        bench_op2(OP_MSG_SEND, 7, message);
+        bench_op3(OP_ADD_U64, 0, 0, 2);
+        bench_j_cmp_u64(0, 1, 4, loop);
+        bench_exit(3);
+        // main: spawn the producers, receive every message
+        bench_at(mainIp);
+        bench_mv_i(5, 0);
+        for(uint32_t k = 0; k < producers; k++) {
+            bench_op2(OP_SPAWN, 6, 5);
+        }
+        bench_mv_i(0, 0);
+        bench_mv_i(1, count * producers);
+        bench_mv_i(2, 1);
+        loop = bench_here();
+        bench_op1(OP_MSG_RECV, 3);
+        bench_op3(OP_ADD_U64, 0, 0, 2);
+        bench_j_cmp_u64(0, 1, 4, loop);
+        bench_exit(3);
+    }
+    else {
+        payload = argc > 3 ? strtoull(argv[3], NULL, 10) : 0;
+        // ponger at 0: send every message back to the main core until a 0 arrives
+        bench_mv_i(7, 1);
+        bench_mv_i(8, 0);
+        uint32_t loop = bench_here();
+        bench_op1(OP_MSG_RECV, 0);
+        bench_op2(OP_MSG_SEND, 7, 0);
+        bench_j_cmp_u64(8, 0, 1, loop);
+        bench_exit(3);
+        // main: spawn the ponger, count round trips, then stop it
+        bench_at(mainIp);
+        bench_mv_i(5, 0);
+        bench_op2(OP_SPAWN, 6, 5);
+        bench_mv_i(0, 1);
+        bench_mv_i(1, count);
+        bench_mv_i(2, 1);
+        uint8_t message = emit_message(10);
+        loop = bench_here();
+        bench_op2(OP_MSG_SEND, 6, message);
+        bench_op1(OP_MSG_RECV, 3);
+        bench_op3(OP_ADD_U64, 0, 0, 2);
+        bench_j_cmp_u64(0, 1, 5, loop);
+        bench_mv_i(4, 0);
+        bench_op2(OP_MSG_SEND, 6, 4);
+        bench_exit(3);
+    }
+
+    TypeV_Engine engine;
+    bench_engine_init(&engine, mainIp);
+    threads = engine.threadCount;
+    atexit(report);
+    start = typev_now_ns();
+    engine_run(&engine);
+    return 0;
+}
@@ -0,0 +1,87 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+/**
+ * Safepoint preemption: overhead of the polls on the tightest loop, and fairness between a long and a short core
+ * sharing a thread.
+ *
+ * Usage: preemption loop [iterations, default 100000000]
+ *        preemption fair [long iterations, default 400000000] [short iterations, default 2000000]
+ *
+ * loop runs add_u64 and a backward j_cmp_u64, a poll every iteration. fair spawns a core running the long loop,
+ * gives it the thread, then runs the short loop in the main core and reports when it ends. Run it with
+ * TYPEV_ENGINE_THREADS=1, without preemption the main core only gets its thread back once the long loop is done.
+ *
+ * Release build, 1 CPU, 12 interleaved runs of loop, 100M iterations, ns per iteration. The trees before
+ * preemption (f65b804) and with it (eaa2beb) have no OP_SLEEP, build them with -DOP_SLEEP=OP_HALT for loop:
+ *   f65b804, no polls:  min  9.75, median 10.90
+ *   eaa2beb, polls:     min  8.92, median 10.39
+ *   current tree:       min 10.84, median 12.15
+ * The poll is within the noise of this shared machine, about +/-15%.
+ *
+ * fair, 1 thread, 400M / 2M iterations, current tree: the short loop is done after 0.06-0.07 s, while the long
+ * loop alone takes 5.5 s.
+ */
+
+#include "bench.h"
+
+static uint64_t start;
+static uint64_t iterations;
+
+static void report_loop(void) {
+    double seconds = bench_seconds_since(start);
+    printf("loop, %llu iterations: %.3f s, %.2f ns per iteration\n", (unsigned long long)iterations, seconds,
+           seconds * 1e9 / iterations);
+}
+
+static void report_fair(void) {
+    printf("fair, %u threads: short loop of %llu iterations done after %.3f s\n",
+           atoi(getenv("TYPEV_ENGINE_THREADS") ? getenv("TYPEV_ENGINE_THREADS") : "0"),
+           (unsigned long long)iterations, bench_seconds_since(start));
+}
+
+/** for(r0 = 0; r0 < count; r0++), in registers 0 to 2 */
+static void emit_loop(uint64_t count) {
+    bench_mv_i(0, 0);
+    bench_mv_i(1, count);
+    bench_mv_i(2, 1);
+    uint32_t loop = bench_here();
+    bench_op3(OP_ADD_U64, 0, 0, 2);
+    bench_j_cmp_u64(0, 1, 4, loop);
+}
+
+int main(int argc, char** argv) {
+    const char* mode = argc > 1 ? argv[1] : "loop";
+    uint32_t mainIp = 0;
+
+    if(strcmp(mode, "fair") == 0) {
+        uint64_t longCount = argc > 2 ? strtoull(argv[2], NULL, 10) : 400000000;
+        iterations = argc > 3 ? strtoull(argv[3], NULL, 10) : 2000000;
+        // long core at 0
+        emit_loop(longCount);
+        bench_exit(3);
+        // main: spawn it, let it run, then run the short loop
+        mainIp = 1024;
+        bench_at(mainIp);
+        bench_mv_i(5, 0);
+        bench_op2(OP_SPAWN, 6, 5);
+        bench_mv_i(4, 0);
+        bench_op1(OP_SLEEP, 4);
+        emit_loop(iterations);
+        bench_exit(3);
+        atexit(report_fair);
+    }
+    else {
+        iterations = argc > 2 ? strtoull(argv[2], NULL, 10) : 100000000;
+        emit_loop(iterations);
+        bench_exit(3);
+        atexit(report_loop);
+    }
+
+    TypeV_Engine engine;
+    bench_engine_init(&engine, mainIp);
+    start = typev_now_ns();
+    engine_run(&engine);
+    return 0;
+}
@@ -0,0 +1,130 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+/**
+ * Scheduler regression tests. The halt of the main core ends the process, so each test runs its program on an
+ * engine with a single thread in a child process of its own, and checks its results from an FFI call.
+ *
+ * Usage: scheduler_test [test name, all of them if none]
+ */
+
+#include <assert.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "bench.h"
+#include "mailbox/mailbox.h"
+
+static uint64_t start;
+
+/** FFI 0 of test_sleep_while_spinning: the sleep of 10 ms is over */
+static void ffi_woke(TypeV_Core* core) {
+    (void)core;
+    double seconds = bench_seconds_since(start);
+    printf("  woke after %.3f s\n", seconds);
+    fflush(stdout);
+    assert(seconds >= 0.005 && seconds < 0.2);
+    printf("test_sleep_while_spinning passed\n");
+}
+
+static TypeV_Thread sender;
+
+static void native_sender(void* arg) {
+    TypeV_Core* core = arg;
+    struct timespec delay = {0, 200000000};
+    nanosleep(&delay, NULL);
+    engine_send(core->engineRef, 1, mailbox_message_new(core, 42, 0));
+    engine_native_release(core->engineRef);
+}
+
+/** FFI 0 of test_native_send: a native thread sends 42 to the main core in 200 ms */
+static void ffi_send_later(TypeV_Core* core) {
+    engine_native_retain(core->engineRef);
+    int created = typev_thread_create(&sender, native_sender, core);
+    assert(created == 0);
+}
+
+/** FFI 1 of test_native_send: the message is in r0 */
+static void ffi_received(TypeV_Core* core) {
+    double seconds = bench_seconds_since(start);
+    typev_thread_join(sender);
+    printf("  received %llu after %.3f s\n", (unsigned long long)core->regs[0].u64, seconds);
+    fflush(stdout);
+    assert(core->regs[0].u64 == 42 && seconds >= 0.2);
+    printf("test_native_send passed\n");
+}
+
+static void run(const TypeV_FFIFunc lib[]) {
+    static TypeV_Engine engine;
+    bench_engine_init(&engine, 1024);
+    bench_engine_ffi(&engine, lib);
+    start = typev_now_ns();
+    engine_run(&engine);
+}
+
+/** A core sleeping for 10 ms wakes up on time while another one spins on the only thread */
+void test_sleep_while_spinning() {
+    static TypeV_FFIFunc lib[] = {ffi_woke, NULL};
+    // spinning core at 0, a couple of seconds of additions
+    bench_mv_i(0, 0);
+    bench_mv_i(1, 200000000);
+    bench_mv_i(2, 1);
+    uint32_t loop = bench_here();
+    bench_op3(OP_ADD_U64, 0, 0, 2);
+    bench_j_cmp_u64(0, 1, 4, loop);
+    bench_exit(3);
+    // main: spawn it, sleep, then check the time
+    bench_at(1024);
+    bench_mv_i(5, 0);
+    bench_op2(OP_SPAWN, 6, 5);
+    bench_mv_i(4, 10);
+    bench_op1(OP_SLEEP, 4);
+    bench_call_ffi(0);
+    bench_exit(3);
+    run(lib);
+}
+
+/** The only core waits for a message a native thread sends later, it is not killed as deadlocked meanwhile */
+void test_native_send() {
+    static TypeV_FFIFunc lib[] = {ffi_send_later, ffi_received, NULL};
+    bench_at(1024);
+    bench_call_ffi(0);
+    bench_op1(OP_MSG_RECV, 0);
+    bench_call_ffi(1);
+    bench_exit(3);
+    run(lib);
+}
+
+static const struct {
+    const char* name;
+    void (*run)();
+} tests[] = {
+    {"sleep_while_spinning", test_sleep_while_spinning},
+    {"native_send", test_native_send},
+};
+
+int main(int argc, char** argv) {
+    setenv("TYPEV_ENGINE_THREADS", "1", 1);
+    int failed = 0;
+    for(size_t k = 0; k < sizeof(tests) / sizeof(tests[0]); k++) {
+        if(argc > 1 && strcmp(argv[1], tests[k].name) != 0) {
+            continue;
+        }
+        fflush(stdout);
+        pid_t pid = fork();
+        if(pid == 0) {
+            tests[k].run();
+            // the program ends the process once its checks passed
+            printf("test_%s: the program returned without checking\n", tests[k].name);
+            exit(1);
+        }
+        int status;
+        waitpid(pid, &status, 0);
+        if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            printf("test_%s failed\n", tests[k].name);
+            failed = 1;
+        }
+    }
+    return failed;
+}
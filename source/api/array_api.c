@@ -4,6 +4,8 @@
 
 #include <string.h>
 #include "array_api.h"
+#include "../gc/los.h"
+#include "../errors/errors.h"
 
 TypeV_Array* typev_api_array_create(TypeV_Core* core, uint64_t count, uint8_t elementSize, uint8_t ptr) {
     TypeV_Array* array = (TypeV_Array*)core_array_alloc(core, ptr, count, elementSize);
@@ -17,6 +19,9 @@ TypeV_Array* typev_api_array_create_from_buffer(TypeV_Core* core, uint64_t count
 
 
 void typev_api_array_set(TypeV_Core* core, TypeV_Array* array, uint64_t index, void** value) {
+    if(array->storage == ARRAY_STORAGE_SHARED) {
+        core_panic(core, RT_ERROR_IMMUTABLE, "Cannot store into a shared array");
+    }
     memcpy(array->data + index * array->elementSize, value, array->elementSize);
 }
 
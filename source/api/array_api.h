@@ -13,7 +13,8 @@
 DYNLIB_EXPORT TypeV_Array* typev_api_array_create(TypeV_Core* core, uint64_t count, uint8_t elementSize, uint8_t ptr);
 
 /**
- * @brief Creates an array from a buffer, does not copy the buffer instead uses it as the data
+ * @brief Creates an array from a buffer, does not copy the buffer instead uses it as the data.
+ * The array takes the buffer over: it must come from malloc, and is freed once the array is collected
  * @param core Core
  * @param count Number of elements
  * @param elementSize Size of each element
@@ -7,6 +7,8 @@
 #include <stdint.h>
 #include "typev_api.h"
 #include "../stack/stack.h"
+#include "../gc/gc.h"
+#include "../engine.h"
 
 size_t typev_api_register_lib(const TypeV_FFIFunc methods[]) {
     // get the number of methods
@@ -184,3 +186,51 @@ void typev_api_core_panic(TypeV_Core* core, uint32_t errorId, char* fmt, ...){
     core_panic(core, errorId, fmt);
 };
 
+void typev_api_gc_stats(TypeV_Core* core, TypeV_GCStats* stats) {
+    gc_stats_snapshot(core->gc, stats);
+}
+
+uint64_t typev_api_gc_stat(TypeV_Core* core, uint32_t id) {
+    TypeV_GCStats stats;
+    gc_stats_snapshot(core->gc, &stats);
+    return gc_stats_get(&stats, id);
+}
+
+uint64_t typev_api_gc_pause_histogram(TypeV_Core* core, uint32_t kind, uint32_t bucket) {
+    if(kind >= GC_PAUSE_KINDS || bucket >= GC_PAUSE_BUCKETS) {
+        return 0;
+    }
+    return core->gc->stats.pauses[kind].histogram[bucket];
+}
+
+uint64_t typev_api_core_stat(TypeV_Core* core, uint32_t id) {
+    return sched_stats_core_get(core, id);
+}
+
+uint64_t typev_api_engine_stat(TypeV_Core* core, uint32_t id) {
+    return sched_stats_engine_get(core->engineRef, id);
+}
+
+void typev_api_engine_stats_dump(TypeV_Core* core) {
+    sched_stats_report(core->engineRef);
+}
+
+void typev_api_core_set_class(TypeV_Core* core, uint8_t sclass, uint8_t weight) {
+    engine_set_core_class(core, sclass, weight);
+}
+
+uint64_t typev_api_sched_latency_histogram(TypeV_Core* core, uint32_t sclass, uint32_t bucket) {
+    return sched_stats_latency_get(core->engineRef, sclass, bucket);
+}
+
+void typev_api_parallel_for(TypeV_Core* core, TypeV_Closure* closure, uint64_t start, uint64_t end, uint32_t chunks, TypeV_Array* out) {
+    engine_parallel_for(core->engineRef, core, closure, start, end, chunks, out);
+}
+
+uint8_t typev_api_parallel_pending(TypeV_Core* core) {
+    return engine_parallel_pending(core);
+}
+
+uint8_t typev_api_parallel_wait(TypeV_Core* core) {
+    return engine_parallel_wait(core->engineRef, core);
+}
@@ -14,6 +14,8 @@
 #include "../core.h"
 #include "../dynlib/dynlib.h"
 #include "array_api.h"
+#include "../gc/stats.h"
+#include "../scheduler/stats.h"
 
 DYNLIB_EXPORT size_t typev_api_register_lib(const TypeV_FFIFunc lib[]);
 
@@ -73,6 +75,99 @@ DYNLIB_EXPORT void typev_api_struct_set_offset(struct TypeV_Core *core, TypeV_St
 
 DYNLIB_EXPORT void typev_api_core_panic(TypeV_Core* core, uint32_t errorId, char* fmt, ...);
 
+/**
+ * Copies the GC statistics of a core, counters since startup and current heap sizes
+ * @param core
+ * @param stats
+ */
+DYNLIB_EXPORT void typev_api_gc_stats(struct TypeV_Core* core, TypeV_GCStats* stats);
+
+/**
+ * Reads a single GC statistic
+ * @param core
+ * @param id TypeV_GCStatId
+ * @return the value, 0 for unknown ids
+ */
+DYNLIB_EXPORT uint64_t typev_api_gc_stat(struct TypeV_Core* core, uint32_t id);
+
+/**
+ * Reads a bucket of a GC pause histogram
+ * @param core
+ * @param kind TypeV_GCPauseKind
+ * @param bucket in [0, GC_PAUSE_BUCKETS), see gc/stats.h for the bucket bounds
+ * @return number of pauses in the bucket, 0 for unknown kinds or buckets
+ */
+DYNLIB_EXPORT uint64_t typev_api_gc_pause_histogram(struct TypeV_Core* core, uint32_t kind, uint32_t bucket);
+
+/**
+ * Reads a scheduling statistic of the calling core, as of the end of its last time slice
+ * @param core
+ * @param id TypeV_CoreStatId
+ * @return the value, 0 for unknown ids
+ */
+DYNLIB_EXPORT uint64_t typev_api_core_stat(struct TypeV_Core* core, uint32_t id);
+
+/**
+ * Reads an engine-wide scheduling statistic
+ * @param core
+ * @param id TypeV_EngineStatId
+ * @return the value, 0 for unknown ids
+ */
+DYNLIB_EXPORT uint64_t typev_api_engine_stat(struct TypeV_Core* core, uint32_t id);
+
+/**
+ * Writes the scheduling statistics of the engine, its threads and every core, see scheduler/stats.h
+ * @param core
+ */
+DYNLIB_EXPORT void typev_api_engine_stats_dump(struct TypeV_Core* core);
+
+/**
+ * Sets the scheduling class and weight of the calling core, see engine_set_core_class
+ * @param core
+ * @param sclass TypeV_SchedClass
+ * @param weight 0 for the default of the class
+ */
+DYNLIB_EXPORT void typev_api_core_set_class(struct TypeV_Core* core, uint8_t sclass, uint8_t weight);
+
+/**
+ * Reads a bucket of the run queue latency histogram of a scheduling class
+ * @param core
+ * @param sclass TypeV_SchedClass
+ * @param bucket in [0, SCHED_LATENCY_BUCKETS), see scheduler/stats.h for the bucket bounds
+ * @return number of waits for a thread in the bucket, 0 for unknown classes or buckets
+ */
+DYNLIB_EXPORT uint64_t typev_api_sched_latency_histogram(struct TypeV_Core* core, uint32_t sclass, uint32_t bucket);
+
+/**
+ * Starts a parallel for: splits [start, end) into chunks, and calls `closure` with the start and end of a chunk
+ * and `out` on a core of its own for each one. The chunks write into `out` in place, it must hold values and
+ * not be shared. The closure must only read what it captured, and only write the elements of its own range.
+ * The calling FFI function then joins the chunks with typev_api_parallel_wait.
+ * @param core
+ * @param closure
+ * @param start
+ * @param end Exclusive
+ * @param chunks Number of chunks, 0 for a few per engine thread
+ * @param out
+ */
+DYNLIB_EXPORT void typev_api_parallel_for(struct TypeV_Core* core, TypeV_Closure* closure, uint64_t start, uint64_t end, uint32_t chunks, TypeV_Array* out);
+
+/**
+ * Whether the calling FFI function runs again to join a parallel for, in which case it must not pop its
+ * arguments again: they were popped by the call which started it
+ * @param core
+ * @return 1 if a parallel for is pending
+ */
+DYNLIB_EXPORT uint8_t typev_api_parallel_pending(struct TypeV_Core* core);
+
+/**
+ * Joins the chunks of the parallel for of the calling core. While chunks are still running, the FFI function
+ * must return right away without a result: the core waits, and the same FFI call runs again once a chunk ended.
+ * @param core
+ * @return TypeV_ParallelStatus, PARALLEL_PENDING while chunks are running
+ */
+DYNLIB_EXPORT uint8_t typev_api_parallel_wait(struct TypeV_Core* core);
+
 
 
 
@@ -281,6 +281,18 @@ static char* instructions[] = {
         "coroutine_finish",
         "throw_rt",
         "throw_user_rt",
+        "spawn",
+        "msg_send",
+        "msg_recv",
+        "msg_try_recv",
+        "msg_transfer",
+        "a_share",
+        "sleep",
+        "core_class",
+        "task_spawn",
+        "task_return",
+        "task_transfer",
+        "task_join",
 };
 #define MAX_INSTRUCTION 267
 
@@ -435,6 +447,10 @@ typedef struct TypeV_ASM_Program {
     uint8_t *templatePool;
     uint8_t *objKeysPool;
     uint8_t *codePool;
+
+    const uint8_t *image;     ///< Mapping of the image file the pools point into, NULL unless loaded by typev_image_map
+    uint64_t imageSize;
+    uint64_t globalOffset;    ///< Offset of the globals in the image, they have a mapping of their own
 }TypeV_ASM_Program;
 
 
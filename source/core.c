@@ -7,9 +7,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdalign.h>
+#include <stdatomic.h>
 
 #include "stack/stack.h"
 #include "gc/gc.h"
+#include "gc/mark.h"
+#include "mailbox/mailbox.h"
 #include "engine.h"
 #include "core.h"
 
@@ -57,22 +60,76 @@ TypeV_FuncState* core_duplicate_function_state(TypeV_FuncState* original) {
     return state;
 }
 
-void core_init(TypeV_Core *core, uint32_t id, struct TypeV_Engine *engineRef) {
+/**
+ * Drops the parallel for of a core which was killed waiting for it
+ */
+static void core_parallel_free(TypeV_Core *core) {
+    if(core->parallel != NULL) {
+        free(core->parallel->tasks);
+        free(core->parallel);
+        core->parallel = NULL;
+    }
+}
+
+void core_reinit(TypeV_Core *core, uint32_t id, struct TypeV_Engine *engineRef) {
     core->id = id;
     core->state = CS_INITIALIZED;
+    core->isRunning = 0;
+    core->wakeAt = 0;
+    sched_stats_init(&core->stats);
+    atomic_store(&core->sclass, SCHED_CLASS_NORMAL);
+    atomic_store(&core->weight, SCHED_WEIGHT_NORMAL);
+
+    core->engineRef = engineRef;
+    core->lastSignal = CSIG_NONE;
+    core->exitCode = 0;
+    core->activeCoroutine = NULL;
+    core->joinerID = 0;
+    core->result = NULL;
+    core->parallel = NULL;
+    atomic_store(&core->parallelWaiting, 0);
+    core->restartIp = 0;
 
+    core->ip = 0;
+}
+
+void core_init(TypeV_Core *core, uint32_t id, struct TypeV_Engine *engineRef) {
     core->funcState = core_create_function_state(NULL);
     core->regs = core->funcState->regs;
 
-    // Initialize GC
+    // Initialize GC, the heap is only mapped once the core allocates
     core->gc = initialize_gc();
 
+    core->mailbox = malloc(sizeof(TypeV_Mailbox));
+    mailbox_init(core->mailbox);
 
-    core->engineRef = engineRef;
-    core->lastSignal = CSIG_NONE;
-    core->activeCoroutine = NULL;
+    core_reinit(core, id, engineRef);
+}
 
-    core->ip = 0;
+void core_recycle(TypeV_Core *core) {
+    // keep the outermost function state, free the ones of the calls the core died in
+    TypeV_FuncState* root = core->funcState;
+    while(root->prev != NULL) {
+        root = root->prev;
+    }
+    TypeV_FuncState* state = root->next;
+    while(state != NULL) {
+        TypeV_FuncState* next = state->next;
+        core_free_function_state(core, state);
+        state = next;
+    }
+    root->next = NULL;
+    root->sp = 0;
+    memset(root->regsPtrBitmap, 0, sizeof(root->regsPtrBitmap));
+    core->funcState = root;
+    core->regs = root->regs;
+
+    gc_reset(core);
+
+    // messages sent before the core was detached are dropped
+    mailbox_free(core->mailbox);
+    mailbox_init(core->mailbox);
+    core_parallel_free(core);
 }
 
 void core_setup(TypeV_Core *core, const uint8_t* program, const uint8_t* constantPool, uint8_t* globalPool, const uint8_t* templatePool) {
@@ -86,14 +143,24 @@ void core_setup(TypeV_Core *core, const uint8_t* program, const uint8_t* constan
 
 
 void core_deallocate(TypeV_Core *core) {
-    // first free all the function states
+    // first free all the function states, from the outermost one
     TypeV_FuncState* state = core->funcState;
+    while(state->prev != NULL) {
+        state = state->prev;
+    }
     while(state != NULL) {
         TypeV_FuncState* next = state->next;
         core_free_function_state(core, state);
         state = next;
     }
 
+    mailbox_free(core->mailbox);
+    free(core->mailbox);
+    if(core->result != NULL) {
+        mailbox_message_free(core->result);
+    }
+    core_parallel_free(core);
+
     //core_gc_sweep_all(core);
     //free(core->gc.memObjects);
     free(core);
@@ -129,12 +196,10 @@ uintptr_t core_struct_alloc(TypeV_Core* core, uint8_t numFields, size_t totalSiz
     totalAllocationSize += totalSize;
 
     // Allocate memory
-    TypeV_ObjectHeader* header = (TypeV_ObjectHeader*)gc_alloc(core, totalAllocationSize);
+    TypeV_ObjectHeader* header = (TypeV_ObjectHeader*)gc_alloc_at(core, totalAllocationSize, core->ip);
 
     // Initialize object header
     header->type = OT_STRUCT;
-    header->totalSize = totalAllocationSize;
-    header->surviveCount = 0;
 
     // Initialize TypeV_Struct
     TypeV_Struct* struct_ptr = (TypeV_Struct*)(header + 1);
@@ -157,8 +222,8 @@ uintptr_t core_struct_alloc(TypeV_Core* core, uint8_t numFields, size_t totalSiz
     base_ptr = (uint8_t*)ALIGN_PTR(base_ptr, alignof(uint64_t));
     struct_ptr->data = base_ptr;  // Data starts after aligned PointerBitmask
 
-    static uint32_t uid = 0;
-    struct_ptr->uid = uid++;
+    static _Atomic uint32_t uid = 0;
+    struct_ptr->uid = atomic_fetch_add_explicit(&uid, 1, memory_order_relaxed);
 
     // Zero out the bitmask
     memset(struct_ptr->pointerBitmask, 0, bitmaskSize);
@@ -184,16 +249,17 @@ uintptr_t core_class_alloc(TypeV_Core *core, uint16_t num_methods, uint8_t num_a
 
     // Calculate total allocation size
     size_t totalAllocationSize = sizeof(TypeV_ObjectHeader) + sizeof(TypeV_Class) +
-                                 total_fields_size + methodsSize +
-                                 globalMethodsSize + fieldOffsetsSize + bitmaskSize;
+                                 methodsSize + globalMethodsSize + fieldOffsetsSize + bitmaskSize;
+
+    // Align size for the `data` segment, the padding is not free anymore with small cells
+    totalAllocationSize = ALIGN_PTR(totalAllocationSize, alignof(uint64_t));
+    totalAllocationSize += total_fields_size;
 
     // Allocate memory
-    TypeV_ObjectHeader* header = (TypeV_ObjectHeader*)gc_alloc(core, totalAllocationSize);
+    TypeV_ObjectHeader* header = (TypeV_ObjectHeader*)gc_alloc_at(core, totalAllocationSize, core->ip);
 
     // Initialize object header
     header->type = OT_CLASS;
-    header->totalSize = totalAllocationSize;
-    header->surviveCount = 0;
 
     // Initialize TypeV_Class structure
     TypeV_Class* class_ptr = (TypeV_Class*)(header + 1);
@@ -238,12 +304,15 @@ uintptr_t core_class_alloc(TypeV_Core *core, uint16_t num_methods, uint8_t num_a
 
 
 
-uintptr_t core_array_alloc(TypeV_Core *core, uint8_t is_pointer_container, uint64_t num_elements, uint8_t element_size) {
-    LOG_INFO("CORE[%d]: Allocating array with %" PRIu64 " elements of cellSize %d", core->id, num_elements, element_size);
-
-    static uint32_t uid = 0;
-    size_t totalAllocationSize = sizeof(TypeV_ObjectHeader) + sizeof(TypeV_Array);
-    TypeV_ObjectHeader* header = (TypeV_ObjectHeader*)gc_alloc(core, totalAllocationSize);
+/**
+ * Allocates an array object with a zeroed payload of num_elements * element_size bytes.
+ * Small payloads are allocated inline, right after the array, large ones in the large-object space.
+ */
+static TypeV_Array* core_array_new(TypeV_Core *core, uint8_t is_pointer_container, uint64_t num_elements, uint8_t element_size) {
+    size_t bytes = num_elements * element_size;
+    uint8_t large = bytes >= GC_LARGE_OBJECT_BYTES;
+    size_t totalAllocationSize = sizeof(TypeV_ObjectHeader) + sizeof(TypeV_Array) + (large ? 0 : bytes);
+    TypeV_ObjectHeader* header = (TypeV_ObjectHeader*)gc_alloc_at(core, totalAllocationSize, core->ip);
     header->type = OT_ARRAY;
     // for arrays 0 means elements are not pointers
     // anything else means elements are pointers
@@ -251,12 +320,30 @@ uintptr_t core_array_alloc(TypeV_Core *core, uint8_t is_pointer_container, uint6
     TypeV_Array* array_ptr = (TypeV_Array*)(header + 1);
     array_ptr->elementSize = element_size;
     array_ptr->length = num_elements;
-    array_ptr->data = malloc(num_elements* element_size);
-    if(array_ptr->data == NULL) {
-        core_panic(core, RT_ERROR_OOM, "Failed to allocate array data");
-    }
-    array_ptr->uid = uid++;
     array_ptr->isPointerContainer = is_pointer_container;
+    array_ptr->storage = ARRAY_STORAGE_INLINE;
+    array_ptr->data = (uint8_t*)(array_ptr + 1);
+    array_ptr->capacity = gc_array_inline_capacity(header->cells);
+
+    if(large) {
+        // fresh mappings are already zeroed
+        if(!gc_array_storage_alloc(core, array_ptr, bytes)) {
+            core_panic(core, RT_ERROR_OOM, "Failed to allocate array data");
+        }
+    }
+    else {
+        memset(array_ptr->data, 0, bytes);
+    }
+
+    return array_ptr;
+}
+
+uintptr_t core_array_alloc(TypeV_Core *core, uint8_t is_pointer_container, uint64_t num_elements, uint8_t element_size) {
+    LOG_INFO("CORE[%d]: Allocating array with %" PRIu64 " elements of cellSize %d", core->id, num_elements, element_size);
+
+    static _Atomic uint32_t uid = 0;
+    TypeV_Array* array_ptr = core_array_new(core, is_pointer_container, num_elements, element_size);
+    array_ptr->uid = atomic_fetch_add_explicit(&uid, 1, memory_order_relaxed);
 
     return (uintptr_t)array_ptr;
 }
@@ -268,22 +355,13 @@ uintptr_t core_array_alloc_from_buffer(TypeV_Core *core, uint8_t is_pointer_cont
         return core_array_alloc(core, is_pointer_container, 0, element_size);
     }
 
-    static uint32_t uid = 0;
-    size_t totalAllocationSize = sizeof(TypeV_ObjectHeader) + sizeof(TypeV_Array);
-    TypeV_ObjectHeader* header = (TypeV_ObjectHeader*)gc_alloc(core, totalAllocationSize);
-    header->type = OT_ARRAY;
-    // for arrays 0 means elements are not pointers
-    // anything else means elements are pointers
+    static _Atomic uint32_t uid = 0;
+    TypeV_Array* array_ptr = core_array_new(core, is_pointer_container, 0, element_size);
+    array_ptr->uid = atomic_fetch_add_explicit(&uid, 1, memory_order_relaxed);
 
-    TypeV_Array* array_ptr = (TypeV_Array*)(header + 1);
-    array_ptr->elementSize = element_size;
+    // the array takes the buffer over, it is freed along with it
+    gc_array_storage_adopt(core, array_ptr, buffer, num_elements * element_size);
     array_ptr->length = num_elements;
-    array_ptr->data = buffer;
-    if(array_ptr->data == NULL) {
-        core_panic(core, RT_ERROR_OOM, "Failed to allocate array data");
-    }
-    array_ptr->uid = uid++;
-    array_ptr->isPointerContainer = is_pointer_container;
 
     return (uintptr_t)array_ptr;
 }
@@ -292,22 +370,53 @@ uintptr_t core_array_slice(TypeV_Core *core, TypeV_Array* array, uint64_t start,
     LOG_INFO("Slicing array %p from %" PRIu64 " to %" PRIu64, array, start, end);
 
     size_t slice_length = end - start;
-    size_t totalAllocationSize = sizeof(TypeV_ObjectHeader) + sizeof(TypeV_Array) + slice_length * array->elementSize;
-    TypeV_ObjectHeader* header = (TypeV_ObjectHeader*)gc_alloc(core, totalAllocationSize);
-    header->type = OT_ARRAY;
+    TypeV_Array* array_ptr = core_array_new(core, array->isPointerContainer, slice_length, array->elementSize);
 
-    TypeV_Array* array_ptr = (TypeV_Array*)(header + 1);
-    array_ptr->elementSize = array->elementSize;
-    array_ptr->length = slice_length;
-    array_ptr->data = malloc(slice_length* array->elementSize);
-    array_ptr->uid = 1000000-array->uid;
-    array_ptr->isPointerContainer = array->isPointerContainer;
+    // the allocation may have triggered a collection, the source array may have moved
+    TypeV_ObjectHeader* moved = gc_get_forward(GET_OBJ_HEADER(array));
+    if(moved != NULL) {
+        array = (TypeV_Array*)(moved + 1);
+    }
 
+    array_ptr->uid = 1000000-array->uid;
     memcpy(array_ptr->data, array->data + start * array->elementSize, slice_length * array->elementSize);
 
     return (uintptr_t)array_ptr;
 }
 
+uintptr_t core_array_share(TypeV_Core *core, TypeV_Array* array) {
+    if(array == NULL) {
+        core_panic(core, RT_ERROR_NULL_POINTER, "Cannot share null array");
+    }
+    if(array->isPointerContainer) {
+        core_panic(core, RT_ERROR_NOT_SENDABLE, "Arrays of pointers cannot be shared");
+    }
+
+    // done before the allocation, which may move the source array
+    TypeV_SharedBuffer* buffer;
+    size_t bytes = array->length * array->elementSize;
+    uint64_t length = array->length;
+    uint32_t uid = array->uid;
+    if(array->storage == ARRAY_STORAGE_SHARED) {
+        buffer = gc_shared_buffer_of(array->data);
+        bytes = array->capacity;
+        gc_shared_buffer_retain(buffer);
+    }
+    else {
+        buffer = gc_shared_buffer_new(array->data, bytes);
+        if(buffer == NULL) {
+            core_panic(core, RT_ERROR_OOM, "Failed to allocate shared array data");
+        }
+    }
+
+    TypeV_Array* array_ptr = core_array_new(core, 0, 0, array->elementSize);
+    gc_array_storage_attach(core, array_ptr, buffer->data, bytes, ARRAY_STORAGE_SHARED);
+    array_ptr->length = length;
+    array_ptr->uid = uid;
+
+    return (uintptr_t)array_ptr;
+}
+
 uintptr_t core_array_extend(TypeV_Core *core, uintptr_t array_ptr, uint64_t num_elements){
     LOG_INFO("Extending array %p with %"PRIu64" elements, total allocated cellSize: %d", array_ptr, num_elements, num_elements*sizeof(size_t));
     TypeV_Array* array = (TypeV_Array*)array_ptr;
@@ -316,9 +425,8 @@ uintptr_t core_array_extend(TypeV_Core *core, uintptr_t array_ptr, uint64_t num_
         core_panic(core, RT_ERROR_NULL_POINTER, "Cannot extend null array");
     }
 
-    array->data = realloc(array->data, num_elements*array->elementSize);
-
-    if((array->data == NULL) && num_elements) {
+    // the payload moves out of line once it outgrows its capacity, the array itself stays in place
+    if(!gc_array_storage_reserve(core, array, num_elements*array->elementSize)) {
         core_panic(core, RT_ERROR_OOM, "Failed to reallocate array");
     }
 
@@ -362,6 +470,18 @@ uint64_t core_array_insert(TypeV_Core* core, TypeV_Array* dest, TypeV_Array* src
     // Update the length of the destination array
     dest->length = newLength;
 
+    // the inserted pointers may be young, an old destination has to be rescanned by the next minor GC,
+    // and by the incremental mark in progress if any
+    if(dest->isPointerContainer) {
+        TypeV_ObjectHeader* header = GET_OBJ_HEADER(dest);
+        if(header->location == 1) {
+            gc_remember(core, header);
+            if(core->gc->incremental.marking) {
+                gc_mark_rescan(core, header);
+            }
+        }
+    }
+
     // Return the new position pointing at the end of the inserted elements
     return position + src->length;
 }
@@ -388,8 +508,6 @@ uintptr_t core_closure_alloc(TypeV_Core* core, uintptr_t fnPtr, uint8_t argsOffs
 
     // Set header information
     header->type = OT_CLOSURE;
-    header->totalSize = totalAllocationSize;
-    header->surviveCount = 0;
 
     // Get a pointer to the actual closure, which comes after the header
     TypeV_Closure* closure_ptr = (TypeV_Closure*)(header + 1);
@@ -442,16 +560,14 @@ uintptr_t core_user_object_alloc(TypeV_Core* core, uintptr_t ptr, void (*dealloc
     size_t totalAllocationSize = sizeof(TypeV_ObjectHeader) + sizeof(TypeV_UserObject);
     TypeV_ObjectHeader* header = (TypeV_ObjectHeader*)gc_alloc(core, totalAllocationSize);
     header->type = OT_USER_OBJECT;
-    header->totalSize = totalAllocationSize;
-    header->surviveCount = 0;
-    header->fwd = NULL;
-    header->location = 0;
 
     TypeV_UserObject* user_object = (TypeV_UserObject*)(header + 1);
     user_object->ptr = ptr;
     user_object->dealloc = dealloc;
 
-    return (uintptr_t)header;
+    gc_register_user_object(core, header);
+
+    return (uintptr_t)user_object;
 }
 
 inline uint8_t object_find_global_index(TypeV_Core *core, uint32_t *b, uint8_t n, uint32_t x, uint8_t* errFlag) {
@@ -516,16 +632,15 @@ void core_panic(TypeV_Core* core, uint32_t errorId, char* fmt, ...) {
 
     LOG_ERROR("CORE[%d]: PANIC: ErrorID: %d, Message %s", core->id, errorId, message);
 
-    TypeV_ENV env = get_env();
-    if (env_sourcemap_has(env)) {
+    if (env_sourcemap_has()) {
         LOG_ERROR("Stack trace:");
         // Print first frame
-        TypeV_SourcePoint point = env_sourcemap_get(env, core->ip);
+        TypeV_SourcePoint point = env_sourcemap_get(core->ip);
         LOG_ERROR("function: %s at %s:%d:%d", point.func_name, point.file, point.line + 1, point.column);
 
         TypeV_FuncState* state = core->funcState->prev;
         while (state != NULL) {
-            TypeV_SourcePoint point = env_sourcemap_get(env, state->ip);
+            TypeV_SourcePoint point = env_sourcemap_get(state->ip);
             LOG_ERROR("function: %s at %s:%d:%d", point.func_name, point.file, point.line + 1, point.column);
             state = state->prev;
         }
@@ -537,16 +652,15 @@ void core_panic(TypeV_Core* core, uint32_t errorId, char* fmt, ...) {
 
 void core_panic_custom(TypeV_Core* core, char* message) {
     LOG_ERROR("CORE[%d]: PANIC: ErrorID: %d, Message %s", core->id, RT_ERROR_CUSTOM, message);
-    TypeV_ENV env = get_env();
-    if (env_sourcemap_has(env)) {
+    if (env_sourcemap_has()) {
         LOG_ERROR("Stack trace:");
         // Print first frame
-        TypeV_SourcePoint point = env_sourcemap_get(env, core->ip);
+        TypeV_SourcePoint point = env_sourcemap_get(core->ip);
         LOG_ERROR("function: %s at %s:%d:%d", point.func_name, point.file, point.line + 1, point.column);
 
         TypeV_FuncState* state = core->funcState->prev;
         while (state != NULL) {
-            TypeV_SourcePoint point = env_sourcemap_get(env, state->ip);
+            TypeV_SourcePoint point = env_sourcemap_get(state->ip);
             LOG_ERROR("function: %s at %s:%d:%d", point.func_name, point.file, point.line + 1, point.column);
             state = state->prev;
         }
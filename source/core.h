@@ -11,6 +11,7 @@
 #include <stdint.h>
 #include <stdalign.h>
 #include <stddef.h>
+#include "scheduler/stats.h"
 
 #define PTR_SIZE 8
 #define MAX_REG 256
@@ -43,9 +44,11 @@ typedef struct TypeV_Class {
 
 typedef struct TypeV_Array {
     uint64_t length;          ///< Array length
+    uint64_t capacity;        ///< Bytes available at data
     uint32_t uid;
     uint8_t isPointerContainer;
     uint8_t elementSize;      ///< Size of each element
+    uint8_t storage;          ///< Where data lives, TypeV_ArrayStorage (see gc/los.h)
     uint8_t* data;            ///< Array data
 }TypeV_Array;
 
@@ -88,7 +91,8 @@ typedef enum {
     CS_FINISHING,         ///< Process has received terminate signal and is no longer accepting messages
     CS_TERMINATED,        ///< Process has been gracefully terminated
     CS_KILLED,          ///< Process has been killed
-    CS_CRASHED            ///< Process has crashed
+    CS_CRASHED,           ///< Process has crashed
+    CS_WAITING            ///< Parked until a message arrives in its mailbox, or until its sleep ends
 }TypeV_CoreState;
 
 typedef enum {
@@ -248,6 +252,16 @@ typedef struct TypeV_Core {
     TypeV_CoreState state;                    ///< Core state
 
     struct TypeV_GC* gc;                              ///< Future Garbage collector
+    struct TypeV_Mailbox* mailbox;            ///< Messages sent by other cores
+    uint32_t joinerID;                        ///< Core the result goes to if the core is a task, 0 otherwise
+    struct TypeV_Message* result;             ///< Result of the task, set once it returned, handed over when it ends
+    struct TypeV_ParallelFor* parallel;       ///< Parallel for the core waits for, NULL if none
+    _Atomic uint8_t parallelWaiting;          ///< Set while the core waits for a chunk of its parallel for to end
+    uint64_t restartIp;                       ///< ip of the FFI call in progress, which runs again once the core stops waiting
+    uint64_t wakeAt;                          ///< Engine clock time a sleeping core resumes at, 0 when not sleeping
+    TypeV_CoreStats stats;                    ///< Scheduling statistics
+    _Atomic uint8_t sclass;                   ///< TypeV_SchedClass, read when the core is queued
+    _Atomic uint8_t weight;                   ///< Share of the threads relative to the cores of its class, in [1, SCHED_WEIGHT_MAX]
 
     struct TypeV_Engine* engineRef;           ///< Reference to the engine. Not part of the core state, just to void adding to every function call.
     TypeV_CoreSignal lastSignal;              ///< Last signal received
@@ -280,6 +294,21 @@ void core_free_function_state(TypeV_Core* core, TypeV_FuncState* state);
  * @param engineRef
  */
 void core_init(TypeV_Core *core, uint32_t id, struct TypeV_Engine *engineRef);
+
+/**
+ * Releases what a dead core holds: its heap, its pending messages and the function states of the calls
+ * it died in. The structures are kept for core_reinit.
+ * @param core
+ */
+void core_recycle(TypeV_Core *core);
+
+/**
+ * Initializes a core released by core_recycle, as core_init does a new one
+ * @param core
+ * @param id
+ * @param engineRef
+ */
+void core_reinit(TypeV_Core *core, uint32_t id, struct TypeV_Engine *engineRef);
 void core_setup(
         TypeV_Core *core,
         const uint8_t* program,
@@ -385,6 +414,16 @@ uintptr_t core_array_extend(TypeV_Core *core, size_t array_ptr, uint64_t num_ele
  */
 uintptr_t core_array_slice(TypeV_Core *core, TypeV_Array* array, uint64_t start, uint64_t end);
 
+/**
+ * Creates a shared immutable array with the content of array, which must not hold pointers.
+ * Its buffer is reference counted and lives outside the heap, so that sending the array to other
+ * cores copies no element. Sharing an array which is already shared copies nothing either.
+ * @param core
+ * @param array
+ * @return
+ */
+uintptr_t core_array_share(TypeV_Core *core, TypeV_Array* array);
+
 
 /**
  * Insert a src array into a dest array at a given position,
@@ -2,33 +2,237 @@
 #include <time.h>
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
 
 
 #include "engine.h"
+#include "gc/gc.h"
+#include "gc/los.h"
+#include "mailbox/mailbox.h"
 #include "assembler/assembler.h"
 #include "core.h"
 #include "instructions/opfuncs.h"
 #include "utils/log.h"
 #include "utils/utils.h"
+#include "errors/errors.h"
 #include "vendor/yyjson/yyjson.h"
 
+/** Engine thread running on the current OS thread, NULL outside of engine_run */
+static TYPEV_THREAD_LOCAL TypeV_Worker* engine_current_worker = NULL;
+
+static TypeV_CoreIterator* engine_new_iterator(TypeV_Core* core) {
+    TypeV_CoreIterator* iter = malloc(sizeof(TypeV_CoreIterator));
+    iter->core = core;
+    iter->maxInstructions = 0;
+    iter->currentInstructions = 0;
+    iter->sliceInstructions = 0;
+    atomic_init(&iter->sched, SCHED_QUEUED);
+    iter->sclass = SCHED_CLASS_NORMAL;
+    iter->next = NULL;
+    iter->prev = NULL;
+    iter->runNext = NULL;
+    return iter;
+}
+
+/**
+ * Wakes an idle thread up, if any, once a core was queued
+ */
+static void engine_wake_worker(TypeV_Engine *engine) {
+    // pairs with the fence of engine_park: either the idle thread sees the core, or this sees the thread idle
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load(&engine->idleWorkers) > 0) {
+        typev_mutex_lock(&engine->runLock);
+        typev_cond_signal(&engine->wake);
+        typev_mutex_unlock(&engine->runLock);
+    }
+}
+
+static void engine_global_push(TypeV_Engine *engine, TypeV_CoreIterator* iter) {
+    TypeV_GlobalQueue* queue = &engine->global[sched_class_level(iter->sclass)];
+    typev_mutex_lock(&engine->runLock);
+    iter->runNext = NULL;
+    if(queue->tail == NULL) {
+        queue->head = iter;
+    }
+    else {
+        queue->tail->runNext = iter;
+    }
+    queue->tail = iter;
+    queue->count++;
+    typev_cond_signal(&engine->wake);
+    typev_mutex_unlock(&engine->runLock);
+}
+
+/**
+ * Takes the oldest core of a global run queue, called with the run lock held
+ */
+static TypeV_CoreIterator* engine_global_pop_locked(TypeV_GlobalQueue* queue) {
+    TypeV_CoreIterator* iter = queue->head;
+    if(iter != NULL) {
+        queue->head = iter->runNext;
+        if(queue->head == NULL) {
+            queue->tail = NULL;
+        }
+        queue->count--;
+    }
+    return iter;
+}
+
+static TypeV_CoreIterator* engine_global_pop(TypeV_Engine *engine, uint32_t level) {
+    TypeV_GlobalQueue* queue = &engine->global[level];
+    if(atomic_load_explicit(&queue->count, memory_order_relaxed) == 0) {
+        return NULL;
+    }
+    typev_mutex_lock(&engine->runLock);
+    TypeV_CoreIterator* iter = engine_global_pop_locked(queue);
+    typev_mutex_unlock(&engine->runLock);
+    return iter;
+}
+
+/**
+ * Makes a core runnable. On an engine thread, it goes to the run queue of the thread unless full,
+ * elsewhere to the global run queue
+ */
+static void engine_ready(TypeV_Engine *engine, TypeV_CoreIterator* iter) {
+    TypeV_Worker* worker = engine_current_worker;
+    if(worker != NULL && worker->engine != engine) {
+        worker = NULL;
+    }
+
+    iter->queuedAt = worker != NULL ? worker->now : typev_now_ns();
+    iter->sclass = atomic_load(&iter->core->sclass);
+    atomic_store(&iter->sched, SCHED_QUEUED);
+    if(iter->sclass == SCHED_CLASS_INTERACTIVE) {
+        engine->interactiveQueued++;
+    }
+    engine->queuedCoresCount++;
+
+    if(worker != NULL && sched_runq_push(&worker->queues[sched_class_level(iter->sclass)], iter)) {
+        engine_wake_worker(engine);
+        return;
+    }
+    engine_global_push(engine, iter);
+}
+
+/**
+ * Makes a core waiting for a message or sleeping runnable, unless another thread already did
+ * @return 1 if this call did
+ */
+static uint8_t engine_unpark(TypeV_Engine *engine, TypeV_CoreIterator* iter) {
+    uint8_t expected = SCHED_WAITING;
+    if(!atomic_compare_exchange_strong(&iter->sched, &expected, SCHED_QUEUED)) {
+        return 0;
+    }
+    if(iter->core->wakeAt != 0) {
+        iter->core->wakeAt = 0;
+        engine->sleepingCoresCount--;
+    }
+    else {
+        engine->parkedCoresCount--;
+    }
+    iter->core->state = CS_HALTED;
+    engine_ready(engine, iter);
+    return 1;
+}
+
+/**
+ * Puts a core which stopped on a sleep in the timer wheel
+ */
+static void engine_sleep(TypeV_Engine *engine, TypeV_CoreIterator* iter) {
+    iter->core->state = CS_WAITING;
+    engine->sleepingCoresCount++;
+    atomic_store(&iter->sched, SCHED_WAITING);
+    iter->timer.expires = iter->core->wakeAt;
+
+    typev_mutex_lock(&engine->runLock);
+    sched_wheel_add(&engine->timers, &iter->timer);
+    uint64_t deadline = sched_wheel_next(&engine->timers);
+    atomic_store(&engine->timerDeadline, deadline);
+    // idle threads must find out, either no one keeps time or the timekeeper waits for a later deadline
+    if(deadline < engine->timekeeperDeadline && engine->idleWorkers > 0) {
+        typev_cond_broadcast(&engine->wake);
+    }
+    typev_mutex_unlock(&engine->runLock);
+}
+
+/**
+ * Makes the sleeping cores due by `now` runnable
+ */
+static void engine_fire_timers(TypeV_Engine *engine, uint64_t now) {
+    typev_mutex_lock(&engine->runLock);
+    TypeV_Timer* due = sched_wheel_advance(&engine->timers, now);
+    atomic_store(&engine->timerDeadline, sched_wheel_next(&engine->timers));
+    typev_mutex_unlock(&engine->runLock);
+
+    while(due != NULL) {
+        TypeV_Timer* next = due->next;
+        engine_unpark(engine, (TypeV_CoreIterator*)((uint8_t*)due - offsetof(TypeV_CoreIterator, timer)));
+        due = next;
+    }
+}
+
 void engine_init(TypeV_Engine *engine, int argc, char** argv) {
     // we will allocate memory for cores later
-    engine->coreCount = 0;
-    engine->runningCoresCount = 0;
-    engine->health = EH_OK;
-    engine->coreIterator = malloc(sizeof(TypeV_CoreIterator));
-    engine->coreIterator->core = malloc(sizeof(TypeV_Core));
-    engine->coreIterator->next = NULL;
+    typev_mutex_init(&engine->lock);
+    typev_mutex_init(&engine->runLock);
+    typev_cond_init(&engine->wake);
+    atomic_init(&engine->nextCoreID, 0);
+    atomic_init(&engine->coreCount, 0);
+    atomic_init(&engine->runningCoresCount, 0);
+    atomic_init(&engine->parkedCoresCount, 0);
+    atomic_init(&engine->sleepingCoresCount, 0);
+    atomic_init(&engine->queuedCoresCount, 0);
+    atomic_init(&engine->idleWorkers, 0);
+    atomic_init(&engine->nativeSenders, 0);
+    for(uint32_t level = 0; level < SCHED_LEVELS; level++) {
+        engine->global[level].head = NULL;
+        engine->global[level].tail = NULL;
+        atomic_init(&engine->global[level].count, 0);
+    }
+    atomic_init(&engine->interactiveQueued, 0);
+    for(uint32_t k = 0; k < SCHED_CLASS_COUNT; k++) {
+        sched_stats_class_init(&engine->classStats[k]);
+    }
+    sched_wheel_init(&engine->timers, engine_clock());
+    atomic_init(&engine->timerDeadline, UINT64_MAX);
+    engine->timekeeperDeadline = UINT64_MAX;
+    engine->workers = NULL;
+    engine->workerCount = 0;
+    // each core gets its time slice when it is picked, a core alone keeps running after its safepoints
+    engine->sliceInstructions = ENGINE_SLICE_POLLS;
+    engine->startNs = typev_now_ns();
+    atomic_init(&engine->health, EH_OK);
+    atomic_init(&engine->healthAt, engine->startNs);
+    atomic_init(&engine->windowWaitMaxNs, 0);
+    atomic_init(&engine->healthWaitMaxNs, 0);
+    engine->healthTicks = 0;
+    const char* cpuStats = getenv("TYPEV_ENGINE_CPU_STATS");
+    engine->cpuAccounting = cpuStats != NULL && cpuStats[0] != '\0' && cpuStats[0] != '0';
+    sched_table_init(&engine->coreTable);
+    engine->coreIterator = engine_new_iterator(malloc(sizeof(TypeV_Core)));
+    engine->coreTail = engine->coreIterator;
 
-    engine->ffi = malloc(sizeof(TypeV_FFI*));
+    engine->ffi = calloc(ENGINE_FFI_MAX_LIBS, sizeof(*engine->ffi));
     engine->ffiCount = 0;
 
     core_init(engine->coreIterator->core, engine_generateNewCoreID(engine), engine);
     engine->coreCount++;
+    sched_table_insert(&engine->coreTable, engine->coreIterator);
+    engine_ready(engine, engine->coreIterator);
 
     engine->argv = argv;
     engine->argc = argc;
+
+    uint32_t threads = typev_cpu_count();
+    const char* env = getenv("TYPEV_ENGINE_THREADS");
+    if(env != NULL && atoi(env) > 0) {
+        threads = (uint32_t)atoi(env);
+    }
+    engine_set_threads(engine, threads);
+}
+
+void engine_set_threads(TypeV_Engine *engine, uint32_t count) {
+    engine->threadCount = count == 0 ? 1 : (count > ENGINE_MAX_THREADS ? ENGINE_MAX_THREADS : count);
 }
 
 void engine_setmain(
@@ -64,6 +268,7 @@ void engine_deallocate(TypeV_Engine *engine) {
         iterator = next;
     }
     engine->coreIterator = NULL;
+    engine->coreTail = NULL;
     engine->coreCount = 0;
 
     // free ffi
@@ -71,35 +276,474 @@ void engine_deallocate(TypeV_Engine *engine) {
         free(engine->ffi[i]);
     }
     free(engine->ffi);
+
+    sched_table_free(&engine->coreTable);
+    for(uint32_t level = 0; level < SCHED_LEVELS; level++) {
+        engine->global[level].head = NULL;
+        engine->global[level].tail = NULL;
+    }
+
+    typev_cond_destroy(&engine->wake);
+    typev_mutex_destroy(&engine->runLock);
+    typev_mutex_destroy(&engine->lock);
 }
 
-void engine_run(TypeV_Engine *engine) {
-    int coreIterator = -1;
+/**
+ * Hands the result of a task which ended to the core which spawned it, and wakes that core up in case it
+ * waits for it. Results of tasks whose spawning core is gone are dropped. Called with the engine lock held
+ */
+static void engine_task_post(TypeV_Engine *engine, TypeV_Core* core) {
+    TypeV_Message* msg = core->result != NULL ? core->result : mailbox_message_exit(core->id, core->exitCode);
+    core->result = NULL;
+
+    TypeV_CoreIterator* joiner = sched_table_find(&engine->coreTable, core->joinerID);
+    if(joiner == NULL) {
+        mailbox_message_free(msg);
+        return;
+    }
+
+    // tasks tend to be joined in the order they end, they are found first
+    TypeV_Mailbox* mailbox = joiner->core->mailbox;
+    atomic_store_explicit(&msg->next, NULL, memory_order_relaxed);
+    if(mailbox->resultsTail == NULL) {
+        mailbox->results = msg;
+    }
+    else {
+        atomic_store_explicit(&mailbox->resultsTail->next, msg, memory_order_relaxed);
+    }
+    mailbox->resultsTail = msg;
+    // the joiner waits in task_join on its mailbox, or in an FFI call for a chunk of its parallel for
+    if(atomic_exchange(&mailbox->parked, 0) || atomic_exchange(&joiner->core->parallelWaiting, 0)) {
+        engine_unpark(engine, joiner);
+    }
+}
+
+/**
+ * Removes a core from the core list and table. The caller holds the engine lock, and frees the core once
+ * it released it
+ */
+static void engine_detach_locked(TypeV_Engine *engine, TypeV_Core* core) {
+    LOG_INFO("Core[%d] detached with status %d", core->id, core->state);
+    if(core->id == 1) {
+        // main core
+        engine->mainCoreExitCode = core->exitCode;
+    }
+
+    TypeV_CoreIterator* iter = sched_table_find(&engine->coreTable, core->id);
+    if(iter == NULL) {
+        return;
+    }
+    sched_table_remove(&engine->coreTable, core->id);
+    if(core->joinerID != 0) {
+        engine_task_post(engine, core);
+    }
+    if(iter->prev != NULL) {
+        iter->prev->next = iter->next;
+    }
+    else {
+        engine->coreIterator = iter->next;
+    }
+    if(iter->next != NULL) {
+        iter->next->prev = iter->prev;
+    }
+    else {
+        engine->coreTail = iter->prev;
+    }
+    free(iter);
+
     engine_update_scheduler(engine);
+    if(--engine->coreCount == 0) {
+        typev_mutex_lock(&engine->runLock);
+        typev_cond_broadcast(&engine->wake);
+        typev_mutex_unlock(&engine->runLock);
+    }
+}
 
-    while(1) {
-        if(engine->interruptNextLoop){
-            engine->interruptNextLoop = 0;
+/**
+ * Kills the cores waiting for a message once neither a core nor native code is left to send one. Called by the
+ * last thread going idle, with no lock held.
+ */
+static void engine_break_deadlock(TypeV_Engine *engine) {
+    typev_mutex_lock(&engine->lock);
+    uint32_t killed = 0;
+    for(TypeV_CoreIterator* iter = engine->coreIterator; iter != NULL; iter = iter->next) {
+        if(atomic_load(&iter->sched) == SCHED_WAITING && iter->core->wakeAt == 0) {
+            iter->core->lastSignal = CSIG_KILL;
+            killed += engine_unpark(engine, iter);
         }
+    }
+    typev_mutex_unlock(&engine->lock);
 
-        TypeV_CoreIterator* iter = engine->coreIterator;
-        while(iter != NULL){
-            iter->currentInstructions = 0;
-            if(iter->core->lastSignal == CSIG_KILL) {
-                // kill the core
-                LOG_INFO("Core[%d] killed", iter->core->id);
-                engine_detach_core(engine, iter->core);
-                iter = iter->next;
-                continue;
+    if(killed > 0) {
+        LOG_ERROR("Deadlock, all %d cores are waiting for a message", killed);
+    }
+}
+
+/**
+ * Computes the health over the time slices run since the last update, once ENGINE_HEALTH_INTERVAL_NS passed
+ */
+static void engine_update_health(TypeV_Engine *engine, uint64_t now) {
+    uint64_t last = atomic_load_explicit(&engine->healthAt, memory_order_relaxed);
+    if(now < last + ENGINE_HEALTH_INTERVAL_NS || !atomic_compare_exchange_strong(&engine->healthAt, &last, now)) {
+        return;
+    }
+
+    typev_mutex_lock(&engine->runLock);
+    uint64_t waitMax = atomic_exchange(&engine->windowWaitMaxNs, 0);
+    // cores of the global run queues are the ones most likely to be waiting for long, and have not been picked yet
+    for(uint32_t level = 0; level < SCHED_LEVELS; level++) {
+        TypeV_CoreIterator* head = engine->global[level].head;
+        if(head != NULL && now > head->queuedAt && now - head->queuedAt > waitMax) {
+            waitMax = now - head->queuedAt;
+        }
+    }
+    uint8_t stalled = 0;
+    if(engine->workers != NULL) {
+        uint32_t ticks = 0;
+        for(uint32_t k = 0; k < engine->workerCount; k++) {
+            ticks += atomic_load_explicit(&engine->workers[k].tick, memory_order_relaxed);
+        }
+        stalled = ticks == engine->healthTicks && engine->queuedCoresCount > 0;
+        engine->healthTicks = ticks;
+    }
+    typev_mutex_unlock(&engine->runLock);
+
+    TypeV_EngineHealth health = EH_OK;
+    if(stalled) {
+        health = EH_ZOMBIE;
+    }
+    else if(waitMax >= ENGINE_UNHEALTHY_WAIT_NS) {
+        health = EH_UNHEALTHY;
+    }
+    else if(waitMax >= ENGINE_SLUGGISH_WAIT_NS) {
+        health = EH_SLUGGISH;
+    }
+    atomic_store(&engine->healthWaitMaxNs, waitMax);
+    atomic_store(&engine->health, health);
+}
+
+TypeV_EngineHealth engine_health(TypeV_Engine *engine) {
+    engine_update_health(engine, typev_now_ns());
+    return atomic_load(&engine->health);
+}
+
+/**
+ * Whether a run queue holds a core
+ */
+static uint8_t engine_has_work(TypeV_Engine *engine) {
+    for(uint32_t level = 0; level < SCHED_LEVELS; level++) {
+        if(atomic_load(&engine->global[level].count) > 0) {
+            return 1;
+        }
+        for(uint32_t k = 0; k < engine->workerCount; k++) {
+            if(sched_runq_size(&engine->workers[k].queues[level]) > 0) {
+                return 1;
             }
-            engine_run_core(engine, iter);
-            iter = iter->next;
         }
+    }
+    return 0;
+}
+
+/**
+ * Finds the next core of a run queue level: from the run queue of the thread, the global run queue, then
+ * stolen from another thread starting at a random one.
+ * @return NULL if no core of the level is runnable
+ */
+static TypeV_CoreIterator* engine_find_level(TypeV_Worker* worker, uint32_t level) {
+    TypeV_Engine* engine = worker->engine;
+    TypeV_CoreIterator* iter;
+
+    // interactive cores are rare, most of the time there is none to look for
+    if(level == SCHED_LEVEL_INTERACTIVE && atomic_load_explicit(&engine->interactiveQueued, memory_order_relaxed) == 0) {
+        return NULL;
+    }
+
+    if(atomic_load_explicit(&worker->tick, memory_order_relaxed) % ENGINE_GLOBAL_QUEUE_INTERVAL == 0 &&
+       (iter = engine_global_pop(engine, level)) != NULL) {
+        return iter;
+    }
+    if((iter = sched_runq_pop(&worker->queues[level])) != NULL) {
+        return iter;
+    }
+    if((iter = engine_global_pop(engine, level)) != NULL) {
+        return iter;
+    }
+
+    // xorshift
+    worker->rng ^= worker->rng << 13;
+    worker->rng ^= worker->rng >> 7;
+    worker->rng ^= worker->rng << 17;
+
+    uint32_t count = engine->workerCount;
+    uint32_t start = (uint32_t)(worker->rng % count);
+    for(uint32_t k = 0; k < count; k++) {
+        TypeV_Worker* victim = &engine->workers[(start + k) % count];
+        if(victim != worker && (iter = sched_runq_steal(&worker->queues[level], &victim->queues[level])) != NULL) {
+            return iter;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Finds the next core to run, interactive cores first. Sleeping cores which are due are made runnable first.
+ * @return NULL if no core is runnable
+ */
+static TypeV_CoreIterator* engine_find_work(TypeV_Worker* worker) {
+    TypeV_Engine* engine = worker->engine;
+    TypeV_CoreIterator* iter;
+
+    uint64_t deadline = atomic_load_explicit(&engine->timerDeadline, memory_order_relaxed);
+    if(deadline != UINT64_MAX) {
+        uint64_t now = engine_clock();
+        if(now >= deadline) {
+            engine_fire_timers(engine, now);
+        }
+    }
+
+    for(uint32_t level = 0; level < SCHED_LEVELS; level++) {
+        if((iter = engine_find_level(worker, level)) != NULL) {
+            return iter;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Waits until a core may have become runnable. While cores sleep, one waiting thread wakes up in time for
+ * the next one to be due.
+ * @return 0 once every core has been detached
+ */
+static uint8_t engine_park(TypeV_Worker* worker) {
+    TypeV_Engine* engine = worker->engine;
+
+    typev_mutex_lock(&engine->runLock);
+    if(engine->coreCount == 0) {
+        typev_mutex_unlock(&engine->runLock);
+        return 0;
+    }
+
+    engine->idleWorkers++;
+    // pairs with the fence of engine_wake_worker
+    atomic_thread_fence(memory_order_seq_cst);
+    if(engine_has_work(engine)) {
+        engine->idleWorkers--;
+        typev_mutex_unlock(&engine->runLock);
+        return 1;
+    }
+
+    uint64_t deadline = atomic_load(&engine->timerDeadline);
+    if(deadline != UINT64_MAX && engine->timekeeperDeadline == UINT64_MAX) {
+        uint64_t now = engine_clock();
+        if(deadline > now) {
+            engine->timekeeperDeadline = deadline;
+            atomic_store_explicit(&worker->cpu_ns, typev_thread_cpu_ns(), memory_order_relaxed);
+            typev_cond_timedwait(&engine->wake, &engine->runLock, (deadline - now) * ENGINE_CLOCK_TICK_NS);
+            engine->timekeeperDeadline = UINT64_MAX;
+        }
+        engine->idleWorkers--;
+        typev_mutex_unlock(&engine->runLock);
+        return 1;
+    }
+
+    if(deadline == UINT64_MAX && engine->idleWorkers == engine->workerCount && atomic_load(&engine->nativeSenders) == 0) {
+        // nothing runs, nothing is queued, nothing sleeps and native code sends nothing, the cores left are all
+        // waiting for a message
+        engine->idleWorkers--;
+        typev_mutex_unlock(&engine->runLock);
+        engine_break_deadlock(engine);
+        return 1;
+    }
+
+    atomic_store_explicit(&worker->cpu_ns, typev_thread_cpu_ns(), memory_order_relaxed);
+    typev_cond_wait(&engine->wake, &engine->runLock);
+    engine->idleWorkers--;
+    typev_mutex_unlock(&engine->runLock);
+    return 1;
+}
+
+/**
+ * Accounts for a time slice of a core, from `start` to `end`, and updates the engine health when due
+ */
+static void engine_account_slice(TypeV_Worker* worker, TypeV_CoreIterator* iter, uint64_t start, uint64_t end, uint64_t cpu) {
+    TypeV_Engine* engine = worker->engine;
+    TypeV_CoreStats* stats = &iter->core->stats;
+
+    uint64_t wait = start > iter->queuedAt ? start - iter->queuedAt : 0;
+    sched_stats_add(&stats->slices, 1);
+    sched_stats_add(&stats->run_ns, end - start);
+    sched_stats_add(&stats->wait_ns, wait);
+    sched_stats_max(&stats->wait_max_ns, wait);
+    sched_stats_add(&stats->cpu_ns, cpu);
+    sched_stats_class_record(&engine->classStats[iter->sclass], wait);
+
+    TypeV_GCPauseStats* pauses = iter->core->gc->stats.pauses;
+    atomic_store_explicit(&stats->gc_ns, pauses[GC_PAUSE_MINOR].total_ns + pauses[GC_PAUSE_MAJOR].total_ns +
+                          pauses[GC_PAUSE_MARK_STEP].total_ns, memory_order_relaxed);
+
+    uint64_t windowMax = atomic_load_explicit(&engine->windowWaitMaxNs, memory_order_relaxed);
+    while(wait > windowMax && !atomic_compare_exchange_weak(&engine->windowWaitMaxNs, &windowMax, wait));
+
+    if(end >= atomic_load_explicit(&engine->healthAt, memory_order_relaxed) + ENGINE_HEALTH_INTERVAL_NS) {
+        atomic_store_explicit(&worker->cpu_ns, typev_thread_cpu_ns(), memory_order_relaxed);
+        engine_update_health(engine, end);
+    }
+}
+
+/**
+ * Frees a detached core, or keeps it for engine_spawnCore in the pool of the thread it ended on
+ */
+static void engine_release_core(TypeV_Worker* worker, TypeV_Core* core) {
+    if(worker->poolSize < ENGINE_CORE_POOL_MAX) {
+        core_recycle(core);
+        worker->pool[worker->poolSize++] = core;
+        return;
+    }
+    cleanup_gc(core);
+    core_deallocate(core);
+}
+
+/**
+ * Whether a core which stopped is waiting for a message, a task, or a chunk of its parallel for. Whoever
+ * clears the flag makes it runnable again
+ */
+static inline uint8_t engine_core_waits(TypeV_Core* core) {
+    return atomic_load(&core->mailbox->parked) || atomic_load(&core->parallelWaiting);
+}
+
+/**
+ * Runs a core for a time slice, then requeues, parks or frees it depending on how it stopped
+ */
+static void engine_worker_run(TypeV_Worker* worker, TypeV_CoreIterator* iter) {
+    TypeV_Engine* engine = worker->engine;
+    TypeV_Core* core = iter->core;
+    // the slice starts when the previous one ended, the time to find the core is negligible
+    uint64_t start = worker->now;
+    uint64_t cpu = engine->cpuAccounting ? typev_thread_cpu_ns() : 0;
+
+    if(iter->sclass == SCHED_CLASS_INTERACTIVE) {
+        engine->interactiveQueued--;
+    }
+    engine->queuedCoresCount--;
+    engine->runningCoresCount++;
+    atomic_store(&iter->sched, SCHED_RUNNING);
+    core->isRunning = 1;
+    iter->maxInstructions = engine->sliceInstructions;
+    iter->currentInstructions = 0;
+    iter->sliceInstructions = engine->sliceInstructions * atomic_load(&core->weight);
 
-        if(engine->coreCount == 0) {
+    if(core->lastSignal != CSIG_KILL && (core->state == CS_RUNNING || core->state == CS_HALTED)) {
+        engine_run_core(engine, iter);
+    }
+    if(core->lastSignal == CSIG_KILL) {
+        LOG_INFO("Core[%d] killed", core->id);
+        core->state = CS_KILLED;
+    }
+
+    core->isRunning = 0;
+    engine->runningCoresCount--;
+
+    worker->now = typev_now_ns();
+    engine_account_slice(worker, iter, start, worker->now, engine->cpuAccounting ? typev_thread_cpu_ns() - cpu : 0);
+
+    if(core->state == CS_TERMINATED || core->state == CS_KILLED || core->state == CS_CRASHED) {
+        engine_detach_core(engine, core);
+        engine_release_core(worker, core);
+    }
+    else if(core->wakeAt != 0) {
+        // stopped on a sleep, the timer wheel makes it runnable again
+        engine_sleep(engine, iter);
+    }
+    else if(engine_core_waits(core)) {
+        // stopped on an empty mailbox or a running task, engine_send or the end of the task makes it runnable again
+        core->state = CS_WAITING;
+        engine->parkedCoresCount++;
+        atomic_store(&iter->sched, SCHED_WAITING);
+        // a sender which cleared the flag before the core was waiting left waking it up to this thread
+        if(!engine_core_waits(core)) {
+            engine_unpark(engine, iter);
+        }
+    }
+    else {
+        engine_ready(engine, iter);
+    }
+}
+
+/**
+ * Thread loop, runs cores until none is left
+ */
+static void engine_worker_loop(void* arg) {
+    TypeV_Worker* worker = arg;
+    engine_current_worker = worker;
+
+    while(1) {
+        TypeV_CoreIterator* iter = engine_find_work(worker);
+        if(iter == NULL) {
+            if(!engine_park(worker)) {
+                break;
+            }
+            worker->now = typev_now_ns();
+            continue;
+        }
+        atomic_store_explicit(&worker->tick, atomic_load_explicit(&worker->tick, memory_order_relaxed) + 1, memory_order_relaxed);
+        engine_worker_run(worker, iter);
+    }
+
+    engine_current_worker = NULL;
+}
+
+void engine_run(TypeV_Engine *engine) {
+    uint32_t count = engine->threadCount;
+    engine->workers = malloc(count * sizeof(TypeV_Worker));
+    for(uint32_t k = 0; k < count; k++) {
+        TypeV_Worker* worker = &engine->workers[k];
+        for(uint32_t level = 0; level < SCHED_LEVELS; level++) {
+            sched_runq_init(&worker->queues[level]);
+        }
+        worker->engine = engine;
+        worker->id = k;
+        atomic_init(&worker->tick, 0);
+        worker->rng = 0x9E3779B97F4A7C15ULL * (k + 1);
+        worker->now = typev_now_ns();
+        atomic_init(&worker->cpu_ns, 0);
+        worker->poolSize = 0;
+    }
+
+    // the calling thread is one of the workers, the others are started first so that the count is final
+    TypeV_Thread threads[ENGINE_MAX_THREADS];
+    uint32_t started = 0;
+    engine->workerCount = count;
+    typev_mutex_lock(&engine->runLock);
+    while(started < count - 1) {
+        if(typev_thread_create(&threads[started], engine_worker_loop, &engine->workers[started + 1]) != 0) {
             break;
         }
+        started++;
+    }
+    if(started + 1 < count) {
+        // running threads may already be stealing, the count is only lowered when threads failed to start
+        engine->workerCount = started + 1;
+    }
+    typev_mutex_unlock(&engine->runLock);
+
+    engine_worker_loop(&engine->workers[0]);
+
+    for(uint32_t i = 0; i < started; i++) {
+        typev_thread_join(threads[i]);
+    }
+    typev_mutex_lock(&engine->runLock);
+    TypeV_Worker* workers = engine->workers;
+    engine->workers = NULL;
+    engine->workerCount = 0;
+    typev_mutex_unlock(&engine->runLock);
+
+    for(uint32_t k = 0; k < count; k++) {
+        for(uint32_t i = 0; i < workers[k].poolSize; i++) {
+            cleanup_gc(workers[k].pool[i]);
+            core_deallocate(workers[k].pool[i]);
+        }
     }
+    free(workers);
 }
 
 
@@ -332,21 +976,79 @@ static void* dispatch_table[] = { \
     &&DO_COROUTINE_RESET, \
     &&DO_COROUTINE_FINISH, \
     &&DO_THROW_RT, \
-    &&DO_THROW_USER_RT \
+    &&DO_THROW_USER_RT, \
+    &&DO_SPAWN, \
+    &&DO_MSG_SEND, \
+    &&DO_MSG_RECV, \
+    &&DO_MSG_TRY_RECV, \
+    &&DO_MSG_TRANSFER, \
+    &&DO_A_SHARE, \
+    &&DO_SLEEP, \
+    &&DO_CORE_CLASS, \
+    &&DO_TASK_SPAWN, \
+    &&DO_TASK_RETURN, \
+    &&DO_TASK_TRANSFER, \
+    &&DO_TASK_JOIN \
 };
 
+/**
+ * Slow path of a safepoint poll, every ENGINE_SLICE_POLLS polls. Sleeping cores which are due are made runnable
+ * here too, threads busy running cores would otherwise only find them once a core stops.
+ * @return 1 if the core must return to the scheduler: it was killed, a sleeping core woke up, an interactive
+ * core waits for a thread and this one is not, or this one used its time slice and other cores are waiting for
+ * a thread
+ */
+static uint8_t engine_safepoint(TypeV_Engine *engine, TypeV_CoreIterator* iter) {
+    TypeV_Core* core = iter->core;
+    // saturates, a core alone can run for long
+    if(iter->currentInstructions < iter->sliceInstructions) {
+        iter->currentInstructions += iter->maxInstructions;
+    }
+    if(core->lastSignal == CSIG_KILL) {
+        return 1;
+    }
+
+    // let pending GC work progress even if the core does not allocate
+    gc_safepoint(core);
+
+    uint64_t deadline = atomic_load_explicit(&engine->timerDeadline, memory_order_relaxed);
+    if(deadline != UINT64_MAX) {
+        uint64_t now = engine_clock();
+        if(now >= deadline) {
+            engine_fire_timers(engine, now);
+            return 1;
+        }
+    }
+
+    if(iter->sclass != SCHED_CLASS_INTERACTIVE && atomic_load_explicit(&engine->interactiveQueued, memory_order_relaxed) > 0) {
+        return 1;
+    }
+    return iter->currentInstructions >= iter->sliceInstructions &&
+           atomic_load_explicit(&engine->queuedCoresCount, memory_order_relaxed) > 0;
+}
+
 void engine_run_core(TypeV_Engine *engine, TypeV_CoreIterator* iter) {
-    uint8_t runInf = iter->maxInstructions == -1;
     TypeV_Core * core = iter->core;
     if(core->state == CS_HALTED) {
         core_resume(core);
     }
 
     if(core->state == CS_CRASHED){
-        LOG_INFO("Core[%d] Crashed");
-        engine_detach_core(engine, core);
+        LOG_INFO("Core[%d] Crashed", core->id);
         return;
     }
+
+    // polls left before the next safepoint, kept local so that polling stays a register decrement
+    int32_t budget = iter->maxInstructions;
+    // polls of the budgets already used up, added to the core statistics once the slice ends
+    uint64_t polls = 0;
+#ifdef TYPEV_ENGINE_INSTRUCTION_STATS
+    uint64_t executed = 0;
+#define COUNT_INSTRUCTION() executed++;
+#else
+#define COUNT_INSTRUCTION()
+#endif
+
     while(1){
 
         DISPATCH_TABLE
@@ -354,9 +1056,34 @@ void engine_run_core(TypeV_Engine *engine, TypeV_CoreIterator* iter) {
              \
             /*if((core->ip >= 42) && (core->ip <= 55))                           */\
                /*printf("[%d]=%s\n", core->ip, instructions[core->codePtr[core->ip]]);*/\
+            COUNT_INSTRUCTION()                                                       \
             goto *dispatch_table[core->codePtr[core->ip++]];                          \
         }
 
+/* Safepoint poll, placed after backward jumps and calls so that every loop and recursion reaches one.
+ * The instruction is complete, ip and the frames are consistent and the core can be left and resumed */
+#define SAFEPOINT() { \
+            if(__builtin_expect(--budget <= 0, 0)) { \
+                goto SAFEPOINT_SLOW;                 \
+            }                                        \
+        }
+
+#define JUMP(fn) { \
+            uint64_t from = core->ip; \
+            fn(core);                 \
+            if(core->ip < from) {     \
+                SAFEPOINT();          \
+            }                         \
+        }
+
+        DISPATCH();
+        SAFEPOINT_SLOW:
+        // engine_safepoint accounts for the budget used up, END_RUN only for what is left of the next one
+        polls += iter->maxInstructions - budget;
+        budget = iter->maxInstructions;
+        if(engine_safepoint(engine, iter)) {
+            goto END_RUN;
+        }
         DISPATCH();
         DO_MV_REG_REG:
         mv_reg_reg(core);
@@ -537,11 +1264,18 @@ void engine_run_core(TypeV_Engine *engine, TypeV_CoreIterator* iter) {
         DISPATCH();
         DO_FN_CALL:
         fn_call(core);
+        SAFEPOINT();
         DISPATCH();
         DO_FN_CALLI:
         fn_calli(core);
+        SAFEPOINT();
         DISPATCH();
         DO_FN_RET:
+        if(__builtin_expect(core->funcState->prev == NULL && core->joinerID != 0, 0)) {
+            // returning from the outermost frame of a task, a chunk of a parallel for is done
+            task_end(core, NULL);
+            goto END_RUN;
+        }
         fn_ret(core);
         DISPATCH();
         DO_FN_GET_RET_REG:
@@ -860,64 +1594,70 @@ void engine_run_core(TypeV_Engine *engine, TypeV_CoreIterator* iter) {
         not(core);
         DISPATCH();
         DO_J:
-        jmp(core);
+        JUMP(jmp);
         DISPATCH();
         DO_J_CMP_U8:
-        j_cmp_u8(core);
+        JUMP(j_cmp_u8);
         DISPATCH();
         DO_J_CMP_I8:
-        j_cmp_i8(core);
+        JUMP(j_cmp_i8);
         DISPATCH();
         DO_J_CMP_U16:
-        j_cmp_u16(core);
+        JUMP(j_cmp_u16);
         DISPATCH();
         DO_J_CMP_I16:
-        j_cmp_i16(core);
+        JUMP(j_cmp_i16);
         DISPATCH();
         DO_J_CMP_U32:
-        j_cmp_u32(core);
+        JUMP(j_cmp_u32);
         DISPATCH();
         DO_J_CMP_I32:
-        j_cmp_i32(core);
+        JUMP(j_cmp_i32);
         DISPATCH();
         DO_J_CMP_U64:
-        j_cmp_u64(core);
+        JUMP(j_cmp_u64);
         DISPATCH();
         DO_J_CMP_I64:
-        j_cmp_i64(core);
+        JUMP(j_cmp_i64);
         DISPATCH();
         DO_J_CMP_F32:
-        j_cmp_f32(core);
+        JUMP(j_cmp_f32);
         DISPATCH();
         DO_J_CMP_F64:
-        j_cmp_f64(core);
+        JUMP(j_cmp_f64);
         DISPATCH();
         DO_J_CMP_PTR:
-        j_cmp_ptr(core);
+        JUMP(j_cmp_ptr);
         DISPATCH();
         DO_J_CMP_BOOL:
-        j_cmp_bool(core);
+        JUMP(j_cmp_bool);
         DISPATCH();
         DO_J_EQ_NULL_8:
-        j_eq_null_8(core);
+        JUMP(j_eq_null_8);
         DISPATCH();
         DO_J_EQ_NULL_16:
-        j_eq_null_16(core);
+        JUMP(j_eq_null_16);
         DISPATCH();
         DO_J_EQ_NULL_32:
-        j_eq_null_32(core);
+        JUMP(j_eq_null_32);
         DISPATCH();
         DO_J_EQ_NULL_64:
-        j_eq_null_64(core);
+        JUMP(j_eq_null_64);
         DISPATCH();
         DO_J_EQ_NULL_PTR:
-        j_eq_null_ptr(core);
+        JUMP(j_eq_null_ptr);
         DISPATCH();
         DO_REG_FFI:
         reg_ffi(core);
         DISPATCH();
         DO_CALL_FFI:
+        core->restartIp = core->ip - 1;
         call_ffi(core);
+        if(atomic_load_explicit(&core->parallelWaiting, memory_order_relaxed)) {
+            // the function waits for a parallel for, the call runs again once a chunk ended
+            core->ip = core->restartIp;
+            goto END_RUN;
+        }
         DISPATCH();
         DO_CLOSE_FFI:
         close_ffi(core);
@@ -929,7 +1669,7 @@ void engine_run_core(TypeV_Engine *engine, TypeV_CoreIterator* iter) {
         DISPATCH();
         DO_HALT:
         halt(core);
-        DISPATCH();
+        goto END_RUN;
         DO_LOAD_STD:
         load_std(core);
         DISPATCH();
@@ -944,6 +1684,7 @@ void engine_run_core(TypeV_Engine *engine, TypeV_CoreIterator* iter) {
         DISPATCH();
         DO_CLOSURE_CALL:
         closure_call(core);
+        SAFEPOINT();
         DISPATCH();
         DO_CLOSURE_BACKUP:
         closure_backup(core);
@@ -959,6 +1700,7 @@ void engine_run_core(TypeV_Engine *engine, TypeV_CoreIterator* iter) {
         DISPATCH();
         DO_COROUTINE_CALL:
         coroutine_call(core);
+        SAFEPOINT();
         DISPATCH();
         DO_COROUTINE_YIELD:
         coroutine_yield(core);
@@ -978,8 +1720,60 @@ void engine_run_core(TypeV_Engine *engine, TypeV_CoreIterator* iter) {
         DO_THROW_USER_RT:
         throw_user_rt(core);
         DISPATCH();
+        DO_SPAWN:
+        spawn(core);
+        DISPATCH();
+        DO_MSG_SEND:
+        msg_send(core);
+        DISPATCH();
+        DO_MSG_RECV:
+        msg_recv(core);
+        if(atomic_load_explicit(&core->mailbox->parked, memory_order_relaxed)) {
+            // empty mailbox, msg_recv runs again once the core is woken up
+            goto END_RUN;
+        }
+        DISPATCH();
+        DO_MSG_TRY_RECV:
+        msg_try_recv(core);
+        DISPATCH();
+        DO_MSG_TRANSFER:
+        msg_transfer(core);
+        DISPATCH();
+        DO_A_SHARE:
+        a_share(core);
+        DISPATCH();
+        DO_SLEEP:
+        sleep_ms(core);
+        // the core sleeps, or gives its thread to another core for a zero duration
+        goto END_RUN;
+        DO_CORE_CLASS:
+        core_class(core);
+        DISPATCH();
+        DO_TASK_SPAWN:
+        task_spawn(core);
+        DISPATCH();
+        DO_TASK_RETURN:
+        task_return(core);
+        goto END_RUN;
+        DO_TASK_TRANSFER:
+        task_transfer(core);
+        goto END_RUN;
+        DO_TASK_JOIN:
+        task_join(core);
+        if(atomic_load_explicit(&core->mailbox->parked, memory_order_relaxed)) {
+            // the task is still running, task_join runs again once it ended
+            goto END_RUN;
+        }
+        DISPATCH();
     }
     END_RUN:
+    if(iter->currentInstructions < iter->sliceInstructions) {
+        iter->currentInstructions += iter->maxInstructions - budget;
+    }
+    sched_stats_add(&core->stats.polls, polls + iter->maxInstructions - budget);
+#ifdef TYPEV_ENGINE_INSTRUCTION_STATS
+    sched_stats_add(&core->stats.instructions, executed);
+#endif
 
     // set process to halted, if was gracefully done
     if(core->state == CS_RUNNING && core->lastSignal == CSIG_NONE) {
@@ -988,121 +1782,297 @@ void engine_run_core(TypeV_Engine *engine, TypeV_CoreIterator* iter) {
 }
 
 uint32_t engine_generateNewCoreID(TypeV_Engine *engine) {
-    return engine->coreCount+1;
+    return ++engine->nextCoreID;
 }
 
 void engine_update_scheduler(TypeV_Engine *engine) {
     engine->interruptNextLoop = 1;
-    if(!engine->coreCount){return;}
-    if(engine->coreCount == 1) {
-        engine->coreIterator->maxInstructions = -1;
-        engine->coreIterator->currentInstructions = 0;
-    }
-    else {
-        // iterate over all cores and set maxInstructions to 1
-        TypeV_CoreIterator* iter = engine->coreIterator;
-        while(iter != NULL){
-            iter->maxInstructions = 2;
-            iter->currentInstructions = 0;
-            iter = iter->next;
-        }
-    }
 }
 
-TypeV_Core* engine_spawnCore(TypeV_Engine *engine, TypeV_Core* parentCore, uint64_t ip) {
+/**
+ * Creates a core, a task of core joinerID unless 0. The core is not attached to the engine yet
+ */
+static TypeV_Core* engine_spawn_new(TypeV_Engine *engine, TypeV_Core* parentCore, uint64_t ip, uint32_t joinerID) {
     uint32_t id = engine_generateNewCoreID(engine);
-    TypeV_Core* newCore = malloc(sizeof(TypeV_Core));
-
-
-    core_init(newCore, id, engine);
-    engine->coreCount++;
 
+    // a core which ended on this thread is reused if there is one, the core is set up outside of the lock.
+    // its heap is only mapped once it allocates, code and pools are shared with the parent
+    TypeV_Worker* worker = engine_current_worker;
+    TypeV_Core* newCore;
+    if(worker != NULL && worker->poolSize > 0) {
+        newCore = worker->pool[--worker->poolSize];
+        core_reinit(newCore, id, engine);
+    }
+    else {
+        newCore = malloc(sizeof(TypeV_Core));
+        core_init(newCore, id, engine);
+    }
     newCore->ip = ip;
+    newCore->joinerID = joinerID;
+    atomic_store(&newCore->sclass, atomic_load(&parentCore->sclass));
+    atomic_store(&newCore->weight, atomic_load(&parentCore->weight));
 
     core_setup(newCore,
                parentCore->codePtr,
                parentCore->constPtr,
                parentCore->globalPtr,
                parentCore->templatePtr);
+    return newCore;
+}
+
+/**
+ * Attaches a core created by engine_spawn_new and makes it runnable
+ */
+static uint32_t engine_spawn_attach(TypeV_Engine *engine, TypeV_Core* newCore) {
+    uint32_t id = newCore->id;
+
+    // add iterator and attach to engine
+    TypeV_CoreIterator* iter = engine_new_iterator(newCore);
+
+    typev_mutex_lock(&engine->lock);
+    iter->prev = engine->coreTail;
+    if(engine->coreTail != NULL) {
+        engine->coreTail->next = iter;
+    }
+    else {
+        engine->coreIterator = iter;
+    }
+    engine->coreTail = iter;
+    sched_table_insert(&engine->coreTable, iter);
+    engine->coreCount++;
+    engine_update_scheduler(engine);
+    typev_mutex_unlock(&engine->lock);
+
+    // from here on, the core may run and end on another thread
+    engine_ready(engine, iter);
+    return id;
+}
+
+/**
+ * Spawns a core, a task of core joinerID unless 0
+ */
+static uint32_t engine_spawn(TypeV_Engine *engine, TypeV_Core* parentCore, uint64_t ip, uint32_t joinerID) {
+    return engine_spawn_attach(engine, engine_spawn_new(engine, parentCore, ip, joinerID));
+}
+
+uint32_t engine_spawnCore(TypeV_Engine *engine, TypeV_Core* parentCore, uint64_t ip) {
+    return engine_spawn(engine, parentCore, ip, 0);
+}
+
+uint32_t engine_spawnTask(TypeV_Engine *engine, TypeV_Core* parentCore, uint64_t ip) {
+    return engine_spawn(engine, parentCore, ip, parentCore->id);
+}
 
-    // add iterator and attack to engine
-    TypeV_CoreIterator* newCoreIterator = malloc(sizeof(TypeV_CoreIterator));
-    newCoreIterator->next = NULL;
-    newCoreIterator->currentInstructions = 0;
-    newCoreIterator->maxInstructions = 0;
-    newCoreIterator->core = newCore;
-
-    if(engine->coreIterator == NULL) {
-        engine->coreIterator = newCoreIterator;
-    } else {
-        TypeV_CoreIterator* iterator = engine->coreIterator;
-        while(iterator->next != NULL) {
-            iterator = iterator->next;
+/**
+ * Takes the result of a task, see engine_task_join
+ * @param waiting Flag set while the task is running, which the end of the task clears to wake the core up
+ */
+static TypeV_Message* engine_task_take(TypeV_Engine *engine, TypeV_Core* core, uint32_t taskID, _Atomic uint8_t* waiting, uint8_t* pending) {
+    *pending = 0;
+    typev_mutex_lock(&engine->lock);
+    TypeV_Message* prev = NULL;
+    for(TypeV_Message* msg = core->mailbox->results; msg != NULL; msg = atomic_load_explicit(&msg->next, memory_order_relaxed)) {
+        if(msg->sender == taskID) {
+            TypeV_Message* next = atomic_load_explicit(&msg->next, memory_order_relaxed);
+            if(prev == NULL) {
+                core->mailbox->results = next;
+            }
+            else {
+                atomic_store_explicit(&prev->next, next, memory_order_relaxed);
+            }
+            if(next == NULL) {
+                core->mailbox->resultsTail = prev;
+            }
+            typev_mutex_unlock(&engine->lock);
+            return msg;
         }
-        iterator->next = newCoreIterator;
+        prev = msg;
     }
 
-    engine_update_scheduler(engine);
+    // the task posts its result under the lock, it cannot end between the two lookups
+    TypeV_CoreIterator* task = sched_table_find(&engine->coreTable, taskID);
+    if(task != NULL && task->core->joinerID == core->id) {
+        atomic_store(waiting, 1);
+        *pending = 1;
+    }
+    typev_mutex_unlock(&engine->lock);
+    return NULL;
+}
 
-    return newCore;
+TypeV_Message* engine_task_join(TypeV_Engine *engine, TypeV_Core* core, uint32_t taskID, uint8_t* pending) {
+    return engine_task_take(engine, core, taskID, &core->mailbox->parked, pending);
 }
 
-void engine_detach_core(TypeV_Engine *engine, TypeV_Core* core) {
-    LOG_INFO("Core[%d] detached with status %d", core->id, core->state);
-    // find the core in the iterator list
-    if(core->id == 1) {
-        // main core
-        engine->mainCoreExitCode = core->exitCode;
+uint32_t engine_spawnChunk(TypeV_Engine *engine, TypeV_Core* parentCore, TypeV_Closure* closure, uint64_t start, uint64_t end, TypeV_Array* out) {
+    TypeV_Core* newCore = engine_spawn_new(engine, parentCore, closure->fnAddress, parentCore->id);
+
+    // the arguments and the environment, as closure_call lays them out. The chunk runs in its outermost
+    // frame, returning from it ends the task. Its GC leaves the objects of the parent alone
+    newCore->regs[0].u64 = start;
+    newCore->regs[1].u64 = end;
+    newCore->regs[2].ptr = (uintptr_t)out;
+    SET_REG_PTR(newCore->funcState, 2);
+    for(uint8_t i = 0; i < closure->envSize; i++) {
+        newCore->regs[i + closure->offset] = closure->upvalues[i];
+        if(IS_CLOSURE_UPVALUE_POINTER(closure->ptrFields, i)) {
+            SET_REG_PTR(newCore->funcState, i + closure->offset);
+        }
     }
-    TypeV_CoreIterator* iterator = engine->coreIterator;
-    TypeV_CoreIterator* prevIterator = NULL;
-    while(iterator != NULL) {
-        if(iterator->core == core) {
-            // found it
-            if(prevIterator == NULL) {
-                // we are the first iterator
-                engine->coreIterator = iterator->next;
-            } else {
-                prevIterator->next = iterator->next;
-            }
-            // Free iterator here
-            TypeV_CoreIterator* next = iterator->next;
-            // These cause saniation issues, must fix later
-            //free(iterator);
-            iterator = next;
-            prevIterator = NULL;
-
-            // free the core
-            //core_deallocate(core);
-            //free(core);
-            break;
+
+    return engine_spawn_attach(engine, newCore);
+}
+
+void engine_parallel_for(TypeV_Engine *engine, TypeV_Core* core, TypeV_Closure* closure, uint64_t start, uint64_t end, uint32_t chunks, TypeV_Array* out) {
+    if(closure == NULL) {
+        core_panic(core, RT_ERROR_NULL_POINTER, "Cannot run a null closure in parallel");
+    }
+    if(out == NULL) {
+        core_panic(core, RT_ERROR_NULL_POINTER, "Cannot write a parallel for into a null array");
+    }
+    if(out->isPointerContainer) {
+        // the chunks would store pointers into their own heaps
+        core_panic(core, RT_ERROR_NOT_SENDABLE, "Arrays of pointers cannot be written in parallel");
+    }
+    if(out->storage == ARRAY_STORAGE_SHARED) {
+        core_panic(core, RT_ERROR_IMMUTABLE, "Cannot store into a shared array");
+    }
+    if(end <= start) {
+        return;
+    }
+
+    uint64_t length = end - start;
+    if(chunks == 0) {
+        chunks = engine->threadCount * ENGINE_PARALLEL_CHUNKS;
+    }
+    if(chunks > length) {
+        chunks = (uint32_t)length;
+    }
+
+    TypeV_ParallelFor* parallel = malloc(sizeof(TypeV_ParallelFor));
+    parallel->tasks = malloc(chunks * sizeof(uint32_t));
+    parallel->count = chunks;
+    parallel->joined = 0;
+    parallel->failed = 0;
+    core->parallel = parallel;
+
+    // the first length % chunks chunks take one more element
+    uint64_t size = length / chunks;
+    uint64_t extra = length % chunks;
+    uint64_t from = start;
+    for(uint32_t k = 0; k < chunks; k++) {
+        uint64_t to = from + size + (k < extra);
+        parallel->tasks[k] = engine_spawnChunk(engine, core, closure, from, to, out);
+        from = to;
+    }
+}
+
+TypeV_ParallelStatus engine_parallel_wait(TypeV_Engine *engine, TypeV_Core* core) {
+    TypeV_ParallelFor* parallel = core->parallel;
+    if(parallel == NULL) {
+        return PARALLEL_DONE;
+    }
+
+    while(parallel->joined < parallel->count) {
+        uint8_t pending;
+        TypeV_Message* msg = engine_task_take(engine, core, parallel->tasks[parallel->joined], &core->parallelWaiting, &pending);
+        if(pending) {
+            return PARALLEL_PENDING;
+        }
+        // chunks end without a result, the exit code is the one of their halt if any
+        if(msg == NULL || msg->value != 0) {
+            parallel->failed = 1;
         }
-        prevIterator = iterator;
-        iterator = iterator->next;
+        if(msg != NULL) {
+            mailbox_message_free(msg);
+        }
+        parallel->joined++;
     }
 
-    engine->coreCount--;
-    engine_update_scheduler(engine);
+    TypeV_ParallelStatus status = parallel->failed ? PARALLEL_FAILED : PARALLEL_DONE;
+    free(parallel->tasks);
+    free(parallel);
+    core->parallel = NULL;
+    return status;
 }
 
-void engine_ffi_register(TypeV_Engine *engine, char* dynlibName, uint16_t dynlibID) {
-    if(dynlibID >= engine->ffiCount) {
-        engine->ffiCount = dynlibID+1;
-        engine->ffi = realloc(engine->ffi, sizeof(TypeV_EngineFFI)*engine->ffiCount);
+uint8_t engine_parallel_pending(TypeV_Core* core) {
+    return core->parallel != NULL;
+}
+
+void engine_detach_core(TypeV_Engine *engine, TypeV_Core* core) {
+    typev_mutex_lock(&engine->lock);
+    TypeV_CoreIterator* iter = sched_table_find(&engine->coreTable, core->id);
+    if(iter != NULL && engine->workers == NULL && atomic_load(&iter->sched) == SCHED_QUEUED) {
+        // outside of engine_run, runnable cores are in the global run queues
+        typev_mutex_lock(&engine->runLock);
+        TypeV_GlobalQueue* queue = &engine->global[sched_class_level(iter->sclass)];
+        TypeV_CoreIterator** link = &queue->head;
+        queue->tail = NULL;
+        while(*link != NULL) {
+            if(*link == iter) {
+                *link = iter->runNext;
+                queue->count--;
+                engine->queuedCoresCount--;
+                if(iter->sclass == SCHED_CLASS_INTERACTIVE) {
+                    engine->interactiveQueued--;
+                }
+                continue;
+            }
+            queue->tail = *link;
+            link = &(*link)->runNext;
+        }
+        typev_mutex_unlock(&engine->runLock);
     }
+    engine_detach_locked(engine, core);
+    typev_mutex_unlock(&engine->lock);
+}
 
-    engine->ffi[dynlibID] = malloc(sizeof(TypeV_EngineFFI));
+void engine_set_core_class(TypeV_Core* core, uint8_t sclass, uint8_t weight) {
+    // the statistics dump reads both from other threads
+    sclass = sclass < SCHED_CLASS_COUNT ? sclass : SCHED_CLASS_BATCH;
+    if(weight == 0) {
+        weight = sched_class_weight(sclass);
+    }
+    atomic_store(&core->sclass, sclass);
+    atomic_store(&core->weight, weight > SCHED_WEIGHT_MAX ? SCHED_WEIGHT_MAX : weight);
+}
 
+void engine_send(TypeV_Engine *engine, uint32_t coreID, TypeV_Message* msg) {
+    // the lock keeps the receiver from being detached and freed meanwhile
+    typev_mutex_lock(&engine->lock);
+    TypeV_CoreIterator* iter = sched_table_find(&engine->coreTable, coreID);
+    if(iter == NULL) {
+        typev_mutex_unlock(&engine->lock);
+        LOG_INFO("Message to Core[%d] dropped, no such core", coreID);
+        mailbox_message_free(msg);
+        return;
+    }
 
-    engine->ffi[dynlibID]->dynlibName = dynlibName;
-    engine->ffi[dynlibID]->dynlibHandle = NULL;
-    engine->ffi[dynlibID]->ffi = NULL;
+    mailbox_push(iter->core->mailbox, msg);
+    // the receiver clears the flag itself if it finds the message before it stops
+    if(atomic_exchange(&iter->core->mailbox->parked, 0)) {
+        engine_unpark(engine, iter);
+    }
+    typev_mutex_unlock(&engine->lock);
+}
 
-    // load the library
-    engine_ffi_open(engine, dynlibID);
+void engine_native_retain(TypeV_Engine *engine) {
+    atomic_fetch_add(&engine->nativeSenders, 1);
 }
 
-void engine_ffi_open(TypeV_Engine *engine, uint16_t dynlibID) {
+void engine_native_release(TypeV_Engine *engine) {
+    if(atomic_fetch_sub(&engine->nativeSenders, 1) == 1) {
+        // the last idle thread looks for a deadlock again
+        typev_mutex_lock(&engine->runLock);
+        typev_cond_broadcast(&engine->wake);
+        typev_mutex_unlock(&engine->runLock);
+    }
+}
+
+/**
+ * Loads a registered library, called with the engine lock held
+ */
+static void engine_ffi_open_locked(TypeV_Engine *engine, uint16_t dynlibID) {
     TypeV_EngineFFI* ffi = engine->ffi[dynlibID];
     if(ffi->dynlibHandle != NULL) {
         return;
@@ -1116,35 +2086,69 @@ void engine_ffi_open(TypeV_Engine *engine, uint16_t dynlibID) {
     void* openLib = ffi_dynlib_getsym(lib, "typev_ffi_open");
     ASSERT(openLib != NULL, "Failed to open library %s", ffi_find_dynlib(name));
     size_t (*openFunc)() = openLib;
-    ffi->ffi = (TypeV_FFI*)openFunc();
     ffi->dynlibHandle = lib;
-    engine->ffi[dynlibID] = ffi;
+    // engine_ffi_get reads it without the lock
+    atomic_store_explicit(&ffi->ffi, (TypeV_FFI*)openFunc(), memory_order_release);
+}
+
+void engine_ffi_register(TypeV_Engine *engine, char* dynlibName, uint16_t dynlibID) {
+    typev_mutex_lock(&engine->lock);
+    if(dynlibID >= engine->ffiCount) {
+        engine->ffiCount = dynlibID+1;
+    }
+
+    // every core running the registration code shares the first registration
+    if(engine->ffi[dynlibID] == NULL) {
+        TypeV_EngineFFI* ffi = malloc(sizeof(TypeV_EngineFFI));
+        ffi->dynlibName = dynlibName;
+        ffi->dynlibHandle = NULL;
+        atomic_init(&ffi->ffi, NULL);
+        atomic_store_explicit(&engine->ffi[dynlibID], ffi, memory_order_release);
+    }
+    else {
+        free(dynlibName);
+    }
+
+    // load the library
+    engine_ffi_open_locked(engine, dynlibID);
+    typev_mutex_unlock(&engine->lock);
+}
+
+void engine_ffi_open(TypeV_Engine *engine, uint16_t dynlibID) {
+    typev_mutex_lock(&engine->lock);
+    engine_ffi_open_locked(engine, dynlibID);
+    typev_mutex_unlock(&engine->lock);
 }
 
 TypeV_FFIFunc engine_ffi_get(TypeV_Engine *engine, uint16_t dynlibID, uint8_t methodId){
-    TypeV_EngineFFI* ffi = engine->ffi[dynlibID];
+    // no lock: entries and libraries are published once complete, and stay until the engine stops
+    TypeV_EngineFFI* ffi = atomic_load_explicit(&engine->ffi[dynlibID], memory_order_acquire);
+    ASSERT(ffi != NULL, "Library %d not registered", dynlibID);
+    TypeV_FFI* functions = atomic_load_explicit(&ffi->ffi, memory_order_acquire);
 
-    ASSERT(ffi->dynlibHandle != NULL, "Library %s not loaded", ffi_find_dynlib(ffi->dynlibName));
-    ASSERT(ffi->ffi != NULL, "Library %s not opened", ffi_find_dynlib(ffi->dynlibName));
-    ASSERT(methodId < ffi->ffi->functionCount, "Method %d not found in library %s", methodId, ffi_find_dynlib(ffi->dynlibName));
+    ASSERT(functions != NULL, "Library %s not opened", ffi_find_dynlib(ffi->dynlibName));
+    ASSERT(methodId < functions->functionCount, "Method %d not found in library %s", methodId, ffi_find_dynlib(ffi->dynlibName));
 
-    return ffi->ffi->functions[methodId];
+    return functions->functions[methodId];
 }
 
 void engine_ffi_close(TypeV_Engine *engine, uint16_t dynlibID) {
+    typev_mutex_lock(&engine->lock);
     TypeV_EngineFFI* ffi = engine->ffi[dynlibID];
-    if(ffi->dynlibHandle == NULL) {
-        return;
+    if(engine->workers != NULL) {
+        LOG_INFO("Library %s stays loaded until the engine stops", ffi->dynlibName);
     }
-
-    ffi_dynlib_unload(ffi->dynlibHandle);
-    ffi->dynlibHandle = NULL;
-    ffi->ffi = NULL;
-    engine->ffi[dynlibID] = ffi;
+    else if(ffi->dynlibHandle != NULL) {
+        ffi_dynlib_unload(ffi->dynlibHandle);
+        ffi->dynlibHandle = NULL;
+        ffi->ffi = NULL;
+    }
+    typev_mutex_unlock(&engine->lock);
 }
 
 
 void engine_get_field_id(TypeV_Engine *engine, const char* fieldName, uint32_t* fieldId, uint8_t* error) {
+    // objRoot is immutable once set up, no lock needed
     *fieldId = 0;
     yyjson_val *root = engine->objRoot;
     yyjson_val *obj = yyjson_obj_get(root, fieldName);
@@ -13,12 +13,54 @@
 #include <stdint.h>
 #include "core.h"
 #include "dynlib/dynlib.h"
+#include "platform/threads.h"
+#include "scheduler/scheduler.h"
+#include "scheduler/timer.h"
+#include "scheduler/stats.h"
 
-// Hard limit on the number of cores
-#define MAX_CORES 256
+struct TypeV_Message;
+
+// There is no limit on the number of cores other than memory and their 32-bit IDs, a parked core costs its
+// registers, mailbox and GC nursery, see bench/idle_cores.c
+
+// Hard limit on the number of OS threads running cores
+#define ENGINE_MAX_THREADS 64
+
+// Every that many cores, a thread looks at the global run queue before its own, so that the global queue
+// is not starved by busy threads
+#define ENGINE_GLOBAL_QUEUE_INTERVAL 61
+
+// Safepoint polls a core runs before checking whether it must give its thread to another core, and time slice
+// of a core per unit of weight. Polls happen at backward jumps and calls, so this bounds the time slice without
+// counting every instruction
+#define ENGINE_SLICE_POLLS 256
+
+// Library IDs are 16 bits. The FFI table is allocated whole so that it never moves and FFI calls read it without
+// a lock, the pages of entries which are never registered are not touched
+#define ENGINE_FFI_MAX_LIBS (UINT16_MAX + 1)
+
+// Dead cores each thread keeps for engine_spawnCore to reuse, with their GC, registers and mailbox. This only
+// bounds the cache, cores past it are freed when they end, living cores are not limited by it
+#define ENGINE_CORE_POOL_MAX 256
+
+// Nanoseconds per tick of the engine clock, which sleeping cores are timed with
+#define ENGINE_CLOCK_TICK_NS 1000000ULL
+
+// Interval at which the engine health is computed, over the time slices run meanwhile
+#define ENGINE_HEALTH_INTERVAL_NS 100000000ULL
+
+// Waits for a thread past which a runnable core makes the engine sluggish, then unhealthy
+#define ENGINE_SLUGGISH_WAIT_NS 20000000ULL
+#define ENGINE_UNHEALTHY_WAIT_NS 500000000ULL
+
+// Chunks per engine thread a parallel for splits its range into by default, more than one so that
+// uneven chunks still balance between the threads
+#define ENGINE_PARALLEL_CHUNKS 4
 
 /**
  * @brief Engine Health Engine health is used to determine whether the engine is healthy or not, from an API perspective.
+ * It is derived from the longest time a runnable core waited for a thread over the last ENGINE_HEALTH_INTERVAL_NS,
+ * see engine_health.
  */
 typedef enum TypeV_EngineHealth {
     EH_OK = 0,        ///< A healthy engine means that all cores are sharing a fair amount of CPU time.
@@ -27,32 +69,114 @@ typedef enum TypeV_EngineHealth {
     EH_ZOMBIE = 3,    ///< A zombie engine means that all cores are getting almost no CPU time.
 } TypeV_EngineHealth;
 
+/** Outcome of engine_parallel_wait */
+typedef enum TypeV_ParallelStatus {
+    PARALLEL_DONE = 0,     ///< Every chunk returned
+    PARALLEL_FAILED = 1,   ///< Every chunk ended, at least one of them halted with a non-zero code or was killed
+    PARALLEL_PENDING = 2,  ///< Chunks are still running, the core waits for them
+} TypeV_ParallelStatus;
+
+/** Parallel for a core waits for, see engine_parallel_for */
+typedef struct TypeV_ParallelFor {
+    uint32_t* tasks;              ///< Chunk tasks, joined in order
+    uint32_t count;
+    uint32_t joined;              ///< Chunks joined so far
+    uint8_t failed;
+} TypeV_ParallelFor;
+
 
 typedef struct TypeV_CoreIterator {
     TypeV_Core* core;
-    int32_t maxInstructions;
-    int32_t currentInstructions;
-    struct TypeV_CoreIterator* next;
+    int32_t maxInstructions;      ///< Safepoint polls between two checks of the scheduler
+    int32_t currentInstructions;  ///< Safepoint polls run since the core was last picked, up to sliceInstructions
+    int32_t sliceInstructions;    ///< Time slice, in safepoint polls, from the weight of the core
+    _Atomic uint8_t sched;        ///< TypeV_SchedState
+    uint8_t sclass;               ///< TypeV_SchedClass the core was last queued with
+    struct TypeV_CoreIterator* next;     ///< Next living core
+    struct TypeV_CoreIterator* prev;     ///< Previous living core
+    struct TypeV_CoreIterator* runNext;  ///< Next core of the global run queue
+    TypeV_Timer timer;                   ///< Wake-up of the core while it sleeps
+    uint64_t queuedAt;                   ///< Time the core last became runnable, from the clock of the thread which queued it
 }TypeV_CoreIterator;
 
+/**
+ * @brief An engine thread, running the cores of its run queue and stealing from the others once it is empty
+ */
+typedef struct TypeV_Worker {
+    TypeV_RunQueue queues[SCHED_LEVELS];
+    struct TypeV_Engine* engine;
+    uint32_t id;
+    _Atomic uint32_t tick;        ///< Cores run so far, written by the thread only
+    uint64_t rng;                 ///< Victim selection
+    uint64_t now;                 ///< Coarse clock, read at the end of each time slice and when the thread wakes up
+    _Atomic uint64_t cpu_ns;      ///< CPU time of the thread, sampled at health updates and before it waits
+    uint32_t poolSize;
+    TypeV_Core* pool[ENGINE_CORE_POOL_MAX]; ///< Cores which ended on this thread, released by core_recycle
+}TypeV_Worker;
+
+/**
+ * @brief A global run queue, protected by the engine run lock
+ */
+typedef struct TypeV_GlobalQueue {
+    TypeV_CoreIterator* head;
+    TypeV_CoreIterator* tail;
+    _Atomic uint32_t count;
+}TypeV_GlobalQueue;
+
 typedef struct TypeV_EngineFFI{
     char* dynlibName;
     TV_LibraryHandle dynlibHandle;
-    TypeV_FFI* ffi;
+    TypeV_FFI* _Atomic ffi;                     ///< Functions of the library, set once it is opened
 }TypeV_EngineFFI;
 
 /**
  * @brief: TypeV_Engine: The execution engine: Array of cores
+ * Cores are run M:N by a pool of `threadCount` OS threads, the thread calling engine_run being one of them.
+ * A core runs on at most one thread at a time and only touches its own registers, stack and GC heap.
+ * Runnable cores sit in the run queues of the threads (see scheduler/scheduler.h), or in the global run
+ * queues protected by `runLock`, which idle threads wait on. Each thread and the engine have one run queue
+ * per TypeV_SchedLevel. Sleeping cores sit in the timer wheel, also
+ * protected by `runLock`: busy threads check it each time they pick a core, and one idle thread at most, the
+ * timekeeper, waits only until the next core is due. The core list, the core table and the FFI table
+ * are protected by `lock`, taken before `runLock` when both are needed.
+ * `objRoot` is only read once the main core is set up.
  */
 typedef struct TypeV_Engine {
     char* srcFileMap;                           ///< Source file map
-    TypeV_EngineHealth health;
-    TypeV_CoreIterator* coreIterator;
-    uint32_t coreCount;                         ///< number of living cores
-    uint32_t runningCoresCount;                 ///< number of running cores
+    _Atomic TypeV_EngineHealth health;          ///< Computed every ENGINE_HEALTH_INTERVAL_NS, see engine_health
+    _Atomic uint64_t healthAt;                  ///< Time health was last computed
+    _Atomic uint64_t windowWaitMaxNs;           ///< Longest wait for a thread since then
+    _Atomic uint64_t healthWaitMaxNs;           ///< Longest wait for a thread over the last health interval
+    uint32_t healthTicks;                       ///< Time slices run when health was last computed, protected by runLock
+    uint8_t cpuAccounting;                      ///< Whether per-core CPU time is measured, see scheduler/stats.h
+    uint64_t startNs;                           ///< Time the engine was initialized
+    TypeV_Mutex lock;                           ///< Protects the core list, the core table and the FFI table
+    TypeV_Mutex runLock;                        ///< Protects the global run queue, idle threads wait on it
+    TypeV_Cond wake;                            ///< Signaled when a core becomes runnable or the last core detaches
+    uint32_t threadCount;                       ///< Number of OS threads running cores
+    _Atomic uint32_t nextCoreID;                ///< Last core ID given out
+    int32_t sliceInstructions;                  ///< Time slice of a core of weight 1, in safepoint polls
+    TypeV_CoreIterator* coreIterator;           ///< Living cores, the main core first
+    TypeV_CoreIterator* coreTail;               ///< Last living core
+    TypeV_CoreTable coreTable;                  ///< Living cores by ID
+    TypeV_Worker* workers;                      ///< Engine threads, while engine_run runs
+    uint32_t workerCount;
+    _Atomic uint32_t idleWorkers;               ///< Threads waiting for a runnable core
+    TypeV_GlobalQueue global[SCHED_LEVELS];     ///< Global run queues
+    _Atomic uint32_t interactiveQueued;         ///< Runnable interactive cores, which other cores give their thread to
+    TypeV_SchedClassStats classStats[SCHED_CLASS_COUNT]; ///< Waits for a thread per scheduling class
+    TypeV_TimerWheel timers;                    ///< Sleeping cores, in engine clock ticks
+    _Atomic uint64_t timerDeadline;             ///< Lower bound of the time the next sleeping core is due, UINT64_MAX if none
+    uint64_t timekeeperDeadline;                ///< Time the timekeeper waits for, UINT64_MAX if no thread keeps time
+    _Atomic uint32_t nativeSenders;             ///< Messages native code is yet to send, see engine_native_retain
+    _Atomic uint32_t coreCount;                 ///< number of living cores
+    _Atomic uint32_t runningCoresCount;         ///< number of cores currently running on a thread
+    _Atomic uint32_t parkedCoresCount;          ///< number of cores waiting for a message
+    _Atomic uint32_t sleepingCoresCount;        ///< number of cores waiting for their sleep to end
+    _Atomic uint32_t queuedCoresCount;          ///< number of runnable cores waiting for a thread
     uint32_t mainCoreExitCode;                  ///< Exit code of the main core
     uint8_t interruptNextLoop;                  ///< interrupt the next loop, set to true when cores are spawned/killed
-    TypeV_EngineFFI** ffi;                      ///< FFI libraries
+    _Atomic(TypeV_EngineFFI*)* ffi;             ///< FFI libraries by ID, ENGINE_FFI_MAX_LIBS entries read without a lock
     uint16_t ffiCount;                          ///< Number of FFI libraries
     void* objRoot;                              ///< Keys' JSON Root object
     void* objDoc;                               ///< Keys' JSON Document object
@@ -61,6 +185,23 @@ typedef struct TypeV_Engine {
 } TypeV_Engine;
 
 
+/**
+ * @brief Monotonic engine clock, in ticks of ENGINE_CLOCK_TICK_NS
+ */
+static inline uint64_t engine_clock(void) {
+    return typev_now_ns() / ENGINE_CLOCK_TICK_NS;
+}
+
+/**
+ * @brief engine_health Computes the health of the engine if ENGINE_HEALTH_INTERVAL_NS passed since it last was.
+ * The engine is sluggish or unhealthy once a runnable core waited for a thread longer than ENGINE_SLUGGISH_WAIT_NS
+ * or ENGINE_UNHEALTHY_WAIT_NS, and a zombie when runnable cores were left waiting while no thread ended
+ * a time slice during a whole interval.
+ * @param engine
+ * @return the current health
+ */
+TypeV_EngineHealth engine_health(TypeV_Engine *engine);
+
 /**
  * @brief engine_init Initialize the engine
  * @param engine
@@ -68,13 +209,23 @@ typedef struct TypeV_Engine {
 void engine_init(TypeV_Engine *engine, int argc, char** argv);
 
 /**
- * @brief engine_run Run the engine
+ * @brief engine_run Run the engine, returns once every core has been detached
  * @param engine
  */
 void engine_run(TypeV_Engine *engine);
 
 /**
- * @brief engine_run_core Run a single core
+ * @brief engine_set_threads Sets the number of OS threads engine_run uses to run cores.
+ * Defaults to the number of processors, or to TYPEV_ENGINE_THREADS when set.
+ * @param engine
+ * @param count clamped to [1, ENGINE_MAX_THREADS]
+ */
+void engine_set_threads(TypeV_Engine *engine, uint32_t count);
+
+/**
+ * @brief engine_run_core Run a single core, until it ends or reaches a safepoint (backward jump or call)
+ * past its time slice while other cores wait for a thread, or while it has been sent CSIG_KILL.
+ * The core can be resumed later from where it stopped.
  * @param engine
  * @param core
  */
@@ -117,14 +268,14 @@ void engine_set_args(TypeV_Engine *engine, int argc, char** argv);
 void engine_deallocate(TypeV_Engine *engine);
 
 /**
- * @brief engine_generateNewCoreID Generate a new core ID
+ * @brief engine_generateNewCoreID Generate a new core ID, IDs are never reused
  * @param engine
  * @return
  */
 uint32_t engine_generateNewCoreID(TypeV_Engine *engine);
 
 /**
- * @brief engine_update_scheduler Update the scheduler
+ * @brief engine_update_scheduler Update the scheduler. Called with the engine lock held
  * The scheduler is responsible for determining which core should be executed next.
  * @param engine
  */
@@ -135,23 +286,131 @@ void engine_update_scheduler(TypeV_Engine *engine);
  * @param engine
  * @param parentCore The parent core
  * @param ip The instruction pointer which references the init function of the new core
- *
+ * The new core has the scheduling class and weight of its parent. It is runnable right away, on any of the engine threads, and may have ended by the time this returns.
+ * @return ID of the new core
  */
-TypeV_Core* engine_spawnCore(TypeV_Engine *engine, TypeV_Core* parentCore, uint64_t ip);
+uint32_t engine_spawnCore(TypeV_Engine *engine, TypeV_Core* parentCore, uint64_t ip);
 
 /**
- * @brief Detaches a core
+ * @brief engine_spawnTask Spawns a task: a core as engine_spawnCore does, whose result goes back to the
+ * parent core once it ends, see engine_task_join
+ * @param engine
+ * @param parentCore The parent core, which alone can join the task
+ * @param ip The instruction pointer which references the init function of the task
+ * @return ID of the new core, the handle of the task
+ */
+uint32_t engine_spawnTask(TypeV_Engine *engine, TypeV_Core* parentCore, uint64_t ip);
+
+/**
+ * @brief engine_task_join Takes the result of a task of `core`, which must be running. A task which returned
+ * leaves the message it returned with, any other end a MESSAGE_EXIT message with the exit code of the task.
+ * @param engine
+ * @param core The core which spawned the task
+ * @param taskID
+ * @param pending Set to 1 if the task has not ended yet, the core is then set to wait (see mailbox.h)
+ * until it does. Set to 0 if there is no such task
+ * @return the result, owned by the caller, NULL if it is not available
+ */
+struct TypeV_Message* engine_task_join(TypeV_Engine *engine, TypeV_Core* core, uint32_t taskID, uint8_t* pending);
+
+/**
+ * @brief engine_spawnChunk Spawns a task which calls `closure` with start, end and out as its first three
+ * arguments, and ends once the closure returns. The task starts in the closure, with a copy of its environment:
+ * objects the environment refers to are shared with the parent, which must not run until the task ended.
+ * @param engine
+ * @param parentCore The parent core, which alone can join the task
+ * @param closure
+ * @param start
+ * @param end
+ * @param out Array of the parent the chunk writes to
+ * @return ID of the new core, the handle of the task
+ */
+uint32_t engine_spawnChunk(TypeV_Engine *engine, TypeV_Core* parentCore, TypeV_Closure* closure, uint64_t start, uint64_t end, TypeV_Array* out);
+
+/**
+ * @brief engine_parallel_for Splits [start, end) into chunks and spawns a task per chunk, see engine_spawnChunk.
+ * The chunks write their results straight into `out`, which must hold values and not be shared: a chunk only
+ * reads what its closure captured, and only writes the elements of its own range. The core then waits for them
+ * with engine_parallel_wait, without running meanwhile, so that its heap stays as the chunks found it.
+ * Panics if out is null, holds pointers or is shared.
+ * @param engine
+ * @param core The calling core, which must not already wait for a parallel for
+ * @param closure
+ * @param start
+ * @param end Exclusive, nothing runs if end <= start
+ * @param chunks Number of chunks, at most end - start, 0 for ENGINE_PARALLEL_CHUNKS per engine thread
+ * @param out
+ */
+void engine_parallel_for(TypeV_Engine *engine, TypeV_Core* core, TypeV_Closure* closure, uint64_t start, uint64_t end, uint32_t chunks, TypeV_Array* out);
+
+/**
+ * @brief engine_parallel_wait Joins the chunks of the parallel for of `core`. Only meant for FFI functions: when
+ * it returns PARALLEL_PENDING, the function must return right away. The core then waits with its parallelWaiting
+ * flag set, which the next chunk to end clears, and runs the same FFI call again from its restartIp. The arguments
+ * of the call are not pushed again, see engine_parallel_pending.
+ * @param engine
+ * @param core
+ * @return PARALLEL_DONE or PARALLEL_FAILED once every chunk ended, or if the core has no parallel for
+ */
+TypeV_ParallelStatus engine_parallel_wait(TypeV_Engine *engine, TypeV_Core* core);
+
+/**
+ * @brief engine_parallel_pending Whether the core waits for a parallel for, in which case an FFI function
+ * is called again to join it, see engine_parallel_wait
+ */
+uint8_t engine_parallel_pending(TypeV_Core* core);
+
+/**
+ * @brief engine_set_core_class Sets the scheduling class and weight of a core, see scheduler/scheduler.h.
+ * Called by the core itself, takes effect once it is next queued. Unknown classes are taken as batch.
+ * @param core
+ * @param sclass TypeV_SchedClass
+ * @param weight Share of the threads, clamped to SCHED_WEIGHT_MAX, 0 for the default of the class
+ */
+void engine_set_core_class(TypeV_Core* core, uint8_t sclass, uint8_t weight);
+
+/**
+ * @brief Detaches a core, it must not be running. Outside of engine_run, a runnable core is also
+ * taken out of the run queue
  * @param engine
  * @param coreID
  */
 void engine_detach_core(TypeV_Engine *engine, TypeV_Core* core);
 
+/**
+ * @brief Sends a message to a core, waking it up if it is waiting for one. Messages sent to a core
+ * which no longer exists are dropped. Safe from any thread, native code completing work on its own threads
+ * wakes the core waiting for the result this way, between engine_native_retain and engine_native_release.
+ * @param engine
+ * @param coreID Receiving core
+ * @param msg Message, owned by the engine afterwards
+ */
+void engine_send(TypeV_Engine *engine, uint32_t coreID, struct TypeV_Message* msg);
+
+/**
+ * @brief engine_native_retain Announces a message native code is going to send with engine_send, from a thread
+ * of its own. Until the matching engine_native_release, cores waiting for a message are not killed as deadlocked
+ * when no core is left to run, the message may still wake them up.
+ * @param engine
+ */
+void engine_native_retain(TypeV_Engine *engine);
+
+/**
+ * @brief engine_native_release Ends an engine_native_retain, once the message was sent or will not be
+ * @param engine
+ */
+void engine_native_release(TypeV_Engine *engine);
+
 void engine_get_field_id(TypeV_Engine *engine, const char* fieldName, uint32_t* fieldId, uint8_t* error);
 
 
 void engine_ffi_register(TypeV_Engine *engine, char* dynlibName, uint16_t dynlibID);
 void engine_ffi_open(TypeV_Engine *engine, uint16_t dynlibID);
 TypeV_FFIFunc engine_ffi_get(TypeV_Engine *engine, uint16_t dynlibID, uint8_t methodId);
+/**
+ * @brief engine_ffi_close Unloads a library. Libraries stay loaded while engine_run runs: cores on other threads
+ * may be running their functions, or about to call them
+ */
 void engine_ffi_close(TypeV_Engine *engine, uint16_t dynlibID);
 
 #endif //TYPE_V_ENGINE_H
@@ -10,7 +10,9 @@
 
 #include <string.h>
 #include "env.h"
+#include "sourcemap.h"
 #include "../utils/utils.h"
+#include "../platform/threads.h"
 
 #define CPU_INFO_IMPLEMENTATION
 #include "../vendor/cpu_info/cpu_info.h"
@@ -77,21 +79,28 @@ TypeV_ENV get_env(){
 }
 
 
-uint8_t env_sourcemap_has(TypeV_ENV env) {
-    return env.sourceMapFile != NULL;
+// loaded by the first panic, traces of other threads wait for it
+static TypeV_Once sourceMapOnce = TYPEV_ONCE_INIT;
+static TypeV_SourceMap* sourceMap = NULL;
 
+static void env_sourcemap_load(void) {
+    if(env.sourceMapFile != NULL) {
+        sourceMap = sourcemap_load(env.sourceMapFile);
+    }
 }
 
-TypeV_SourcePoint env_sourcemap_get(TypeV_ENV env, uint64_t ip){
-    if(!env_sourcemap_has(env)) {
-        return (TypeV_SourcePoint){.line = 0, .column = 0, .file = NULL};
-    }
+uint8_t env_sourcemap_has(void) {
+    typev_once(&sourceMapOnce, env_sourcemap_load);
+    return sourceMap != NULL && sourceMap->entryCount > 0;
+}
 
-    char file[1024] = {};
-    uint64_t line = 0;
-    uint64_t column = 0;
-    char func_name[1024] = {};
-    int found = get_source_map_line_content(env.sourceMapFile, ip, file, &line, &column, func_name);
+TypeV_SourcePoint env_sourcemap_get(uint64_t ip){
+    const TypeV_SourceMapEntry* entry = env_sourcemap_has() ? sourcemap_find(sourceMap, ip) : NULL;
+    if(entry == NULL) {
+        return (TypeV_SourcePoint){.line = 0, .column = 0, .file = "", .func_name = ""};
+    }
 
-    return (TypeV_SourcePoint){.line = line, .column = column, .file = strdup(file), .func_name = strdup(func_name)};
+    return (TypeV_SourcePoint){.line = entry->line, .column = entry->column,
+                               .file = (char*)sourcemap_string(sourceMap, entry->file),
+                               .func_name = (char*)sourcemap_string(sourceMap, entry->func)};
 }
\ No newline at end of file
@@ -14,8 +14,8 @@
 #include <stdint.h>
 
 typedef struct {
-    char* file;
-    char* func_name;
+    char* file;                  ///< Owned by the source map, empty if the instruction is not mapped
+    char* func_name;             ///< Owned by the source map, empty if the instruction is not mapped
     uint64_t line;
     uint64_t column;
 }TypeV_SourcePoint;
@@ -37,20 +37,18 @@ TypeV_ENV get_env();
 
 
 /**
- * @brief Checks if the engine has a source map available
- * @param engine
+ * @brief Checks if the engine has a source map available, loading the sourceMapFile given to typev_env_init
+ * on first call, see env/sourcemap.h
  * @return
  */
-uint8_t env_sourcemap_has(TypeV_ENV);
+uint8_t env_sourcemap_has(void);
 
 /**
- * @brief  Get the source location of an instruction from the source map
- * @param engine
+ * @brief  Get the source location of an instruction from the source map, a binary search in its ip table
  * @param ip
- * @param buffer
- * @param bufferSize
+ * @return An empty location if there is no source map or no entry for ip
  */
-TypeV_SourcePoint env_sourcemap_get(TypeV_ENV env, uint64_t ip);
+TypeV_SourcePoint env_sourcemap_get(uint64_t ip);
 
 
 #endif //TYPE_V_ENV_H
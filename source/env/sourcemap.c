@@ -0,0 +1,301 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "sourcemap.h"
+#include "../platform/memory.h"
+
+// Interned strings of a map being built: the table itself, and an open addressing hash set of their offsets
+typedef struct {
+    char* data;
+    uint64_t size;
+    uint64_t capacity;
+    uint32_t* slots;                     ///< Offset + 1, 0 for an empty slot
+    uint32_t slotCount;                  ///< Power of two
+    uint32_t count;
+} SourceMapStrings;
+
+typedef struct {
+    TypeV_SourceMapEntry* data;
+    uint64_t count;
+    uint64_t capacity;
+} SourceMapEntries;
+
+static uint32_t sourcemap_hash(const char* str, size_t len) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)str[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void sourcemap_strings_rehash(SourceMapStrings* strings, uint32_t slotCount) {
+    uint32_t* slots = calloc(slotCount, sizeof(uint32_t));
+    for(uint32_t i = 0; i < strings->slotCount; i++) {
+        if(strings->slots[i] == 0) {
+            continue;
+        }
+        const char* str = strings->data + strings->slots[i] - 1;
+        uint32_t k = sourcemap_hash(str, strlen(str)) & (slotCount - 1);
+        while(slots[k] != 0) {
+            k = (k + 1) & (slotCount - 1);
+        }
+        slots[k] = strings->slots[i];
+    }
+    free(strings->slots);
+    strings->slots = slots;
+    strings->slotCount = slotCount;
+}
+
+/** @return Offset of the string in the table, added if missing, UINT32_MAX if the table is full */
+static uint32_t sourcemap_strings_intern(SourceMapStrings* strings, const char* str, size_t len) {
+    if((strings->count + 1) * 2 > strings->slotCount) {
+        sourcemap_strings_rehash(strings, strings->slotCount == 0 ? 64 : strings->slotCount * 2);
+    }
+
+    uint32_t k = sourcemap_hash(str, len) & (strings->slotCount - 1);
+    while(strings->slots[k] != 0) {
+        const char* other = strings->data + strings->slots[k] - 1;
+        if(strncmp(other, str, len) == 0 && other[len] == '\0') {
+            return strings->slots[k] - 1;
+        }
+        k = (k + 1) & (strings->slotCount - 1);
+    }
+
+    if(strings->size + len + 1 >= UINT32_MAX) {
+        return UINT32_MAX;
+    }
+    if(strings->size + len + 1 > strings->capacity) {
+        strings->capacity = (strings->size + len + 1) * 2;
+        strings->data = realloc(strings->data, strings->capacity);
+    }
+    uint32_t offset = (uint32_t)strings->size;
+    memcpy(strings->data + offset, str, len);
+    strings->data[offset + len] = '\0';
+    strings->size += len + 1;
+    strings->slots[k] = offset + 1;
+    strings->count++;
+    return offset;
+}
+
+/** Reads a decimal field followed by a comma, as sscanf("%llu,") would */
+static const char* sourcemap_parse_number(const char* p, const char* end, uint64_t* value) {
+    while(p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    if(p == end || *p < '0' || *p > '9') {
+        return NULL;
+    }
+    *value = 0;
+    while(p < end && *p >= '0' && *p <= '9') {
+        *value = *value * 10 + (uint64_t)(*p - '0');
+        p++;
+    }
+    return p < end && *p == ',' ? p + 1 : NULL;
+}
+
+/**
+ * Parses a `file,line,column,function` line of the text map
+ * @return 1 if valid
+ */
+static uint8_t sourcemap_parse_line(const char* p, const char* end, SourceMapStrings* strings, TypeV_SourceMapEntry* entry) {
+    const char* comma = memchr(p, ',', end - p);
+    if(comma == NULL || comma == p) {
+        return 0;
+    }
+    const char* file = p;
+    size_t fileLen = comma - p;
+
+    uint64_t line, column;
+    p = sourcemap_parse_number(comma + 1, end, &line);
+    if(p == NULL || (p = sourcemap_parse_number(p, end, &column)) == NULL) {
+        return 0;
+    }
+    if(end > p && end[-1] == '\r') {
+        end--;
+    }
+    if(p == end) {
+        return 0;
+    }
+
+    entry->line = line > UINT32_MAX ? UINT32_MAX : (uint32_t)line;
+    entry->column = column > UINT32_MAX ? UINT32_MAX : (uint32_t)column;
+    entry->file = sourcemap_strings_intern(strings, file, fileLen);
+    entry->func = sourcemap_strings_intern(strings, p, end - p);
+    return entry->file != UINT32_MAX && entry->func != UINT32_MAX;
+}
+
+/**
+ * Converts a text map to a binary one, in memory
+ * @return The binary map, NULL if the text map cannot be read
+ */
+static uint8_t* sourcemap_convert(const char* textPath, const struct stat* textStat, uint64_t* size) {
+    TypeV_FileMapping text;
+    if(typev_file_map(textPath, &text) != 0) {
+        return NULL;
+    }
+
+    SourceMapStrings strings = {0};
+    SourceMapEntries entries = {0};
+    const char* p = (const char*)text.data;
+    const char* end = p + text.size;
+    for(uint64_t ip = 0; p < end; ip++) {
+        const char* eol = memchr(p, '\n', end - p);
+        if(eol == NULL) {
+            eol = end;
+        }
+
+        TypeV_SourceMapEntry entry = {.ip = ip};
+        if(sourcemap_parse_line(p, eol, &strings, &entry)) {
+            if(entries.count == entries.capacity) {
+                entries.capacity = entries.capacity == 0 ? 1024 : entries.capacity * 2;
+                entries.data = realloc(entries.data, entries.capacity * sizeof(TypeV_SourceMapEntry));
+            }
+            entries.data[entries.count++] = entry;
+        }
+        p = eol + 1;
+    }
+    typev_file_unmap(&text);
+    typev_file_close(&text);
+
+    TypeV_SourceMapHeader header = {.magic = SOURCEMAP_MAGIC, .version = SOURCEMAP_VERSION,
+                                    .textSize = (uint64_t)textStat->st_size, .textMtime = (int64_t)textStat->st_mtime,
+                                    .entryCount = entries.count, .stringsSize = strings.size};
+    *size = sizeof(header) + entries.count * sizeof(TypeV_SourceMapEntry) + strings.size;
+    uint8_t* map = malloc(*size);
+    memcpy(map, &header, sizeof(header));
+    if(entries.count > 0) {
+        memcpy(map + sizeof(header), entries.data, entries.count * sizeof(TypeV_SourceMapEntry));
+    }
+    if(strings.size > 0) {
+        memcpy(map + sizeof(header) + entries.count * sizeof(TypeV_SourceMapEntry), strings.data, strings.size);
+    }
+
+    free(entries.data);
+    free(strings.data);
+    free(strings.slots);
+    return map;
+}
+
+/**
+ * Checks a binary map against the text map it should have been built from, and every offset in it against its size
+ * @param textStat NULL if the text map is gone
+ * @return 1 if the map can be used
+ */
+static uint8_t sourcemap_validate(const uint8_t* data, uint64_t size, const struct stat* textStat, TypeV_SourceMap* map) {
+    TypeV_SourceMapHeader header;
+    if(size < sizeof(header)) {
+        return 0;
+    }
+    memcpy(&header, data, sizeof(header));
+    if(memcmp(header.magic, SOURCEMAP_MAGIC, SOURCEMAP_MAGIC_SIZE) != 0 || header.version != SOURCEMAP_VERSION) {
+        return 0;
+    }
+    if(textStat != NULL && (header.textSize != (uint64_t)textStat->st_size || header.textMtime != (int64_t)textStat->st_mtime)) {
+        return 0;
+    }
+    if(header.entryCount > (size - sizeof(header)) / sizeof(TypeV_SourceMapEntry) ||
+       header.stringsSize != size - sizeof(header) - header.entryCount * sizeof(TypeV_SourceMapEntry)) {
+        return 0;
+    }
+
+    map->entries = (const TypeV_SourceMapEntry*)(data + sizeof(header));
+    map->entryCount = header.entryCount;
+    map->strings = (const char*)(map->entries + header.entryCount);
+    map->stringsSize = header.stringsSize;
+    if(map->stringsSize > 0 && map->strings[map->stringsSize - 1] != '\0') {
+        return 0;
+    }
+    for(uint64_t i = 0; i < map->entryCount; i++) {
+        const TypeV_SourceMapEntry* entry = &map->entries[i];
+        if(entry->file >= map->stringsSize || entry->func >= map->stringsSize ||
+           (i > 0 && entry->ip <= map->entries[i - 1].ip)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static char* sourcemap_binary_path(const char* textPath) {
+    size_t len = strlen(textPath);
+    if(len >= 4 && strcmp(textPath + len - 4, ".txt") == 0) {
+        len -= 4;
+    }
+    char* path = malloc(len + 5);
+    memcpy(path, textPath, len);
+    strcpy(path + len, ".bin");
+    return path;
+}
+
+/** Writes the binary map through a temporary file, so that other runs never map a partial one */
+static void sourcemap_cache(const char* binPath, const uint8_t* data, uint64_t size) {
+    size_t len = strlen(binPath);
+    char* tmpPath = malloc(len + 5);
+    memcpy(tmpPath, binPath, len);
+    strcpy(tmpPath + len, ".tmp");
+
+    FILE* out = fopen(tmpPath, "wb");
+    if(out == NULL) {
+        free(tmpPath);
+        return;
+    }
+    uint8_t written = fwrite(data, 1, size, out) == size;
+    written = fclose(out) == 0 && written;
+#if defined(_WIN32) || defined(_WIN64)
+    // rename does not replace on windows
+    remove(binPath);
+#endif
+    if(!written || rename(tmpPath, binPath) != 0) {
+        remove(tmpPath);
+    }
+    free(tmpPath);
+}
+
+TypeV_SourceMap* sourcemap_load(const char* textPath) {
+    struct stat textStat;
+    uint8_t hasText = stat(textPath, &textStat) == 0;
+    char* binPath = sourcemap_binary_path(textPath);
+    TypeV_SourceMap* map = malloc(sizeof(TypeV_SourceMap));
+
+    TypeV_FileMapping bin;
+    if(typev_file_map(binPath, &bin) == 0) {
+        typev_file_close(&bin);
+        if(sourcemap_validate(bin.data, bin.size, hasText ? &textStat : NULL, map)) {
+            free(binPath);
+            return map;
+        }
+        typev_file_unmap(&bin);
+    }
+
+    uint64_t size = 0;
+    uint8_t* data = hasText ? sourcemap_convert(textPath, &textStat, &size) : NULL;
+    if(data == NULL || !sourcemap_validate(data, size, &textStat, map)) {
+        free(data);
+        free(map);
+        free(binPath);
+        return NULL;
+    }
+    sourcemap_cache(binPath, data, size);
+    free(binPath);
+    return map;
+}
+
+const TypeV_SourceMapEntry* sourcemap_find(const TypeV_SourceMap* map, uint64_t ip) {
+    uint64_t low = 0;
+    uint64_t high = map->entryCount;
+    while(low < high) {
+        uint64_t mid = low + (high - low) / 2;
+        if(map->entries[mid].ip < ip) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+    return low < map->entryCount ? &map->entries[low] : NULL;
+}
@@ -0,0 +1,74 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+#ifndef TYPE_V_SOURCEMAP_H
+#define TYPE_V_SOURCEMAP_H
+
+#include <stdint.h>
+
+/**
+ * Source maps. The compiler writes a text map, src_map.map.txt, with one line per byte of code: line k is
+ * `file,line,column,function` for the instruction at ip k, or anything else for the bytes which start no
+ * instruction. An ip resolves to the first valid line at or after it.
+ *
+ * The text map is converted on first load to a binary one next to it, src_map.map.bin, which later runs map
+ * directly. It holds a header, the valid lines sorted by ip, and a string table in which each file and
+ * function name appears once, NUL terminated. The binary map records the size and modification time of the
+ * text map it was built from, and is rebuilt when they no longer match. It is a cache of this machine, written
+ * in its byte order.
+ */
+
+#define SOURCEMAP_MAGIC "TVSM"
+#define SOURCEMAP_MAGIC_SIZE 4
+#define SOURCEMAP_VERSION 1
+
+typedef struct TypeV_SourceMapHeader {
+    uint8_t magic[SOURCEMAP_MAGIC_SIZE]; ///< SOURCEMAP_MAGIC
+    uint32_t version;                    ///< SOURCEMAP_VERSION
+    uint64_t textSize;                   ///< Size of the text map it was built from
+    int64_t textMtime;                   ///< Modification time of the text map, in seconds
+    uint64_t entryCount;
+    uint64_t stringsSize;                ///< Size of the string table, which follows the entries
+} TypeV_SourceMapHeader;
+
+typedef struct TypeV_SourceMapEntry {
+    uint64_t ip;
+    uint32_t line;
+    uint32_t column;
+    uint32_t file;                       ///< Offset of the file name in the string table
+    uint32_t func;                       ///< Offset of the function name in the string table
+} TypeV_SourceMapEntry;
+
+/** Points into the mapped binary map, or into a copy built in memory. Stays loaded until the process exits */
+typedef struct TypeV_SourceMap {
+    const TypeV_SourceMapEntry* entries; ///< Sorted by ip
+    uint64_t entryCount;
+    const char* strings;
+    uint64_t stringsSize;
+} TypeV_SourceMap;
+
+/**
+ * @brief Loads the binary map of a text map, converting and caching it first if it is missing or stale. The
+ * binary map alone is enough if the text map is gone. Failing to write the cache is not an error, the map is
+ * then built in memory on each run
+ * @param textPath Path to src_map.map.txt
+ * @return The map, NULL if neither map can be read
+ */
+TypeV_SourceMap* sourcemap_load(const char* textPath);
+
+/**
+ * @brief Finds the entry of an instruction, O(log n)
+ * @return The first entry at or after ip, NULL if there is none
+ */
+const TypeV_SourceMapEntry* sourcemap_find(const TypeV_SourceMap* map, uint64_t ip);
+
+/**
+ * @brief Name in the string table of the map
+ * @param offset TypeV_SourceMapEntry file or func
+ */
+static inline const char* sourcemap_string(const TypeV_SourceMap* map, uint32_t offset) {
+    return map->strings + offset;
+}
+
+#endif //TYPE_V_SOURCEMAP_H
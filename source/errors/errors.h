@@ -14,6 +14,8 @@ typedef enum TypeV_RTError {
     RT_ERROR_INVALID_COMPARISON_OPERATOR = 9,
     RT_ERROR_ENTITY_TOO_LARGE = 10,
     RT_ERROR_CUSTOM = 11,
+    RT_ERROR_NOT_SENDABLE = 12,
+    RT_ERROR_IMMUTABLE = 13,
 
     RT_ERROR_COUNT //Tracks the number of errors
 } TypeV_RTError;
@@ -31,6 +33,8 @@ static const char* TypeV_RTErrorMessages[] = {
     "Invalid comparison operator",
     "Entity too large",
     "User Error",
+    "Value cannot be sent to another core",
+    "Immutable value cannot be modified",
 };
 
 #endif // TYPE_V_ERRORS_H
@@ -3,64 +3,310 @@
 #include <string.h>
 #include "gc.h"
 #include "mark.h"
+#include "../platform/threads.h"
+#include "../platform/memory.h"
 
-TypeV_GC* initialize_gc() {
-    TypeV_GC* gc = (TypeV_GC*)malloc(sizeof(TypeV_GC));
+/**
+ * Sets up an empty collector, the heap is only mapped by gc_heap_reserve
+ */
+static void gc_init(TypeV_GC* gc) {
     gc_log("initialize_gc: Initializing GC");
-    gc->nursery.data = aligned_alloc(8, NURSERY_SIZE);
-    gc->nursery.active_bitmap = (uint8_t*)calloc(NURSERY_MAX_CELLS / 8, sizeof(uint8_t));
-    gc->nursery.from = gc->nursery.data;
-    gc->nursery.to = gc->nursery.data + NURSERY_REGION_SIZE;
+    gc->nursery.active_bitmap = NULL;
     gc->nursery.cell_size = 0;
+    gc->nursery.limit_cells = GC_POLICY_INITIAL_NURSERY_CELLS;
+    gc->nursery.request_cells = 0;
+    gc->nursery.from = NULL;
+    gc->nursery.to = NULL;
+    gc->nursery.from_cells = 0;
+    gc->nursery.to_cells = 0;
 
     gc->oldRegion.capacity_factor = 1;
     gc->oldRegion.cell_size = 0;
-    gc->oldRegion.data = (uint8_t*)aligned_alloc(8, OLD_REGION_INITIAL_SIZE);
-    gc->oldRegion.active_bitmap = (uint8_t*)calloc(INITIAL_OLD_CELLS / 8, sizeof(uint8_t));
-    gc->oldRegion.from = gc->oldRegion.data;
-    gc->oldRegion.to = gc->oldRegion.data + OLD_REGION_INITIAL_SIZE;
+    gc->oldRegion.data = NULL;
+    gc->oldRegion.mapped = 0;
+    gc->oldRegion.active_bitmap = NULL;
+    gc->oldRegion.from = NULL;
+    gc->oldRegion.to = NULL;
     gc->oldRegion.direction = 1; // Start with downwards direction
 
-    gc->rs.size = 0;
-    gc->rs.capacity = 1024;
-    gc->rs.set = (TypeV_ObjectHeader**)malloc(gc->rs.capacity * sizeof(TypeV_ObjectHeader*));
+    // the lists grow on their first push
+    memset(&gc->rs, 0, sizeof(TypeV_RememberedSet));
+    memset(&gc->promoted, 0, sizeof(TypeV_RememberedSet));
+    memset(&gc->userObjects, 0, sizeof(TypeV_RememberedSet));
+    memset(&gc->markStack, 0, sizeof(TypeV_RememberedSet));
+    memset(&gc->finalizers, 0, sizeof(TypeV_FinalizerQueue));
+    memset(&gc->sites, 0, sizeof(TypeV_AllocSites));
+
+    gc_los_init(gc);
+    gc_policy_init(gc);
+    gc_stats_init(gc);
+    gc->markedOldCells = 0;
+
+    gc->incremental.marking = 0;
+    gc->incremental.allocated = 0;
+    gc->incremental.pause_budget_ns = 0;
+    const char* budget = getenv("TYPEV_GC_PAUSE_US");
+    if(budget != NULL && atoi(budget) > 0) {
+        gc->incremental.pause_budget_ns = (uint64_t)atoi(budget) * 1000;
+    }
 
     gc_log("initialize_gc: GC initialized");
+}
+
+/** Maps `bytes` of heap, the process cannot go on without it */
+static uint8_t* gc_heap_map(size_t bytes) {
+    uint8_t* data = (uint8_t*)typev_pages_alloc(bytes);
+    if(data == NULL) {
+        fprintf(stderr, "gc: Failed to map %zu bytes of heap\n", bytes);
+        exit(-1);
+    }
+    return data;
+}
+
+/**
+ * Maps the initial heap, on the first allocation of the core
+ */
+static void gc_heap_reserve(TypeV_GC* gc) {
+    gc_log("gc_heap_reserve: Mapping the initial heap");
+    gc->nursery.from = gc_heap_map(NURSERY_INITIAL_CELLS * CELL_SIZE);
+    gc->nursery.to = gc_heap_map(NURSERY_INITIAL_CELLS * CELL_SIZE);
+    gc->nursery.from_cells = NURSERY_INITIAL_CELLS;
+    gc->nursery.to_cells = NURSERY_INITIAL_CELLS;
+    gc->nursery.active_bitmap = (uint64_t*)calloc(BITMAP_WORDS(NURSERY_INITIAL_CELLS), sizeof(uint64_t));
+
+    gc->oldRegion.data = gc_heap_map(OLD_REGION_INITIAL_SIZE);
+    gc->oldRegion.mapped = OLD_REGION_INITIAL_SIZE;
+    gc->oldRegion.active_bitmap = (uint64_t*)calloc(BITMAP_WORDS(INITIAL_OLD_CELLS), sizeof(uint64_t));
+    gc->oldRegion.from = gc->oldRegion.data;
+    gc->oldRegion.to = gc->oldRegion.data + OLD_REGION_INITIAL_SIZE;
 
+    gc_sites_init(&gc->sites);
+}
+
+/** Maps the heap if this is the first allocation */
+static inline void gc_heap_ensure(TypeV_GC* gc) {
+    if(gc->nursery.from == NULL) {
+        gc_heap_reserve(gc);
+    }
+}
+
+TypeV_GC* initialize_gc() {
+    TypeV_GC* gc = (TypeV_GC*)malloc(sizeof(TypeV_GC));
+    gc_init(gc);
     return gc;
 }
 
-void* gc_alloc(TypeV_Core* core, size_t size) {
+/**
+ * Runs one incremental mark step. Once a previous step has emptied the mark stack,
+ * the mark is completed and the old region compacted instead.
+ */
+static void gc_incremental_step(TypeV_Core* core) {
     TypeV_GC* gc = core->gc;
-    size_t cellSize = (size + CELL_SIZE - 1) / CELL_SIZE;
-    gc_log("gc_alloc: Requesting %zu bytes (%zu cells)", size, cellSize);
+    gc->incremental.allocated = 0;
 
-    while ((gc->nursery.cell_size + cellSize) > NURSERY_MAX_CELLS) {
-        gc_log("gc_alloc: Insufficient space, triggering minor GC");
+    if(gc->markStack.size == 0) {
+        perform_major_gc(core);
+        return;
+    }
+
+    uint64_t start_ns = typev_now_ns();
+    gc_incremental_mark_step(core, start_ns + gc->incremental.pause_budget_ns);
+    gc_stats_record_pause(&gc->stats, GC_PAUSE_MARK_STEP, typev_now_ns() - start_ns);
+}
+
+/** Runs a mark step if an incremental mark is in progress and enough has been allocated since the last one */
+static inline void gc_incremental_pace(TypeV_Core* core, size_t cellSize) {
+    TypeV_GC* gc = core->gc;
+    if(gc->incremental.marking) {
+        gc->incremental.allocated += cellSize;
+        if(gc->incremental.allocated >= GC_INCREMENTAL_STEP_CELLS) {
+            gc_incremental_step(core);
+        }
+    }
+}
+
+/** Runs a batch of queued destructors once enough has been allocated since the last one */
+static inline void gc_finalize_pace(TypeV_Core* core, size_t cellSize) {
+    TypeV_GC* gc = core->gc;
+    if(gc->finalizers.head < gc->finalizers.size) {
+        gc->finalizers.allocated += cellSize;
+        if(gc->finalizers.allocated >= GC_FINALIZE_STEP_CELLS) {
+            gc->finalizers.allocated = 0;
+            gc_run_finalizers(core, GC_FINALIZE_BATCH + (gc->finalizers.size - gc->finalizers.head) / 16);
+        }
+    }
+}
+
+static inline void gc_init_header(TypeV_ObjectHeader* ptr, size_t cellSize, uint8_t location) {
+    memset(ptr, 0, sizeof(TypeV_ObjectHeader)); // age 0, no flags, untracked site
+    ptr->cells = (uint32_t)cellSize;
+    ptr->location = location;
+
+#ifdef TYPEV_GC_DEBUG
+    // shared by the GCs of every engine thread
+    static _Atomic uint32_t uid = 0;
+    ptr->uid = atomic_fetch_add_explicit(&uid, 1, memory_order_relaxed);
+#endif
+}
+
+static TypeV_ObjectHeader* gc_alloc_nursery(TypeV_Core* core, size_t cellSize) {
+    TypeV_GC* gc = core->gc;
+
+    // out-of-line array payloads die with their (young) arrays, they count against the nursery limit
+    if ((gc->nursery.cell_size + cellSize + gc->los.allocated / CELL_SIZE) > gc_nursery_limit(gc)) {
+        gc_log("gc_alloc: Nursery limit reached, triggering minor GC");
         perform_minor_gc(core);
-        if ((gc->nursery.cell_size + cellSize) > NURSERY_MAX_CELLS) {
+
+        // the limit is soft, the survivors only have to leave room in the from-space itself,
+        // which the next minor GC grows for them if it can
+        while ((gc->nursery.cell_size + cellSize) > gc->nursery.from_cells) {
             gc_log("gc_alloc: Out of memory after minor GC, retrying allocation");
+            gc->nursery.request_cells = gc->nursery.cell_size + cellSize;
+            perform_minor_gc(core);
         }
     }
 
     TypeV_ObjectHeader* ptr = (TypeV_ObjectHeader *)(gc->nursery.from + (gc->nursery.cell_size * CELL_SIZE));
     gc->nursery.cell_size += cellSize;
+    gc_init_header(ptr, cellSize, 0);
+
+    gc_log("gc_alloc: Allocated at %p, new object %d, (%zu cells)", (void*)ptr, ptr->uid, cellSize);
+
+    return ptr;
+}
+
+/**
+ * Allocates directly in the old region, next to the promoted objects.
+ * @return NULL if that would eat into the room the next minor GC needs for promotions
+ */
+static TypeV_ObjectHeader* gc_alloc_old(TypeV_Core* core, size_t cellSize) {
+    TypeV_GC* gc = core->gc;
+    if (OLD_REGION_CELLS(gc) - gc->oldRegion.cell_size < gc_nursery_limit(gc) + cellSize) {
+        return NULL;
+    }
 
+    TypeV_ObjectHeader* ptr = (TypeV_ObjectHeader*)(gc->oldRegion.direction == 1 ?
+            gc->oldRegion.from + gc->oldRegion.cell_size * CELL_SIZE :
+            gc->oldRegion.to - (gc->oldRegion.cell_size + cellSize) * CELL_SIZE);
+    gc->oldRegion.cell_size += cellSize;
+    gc_init_header(ptr, cellSize, 1);
+    gc->stats.allocated_bytes += cellSize * CELL_SIZE;
+    gc->stats.pretenured_bytes += cellSize * CELL_SIZE;
+
+    // the allocator initializes the object without barriers, let the next minor GC scan it
+    gc_remember(core, ptr);
+    if (gc->incremental.marking) {
+        gc_mark_shade(core, ptr);
+    }
 
-    ptr->color = WHITE;
-    ptr->totalSize = size;
-    ptr->surviveCount = 0;
-    ptr->fwd = NULL;
-    ptr->location = 0; // Set location to nursery
+    gc_log("gc_alloc_old: Allocated at %p, new object %d, (%zu cells)", (void*)ptr, ptr->uid, cellSize);
 
-    static uint32_t uid = 0;
-    ptr->uid = uid++;
+    return ptr;
+}
 
-    gc_log("gc_alloc: Allocated at %p, new object %d, size %zu bytes (%zu cells)", (void*)ptr, ptr->uid, size, cellSize);
+void* gc_alloc(TypeV_Core* core, size_t size) {
+    size_t cellSize = (size + CELL_SIZE - 1) / CELL_SIZE;
+    gc_log("gc_alloc: Requesting %zu bytes (%zu cells)", size, cellSize);
+    gc_heap_ensure(core->gc);
+
+    // marking and finalization are paced by allocation
+    gc_incremental_pace(core, cellSize);
+    gc_finalize_pace(core, cellSize);
+
+    return gc_alloc_nursery(core, cellSize);
+}
 
+void gc_alloc_group(TypeV_Core* core, const size_t* sizes, size_t count, TypeV_ObjectHeader** objects) {
+    size_t cellSize = 0;
+    for(size_t k = 0; k < count; k++) {
+        cellSize += (sizes[k] + CELL_SIZE - 1) / CELL_SIZE;
+    }
+    gc_heap_ensure(core->gc);
+    gc_incremental_pace(core, cellSize);
+    gc_finalize_pace(core, cellSize);
+
+    // one block, carved into the objects
+    uint8_t* block = (uint8_t*)gc_alloc_nursery(core, cellSize);
+    for(size_t k = 0; k < count; k++) {
+        size_t cells = (sizes[k] + CELL_SIZE - 1) / CELL_SIZE;
+        objects[k] = (TypeV_ObjectHeader*)block;
+        gc_init_header(objects[k], cells, 0);
+        block += cells * CELL_SIZE;
+    }
+}
+
+void* gc_alloc_at(TypeV_Core* core, size_t size, uint64_t ip) {
+    TypeV_GC* gc = core->gc;
+    size_t cellSize = (size + CELL_SIZE - 1) / CELL_SIZE;
+    gc_heap_ensure(gc);
+    gc_incremental_pace(core, cellSize);
+    gc_finalize_pace(core, cellSize);
+
+    uint32_t site = gc_site_lookup(&gc->sites, ip);
+    TypeV_ObjectHeader* ptr = NULL;
+
+    if (gc->sites.sites[site].pretenure) {
+        ptr = gc_alloc_old(core, cellSize);
+        if (ptr != NULL) {
+            gc->sites.sites[site].pretenured++;
+        }
+    }
+
+    if (ptr == NULL) {
+        ptr = gc_alloc_nursery(core, cellSize);
+        gc->sites.sites[site].allocated++;
+    }
+
+    ptr->site = site;
     return ptr;
 }
 
+void gc_object_list_push(TypeV_RememberedSet* list, TypeV_ObjectHeader* obj) {
+    if (list->size >= list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : GC_LIST_INITIAL_CAPACITY;
+        list->set = (TypeV_ObjectHeader**)realloc(list->set, list->capacity * sizeof(TypeV_ObjectHeader*));
+    }
+    list->set[list->size++] = obj;
+}
+
+/** Copies the destructor of a dead user object to the finalization queue */
+static void gc_queue_finalizer(TypeV_GC* gc, TypeV_UserObject* user_object) {
+    TypeV_FinalizerQueue* queue = &gc->finalizers;
+    if(queue->size >= queue->capacity) {
+        // drop the entries already run before growing
+        if(queue->head > 0) {
+            memmove(queue->items, queue->items + queue->head, (queue->size - queue->head) * sizeof(TypeV_Finalizer));
+            queue->size -= queue->head;
+            queue->head = 0;
+        }
+        if(queue->size >= queue->capacity) {
+            queue->capacity = queue->capacity ? queue->capacity * 2 : GC_LIST_INITIAL_CAPACITY;
+            queue->items = (TypeV_Finalizer*)realloc(queue->items, queue->capacity * sizeof(TypeV_Finalizer));
+        }
+    }
+    queue->items[queue->size].dealloc = user_object->dealloc;
+    queue->items[queue->size].ptr = user_object->ptr;
+    queue->size++;
+}
+
+size_t gc_run_finalizers(TypeV_Core* core, size_t max) {
+    TypeV_GC* gc = core->gc;
+    TypeV_FinalizerQueue* queue = &gc->finalizers;
+    size_t ran = 0;
+    while(ran < max && queue->head < queue->size) {
+        // the entry is taken before running it, a destructor may allocate and queue more
+        TypeV_Finalizer finalizer = queue->items[queue->head++];
+        finalizer.dealloc((void*)finalizer.ptr);
+        ran++;
+    }
+    if(queue->head == queue->size) {
+        queue->head = 0;
+        queue->size = 0;
+    }
+    gc->stats.finalized += ran;
+    return ran;
+}
+
 static const char* object_names[] = {
         "Class",
         "Struct",
@@ -71,255 +317,535 @@ static const char* object_names[] = {
         "Y"
 };
 
+/**
+ * State of a single scavenge (minor GC) pass.
+ */
+typedef struct TypeV_Scavenger {
+    TypeV_Core* core;
+    uint8_t* from_start;         // Nursery from-space bounds, objects in here are evacuated
+    uint8_t* from_end;
+    uint8_t* to_start;           // Nursery to-space bounds, survivors land here
+    uint8_t* to_end;
+    uint8_t* to_free;            // Next free byte in the to-space (Cheney free pointer)
+    uint8_t* old_free;           // Next promotion slot in the old region
+    int8_t old_direction;        // Promotion direction, mirrors the old region direction
+} TypeV_Scavenger;
+
+static inline uint8_t scavenger_in_from(TypeV_Scavenger* s, void* ptr) {
+    return (uint8_t*)ptr >= s->from_start && (uint8_t*)ptr < s->from_end;
+}
+
+static inline uint8_t scavenger_in_to(TypeV_Scavenger* s, void* ptr) {
+    return (uint8_t*)ptr >= s->to_start && (uint8_t*)ptr < s->to_end;
+}
+
+/**
+ * Moves a single from-space object to its new location, either the to-space or the old region
+ * depending on its age, and leaves a forwarding pointer behind.
+ * @return the new header
+ */
+static TypeV_ObjectHeader* scavenger_evacuate(TypeV_Scavenger* s, TypeV_ObjectHeader* obj) {
+    TypeV_GC* gc = s->core->gc;
+    size_t cellSize = obj->cells;
+    TypeV_ObjectHeader* newLocation = NULL;
+    uint8_t location = 0;
+
+    if (obj->age >= gc->policy.promotion_age) {
+        if(s->old_direction == 1) {
+            newLocation = (TypeV_ObjectHeader*)s->old_free;
+            s->old_free += cellSize * CELL_SIZE;
+        } else {
+            s->old_free -= cellSize * CELL_SIZE;
+            newLocation = (TypeV_ObjectHeader*)s->old_free;
+        }
+        location = 1;
+    }
+    else {
+        newLocation = (TypeV_ObjectHeader*)s->to_free;
+        s->to_free += cellSize * CELL_SIZE;
+    }
+
+    memcpy(newLocation, obj, cellSize * CELL_SIZE);
+    gc_set_forward(obj, newLocation);
+    newLocation->flags = 0;
+    newLocation->age = obj->age < GC_MAX_AGE ? obj->age + 1 : GC_MAX_AGE;
+    newLocation->location = location;
+
+    // internal pointers must follow the object
+    gc_recompute_pointers(newLocation);
+
+    if(location == 1) {
+        gc_object_list_push(&gc->promoted, newLocation);
+        gc->sites.sites[obj->site].promoted++;
+
+        // objects promoted during an incremental mark have not been seen by it yet
+        if(gc->incremental.marking) {
+            gc_mark_shade(s->core, newLocation);
+        }
+    }
+
+    return newLocation;
+}
+
+/**
+ * Updates a single pointer slot, evacuating the referenced object if it still lives in the from-space.
+ * Pointers outside of the from-space (old region, already evacuated objects) are left untouched.
+ * @return 1 if the slot now points into the nursery
+ */
+static uint8_t scavenger_slot(void* ctx, void* slot) {
+    TypeV_Scavenger* s = (TypeV_Scavenger*)ctx;
+    uintptr_t ref;
+    memcpy(&ref, slot, sizeof(uintptr_t));
+    if(!ref) {
+        return 0;
+    }
+
+    TypeV_ObjectHeader* obj = GET_OBJ_HEADER(ref);
+    if(scavenger_in_from(s, obj)) {
+        TypeV_ObjectHeader* newLocation = gc_get_forward(obj);
+        if(newLocation == NULL) {
+            newLocation = scavenger_evacuate(s, obj);
+        }
+        ref = (uintptr_t)(newLocation + 1);
+        memcpy(slot, &ref, sizeof(uintptr_t));
+        return newLocation->location == 0;
+    }
+
+    return scavenger_in_to(s, obj);
+}
+
+/**
+ * Updates all pointer fields of an already evacuated (or old) object.
+ * @return 1 if the object holds at least one pointer into the nursery afterwards
+ */
+static uint8_t scavenger_object(TypeV_Scavenger* s, TypeV_ObjectHeader* obj) {
+    uint8_t young = gc_visit_object_slots(obj, scavenger_slot, s);
+
+    // the coroutine registers are written without a barrier, an old coroutine is always remembered
+    return young || obj->type == OT_COROUTINE;
+}
+
+/**
+ * Sizes the (empty) to-space before a minor GC. It holds the survivors, and becomes the from-space
+ * the mutator allocates in next: the semispaces double until they reach the policy limit, and shrink
+ * back once they are more than twice as large as the limit. The to-space never gets smaller than the
+ * from-space contents, which could all survive, nor than what a pending allocation asked for.
+ */
+static void gc_nursery_size_to(TypeV_GC* gc) {
+    size_t limit = gc->nursery.limit_cells;
+    size_t largest = gc->nursery.from_cells > gc->nursery.to_cells ? gc->nursery.from_cells : gc->nursery.to_cells;
+    size_t target = 2 * largest;
+    if (target > limit) {
+        target = limit;
+    }
+    if (target < gc->nursery.cell_size) {
+        target = gc->nursery.cell_size;
+    }
+    if (target < gc->nursery.request_cells) {
+        target = gc->nursery.request_cells;
+    }
+    if (target > NURSERY_MAX_CELLS) {
+        target = NURSERY_MAX_CELLS;
+    }
+    gc->nursery.request_cells = 0;
+
+    // whole pages
+    size_t page_cells = typev_page_size() / CELL_SIZE;
+    target = (target + page_cells - 1) / page_cells * page_cells;
+    if (target <= gc->nursery.to_cells && gc->nursery.to_cells <= 2 * target) {
+        return;
+    }
+
+    gc_log("gc_nursery_size_to: Resizing the to-space from %zu to %zu cells", gc->nursery.to_cells, target);
+    size_t bitmap_cells = gc->nursery.from_cells > gc->nursery.to_cells ? gc->nursery.from_cells : gc->nursery.to_cells;
+    typev_pages_free(gc->nursery.to, gc->nursery.to_cells * CELL_SIZE);
+    gc->nursery.to = gc_heap_map(target * CELL_SIZE);
+    gc->nursery.to_cells = target;
+
+    // the bitmap is only valid during a major mark, it is cleared before use
+    if (BITMAP_WORDS(target) > BITMAP_WORDS(bitmap_cells)) {
+        free(gc->nursery.active_bitmap);
+        gc->nursery.active_bitmap = (uint64_t*)calloc(BITMAP_WORDS(target), sizeof(uint64_t));
+    }
+}
+
 void perform_minor_gc(TypeV_Core* core) {
     TypeV_GC* gc = core->gc;
     gc_log("perform_minor_gc: Starting minor GC");
     gc_log("perform_minor_gc: Checking old region usage");
 
-    if ((INITIAL_OLD_CELLS*gc->oldRegion.capacity_factor-gc->oldRegion.cell_size ) <= NURSERY_MAX_CELLS ) {
+    if (gc_policy_needs_major(gc)) {
         gc_log("perform_minor_gc: Old region is full %d, performing major GC", gc->oldRegion.cell_size);
         perform_major_gc(core);
     }
-
-    perform_minor_mark(core);
+    else if (gc->incremental.pause_budget_ns && !gc->incremental.marking && gc_policy_should_start_mark(gc)) {
+        gc_log("perform_minor_gc: Starting incremental major mark");
+        gc->incremental.marking = 1;
+        gc->incremental.allocated = 0;
+        gc_incremental_mark_begin(core);
+    }
 
     gc_log("minor_begin (%d/%d, %d/%d)\n", gc->nursery.cell_size, NURSERY_MAX_CELLS, gc->oldRegion.cell_size, INITIAL_OLD_CELLS*gc->oldRegion.capacity_factor);
 
-    uint64_t i = 0;
-
-    uint8_t* position_in_nursery = gc->nursery.to;
-    uint8_t* position_in_old = gc->oldRegion.direction == 1 ?
-                               gc->oldRegion.from+gc->oldRegion.cell_size*CELL_SIZE :
-                               gc->oldRegion.to - gc->oldRegion.cell_size*CELL_SIZE
-    ;
-
-    size_t nursery_cell_size = 0;
+    uint64_t start_ns = typev_now_ns();
+    gc_nursery_size_to(gc);
+    size_t allocated = gc->nursery.cell_size;
+    size_t old_cells = gc->oldRegion.cell_size;
+    if (gc->rs.size > gc->stats.remembered_max) {
+        gc->stats.remembered_max = gc->rs.size;
+    }
 
+    TypeV_Scavenger s;
+    s.core = core;
+    s.from_start = gc->nursery.from;
+    s.from_end = gc->nursery.from + gc->nursery.cell_size * CELL_SIZE;
+    s.to_start = gc->nursery.to;
+    s.to_end = gc->nursery.to + gc->nursery.to_cells * CELL_SIZE;
+    s.to_free = gc->nursery.to;
+    s.old_direction = gc->oldRegion.direction;
+    s.old_free = gc->oldRegion.direction == 1 ?
+                 gc->oldRegion.from+gc->oldRegion.cell_size*CELL_SIZE :
+                 gc->oldRegion.to - gc->oldRegion.cell_size*CELL_SIZE;
+
+    // Step 1: roots, the register files of the active call chain
+    gc_visit_state_slots(core->funcState, scavenger_slot, &s);
+    scavenger_slot(&s, &core->activeCoroutine);
+
+    // Step 2: the remembered set, rebuilt as we go with the containers that still point into the nursery
+    TypeV_RememberedSet remembered = gc->rs;
+    gc->rs.set = (TypeV_ObjectHeader**)malloc(remembered.capacity * sizeof(TypeV_ObjectHeader*));
+    gc->rs.capacity = remembered.capacity;
+    gc->rs.size = 0;
 
-    for(uint64_t k = 0; k < gc->rs.size; k++) {
-        gc->rs.set[k]->color = BLACK;
-        gc->rs.set[k]->surviveCount = 5;
+    for(size_t k = 0; k < remembered.size; k++) {
+        TypeV_ObjectHeader* obj = remembered.set[k];
+        obj->flags &= ~GC_FLAG_REMEMBERED;
+        if(scavenger_object(&s, obj)) {
+            gc_remember(core, obj);
+        }
     }
-    gc->rs.size = 0;
+    free(remembered.set);
+
+    // Step 3: breadth-first scan of everything evacuated so far, the to-space is its own queue
+    uint8_t* scan = s.to_start;
+    while ((scan < s.to_free) || (gc->promoted.size > 0)) {
+        while (scan < s.to_free) {
+            TypeV_ObjectHeader* obj = (TypeV_ObjectHeader*)scan;
+            scavenger_object(&s, obj);
+            scan += obj->cells * CELL_SIZE;
+        }
 
-    while (i < gc->nursery.cell_size) {
-        TypeV_ObjectHeader* obj = (TypeV_ObjectHeader *)(gc->nursery.from + i * CELL_SIZE);
-        size_t cellSize = (obj->totalSize + CELL_SIZE - 1) / CELL_SIZE;
-
-        if (obj->color == BLACK) {
-            TypeV_ObjectHeader* newLocation = NULL;
-            uint8_t location = 0;
-            if (obj->surviveCount >= PROMOTION_SURVIVAL_THRESHOLD) {
-                if(gc->oldRegion.direction == 1) {
-                    newLocation = (TypeV_ObjectHeader*)position_in_old;
-                    position_in_old += cellSize * CELL_SIZE;
-                } else {
-                    position_in_old -= cellSize * CELL_SIZE;
-                    newLocation = (TypeV_ObjectHeader*)position_in_old;
-                }
-
-                location = 1;
-            } else {
-                newLocation = (TypeV_ObjectHeader*)position_in_nursery;
-                position_in_nursery += cellSize * CELL_SIZE;
-                nursery_cell_size += cellSize;
+        while (gc->promoted.size > 0) {
+            TypeV_ObjectHeader* obj = gc->promoted.set[--gc->promoted.size];
+            if(scavenger_object(&s, obj)) {
+                gc_remember(core, obj);
             }
+        }
+    }
 
-            memcpy(newLocation, obj, cellSize * CELL_SIZE);
-            //newLocation->fields = (TypeV_ObjectHeader**)malloc(obj->num_fields * sizeof(TypeV_ObjectHeader*));
-            //memcpy(newLocation->fields, obj->fields, obj->num_fields * sizeof(TypeV_ObjectHeader*));
-
-            obj->fwd = newLocation;
-            newLocation->fwd = NULL;
-            newLocation->surviveCount = obj->surviveCount + 1;
-            newLocation->location = location;
-            newLocation->color = WHITE;
+    // Step 4: user objects left behind in the from-space are dead, queue their destructors.
+    // Arrays left behind release their payloads.
+    size_t liveUserObjects = 0;
+    size_t finalized = 0;
+    for(size_t k = 0; k < gc->userObjects.size; k++) {
+        TypeV_ObjectHeader* obj = gc->userObjects.set[k];
+        if(obj->location == 1) {
+            gc->userObjects.set[liveUserObjects++] = obj;
+            continue;
+        }
 
-            if (newLocation->totalSize == 0) {
-                printf("Error: %p\n", newLocation);
-            }
+        TypeV_ObjectHeader* fwd = gc_get_forward(obj);
+        if(fwd == NULL) {
+            gc_log("Finalizing unmarked nursery object : %d / %s\n", obj->uid, object_names[obj->type]);
+            gc_queue_finalizer(gc, (TypeV_UserObject*)(obj + 1));
+            finalized++;
         }
         else {
-            gc_log("Freeing unmarked nursery object : %d / %s\n", obj->uid, object_names[obj->type]);
-            if(obj->type == OT_USER_OBJECT) {
-                TypeV_UserObject* user_object = (TypeV_UserObject*)(obj + 1);
-                user_object->dealloc((void*)user_object->ptr);
-            }
+            gc->userObjects.set[liveUserObjects++] = fwd;
         }
-        i += cellSize;
     }
+    gc->userObjects.size = liveUserObjects;
+    gc_los_after_minor(core);
 
     uint8_t* temp = gc->nursery.from;
     gc->nursery.from = gc->nursery.to;
     gc->nursery.to = temp;
+    size_t temp_cells = gc->nursery.from_cells;
+    gc->nursery.from_cells = gc->nursery.to_cells;
+    gc->nursery.to_cells = temp_cells;
 
-    gc->nursery.cell_size = nursery_cell_size;
-    gc->oldRegion.cell_size = (gc->oldRegion.direction == 1 ? position_in_old - gc->oldRegion.from : gc->oldRegion.to - (position_in_old)) / CELL_SIZE;
+    gc->nursery.cell_size = (s.to_free - s.to_start) / CELL_SIZE;
+    gc->oldRegion.cell_size = (gc->oldRegion.direction == 1 ? s.old_free - gc->oldRegion.from : gc->oldRegion.to - s.old_free) / CELL_SIZE;
 
+    gc_sites_after_minor(&gc->sites);
 
-    update_root_references(core);
+    size_t promoted = gc->oldRegion.cell_size - old_cells;
+    uint64_t pause_ns = typev_now_ns() - start_ns;
+    gc->stats.allocated_bytes += (allocated - gc->nurseryBaseCells) * CELL_SIZE;
+    gc->stats.copied_bytes += gc->nursery.cell_size * CELL_SIZE;
+    gc->stats.promoted_bytes += promoted * CELL_SIZE;
+    gc->nurseryBaseCells = gc->nursery.cell_size;
+    gc_stats_record_pause(&gc->stats, GC_PAUSE_MINOR, pause_ns);
+    gc_policy_after_minor(gc, allocated, gc->nursery.cell_size, promoted, pause_ns);
+    gc_stats_log_minor(core, pause_ns, allocated, gc->nursery.cell_size, promoted, finalized);
 
     gc_log("minor_end gc (%d/%d, %d/%d)\n", gc->nursery.cell_size, NURSERY_MAX_CELLS, gc->oldRegion.cell_size, INITIAL_OLD_CELLS*gc->oldRegion.capacity_factor);
     gc_log("perform_minor_gc: Completed minor GC");
 }
 
+/**
+ * Returns the pages the heap no longer uses to the OS: the part of the old region mapping left
+ * outside of the region after it shrank, and the nursery pages above the allocation limit.
+ * The free space inside the old region is kept, the next promotions fill it anyway.
+ */
+static void gc_release_pages(TypeV_GC* gc) {
+    uint8_t* map_end = gc->oldRegion.data + gc->oldRegion.mapped;
+    typev_pages_discard(gc->oldRegion.data, gc->oldRegion.from - gc->oldRegion.data);
+    typev_pages_discard(gc->oldRegion.to, map_end - gc->oldRegion.to);
+
+    size_t limit = gc_nursery_limit(gc);
+    size_t kept = gc->nursery.cell_size > limit ? gc->nursery.cell_size : limit;
+    if (kept < gc->nursery.from_cells) {
+        typev_pages_discard(gc->nursery.from + kept * CELL_SIZE, (gc->nursery.from_cells - kept) * CELL_SIZE);
+    }
+    if (limit < gc->nursery.to_cells) {
+        typev_pages_discard(gc->nursery.to + limit * CELL_SIZE, (gc->nursery.to_cells - limit) * CELL_SIZE);
+    }
+}
+
 void perform_major_gc(TypeV_Core* core) {
     TypeV_GC* gc = core->gc;
     gc_log("MAJOR_BEGIN (%d/%d, %d/%d)\n", gc->nursery.cell_size, NURSERY_MAX_CELLS, gc->oldRegion.cell_size, INITIAL_OLD_CELLS*gc->oldRegion.capacity_factor);
-    // Step 1: Mark phase
-    perform_major_mark(core);
+    uint64_t start_ns = typev_now_ns();
+    uint8_t incremental = gc->incremental.marking;
 
-    // Step 2: Check if the old region has enough space for the nursery
-    size_t required_space = NURSERY_REGION_SIZE / CELL_SIZE;
-    size_t current_free_space = INITIAL_OLD_CELLS - gc->oldRegion.cell_size;
+    // Step 1: Mark phase, or the end of the one in progress
+    if (gc->incremental.marking) {
+        gc_incremental_mark_finish(core);
+        gc->incremental.marking = 0;
+    }
+    else {
+        perform_major_mark(core);
+    }
 
-    // if we dont have room for nursery or half old is full we scale up
-    bool needs_new_buffer = (current_free_space < required_space) || (gc->oldRegion.cell_size >= (INITIAL_OLD_CELLS*gc->oldRegion.capacity_factor) / 2);
+    // Step 2: size the region from the live set. Compaction packs the live objects at the end of the region
+    // opposite to the occupied range, so it works in place as long as both fit without overlapping.
+    // A smaller region is carved out of the current one, on the side the live objects move to.
+    size_t live_cells = gc->markedOldCells;
+    size_t occupied_cells = gc->oldRegion.cell_size;
+    size_t new_factor = gc_policy_old_capacity_factor(gc, live_cells);
+    size_t new_capacity = INITIAL_OLD_CELLS * new_factor;
+    bool needs_new_buffer = (new_factor > gc->oldRegion.capacity_factor) ||
+                            (live_cells + occupied_cells > OLD_REGION_CELLS(gc));
 
     uint8_t* new_buffer = NULL;
-    size_t new_capacity = 0;
 
     uint8_t* from = gc->oldRegion.from;
     uint8_t* to = gc->oldRegion.to;
 
-    // new dirty bitmap
-
     if (needs_new_buffer) {
-        // Allocate a new buffer large enough to fit all objects + required free space
-        gc->oldRegion.capacity_factor *= 2;
-        new_capacity = INITIAL_OLD_CELLS * gc->oldRegion.capacity_factor;
-        new_buffer = (uint8_t*)aligned_alloc(16, OLD_REGION_INITIAL_SIZE * gc->oldRegion.capacity_factor);
+        new_buffer = gc_heap_map(new_capacity * CELL_SIZE);
         gc_log("perform_major_gc: Allocated new buffer with capacity %zu cells", new_capacity);
 
         from = new_buffer;
-        to = new_buffer + OLD_REGION_INITIAL_SIZE * gc->oldRegion.capacity_factor;
-
+        to = new_buffer + new_capacity * CELL_SIZE;
+    }
+    else if (new_factor < gc->oldRegion.capacity_factor) {
+        gc_log("perform_major_gc: Shrinking old region to %zu cells", new_capacity);
+        if (gc->oldRegion.direction == 1) {
+            from = to - new_capacity * CELL_SIZE;
+        }
+        else {
+            to = from + new_capacity * CELL_SIZE;
+        }
     }
-    uint8_t* new_dirty_bitmap = (uint8_t*)calloc((INITIAL_OLD_CELLS*gc->oldRegion.capacity_factor) / 8, sizeof(uint8_t));
-
-    uint64_t new_cell_size = 0;
-    if (gc->oldRegion.direction == 1) {
-        for (uint64_t i = 0; i < gc->oldRegion.cell_size; ) {
-            TypeV_ObjectHeader* obj = (TypeV_ObjectHeader *)(gc->oldRegion.from + i * CELL_SIZE);
-            size_t cellSize = (obj->totalSize + CELL_SIZE - 1) / CELL_SIZE;
 
-            if (obj->color == BLACK) {
-                obj->color = WHITE;
+    // Step 3: compaction, live objects are found through the mark bitmap, dead ones are never visited.
+    // The occupied range sits at the bottom of the region when moving downwards, at the top otherwise.
+    uint8_t* moved_from = gc->oldRegion.direction == 1 ? gc->oldRegion.from : gc->oldRegion.to - gc->oldRegion.cell_size * CELL_SIZE;
+    uint8_t* moved_to = moved_from + gc->oldRegion.cell_size * CELL_SIZE;
+    size_t first_cell = (moved_from - gc->oldRegion.from) / CELL_SIZE;
+    size_t last_cell = (moved_to - gc->oldRegion.from) / CELL_SIZE;
 
-                // Determine the new location
+    uint64_t* bitmap = gc->oldRegion.active_bitmap;
+    uint64_t new_cell_size = 0;
+    for (size_t w = first_cell / 64; w < BITMAP_WORDS(last_cell); w++) {
+        uint64_t bits = bitmap[w];
+        while (bits) {
+            size_t cell = w * 64 + count_trailing_zeros_64(bits);
+            bits &= bits - 1;
+
+            TypeV_ObjectHeader* obj = (TypeV_ObjectHeader *)(gc->oldRegion.from + cell * CELL_SIZE);
+            size_t cellSize = obj->cells;
+            TypeV_ObjectHeader* new_location = NULL;
+
+            // Determine the new location
+            if (gc->oldRegion.direction == 1) {
                 new_cell_size += cellSize;
-                TypeV_ObjectHeader* new_location = (TypeV_ObjectHeader *)(to - (new_cell_size * CELL_SIZE));
-                memcpy(new_location, obj, cellSize * CELL_SIZE);
-                obj->fwd = new_location;
-                new_location->fwd = NULL;
-
-            } else {
-                gc_log("Freeing unmarked old object: %d\n", obj->uid);
-                if(obj->type == OT_USER_OBJECT) {
-                    TypeV_UserObject* user_object = (TypeV_UserObject*)(obj + 1);
-                    user_object->dealloc((void*)user_object->ptr);
-                }
+                new_location = (TypeV_ObjectHeader *)(to - (new_cell_size * CELL_SIZE));
             }
-
-            i += cellSize; // Move to the next object
-        }
-    } else {
-        for (uint64_t i = 0; i < gc->oldRegion.cell_size; ) {
-            TypeV_ObjectHeader* obj = (TypeV_ObjectHeader *)(gc->oldRegion.to - (gc->oldRegion.cell_size - i) * CELL_SIZE);
-            size_t cellSize = (obj->totalSize + CELL_SIZE - 1) / CELL_SIZE;
-
-            if (obj->color == BLACK) {
-                obj->color = WHITE;
-
-                // Determine the new location
-                TypeV_ObjectHeader* new_location = (TypeV_ObjectHeader *)(from + new_cell_size * CELL_SIZE);
-                memcpy(new_location, obj, cellSize * CELL_SIZE);
-                obj->fwd = new_location;
-                new_location->fwd = NULL;
+            else {
+                new_location = (TypeV_ObjectHeader *)(from + new_cell_size * CELL_SIZE);
                 new_cell_size += cellSize;
-            } else {
-                gc_log("Freeing unmarked old object: %d\n", obj->uid);
-                if(obj->type == OT_USER_OBJECT) {
-                    TypeV_UserObject* user_object = (TypeV_UserObject*)(obj + 1);
-                    user_object->dealloc((void*)user_object->ptr);
-                }
             }
 
-            i += cellSize; // Move to the next object
+            memcpy(new_location, obj, cellSize * CELL_SIZE);
+            gc_recompute_pointers(new_location);
+            gc_set_forward(obj, new_location);
+            new_location->flags = 0;
+
+            // objects allocated in the old region keep age 0 until their first major GC
+            if (new_location->age == 0) {
+                gc->sites.sites[new_location->site].survived++;
+                new_location->age = GC_MAX_AGE;
+            }
         }
     }
 
+    // Step 4: queue the destructors of dead user objects and release the payloads of dead arrays,
+    // while the mark bitmap still matches the old layout. Dead nursery objects are left to the minor GC.
+    size_t liveUserObjects = 0;
+    size_t finalized = 0;
+    for (size_t k = 0; k < gc->userObjects.size; k++) {
+        TypeV_ObjectHeader* obj = gc->userObjects.set[k];
+        if (obj->location == 0) {
+            gc->userObjects.set[liveUserObjects++] = obj;
+        }
+        else if (gc_is_marked(core, obj)) {
+            gc->userObjects.set[liveUserObjects++] = gc_get_forward(obj);
+        }
+        else {
+            gc_log("Finalizing unmarked old object: %d\n", obj->uid);
+            gc_queue_finalizer(gc, (TypeV_UserObject*)(obj + 1));
+            finalized++;
+        }
+    }
+    gc->userObjects.size = liveUserObjects;
+    gc_los_after_major(core);
+
     gc->oldRegion.cell_size = new_cell_size;
     gc->oldRegion.from = from;
     gc->oldRegion.to = to;
 
     gc->oldRegion.direction = -gc->oldRegion.direction;
 
-    // must update references here before we free (potentially) old buffer
+    if (new_factor != gc->oldRegion.capacity_factor) {
+        gc->oldRegion.capacity_factor = new_factor;
+        free(gc->oldRegion.active_bitmap);
+        gc->oldRegion.active_bitmap = (uint64_t*)calloc(BITMAP_WORDS(new_capacity), sizeof(uint64_t));
+    }
 
-    update_root_references(core);
+    // must update references here before we free (potentially) old buffer
+    // the remembered set is rebuilt while updating, since its entries have moved
+    gc->rs.size = 0;
+    update_root_references(core, moved_from, moved_to);
 
     if(needs_new_buffer) {
-        free(gc->oldRegion.data);
+        typev_pages_free(gc->oldRegion.data, gc->oldRegion.mapped);
         gc->oldRegion.data = new_buffer;
+        gc->oldRegion.mapped = new_capacity * CELL_SIZE;
     }
 
+    gc_release_pages(gc);
+
+    gc_sites_after_major(&gc->sites);
+    gc_policy_after_major(gc, occupied_cells, live_cells);
+
+    uint64_t pause_ns = typev_now_ns() - start_ns;
+    gc->stats.copied_bytes += live_cells * CELL_SIZE;
+    gc_stats_record_pause(&gc->stats, GC_PAUSE_MAJOR, pause_ns);
+    gc_stats_log_major(core, pause_ns, incremental, occupied_cells, live_cells, finalized);
+
     gc_log("MAJOR_END (%d/%d, %d/%d)\n", gc->nursery.cell_size, NURSERY_MAX_CELLS, gc->oldRegion.cell_size, INITIAL_OLD_CELLS*gc->oldRegion.capacity_factor);
     gc_log("perform_major_gc: Completed major GC");
 }
 
 void write_barrier(TypeV_Core* core, TypeV_ObjectHeader* old_obj, TypeV_ObjectHeader* new_obj) {
-    TypeV_GC* gc = core->gc;
-    if (old_obj->location == 1 && new_obj->location == 0) {
-        add_to_remembered_set(core, new_obj);
+    if (old_obj->location == 1) {
+        if (new_obj->location == 0) {
+            gc_remember(core, old_obj);
+        }
+        else if (core->gc->incremental.marking) {
+            // incremental update: an old object may have been scanned already, its new target must not stay white
+            gc_mark_shade(core, new_obj);
+        }
     }
 }
 
-void gc_free_all(TypeV_Core* core) {
-    // iterates over all objects in the nursery and old region and frees them
-    // this is used when the program is exiting
+void gc_set_pause_budget(TypeV_Core* core, uint32_t budget_us) {
+    TypeV_GC* gc = core->gc;
+    gc->incremental.pause_budget_ns = (uint64_t)budget_us * 1000;
 
-    // nursery
-    uint64_t i = 0;
-    while(i < core->gc->nursery.cell_size) {
-        TypeV_ObjectHeader* obj = (TypeV_ObjectHeader *)(core->gc->nursery.from + i * CELL_SIZE);
-        if(obj->type == OT_USER_OBJECT) {
-            TypeV_UserObject* user_object = (TypeV_UserObject*)(obj + 1);
-            user_object->dealloc((void*)user_object->ptr);
-        }
+    // a mark already in progress keeps being stepped until the next major GC completes it
+}
 
-        i += (obj->totalSize + CELL_SIZE - 1) / CELL_SIZE;
+void gc_safepoint(TypeV_Core* core) {
+    TypeV_GC* gc = core->gc;
+    if(gc->incremental.marking) {
+        gc_incremental_step(core);
+    }
+    if(gc->finalizers.head < gc->finalizers.size) {
+        gc->finalizers.allocated = 0;
+        gc_run_finalizers(core, GC_FINALIZE_BATCH);
     }
+}
 
-    // old region
-    i = 0;
-    while(i < core->gc->oldRegion.cell_size) {
-        TypeV_ObjectHeader* obj = (TypeV_ObjectHeader *)(core->gc->oldRegion.from + i * CELL_SIZE);
-        if(obj->type == OT_USER_OBJECT) {
-            TypeV_UserObject* user_object = (TypeV_UserObject*)(obj + 1);
-            user_object->dealloc((void*)user_object->ptr);
-        }
+void gc_remember(TypeV_Core* core, TypeV_ObjectHeader* obj) {
+    if(!(obj->flags & GC_FLAG_REMEMBERED)) {
+        obj->flags |= GC_FLAG_REMEMBERED;
+        add_to_remembered_set(core, obj);
+    }
+}
 
-        i += (obj->totalSize + CELL_SIZE - 1) / CELL_SIZE;
+void gc_register_user_object(TypeV_Core* core, TypeV_ObjectHeader* obj) {
+    gc_object_list_push(&core->gc->userObjects, obj);
+}
+
+void gc_free_all(TypeV_Core* core) {
+    // releases the resources of every user object, dead or alive
+    // this is used when the program is exiting
+    TypeV_GC* gc = core->gc;
+    gc_run_finalizers(core, SIZE_MAX);
+    for(size_t k = 0; k < gc->userObjects.size; k++) {
+        TypeV_UserObject* user_object = (TypeV_UserObject*)(gc->userObjects.set[k] + 1);
+        user_object->dealloc((void*)user_object->ptr);
     }
+    gc->userObjects.size = 0;
 }
 
-void cleanup_gc(TypeV_Core* core) {
+/**
+ * Runs the pending destructors and frees everything the collector holds but the TypeV_GC itself
+ */
+static void gc_release(TypeV_Core* core) {
     gc_free_all(core);
     TypeV_GC* gc = core->gc;
-    free(gc->nursery.data);
+    // the payload owners live in the heap, release them before it
+    gc_los_free(gc);
+    typev_pages_free(gc->nursery.from, gc->nursery.from_cells * CELL_SIZE);
+    typev_pages_free(gc->nursery.to, gc->nursery.to_cells * CELL_SIZE);
     free(gc->nursery.active_bitmap);
-    free(gc->oldRegion.data);
+    typev_pages_free(gc->oldRegion.data, gc->oldRegion.mapped);
     free(gc->oldRegion.active_bitmap);
     free(gc->rs.set);
+    free(gc->promoted.set);
+    free(gc->userObjects.set);
+    free(gc->markStack.set);
+    free(gc->finalizers.items);
+    gc_sites_free(&gc->sites);
+    gc_stats_free(gc);
 }
 
+void gc_reset(TypeV_Core* core) {
+    gc_release(core);
+    gc_init(core->gc);
+}
+
+void cleanup_gc(TypeV_Core* core) {
+    gc_release(core);
+    free(core->gc);
+    core->gc = NULL;
+}
 
 void add_to_remembered_set(TypeV_Core* core, TypeV_ObjectHeader* obj) {
-    TypeV_GC* gc = core->gc;
-    if (gc->rs.size >= gc->rs.capacity) {
-        gc->rs.capacity *= 2;
-        gc->rs.set = (TypeV_ObjectHeader**)realloc(gc->rs.set, gc->rs.capacity * sizeof(TypeV_ObjectHeader*));
-    }
-    gc->rs.set[gc->rs.size++] = obj;
+    gc_object_list_push(&core->gc->rs, obj);
 }
\ No newline at end of file
@@ -8,37 +8,81 @@
 #include <string.h>
 #include <stdbool.h>
 #include "../core.h"
+#include "sites.h"
+#include "policy.h"
+#include "stats.h"
+#include "los.h"
 
 /* ======================= CONSTANTS ======================= */
 
-#define CELL_SIZE 64
-#define NURSERY_MAX_CELLS 1310720
-#define INITIAL_OLD_CELLS 1310720
-#define NURSERY_REGION_SIZE (CELL_SIZE * NURSERY_MAX_CELLS)
-#define NURSERY_SIZE (NURSERY_REGION_SIZE * 2)
+// Allocation granularity, objects are rounded up to a multiple of CELL_SIZE bytes.
+// 16 bytes keeps every header 16-byte aligned while wasting at most 15 bytes per object.
+#define CELL_SIZE 16
+// The heap is mapped on the first allocation, small: each semispace of the nursery starts at
+// NURSERY_INITIAL_CELLS and doubles at every minor GC up to the limit set by the GC policy, the old region
+// starts at INITIAL_OLD_CELLS and grows in multiples of it. A core which never allocates has no heap.
+#define NURSERY_MAX_CELLS 5242880
+#define NURSERY_INITIAL_CELLS 4096
+#define INITIAL_OLD_CELLS 16384
 #define OLD_REGION_INITIAL_SIZE (CELL_SIZE * INITIAL_OLD_CELLS)
+// Initial promotion age, tuned at runtime by the GC policy
 #define PROMOTION_SURVIVAL_THRESHOLD 4
+// Below this many used old cells, the major mark runs on the collecting thread only
+#define GC_PARALLEL_MARK_MIN_CELLS 65536
+// Incremental marking: a mark step runs every GC_INCREMENTAL_STEP_CELLS allocated cells,
+// and checks its deadline every GC_INCREMENTAL_CLOCK_INTERVAL visited slots
+#define GC_INCREMENTAL_STEP_CELLS 4096
+#define GC_INCREMENTAL_CLOCK_INTERVAL 256
+// Destructors of dead user objects run outside the pauses, in a batch every GC_FINALIZE_STEP_CELLS
+// allocated cells: GC_FINALIZE_BATCH of them plus a sixteenth of the backlog, so the queue keeps up
+// with any rate of dying user objects
+#define GC_FINALIZE_BATCH 8
+#define GC_FINALIZE_STEP_CELLS 1024
+// The object lists of the collector start empty, and get this many entries on their first push
+#define GC_LIST_INITIAL_CAPACITY 64
 
 // Define GC_LOG to enable logging, or leave undefined to disable
 //#define GC_LOG
 
+// Define TYPEV_GC_DEBUG to keep a unique id in every object header
+//#define TYPEV_GC_DEBUG
+
 #ifdef GC_LOG
+#ifndef TYPEV_GC_DEBUG
+#define TYPEV_GC_DEBUG
+#endif
 #define gc_log(fmt, ...) printf("[GC_LOG] " fmt "\n", ##__VA_ARGS__)
 #else
 #define gc_log(fmt, ...) ((void)0)
 #endif
 
-/** Get the active bit for a cell in the bitmap **/
-#define GET_ACTIVE(bitmap, cell) ((bitmap[(cell) / 8] >> ((cell) % 8)) & 0x1)
+/**
+ * Mark bitmaps: one bit per cell, set for the first cell of every object found live by the mark phase.
+ * Kept on the side so marking never writes to object headers.
+ */
+#define GET_ACTIVE(bitmap, cell) (((bitmap)[(cell) / 64] >> ((cell) % 64)) & 0x1)
+#define SET_ACTIVE(bitmap, cell) ((bitmap)[(cell) / 64] |= (1ULL << ((cell) % 64)))
+#define BITMAP_WORDS(cells) (((cells) + 63) / 64)
 
-/* ======================= ENUMS ======================= */
+#ifdef _MSC_VER
+#include <intrin.h>
+#pragma intrinsic(_BitScanForward64)
 
-typedef enum {
-    WHITE = 0b00,
-    GRAY = 0b01,
-    NOTSU = 0b10,
-    BLACK = 0b11
-} ObjectColor;
+static inline uint32_t count_trailing_zeros_64(uint64_t value) {
+    unsigned long index;
+    if (_BitScanForward64(&index, value)) {
+        return (uint32_t)index;
+    } else {
+        // If value is 0, behavior is undefined for __builtin_ctzll
+        return 64; // All bits are zero
+    }
+}
+#else
+// GCC and Clang support __builtin_ctzll
+static inline uint32_t count_trailing_zeros_64(uint64_t value) {
+    return __builtin_ctzll(value);
+}
+#endif
 
 /* ======================= STRUCTURES ======================= */
 
@@ -55,28 +99,72 @@ typedef enum {
     OT_USER_OBJECT,
 }TypeV_ObjectType;
 
+/** Object header flags **/
+#define GC_FLAG_FORWARDED 0x1    // The object has been moved, the new address is stored in the payload
+#define GC_FLAG_REMEMBERED 0x2   // The (old) object is currently in the remembered set
+
+/** Largest value the 4-bit age counter can hold **/
+#define GC_MAX_AGE 15
+
+/**
+ * @brief Object header, 16 bytes.
+ * The first word packs the size (in cells), type, location, age and flags of the object.
+ * Once an object has been copied, its forwarding pointer is stored in the first 8 bytes of the
+ * (now dead) payload, see gc_get_forward/gc_set_forward.
+ */
 typedef struct TypeV_ObjectHeader {
-    TypeV_ObjectType type;
-    ObjectColor color;           // Tri-color marking
-    size_t totalSize;            // Object size in bytes
-    size_t surviveCount;         // GC survival counter
-    struct TypeV_ObjectHeader* fwd;    // Forwarding pointer for GC
-    uint8_t location;            // 0 for nursery, 1 for old region
+    uint32_t cells;              // Object size in cells
+    uint8_t type;                // TypeV_ObjectType
+    uint8_t location: 2;         // 0 for nursery, 1 for old region
+    uint8_t age: 4;              // Number of minor GCs survived, saturates at GC_MAX_AGE
+    uint8_t unused: 2;
+    uint8_t flags;               // GC_FLAG_* bits
+    uint8_t reserved;
+    uint32_t site;               // Allocation site (see sites.h), 0 if untracked
+#ifdef TYPEV_GC_DEBUG
     uint32_t uid;                // Unique ID for debugging
+#else
+    uint32_t reserved3;
+#endif
 }TypeV_ObjectHeader;
 
+_Static_assert(sizeof(TypeV_ObjectHeader) == 16, "TypeV_ObjectHeader must be 16 bytes");
+
+/** Size of an object in bytes, including its header **/
+#define GC_OBJ_BYTES(obj) ((size_t)(obj)->cells * CELL_SIZE)
+
+/** Returns the new location of a copied object, NULL if the object has not been moved **/
+static inline struct TypeV_ObjectHeader* gc_get_forward(TypeV_ObjectHeader* obj) {
+    if(!(obj->flags & GC_FLAG_FORWARDED)) {
+        return NULL;
+    }
+    TypeV_ObjectHeader* fwd;
+    memcpy(&fwd, obj + 1, sizeof(TypeV_ObjectHeader*));
+    return fwd;
+}
+
+/** Marks an object as moved, overwriting the start of its payload with the new location **/
+static inline void gc_set_forward(TypeV_ObjectHeader* obj, TypeV_ObjectHeader* fwd) {
+    memcpy(obj + 1, &fwd, sizeof(TypeV_ObjectHeader*));
+    obj->flags |= GC_FLAG_FORWARDED;
+}
+
 typedef struct TypeV_NurseryRegion {
-    uint8_t* active_bitmap;      // Bitmap for active cells
+    uint64_t* active_bitmap;     // Mark bitmap of the from-space, sized for the largest semispace so far
     size_t cell_size;            // Total allocated cells
-    uint8_t* from;               // From-space pointer
+    size_t limit_cells;          // Cells allocated before a minor GC, at most NURSERY_MAX_CELLS, set by the GC policy
+    size_t request_cells;        // Cells the next minor GC has to leave room for in the to-space, 0 if none
+    uint8_t* from;               // From-space pointer, NULL until the first allocation
     uint8_t* to;                 // To-space pointer
-    uint8_t* data;               // Combined from/to space
+    size_t from_cells;           // Capacity of the from-space
+    size_t to_cells;             // Capacity of the to-space
 } TypeV_NurseryRegion;
 
 typedef struct TypeV_OldGenerationRegion {
-    uint8_t* active_bitmap;      // Bitmap for active cells
+    uint64_t* active_bitmap;     // Mark bitmap, indexed from `from`
     size_t cell_size;            // Total allocated cells
-    uint8_t* data;               // Old generation data
+    uint8_t* data;               // Mapping holding the region, [from, to) lies within it
+    size_t mapped;               // Size of the mapping, in bytes
     size_t capacity_factor;      // Capacity scaling factor
     uint8_t* from;               // From-space pointer (downwards)
     uint8_t* to;                 // To-space pointer (upwards)
@@ -89,39 +177,141 @@ typedef struct TypeV_RememberedSet {
     TypeV_ObjectHeader** set;
 } TypeV_RememberedSet;
 
+typedef struct TypeV_IncrementalMark {
+    uint8_t marking;             // 1 while an incremental major mark is in progress
+    uint64_t pause_budget_ns;    // Time budget of a single mark step, 0 for stop-the-world major GCs
+    size_t allocated;            // Cells allocated since the last mark step
+} TypeV_IncrementalMark;
+
+/** Destructor of a dead user object, copied out of the object since its memory is reclaimed right away */
+typedef struct TypeV_Finalizer {
+    void (*dealloc)(void* ptr);
+    uintptr_t ptr;
+} TypeV_Finalizer;
+
+typedef struct TypeV_FinalizerQueue {
+    TypeV_Finalizer* items;
+    size_t head;                 // Next finalizer to run, [head, size) are pending
+    size_t size;
+    size_t capacity;
+    size_t allocated;            // Cells allocated since the last batch
+} TypeV_FinalizerQueue;
+
 typedef struct TypeV_GC {
     TypeV_NurseryRegion nursery;  // Nursery region for young objects
     TypeV_OldGenerationRegion oldRegion; // Old generation region
-    TypeV_RememberedSet rs;
+    TypeV_RememberedSet rs;       // Old objects which may hold pointers into the nursery
+    TypeV_RememberedSet promoted; // Objects promoted during the current minor GC, pending scan
+    TypeV_RememberedSet userObjects; // Finalizable set: live user objects, checked after each collection
+    TypeV_FinalizerQueue finalizers; // Destructors of the user objects found dead, run by gc_run_finalizers
+    TypeV_RememberedSet markStack; // Marked objects whose fields have not been visited yet
+    TypeV_IncrementalMark incremental; // Incremental major mark state
+    TypeV_AllocSites sites;       // Allocation-site feedback, for pretenuring
+    TypeV_GCPolicy policy;        // Heap sizing decisions
+    TypeV_LargeObjectSpace los;   // Out-of-line array payloads
+    size_t markedOldCells;        // Old cells marked by the current major mark, the live set once it completes
+    TypeV_GCStats stats;          // Telemetry counters, see gc_stats_snapshot
+    size_t nurseryBaseCells;      // Nursery cells in use after the last minor GC, to account for allocations
+    uint64_t statsStartNs;        // Initialization time, log timestamps are relative to it
+    FILE* statsLog;               // TYPEV_GC_LOG file, NULL if not set
 } TypeV_GC;
 
+/** Capacity of the old region, in cells **/
+#define OLD_REGION_CELLS(gc) (INITIAL_OLD_CELLS * (gc)->oldRegion.capacity_factor)
+
+/** Cells the nursery allocates before a minor GC: the policy limit, within the capacity of the from-space **/
+static inline size_t gc_nursery_limit(TypeV_GC* gc) {
+    return gc->nursery.limit_cells < gc->nursery.from_cells ? gc->nursery.limit_cells : gc->nursery.from_cells;
+}
+
 /* ======================= FUNCTION DECLARATIONS ======================= */
 
 
 /** Initialize the GC */
 TypeV_GC* initialize_gc(void);
 
+/**
+ * Releases the heap and everything the collector holds, running the pending destructors, and leaves the GC
+ * as initialize_gc returns it. Used to recycle the GC of a dead core.
+ */
+void gc_reset(TypeV_Core* core);
+
 /** Allocate memory using the GC */
 void* gc_alloc(TypeV_Core* core, size_t size);
 
-/** Perform a minor mark phase */
-void perform_minor_mark(TypeV_Core* core);
+/**
+ * Allocate memory on behalf of the instruction at `ip`. The object lands in the nursery, or directly
+ * in the old region if the objects of that allocation site usually get promoted.
+ * Pretenured objects are remembered until the next minor GC, since they are initialized without barriers.
+ */
+void* gc_alloc_at(TypeV_Core* core, size_t size, uint64_t ip);
+
+/**
+ * Allocates `count` nursery objects at once, object k taking sizes[k] bytes, header included. A collection
+ * can only happen before the first one is allocated, so the objects can be linked to each other afterwards
+ * without being rooted meanwhile. Types are left to the caller.
+ */
+void gc_alloc_group(TypeV_Core* core, const size_t* sizes, size_t count, TypeV_ObjectHeader** objects);
 
 /** Perform a major mark phase */
 void perform_major_mark(TypeV_Core* core);
 
-/** Perform a minor garbage collection */
+/**
+ * Perform a minor garbage collection.
+ * The nursery is collected by copying (Cheney-style): live objects are evacuated breadth-first from
+ * the roots and the remembered set into the to-space (or promoted into the old region), and the to-space
+ * itself serves as the scan queue. Dead objects are never visited, so the cost is proportional to the
+ * amount of live data, not to the nursery size.
+ */
 void perform_minor_gc(TypeV_Core* core);
 
 /** Perform a major garbage collection */
 void perform_major_gc(TypeV_Core* core);
 
+/**
+ * Sets the pause budget of the incremental major GC, in microseconds. With a non-zero budget,
+ * the major mark starts ahead of time and is split into steps of at most `budget_us`, run from
+ * gc_alloc; only the final remark and the compaction stop the mutator for longer.
+ * 0 (the default, unless TYPEV_GC_PAUSE_US is set) keeps major GCs stop-the-world.
+ */
+void gc_set_pause_budget(TypeV_Core* core, uint32_t budget_us);
+
+/**
+ * Called by the engine at safepoints. Runs an incremental mark step if a mark is in progress and a batch of
+ * queued destructors, so that both progress while the core runs without allocating.
+ */
+void gc_safepoint(TypeV_Core* core);
+
 /** Cleanup all GC resources */
 void cleanup_gc(TypeV_Core* core);
 
+/**
+ * Records `old_obj` in the remembered set if it lives in the old region and now points to `new_obj`
+ * in the nursery. The container (not the target) is remembered, so the minor GC can update its fields.
+ * While an incremental mark is in progress, an old `new_obj` stored into an old object is shaded instead.
+ */
 void write_barrier(TypeV_Core* core, TypeV_ObjectHeader* old_obj, TypeV_ObjectHeader* new_obj);
 
+/** Adds an old object to the remembered set, unless it is already there */
+void gc_remember(TypeV_Core* core, TypeV_ObjectHeader* obj);
+
 void add_to_remembered_set(TypeV_Core* core, TypeV_ObjectHeader* obj);
 
+/** Appends an object to a growable object list */
+void gc_object_list_push(TypeV_RememberedSet* list, TypeV_ObjectHeader* obj);
+
+/**
+ * Registers a freshly allocated user object in the finalizable set. Collections only check that set:
+ * once the object is found dead, its destructor is queued, and run later by gc_run_finalizers.
+ */
+void gc_register_user_object(TypeV_Core* core, TypeV_ObjectHeader* obj);
+
+/**
+ * Runs at most `max` queued destructors, oldest first. Allocation drains the queue in batches,
+ * and cleanup_gc runs whatever is left.
+ * @return the number of destructors run
+ */
+size_t gc_run_finalizers(TypeV_Core* core, size_t max);
+
 
 #endif // TYPEV_GC_H
\ No newline at end of file
@@ -0,0 +1,231 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "los.h"
+#include "gc.h"
+#include "mark.h"
+#include "../platform/memory.h"
+
+void gc_los_init(TypeV_GC* gc) {
+    gc->los.count = 0;
+    gc->los.capacity = 0;
+    gc->los.owners = NULL;
+    gc->los.bytes = 0;
+    gc->los.allocated = 0;
+}
+
+/** Records the owner of a new out-of-line payload, arrays are tracked from their first one on */
+static void gc_los_track(TypeV_GC* gc, TypeV_Array* array) {
+    if(array->storage != ARRAY_STORAGE_INLINE) {
+        return;
+    }
+    if(gc->los.count >= gc->los.capacity) {
+        gc->los.capacity = gc->los.capacity ? gc->los.capacity * 2 : GC_LIST_INITIAL_CAPACITY;
+        gc->los.owners = (TypeV_ObjectHeader**)realloc(gc->los.owners, gc->los.capacity * sizeof(TypeV_ObjectHeader*));
+    }
+    gc->los.owners[gc->los.count++] = GET_OBJ_HEADER(array);
+}
+
+void gc_array_storage_release(void* data, size_t bytes, uint8_t storage) {
+    if(storage == ARRAY_STORAGE_LARGE) {
+        typev_pages_free(data, bytes);
+    }
+    else if(storage == ARRAY_STORAGE_SHARED) {
+        gc_shared_buffer_release(gc_shared_buffer_of(data));
+    }
+    else {
+        free(data);
+    }
+}
+
+static void gc_los_release(TypeV_GC* gc, TypeV_Array* array) {
+    gc_array_storage_release(array->data, array->capacity, array->storage);
+    // shared buffers are not counted against any core
+    if(array->storage != ARRAY_STORAGE_SHARED) {
+        gc->los.bytes -= array->capacity;
+    }
+}
+
+void gc_los_free(TypeV_GC* gc) {
+    for(size_t k = 0; k < gc->los.count; k++) {
+        gc_los_release(gc, (TypeV_Array*)(gc->los.owners[k] + 1));
+    }
+    free(gc->los.owners);
+    gc->los.owners = NULL;
+    gc->los.count = 0;
+}
+
+size_t gc_array_inline_capacity(size_t cells) {
+    return cells * CELL_SIZE - sizeof(TypeV_ObjectHeader) - sizeof(TypeV_Array);
+}
+
+uint8_t gc_array_storage_alloc(TypeV_Core* core, TypeV_Array* array, size_t bytes) {
+    TypeV_GC* gc = core->gc;
+    uint8_t* data = NULL;
+    uint8_t storage = ARRAY_STORAGE_HEAP;
+
+    if(bytes >= GC_LARGE_OBJECT_BYTES) {
+        size_t page = typev_page_size();
+        bytes = (bytes + page - 1) & ~(page - 1);
+        data = typev_pages_alloc(bytes);
+        storage = ARRAY_STORAGE_LARGE;
+    }
+    else {
+        data = malloc(bytes ? bytes : 1);
+    }
+
+    if(data == NULL) {
+        return 0;
+    }
+
+    gc_los_track(gc, array);
+
+    array->data = data;
+    array->capacity = bytes;
+    array->storage = storage;
+    gc->los.bytes += bytes;
+    gc->los.allocated += bytes;
+    return 1;
+}
+
+void gc_array_storage_adopt(TypeV_Core* core, TypeV_Array* array, void* buffer, size_t bytes) {
+    gc_array_storage_attach(core, array, buffer, bytes, ARRAY_STORAGE_HEAP);
+}
+
+void gc_array_storage_attach(TypeV_Core* core, TypeV_Array* array, void* buffer, size_t bytes, uint8_t storage) {
+    TypeV_GC* gc = core->gc;
+    gc_los_track(gc, array);
+
+    array->data = buffer;
+    array->capacity = bytes;
+    array->storage = storage;
+    if(storage != ARRAY_STORAGE_SHARED) {
+        gc->los.bytes += bytes;
+        gc->los.allocated += bytes;
+    }
+}
+
+void* gc_array_storage_detach(TypeV_Core* core, TypeV_Array* array, size_t* bytes, uint8_t* storage) {
+    TypeV_GC* gc = core->gc;
+    if(array->storage == ARRAY_STORAGE_INLINE) {
+        return NULL;
+    }
+
+    // arrays are tracked once, from their first out-of-line payload on
+    TypeV_ObjectHeader* owner = GET_OBJ_HEADER(array);
+    for(size_t k = 0; k < gc->los.count; k++) {
+        if(gc->los.owners[k] == owner) {
+            gc->los.owners[k] = gc->los.owners[--gc->los.count];
+            break;
+        }
+    }
+
+    void* data = array->data;
+    *bytes = array->capacity;
+    *storage = array->storage;
+    if(array->storage != ARRAY_STORAGE_SHARED) {
+        gc->los.bytes -= array->capacity;
+    }
+
+    array->storage = ARRAY_STORAGE_INLINE;
+    array->data = (uint8_t*)(array + 1);
+    array->capacity = gc_array_inline_capacity(owner->cells);
+    array->length = 0;
+    return data;
+}
+
+TypeV_SharedBuffer* gc_shared_buffer_new(const void* data, size_t bytes) {
+    TypeV_SharedBuffer* buffer = malloc(sizeof(TypeV_SharedBuffer) + bytes);
+    if(buffer == NULL) {
+        return NULL;
+    }
+    atomic_init(&buffer->refs, 1);
+    buffer->bytes = bytes;
+    memcpy(buffer->data, data, bytes);
+    return buffer;
+}
+
+void gc_shared_buffer_release(TypeV_SharedBuffer* buffer) {
+    if(atomic_fetch_sub_explicit(&buffer->refs, 1, memory_order_acq_rel) == 1) {
+        free(buffer);
+    }
+}
+
+uint8_t gc_array_storage_reserve(TypeV_Core* core, TypeV_Array* array, size_t bytes) {
+    TypeV_GC* gc = core->gc;
+    if(bytes <= array->capacity && array->storage != ARRAY_STORAGE_SHARED) {
+        return 1;
+    }
+
+    // grow by at least half, so appending in a loop copies each byte a bounded number of times
+    size_t grown = array->capacity + array->capacity / 2;
+    if(bytes < grown) {
+        bytes = grown;
+    }
+
+    if(array->storage == ARRAY_STORAGE_HEAP && bytes < GC_LARGE_OBJECT_BYTES) {
+        uint8_t* data = realloc(array->data, bytes);
+        if(data == NULL) {
+            return 0;
+        }
+        gc->los.bytes += bytes - array->capacity;
+        gc->los.allocated += bytes - array->capacity;
+        array->data = data;
+        array->capacity = bytes;
+        return 1;
+    }
+
+    TypeV_Array previous = *array;
+    if(!gc_array_storage_alloc(core, array, bytes)) {
+        return 0;
+    }
+
+    memcpy(array->data, previous.data, previous.length * previous.elementSize);
+    if(previous.storage != ARRAY_STORAGE_INLINE) {
+        gc_los_release(gc, &previous);
+    }
+    return 1;
+}
+
+void gc_los_after_minor(TypeV_Core* core) {
+    TypeV_GC* gc = core->gc;
+    size_t live = 0;
+    for(size_t k = 0; k < gc->los.count; k++) {
+        TypeV_ObjectHeader* obj = gc->los.owners[k];
+        if(obj->location == 1) {
+            gc->los.owners[live++] = obj;
+            continue;
+        }
+
+        TypeV_ObjectHeader* fwd = gc_get_forward(obj);
+        if(fwd == NULL) {
+            gc_los_release(gc, (TypeV_Array*)(obj + 1));
+        }
+        else {
+            gc->los.owners[live++] = fwd;
+        }
+    }
+    gc->los.count = live;
+    gc->los.allocated = 0;
+}
+
+void gc_los_after_major(TypeV_Core* core) {
+    TypeV_GC* gc = core->gc;
+    size_t live = 0;
+    for(size_t k = 0; k < gc->los.count; k++) {
+        TypeV_ObjectHeader* obj = gc->los.owners[k];
+        if(obj->location == 0) {
+            gc->los.owners[live++] = obj;
+        }
+        else if(gc_is_marked(core, obj)) {
+            gc->los.owners[live++] = gc_get_forward(obj);
+        }
+        else {
+            gc_los_release(gc, (TypeV_Array*)(obj + 1));
+        }
+    }
+    gc->los.count = live;
+}
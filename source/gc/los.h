@@ -0,0 +1,117 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+#ifndef TYPE_V_LOS_H
+#define TYPE_V_LOS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+struct TypeV_Core;
+struct TypeV_GC;
+struct TypeV_Array;
+struct TypeV_ObjectHeader;
+
+/**
+ * Array payload storage. Payloads smaller than GC_LARGE_OBJECT_BYTES are allocated inline, right after
+ * the array in the same GC object, and move with it. Larger payloads live out of line, in the large-object
+ * space: each one is a page mapping of its own which never moves, owned by its array and unmapped when the
+ * array is found dead. A small array which outgrows its inline payload also moves it out of line, to the
+ * malloc heap. Either way, out-of-line payloads are released by the sweep of the collection which finds
+ * their owner dead.
+ *
+ * A payload can also be a shared buffer: immutable, outside of every heap, and referenced by arrays of any
+ * number of cores. Each array holds one reference, the buffer is freed along with the last one.
+ */
+
+/** Payloads of at least this many bytes get their own mapping */
+#define GC_LARGE_OBJECT_BYTES (32 * 1024)
+
+typedef enum {
+    ARRAY_STORAGE_INLINE = 0,    // After the array, in the same GC object
+    ARRAY_STORAGE_HEAP,          // malloc'd, owned by the array
+    ARRAY_STORAGE_LARGE,         // Mapping of the large-object space
+    ARRAY_STORAGE_SHARED,        // Shared immutable buffer, see TypeV_SharedBuffer
+} TypeV_ArrayStorage;
+
+typedef struct TypeV_SharedBuffer {
+    _Atomic(uint64_t) refs;      // References held by arrays and messages
+    size_t bytes;
+    _Alignas(16) uint8_t data[];
+} TypeV_SharedBuffer;
+
+typedef struct TypeV_LargeObjectSpace {
+    struct TypeV_ObjectHeader** owners; // Arrays with an out-of-line payload
+    size_t count;
+    size_t capacity;
+    size_t bytes;                // Out-of-line payload bytes currently held
+    size_t allocated;            // Out-of-line bytes allocated since the last minor GC, they count against the nursery limit
+} TypeV_LargeObjectSpace;
+
+void gc_los_init(struct TypeV_GC* gc);
+
+/** Releases every out-of-line payload, dead or alive */
+void gc_los_free(struct TypeV_GC* gc);
+
+/** Bytes an inline payload can use in an array object of `cells` cells */
+size_t gc_array_inline_capacity(size_t cells);
+
+/**
+ * Gives `array` a new out-of-line payload of at least `bytes` bytes, mapped when large, malloc'd otherwise.
+ * The previous payload, if any, is neither copied nor released.
+ * @return 0 if out of memory
+ */
+uint8_t gc_array_storage_alloc(struct TypeV_Core* core, struct TypeV_Array* array, size_t bytes);
+
+/** Makes `array` own `buffer`, a malloc'd payload of `bytes` bytes */
+void gc_array_storage_adopt(struct TypeV_Core* core, struct TypeV_Array* array, void* buffer, size_t bytes);
+
+/**
+ * Makes `array` own `buffer`, an out-of-line payload of `bytes` bytes stored as `storage`, as returned by
+ * gc_array_storage_detach. A shared buffer keeps the reference it came with.
+ */
+void gc_array_storage_attach(struct TypeV_Core* core, struct TypeV_Array* array, void* buffer, size_t bytes, uint8_t storage);
+
+/**
+ * Takes the out-of-line payload away from `array`, which is left with an empty inline payload.
+ * The payload is not released, it belongs to the caller, see gc_array_storage_attach.
+ * @param bytes Set to the payload capacity
+ * @param storage Set to the payload storage
+ * @return the payload, NULL if it was inline
+ */
+void* gc_array_storage_detach(struct TypeV_Core* core, struct TypeV_Array* array, size_t* bytes, uint8_t* storage);
+
+/** Releases an out-of-line payload nobody owns anymore, as returned by gc_array_storage_detach */
+void gc_array_storage_release(void* data, size_t bytes, uint8_t storage);
+
+/** Creates a shared buffer holding a copy of `bytes` bytes of `data`, with one reference */
+TypeV_SharedBuffer* gc_shared_buffer_new(const void* data, size_t bytes);
+
+static inline TypeV_SharedBuffer* gc_shared_buffer_of(void* data) {
+    return (TypeV_SharedBuffer*)((uint8_t*)data - offsetof(TypeV_SharedBuffer, data));
+}
+
+static inline void gc_shared_buffer_retain(TypeV_SharedBuffer* buffer) {
+    atomic_fetch_add_explicit(&buffer->refs, 1, memory_order_relaxed);
+}
+
+/** Drops a reference, the last one frees the buffer */
+void gc_shared_buffer_release(TypeV_SharedBuffer* buffer);
+
+/**
+ * Grows the payload of `array` to at least `bytes` bytes, keeping its content. The payload moves out of line
+ * once it no longer fits, repeated growth is amortized. A shared payload is always copied to a private one,
+ * whatever its capacity. Never triggers a collection.
+ * @return 0 if out of memory
+ */
+uint8_t gc_array_storage_reserve(struct TypeV_Core* core, struct TypeV_Array* array, size_t bytes);
+
+/** Releases the out-of-line payloads of the nursery arrays the minor GC left behind, and follows the survivors */
+void gc_los_after_minor(struct TypeV_Core* core);
+
+/** Releases the out-of-line payloads of the old arrays the major mark did not reach, and follows the moved ones */
+void gc_los_after_major(struct TypeV_Core* core);
+
+#endif //TYPE_V_LOS_H
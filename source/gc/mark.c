@@ -4,357 +4,457 @@
 
 #include "mark.h"
 #include "gc.h"
+#include "workers.h"
+#include "../platform/threads.h"
 #include <string.h>
 #include <assert.h>
-
-#ifdef _MSC_VER
-#include <intrin.h>
-#pragma intrinsic(_BitScanForward64)
-
-static inline uint32_t count_trailing_zeros_64(uint64_t value) {
-    unsigned long index;
-    if (_BitScanForward64(&index, value)) {
-        return (uint32_t)index;
-    } else {
-        // If value is 0, behavior is undefined for __builtin_ctzll
-        return 64; // All bits are zero
+#include <stdatomic.h>
+
+
+/**
+ * Locates the mark bit of an object.
+ * @param cell set to the index of the object's first cell within its region
+ * @return the mark bitmap of the region holding the object, NULL if the object is not in a collected region
+ */
+static inline uint64_t* gc_mark_bit(TypeV_GC* gc, TypeV_ObjectHeader* obj, size_t* cell) {
+    uint8_t* ptr = (uint8_t*)obj;
+    if(ptr >= gc->oldRegion.from && ptr < gc->oldRegion.to) {
+        *cell = (ptr - gc->oldRegion.from) / CELL_SIZE;
+        return gc->oldRegion.active_bitmap;
     }
+    if(ptr >= gc->nursery.from && ptr < gc->nursery.from + gc->nursery.cell_size * CELL_SIZE) {
+        *cell = (ptr - gc->nursery.from) / CELL_SIZE;
+        return gc->nursery.active_bitmap;
+    }
+    return NULL;
 }
-#else
-// GCC and Clang support __builtin_ctzll
-static inline uint32_t count_trailing_zeros_64(uint64_t value) {
-    return __builtin_ctzll(value);
-}
-#endif
 
-static inline void fast_copy(void* dest, void* src) {
-    assert(((uintptr_t)src % alignof(uint64_t)) == 0 && "Source pointer is not 8-byte aligned!");
-    assert(((uintptr_t)dest % alignof(uint64_t)) == 0 && "Destination pointer is not 8-byte aligned!");
+static uint8_t mark_slot(void* ctx, void* slot) {
+    TypeV_GC* gc = (TypeV_GC*)ctx;
+    uintptr_t ref;
+    memcpy(&ref, slot, sizeof(uintptr_t));
+    if(!ref) {
+        return 0;
+    }
+
+    TypeV_ObjectHeader* obj = GET_OBJ_HEADER(ref);
+    size_t cell;
+    uint64_t* bitmap = gc_mark_bit(gc, obj, &cell);
+    if(bitmap == NULL || GET_ACTIVE(bitmap, cell)) {
+        return 0;
+    }
 
-    *(uint64_t *)dest = *(const uint64_t *)src;
+    SET_ACTIVE(bitmap, cell);
+    if(bitmap == gc->oldRegion.active_bitmap) {
+        gc->markedOldCells += obj->cells;
+    }
+    gc_object_list_push(&gc->markStack, obj);
+    return 0;
 }
 
-void perform_minor_mark(TypeV_Core* core) {
-    TypeV_GC* gc = core->gc;
-    gc_log("perform_minor_mark: Starting minor mark phase");
+/* ======================= PARALLEL MARK ======================= */
+
+typedef struct TypeV_ParallelMark {
+    TypeV_Core* core;
+    uint32_t workers;            // Number of deques, at least the number of workers running the job
+    TypeV_MarkDeque deques[GC_MAX_WORKERS];
+    _Atomic uint32_t idle;       // Workers which ran out of work, for termination
+    _Atomic size_t markedOldCells; // Sum of the old cells marked by every worker
+    TypeV_FuncState** frames;    // Root frames, split between the workers
+    size_t frameCount;
+} TypeV_ParallelMark;
+
+typedef struct TypeV_MarkWorker {
+    TypeV_ParallelMark* mark;
+    TypeV_MarkDeque* deque;
+    size_t markedOldCells;       // Old cells marked by this worker
+} TypeV_MarkWorker;
+
+/**
+ * Same as mark_slot, but the mark bit is claimed atomically so that
+ * exactly one worker pushes each object.
+ */
+static uint8_t parallel_mark_slot(void* ctx, void* slot) {
+    TypeV_MarkWorker* w = (TypeV_MarkWorker*)ctx;
+    uintptr_t ref;
+    memcpy(&ref, slot, sizeof(uintptr_t));
+    if(!ref) {
+        return 0;
+    }
 
-    mark_state(core, core->funcState);
+    TypeV_ObjectHeader* obj = GET_OBJ_HEADER(ref);
+    size_t cell;
+    TypeV_GC* gc = w->mark->core->gc;
+    uint64_t* bitmap = gc_mark_bit(gc, obj, &cell);
+    if(bitmap == NULL) {
+        return 0;
+    }
 
-    // mark the remembered set
-    for (size_t i = 0; i < gc->rs.size; i++) {
-        mark_object(core, gc->rs.set[i]);
+    uint64_t bit = 1ULL << (cell % 64);
+    _Atomic uint64_t* word = (_Atomic uint64_t*)&bitmap[cell / 64];
+    if(atomic_load_explicit(word, memory_order_relaxed) & bit) {
+        return 0;
+    }
+    if(atomic_fetch_or_explicit(word, bit, memory_order_relaxed) & bit) {
+        return 0;
     }
 
-    gc_log("perform_minor_mark: Completed minor mark phase");
+    if(bitmap == gc->oldRegion.active_bitmap) {
+        w->markedOldCells += obj->cells;
+    }
+    gc_deque_push(w->deque, obj);
+    return 0;
 }
 
-void perform_major_mark(TypeV_Core* core) {
-    gc_log("perform_minor_mark: Starting minor mark phase");
-    mark_state(core, core->funcState);
+/** Takes from the worker's own deque first, then tries to steal from the others */
+static TypeV_ObjectHeader* parallel_mark_next(TypeV_ParallelMark* mark, uint32_t worker, uint32_t workers) {
+    TypeV_ObjectHeader* obj = gc_deque_take(&mark->deques[worker]);
+    if(obj != NULL) {
+        return obj;
+    }
+
+    for(uint32_t i = 1; i < workers; i++) {
+        obj = gc_deque_steal(&mark->deques[(worker + i) % workers]);
+        if(obj != NULL) {
+            return obj;
+        }
+    }
+
+    return NULL;
 }
 
-void mark_object(TypeV_Core* core, TypeV_ObjectHeader* obj) {
-    if(!obj || (obj->color != WHITE && obj->color != NOTSU)) {
-        return;
+static uint8_t parallel_mark_has_work(TypeV_ParallelMark* mark, uint32_t workers) {
+    for(uint32_t i = 0; i < workers; i++) {
+        if(!gc_deque_is_empty(&mark->deques[i])) {
+            return 1;
+        }
     }
+    return 0;
+}
 
-    obj->color = GRAY;
+static void parallel_mark_job(uint32_t worker, uint32_t workers, void* ctx) {
+    TypeV_ParallelMark* mark = (TypeV_ParallelMark*)ctx;
+    TypeV_MarkWorker w = {mark, &mark->deques[worker], 0};
 
-    // If the object is a struct, mark its fields
-    switch (obj->type) {
-        case OT_STRUCT: {
-            TypeV_Struct* struct_ptr = (TypeV_Struct*)(obj + 1);
-
-            for (size_t i = 0; i < struct_ptr->numFields; i++) {
-                // Determine which byte and which bit correspond to the current field index `i`
-                size_t byteIndex = i / 8;       // Which byte contains the bit for the field at index `i`
-                uint8_t bitOffset = i % 8;      // Which bit within that byte corresponds to field `i`
-
-                // Check if the bit corresponding to field `i` is set
-                if (struct_ptr->pointerBitmask[byteIndex] & (1 << bitOffset)) {
-                    uintptr_t field;
-                    fast_copy(&field, struct_ptr->data + struct_ptr->fieldOffsets[i]);
-                    if(field) {
-                        TypeV_ObjectHeader* dest = GET_OBJ_HEADER(field);
-                        mark_object(core, dest);
-                    }
-                }
+    // each worker scans its share of the frames
+    for(size_t i = worker; i < mark->frameCount; i += workers) {
+        TypeV_FuncState* state = mark->frames[i];
+        for(uint32_t r = 0; r < MAX_REG; r++) {
+            if(IS_REG_PTR(state, r)) {
+                parallel_mark_slot(&w, &state->regs[r].ptr);
             }
-
-            break;
         }
+    }
+    if(worker == 0) {
+        parallel_mark_slot(&w, &mark->core->activeCoroutine);
+    }
 
-        case OT_CLASS: {
-            TypeV_Class *class_ptr = (TypeV_Class *) (obj + 1);
-            for (size_t i = 0; i < class_ptr->numFields; i++) {
-                // Determine which byte and which bit correspond to the current field index `i`
-                size_t byteIndex = i / 8;       // Which byte contains the bit for the field at index `i`
-                uint8_t bitOffset = i % 8;      // Which bit within that byte corresponds to field `i`
-
-                // Check if the bit corresponding to field `i` is set
-                if (class_ptr->pointerBitmask[byteIndex] & (1 << bitOffset)) {
-                    uintptr_t field;
-                    fast_copy(&field, class_ptr->data + class_ptr->fieldOffsets[i]);
-
-                    if(field) {
-                        TypeV_ObjectHeader* dest = GET_OBJ_HEADER(field);
-                        mark_object(core, dest);
-                    }
-                }
-            }
-            break;
+    while(1) {
+        TypeV_ObjectHeader* obj;
+        while((obj = parallel_mark_next(mark, worker, workers)) != NULL) {
+            gc_visit_object_slots(obj, parallel_mark_slot, &w);
         }
-        case OT_ARRAY: {
-            TypeV_Array *array_ptr = (TypeV_Array *) (obj + 1);
-            if (array_ptr->isPointerContainer) {
-                for (size_t i = 0; i < array_ptr->length; i++) {
-                    uintptr_t field;
-                    fast_copy(&field, array_ptr->data + i * array_ptr->elementSize);
-
-                    if(field != 0) {
-                        TypeV_ObjectHeader *dest = GET_OBJ_HEADER(field);
-                        mark_object(core, dest);
-                    }
-                }
+
+        // out of work, done once every worker is idle, idle workers never push
+        atomic_fetch_add(&mark->idle, 1);
+        while(1) {
+            if(parallel_mark_has_work(mark, workers)) {
+                atomic_fetch_sub(&mark->idle, 1);
+                break;
             }
-            break;
-        }
-        case OT_CLOSURE: {
-            TypeV_Closure* closure_ptr = (TypeV_Closure*)(obj + 1);
-            for(size_t i = 0; i < closure_ptr->envSize; i++) {
-                if(IS_CLOSURE_UPVALUE_POINTER(closure_ptr->ptrFields, i)) {
-                    uintptr_t field = closure_ptr->upvalues[i].ptr;
-
-                    if(field) {
-                        TypeV_ObjectHeader* dest = GET_OBJ_HEADER(field);
-                        mark_object(core, dest);
-                    }
-                }
+            if(atomic_load(&mark->idle) == workers) {
+                atomic_fetch_add(&mark->markedOldCells, w.markedOldCells);
+                return;
             }
-            break;
-        }
-        case OT_COROUTINE: {
-            TypeV_Coroutine* coroutine_ptr = (TypeV_Coroutine*)(obj + 1);
-            mark_object(core, GET_OBJ_HEADER(coroutine_ptr->closure));
-            gc_update_state(core, coroutine_ptr->state);
-            break;
-        }
-        case OT_USER_OBJECT: {
-            break;
+            typev_thread_yield();
         }
     }
-
-    obj->color = BLACK;
 }
 
-
-void mark_state(TypeV_Core* core, TypeV_FuncState* state) {
-    for (uint32_t i = 0; i < MAX_REG; i++) {
-        if(IS_REG_PTR(state, i) && state->regs[i].ptr) {
-            TypeV_ObjectHeader* obj = GET_OBJ_HEADER(state->regs[i].ptr);
-            mark_object(core, obj);
-        }
+/**
+ * Marks from the roots with at most `workers` workers of the GC worker pool.
+ * @return 0 if the pool could not be used, in which case nothing was marked
+ */
+static uint8_t perform_parallel_mark(TypeV_Core* core, uint32_t workers) {
+    TypeV_ParallelMark* mark = malloc(sizeof(TypeV_ParallelMark));
+    mark->core = core;
+    mark->workers = workers;
+
+    mark->frameCount = 0;
+    for(TypeV_FuncState* state = core->funcState; state != NULL; state = state->prev) {
+        mark->frameCount++;
+    }
+    mark->frames = malloc((mark->frameCount + 1) * sizeof(TypeV_FuncState*));
+    size_t i = 0;
+    for(TypeV_FuncState* state = core->funcState; state != NULL; state = state->prev) {
+        mark->frames[i++] = state;
     }
 
-    // Recursively mark previous state if it exists
-    if (state->prev != NULL) {
-        mark_state(core, state->prev);
+    for(uint32_t w = 0; w < workers; w++) {
+        gc_deque_init(&mark->deques[w]);
     }
-}
+    atomic_init(&mark->idle, 0);
+    atomic_init(&mark->markedOldCells, 0);
 
-void update_root_references(TypeV_Core* core) {
-    gc_log("update_root_references: Updating root object references");
-    gc_update_state(core, core->funcState);
-    gc_log("update_root_references: Completed updating references");
-}
+    uint32_t ran = gc_workers_run(parallel_mark_job, mark, workers);
+    core->gc->markedOldCells += atomic_load(&mark->markedOldCells);
 
-void gc_update_single_state(TypeV_Core* core, TypeV_FuncState* state) {
-    for(uint32_t i = 0; i < MAX_REG; i++) {
-        if(IS_REG_PTR(state, i) && state->regs[i].ptr) {
-            // Now, we know reg_index holds a pointer
-            uintptr_t ptr = state->regs[i].ptr;
-            if(ptr) {
-                TypeV_ObjectHeader* obj = GET_OBJ_HEADER(ptr);
-                state->regs[i].ptr = (uintptr_t)update_object_reference(core, obj);
-            }
-        }
+    for(uint32_t w = 0; w < workers; w++) {
+        gc_deque_free(&mark->deques[w]);
     }
+    free(mark->frames);
+    free(mark);
+
+    return ran != 0;
 }
 
+void perform_major_mark(TypeV_Core* core) {
+    TypeV_GC* gc = core->gc;
+    gc_log("perform_major_mark: Starting major mark phase");
 
-void gc_update_state(TypeV_Core* core, TypeV_FuncState* state) {
-    for(uint32_t i = 0; i < MAX_REG; i++) {
-        if(IS_REG_PTR(state, i) && state->regs[i].ptr) {
-            // Now, we know reg_index holds a pointer
-            uintptr_t ptr = state->regs[i].ptr;
-            if(ptr) {
-                TypeV_ObjectHeader* obj = GET_OBJ_HEADER(ptr);
-                state->regs[i].ptr = (uintptr_t)update_object_reference(core, obj);
-            }
-        }
+    memset(gc->oldRegion.active_bitmap, 0, BITMAP_WORDS(OLD_REGION_CELLS(gc)) * sizeof(uint64_t));
+    memset(gc->nursery.active_bitmap, 0, BITMAP_WORDS(gc->nursery.cell_size) * sizeof(uint64_t));
+    gc->markedOldCells = 0;
+
+    uint32_t workers = gc_workers_get_count();
+    if(workers > 1 && gc->oldRegion.cell_size >= GC_PARALLEL_MARK_MIN_CELLS && perform_parallel_mark(core, workers)) {
+        gc_log("perform_major_mark: Completed parallel major mark phase, %u workers", workers);
+        return;
     }
 
-    // If previous state exists, recursively update it
-    if (state->prev != NULL) {
-        gc_update_state(core, state->prev);
+    gc_visit_state_slots(core->funcState, mark_slot, gc);
+    mark_slot(gc, &core->activeCoroutine);
+
+    while(gc->markStack.size > 0) {
+        TypeV_ObjectHeader* obj = gc->markStack.set[--gc->markStack.size];
+        gc_visit_object_slots(obj, mark_slot, gc);
     }
+
+    gc_log("perform_major_mark: Completed major mark phase");
 }
 
-void* update_object_reference(TypeV_Core* core, TypeV_ObjectHeader* obj) {
-    // printf("Checking for object updates %p\n", header);
-    if (!obj) {
-        return NULL;  // Already marked, or null
+/* ======================= INCREMENTAL MARK ======================= */
+
+typedef struct TypeV_IncrementalMarker {
+    TypeV_GC* gc;
+    size_t slots;                // Slots visited so far, used to pace the deadline checks
+} TypeV_IncrementalMarker;
+
+/**
+ * Marks old objects only, nursery targets are skipped since the nursery moves
+ * at every minor GC. They are traced by gc_incremental_mark_finish instead.
+ */
+static uint8_t incremental_mark_slot(void* ctx, void* slot) {
+    TypeV_IncrementalMarker* m = (TypeV_IncrementalMarker*)ctx;
+    TypeV_GC* gc = m->gc;
+    m->slots++;
+
+    uintptr_t ref;
+    memcpy(&ref, slot, sizeof(uintptr_t));
+    if(!ref) {
+        return 0;
     }
 
-    if(obj->color == NOTSU) {
-        return obj->fwd ? (obj->fwd+1) : (obj+1);
+    uint8_t* obj = (uint8_t*)GET_OBJ_HEADER(ref);
+    if(obj < gc->oldRegion.from || obj >= gc->oldRegion.to) {
+        return 0;
     }
 
-    obj->color = NOTSU;
-    TypeV_ObjectHeader * old_obj = obj;
-    if(obj->fwd) {
-        obj = obj->fwd;
+    size_t cell = (obj - gc->oldRegion.from) / CELL_SIZE;
+    if(!GET_ACTIVE(gc->oldRegion.active_bitmap, cell)) {
+        SET_ACTIVE(gc->oldRegion.active_bitmap, cell);
+        gc->markedOldCells += ((TypeV_ObjectHeader*)obj)->cells;
+        gc_object_list_push(&gc->markStack, (TypeV_ObjectHeader*)obj);
     }
+    return 0;
+}
 
-    // If the object is a struct, mark its fields
-    switch (obj->type) {
-        case OT_STRUCT: {
-            TypeV_Struct* struct_ptr = (TypeV_Struct*)(obj + 1);
-            core_struct_recompute_pointers(struct_ptr);
-
-            // Note: The order and size calculation should match exactly what was done during the initial allocation.
-
-            for (size_t i = 0; i < struct_ptr->numFields; i++) {
-                // Determine which byte and which bit correspond to the current field index `i`
-                size_t byteIndex = i / 8;       // Which byte contains the bit for the field at index `i`
-                uint8_t bitOffset = i % 8;      // Which bit within that byte corresponds to field `i`
-
-                // Check if the bit corresponding to field `i` is set
-                if (struct_ptr->pointerBitmask[byteIndex] & (1 << bitOffset)) {
-                    // struct fields needs to be updated
-
-                    uintptr_t fieldPtr;
-                    fast_copy(&fieldPtr, struct_ptr->data + struct_ptr->fieldOffsets[i]);
-                    if(fieldPtr) {
-                        TypeV_ObjectHeader* fieldHeader = (TypeV_ObjectHeader*)(fieldPtr - sizeof(TypeV_ObjectHeader));
-                        void* res = update_object_reference(core, fieldHeader);
-                        if (res) {
-                            fast_copy(struct_ptr->data + struct_ptr->fieldOffsets[i], &res);
-
-                            // if the field is in a nursery and the object is in the old region, add it to the remembered set
-                            TypeV_ObjectHeader* head = GET_OBJ_HEADER(res);
-                            if(obj->location > head->location) {
-                                add_to_remembered_set(core, head);
-                            }
-                        }
-                    }
-                }
-            }
+void gc_incremental_mark_begin(TypeV_Core* core) {
+    TypeV_GC* gc = core->gc;
+    gc_log("gc_incremental_mark_begin: Starting incremental major mark");
 
-            break;
-        }
+    memset(gc->oldRegion.active_bitmap, 0, BITMAP_WORDS(OLD_REGION_CELLS(gc)) * sizeof(uint64_t));
+    gc->markStack.size = 0;
+    gc->markedOldCells = 0;
 
-        case OT_CLASS: {
-            TypeV_Class *class_ptr = (TypeV_Class *) (obj + 1);
-            core_class_recompute_pointers(class_ptr);
-
-            for (size_t i = 0; i < class_ptr->numFields; i++) {
-                // Determine which byte and which bit correspond to the current field index `i`
-                size_t byteIndex = i / 8;       // Which byte contains the bit for the field at index `i`
-                uint8_t bitOffset = i % 8;      // Which bit within that byte corresponds to field `i`
-
-                // Check if the bit corresponding to field `i` is set
-                if (class_ptr->pointerBitmask[byteIndex] & (1 << bitOffset)) {
-                    uintptr_t fieldPtr;
-                    fast_copy(&fieldPtr, class_ptr->data + class_ptr->fieldOffsets[i]);
-                    if(fieldPtr) {
-                        TypeV_ObjectHeader* fieldHeader = (TypeV_ObjectHeader*)(fieldPtr - sizeof(TypeV_ObjectHeader));
-                        void* res = update_object_reference(core, fieldHeader);
-                        if (res) {
-                            fast_copy(class_ptr->data + class_ptr->fieldOffsets[i], &res);
-
-                            // if the field is in a nursery and the object is in the old region, add it to the remembered set
-                            TypeV_ObjectHeader* head = GET_OBJ_HEADER(res);
-                            if(obj->location > head->location) {
-                                add_to_remembered_set(core, head);
-                            }
-                        }
-                    }
-                }
-            }
-            break;
-        }
-        case OT_ARRAY: {
-            TypeV_Array *array_ptr = (TypeV_Array *) (obj + 1);
-            if (array_ptr->isPointerContainer) {
-                for (size_t i = 0; i < array_ptr->length; i++) {
-                    uintptr_t fieldPtr;
-                    fast_copy(&fieldPtr, array_ptr->data + i * array_ptr->elementSize);
-
-                    if(fieldPtr) {
-                        TypeV_ObjectHeader *fieldHeader =(TypeV_ObjectHeader *) (fieldPtr - sizeof(TypeV_ObjectHeader));
-                        uintptr_t res = (uintptr_t) update_object_reference(core, fieldHeader);
-                        if (res) {
-                            fast_copy(array_ptr->data + i * array_ptr->elementSize, &res);
-
-                            // if the field is in a nursery and the object is in the old region, add it to the remembered set
-                            TypeV_ObjectHeader* head = GET_OBJ_HEADER(res);
-                            if(obj->location > head->location) {
-                                add_to_remembered_set(core, head);
-                            }
-                        }
-                    }
-                }
+    TypeV_IncrementalMarker m = {gc, 0};
+    gc_visit_state_slots(core->funcState, incremental_mark_slot, &m);
+    incremental_mark_slot(&m, &core->activeCoroutine);
+}
+
+uint8_t gc_incremental_mark_step(TypeV_Core* core, uint64_t deadline_ns) {
+    TypeV_GC* gc = core->gc;
+    TypeV_IncrementalMarker m = {gc, 0};
+    size_t next_check = GC_INCREMENTAL_CLOCK_INTERVAL;
+
+    while(gc->markStack.size > 0) {
+        TypeV_ObjectHeader* obj = gc->markStack.set[--gc->markStack.size];
+        gc_visit_object_slots(obj, incremental_mark_slot, &m);
+
+        // reading the clock is not free, only check it every few slots
+        if(m.slots >= next_check) {
+            if(typev_now_ns() >= deadline_ns) {
+                return 0;
             }
-            break;
+            next_check = m.slots + GC_INCREMENTAL_CLOCK_INTERVAL;
         }
-        case OT_CLOSURE: {
-            TypeV_Closure* closure_ptr = (TypeV_Closure*)(obj + 1);
-            core_closure_recompute_pointers(closure_ptr);
-
-            for(size_t i = 0; i < closure_ptr->envSize; i++) {
-                if(IS_CLOSURE_UPVALUE_POINTER(closure_ptr->ptrFields, i)) {
-                    uintptr_t upvaluePtr = closure_ptr->upvalues[i].ptr;
-                    if(upvaluePtr) {
-                        TypeV_ObjectHeader *upvalueHeader = (TypeV_ObjectHeader *) (upvaluePtr -
-                                                                                    sizeof(TypeV_ObjectHeader));
-                        void *res = update_object_reference(core, upvalueHeader);
-                        if (res) {
-                            closure_ptr->upvalues[i].ptr = (uintptr_t)res;
-                            // if the field is in a nursery and the object is in the old region, add it to the remembered set
-                            TypeV_ObjectHeader* head = GET_OBJ_HEADER(res);
-                            if(obj->location > head->location) {
-                                add_to_remembered_set(core, head);
-                            }
-                        }
-                    }
-                }
-            }
-            break;
+    }
+
+    return 1;
+}
+
+void gc_incremental_mark_finish(TypeV_Core* core) {
+    TypeV_GC* gc = core->gc;
+    gc_log("gc_incremental_mark_finish: Completing incremental major mark");
+
+    memset(gc->nursery.active_bitmap, 0, BITMAP_WORDS(gc->nursery.cell_size) * sizeof(uint64_t));
+
+    // registers are written without a barrier, the roots are marked again
+    gc_visit_state_slots(core->funcState, mark_slot, gc);
+    mark_slot(gc, &core->activeCoroutine);
+
+    // the young slots of old objects were skipped so far, every old object holding one is remembered.
+    // unmarked entries are skipped, they are scanned by the drain below if they turn out to be live.
+    for(size_t k = 0; k < gc->rs.size; k++) {
+        if(gc_is_marked(core, gc->rs.set[k])) {
+            gc_visit_object_slots(gc->rs.set[k], mark_slot, gc);
         }
-        case OT_COROUTINE: {
-            TypeV_Coroutine* coroutine_ptr = (TypeV_Coroutine*)(obj + 1);
-            TypeV_ObjectHeader* closureHeader = (TypeV_ObjectHeader*)(coroutine_ptr->closure - sizeof(TypeV_ObjectHeader));
+    }
 
-            coroutine_ptr->closure = update_object_reference(core, closureHeader);
-            gc_update_single_state(core, coroutine_ptr->state);
-            break;
+    while(gc->markStack.size > 0) {
+        TypeV_ObjectHeader* obj = gc->markStack.set[--gc->markStack.size];
+        gc_visit_object_slots(obj, mark_slot, gc);
+    }
+
+    gc_log("gc_incremental_mark_finish: Completed major mark phase");
+}
+
+void gc_mark_shade(TypeV_Core* core, TypeV_ObjectHeader* obj) {
+    TypeV_GC* gc = core->gc;
+    size_t cell;
+    uint64_t* bitmap = gc_mark_bit(gc, obj, &cell);
+    if(bitmap != NULL && !GET_ACTIVE(bitmap, cell)) {
+        SET_ACTIVE(bitmap, cell);
+        if(bitmap == gc->oldRegion.active_bitmap) {
+            gc->markedOldCells += obj->cells;
         }
-        case OT_USER_OBJECT: {
-            break;
+        gc_object_list_push(&gc->markStack, obj);
+    }
+}
+
+void gc_mark_rescan(TypeV_Core* core, TypeV_ObjectHeader* obj) {
+    TypeV_GC* gc = core->gc;
+    size_t cell;
+    uint64_t* bitmap = gc_mark_bit(gc, obj, &cell);
+    if(bitmap != NULL) {
+        if(bitmap == gc->oldRegion.active_bitmap && !GET_ACTIVE(bitmap, cell)) {
+            gc->markedOldCells += obj->cells;
         }
+        SET_ACTIVE(bitmap, cell);
+        gc_object_list_push(&gc->markStack, obj);
     }
+}
 
-    return obj+1;
+uint8_t gc_is_marked(TypeV_Core* core, TypeV_ObjectHeader* obj) {
+    size_t cell;
+    uint64_t* bitmap = gc_mark_bit(core->gc, obj, &cell);
+    return bitmap != NULL && GET_ACTIVE(bitmap, cell);
 }
 
+typedef struct TypeV_ReferenceUpdater {
+    uint8_t* moved_from;         // Bounds of the pre-compaction old region
+    uint8_t* moved_to;
+    uint8_t* nursery_from;       // Bounds of the nursery from-space
+    uint8_t* nursery_to;
+} TypeV_ReferenceUpdater;
+
+/**
+ * Redirects a slot pointing into the moved range to the new location of its target.
+ * @return 1 if the slot points into the nursery
+ */
+static uint8_t update_slot(void* ctx, void* slot) {
+    TypeV_ReferenceUpdater* u = (TypeV_ReferenceUpdater*)ctx;
+    uintptr_t ref;
+    memcpy(&ref, slot, sizeof(uintptr_t));
+    if(!ref) {
+        return 0;
+    }
 
+    uint8_t* obj = (uint8_t*)GET_OBJ_HEADER(ref);
+    if(obj >= u->moved_from && obj < u->moved_to) {
+        // every live object in the moved range has been forwarded during compaction
+        ref = (uintptr_t)(gc_get_forward((TypeV_ObjectHeader*)obj) + 1);
+        memcpy(slot, &ref, sizeof(uintptr_t));
+        return 0;
+    }
 
+    return obj >= u->nursery_from && obj < u->nursery_to;
+}
 
+void update_root_references(TypeV_Core* core, uint8_t* moved_from, uint8_t* moved_to) {
+    TypeV_GC* gc = core->gc;
+    gc_log("update_root_references: Updating root object references");
 
+    TypeV_ReferenceUpdater u;
+    u.moved_from = moved_from;
+    u.moved_to = moved_to;
+    u.nursery_from = gc->nursery.from;
+    u.nursery_to = gc->nursery.from + gc->nursery.cell_size * CELL_SIZE;
+
+    gc_visit_state_slots(core->funcState, update_slot, &u);
+    update_slot(&u, &core->activeCoroutine);
+
+    // the compacted old region only holds live objects, walk it linearly and rebuild the remembered set
+    uint8_t* ptr = gc->oldRegion.direction == 1 ? gc->oldRegion.from : gc->oldRegion.to - gc->oldRegion.cell_size * CELL_SIZE;
+    uint8_t* end = ptr + gc->oldRegion.cell_size * CELL_SIZE;
+    while(ptr < end) {
+        TypeV_ObjectHeader* obj = (TypeV_ObjectHeader*)ptr;
+        uint8_t young = gc_visit_object_slots(obj, update_slot, &u);
+        // coroutine registers are written without a barrier, keep old coroutines remembered
+        if(young || obj->type == OT_COROUTINE) {
+            gc_remember(core, obj);
+        }
+        ptr += GC_OBJ_BYTES(obj);
+    }
 
+    // nursery objects found live by the mark phase
+    uint64_t* bitmap = gc->nursery.active_bitmap;
+    size_t words = BITMAP_WORDS(gc->nursery.cell_size);
+    for(size_t w = 0; w < words; w++) {
+        uint64_t bits = bitmap[w];
+        while(bits) {
+            size_t cell = w * 64 + count_trailing_zeros_64(bits);
+            bits &= bits - 1;
+            gc_visit_object_slots((TypeV_ObjectHeader*)(gc->nursery.from + cell * CELL_SIZE), update_slot, &u);
+        }
+    }
 
+    gc_log("update_root_references: Completed updating references");
+}
 
+void gc_recompute_pointers(TypeV_ObjectHeader* obj) {
+    switch (obj->type) {
+        case OT_STRUCT:
+            core_struct_recompute_pointers((TypeV_Struct*)(obj + 1));
+            break;
+        case OT_CLASS:
+            core_class_recompute_pointers((TypeV_Class*)(obj + 1));
+            break;
+        case OT_CLOSURE:
+            core_closure_recompute_pointers((TypeV_Closure*)(obj + 1));
+            break;
+        case OT_ARRAY: {
+            // inline payloads move with the array, out-of-line ones stay where they are
+            TypeV_Array* array_ptr = (TypeV_Array*)(obj + 1);
+            if(array_ptr->storage == ARRAY_STORAGE_INLINE) {
+                array_ptr->data = (uint8_t*)(array_ptr + 1);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
 
 void core_struct_recompute_pointers(TypeV_Struct* struct_ptr) {
     size_t bitmaskSize = (struct_ptr->numFields + 7) / 8;
@@ -9,27 +9,139 @@
 
 #define GET_OBJ_HEADER(obj) ((TypeV_ObjectHeader *)((uint8_t *)(obj) - sizeof(TypeV_ObjectHeader)))
 
+/**
+ * Callback invoked for every pointer slot of an object, the slot may be unaligned.
+ * @return a flag which is OR-ed into the result of gc_visit_object_slots
+ */
+typedef uint8_t (*TypeV_SlotVisitor)(void* ctx, void* slot);
+
+/**
+ * Visits every pointer slot of an object, using the per-type pointer bitmaps.
+ * For coroutines, the closure and the pointer registers of the saved state are visited.
+ * @return OR of all the visitor results
+ */
+static inline uint8_t gc_visit_object_slots(TypeV_ObjectHeader* obj, TypeV_SlotVisitor visit, void* ctx) {
+    uint8_t res = 0;
+    switch (obj->type) {
+        case OT_STRUCT: {
+            TypeV_Struct* struct_ptr = (TypeV_Struct*)(obj + 1);
+            for (size_t i = 0; i < struct_ptr->numFields; i++) {
+                if (struct_ptr->pointerBitmask[i / 8] & (1 << (i % 8))) {
+                    res |= visit(ctx, struct_ptr->data + struct_ptr->fieldOffsets[i]);
+                }
+            }
+            break;
+        }
+        case OT_CLASS: {
+            TypeV_Class* class_ptr = (TypeV_Class*)(obj + 1);
+            for (size_t i = 0; i < class_ptr->numFields; i++) {
+                if (class_ptr->pointerBitmask[i / 8] & (1 << (i % 8))) {
+                    res |= visit(ctx, class_ptr->data + class_ptr->fieldOffsets[i]);
+                }
+            }
+            break;
+        }
+        case OT_ARRAY: {
+            TypeV_Array* array_ptr = (TypeV_Array*)(obj + 1);
+            if (array_ptr->isPointerContainer) {
+                for (size_t i = 0; i < array_ptr->length; i++) {
+                    res |= visit(ctx, array_ptr->data + i * array_ptr->elementSize);
+                }
+            }
+            break;
+        }
+        case OT_CLOSURE: {
+            TypeV_Closure* closure_ptr = (TypeV_Closure*)(obj + 1);
+            for(size_t i = 0; i < closure_ptr->envSize; i++) {
+                if(IS_CLOSURE_UPVALUE_POINTER(closure_ptr->ptrFields, i)) {
+                    res |= visit(ctx, &closure_ptr->upvalues[i].ptr);
+                }
+            }
+            break;
+        }
+        case OT_COROUTINE: {
+            TypeV_Coroutine* coroutine_ptr = (TypeV_Coroutine*)(obj + 1);
+            res |= visit(ctx, &coroutine_ptr->closure);
+            for(uint32_t i = 0; i < MAX_REG; i++) {
+                if(IS_REG_PTR(coroutine_ptr->state, i)) {
+                    res |= visit(ctx, &coroutine_ptr->state->regs[i].ptr);
+                }
+            }
+            break;
+        }
+        case OT_USER_OBJECT: {
+            break;
+        }
+    }
+
+    return res;
+}
+
+/**
+ * Visits the pointer registers of a function state and all of its callers.
+ */
+static inline void gc_visit_state_slots(TypeV_FuncState* state, TypeV_SlotVisitor visit, void* ctx) {
+    for(; state != NULL; state = state->prev) {
+        for(uint32_t i = 0; i < MAX_REG; i++) {
+            if(IS_REG_PTR(state, i)) {
+                visit(ctx, &state->regs[i].ptr);
+            }
+        }
+    }
+}
+
 /** Marking **/
-void perform_minor_mark(TypeV_Core* core);
+
+/**
+ * Marks every object reachable from the roots, in the mark bitmaps of the old region
+ * and the nursery. Marking uses an explicit stack, headers are not written.
+ */
 void perform_major_mark(TypeV_Core* core);
-void mark_object(TypeV_Core* core, TypeV_ObjectHeader* obj);
-void mark_state(TypeV_Core* core, TypeV_FuncState* state);
+
+/**
+ * Incremental marking, see gc_set_pause_budget.
+ * Steps only mark the old region and run between mutator instructions, a Dijkstra-style barrier
+ * in write_barrier shades every old object stored into an old object meanwhile. Objects promoted
+ * during the mark are shaded too. The nursery is traced, and the roots and remembered set scanned
+ * again, by a final stop-the-world step before compaction.
+ */
+
+/** Clears the old mark bitmap and shades the old objects referenced by the roots */
+void gc_incremental_mark_begin(TypeV_Core* core);
+
+/**
+ * Marks from the mark stack until it is empty or until `deadline_ns` (see typev_now_ns) is reached.
+ * @return 1 once the mark stack is empty
+ */
+uint8_t gc_incremental_mark_step(TypeV_Core* core, uint64_t deadline_ns);
+
+/** Completes an incremental mark, afterwards both mark bitmaps are valid as with perform_major_mark */
+void gc_incremental_mark_finish(TypeV_Core* core);
+
+/** Marks an object and queues it for scanning, unless it is already marked */
+void gc_mark_shade(TypeV_Core* core, TypeV_ObjectHeader* obj);
+
+/** Marks an object and queues it for scanning even if it has already been scanned */
+void gc_mark_rescan(TypeV_Core* core, TypeV_ObjectHeader* obj);
+
+/** Returns 1 if the object has been marked by the last major mark */
+uint8_t gc_is_marked(TypeV_Core* core, TypeV_ObjectHeader* obj);
 
 /** Update **/
-void update_root_references(TypeV_Core* core);
 
 /**
- * Update object references
- * @param core
- * @param obj
- * @return the pointer towards the object's data NOT the header! i.e TypeV_ObjectHeader + 1
+ * Updates every reference after the old region has been compacted. References into [moved_from, moved_to)
+ * are replaced by the forwarding address of their target. Visits the roots, the compacted old region
+ * and the marked nursery objects, and rebuilds the remembered set on the way.
  */
-void* update_object_reference(TypeV_Core *core, TypeV_ObjectHeader *obj);
-void gc_update_state(TypeV_Core* core, TypeV_FuncState* state);
+void update_root_references(TypeV_Core* core, uint8_t* moved_from, uint8_t* moved_to);
 
 
 void core_struct_recompute_pointers(TypeV_Struct* struct_ptr);
 void core_class_recompute_pointers(TypeV_Class* class_ptr);
 void core_closure_recompute_pointers(TypeV_Closure* closure_ptr);
 
-#endif //TYPE_V_MARK_H
\ No newline at end of file
+/** Recomputes the internal pointers of an object which has just been moved */
+void gc_recompute_pointers(TypeV_ObjectHeader* obj);
+
+#endif //TYPE_V_MARK_H
@@ -0,0 +1,117 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+#include <stdlib.h>
+#include "policy.h"
+#include "gc.h"
+
+void gc_policy_init(TypeV_GC* gc) {
+    gc->policy.minor_target_ns = (uint64_t)GC_POLICY_MINOR_TARGET_US * 1000;
+    const char* target = getenv("TYPEV_GC_MINOR_TARGET_US");
+    if(target != NULL && atoi(target) > 0) {
+        gc->policy.minor_target_ns = (uint64_t)atoi(target) * 1000;
+    }
+
+    gc->policy.promotion_age = PROMOTION_SURVIVAL_THRESHOLD;
+    gc->policy.last_minor_ns = 0;
+    gc->policy.last_live_cells = 0;
+    gc->policy.allocated_since_major = 0;
+    gc->policy.large_major_bytes = GC_POLICY_MIN_LARGE_GROWTH;
+}
+
+uint8_t gc_policy_needs_major(TypeV_GC* gc) {
+    // in the worst case, every object of the from-space gets promoted
+    if(OLD_REGION_CELLS(gc) - gc->oldRegion.cell_size < gc->nursery.cell_size) {
+        return 1;
+    }
+
+    if(gc->los.bytes > gc->policy.large_major_bytes) {
+        return 1;
+    }
+
+    return OLD_REGION_CELLS(gc) > GC_POLICY_IDLE_MAJOR_MIN_CELLS &&
+           gc->policy.allocated_since_major > GC_POLICY_IDLE_MAJOR_RATIO * gc->oldRegion.cell_size;
+}
+
+uint8_t gc_policy_should_start_mark(TypeV_GC* gc) {
+    size_t capacity = OLD_REGION_CELLS(gc);
+    size_t free_cells = capacity - gc->oldRegion.cell_size;
+    size_t limit = gc_nursery_limit(gc);
+    if(capacity <= limit) {
+        return 1;
+    }
+
+    // 3/4 of the room left above one nursery worth of promotions is used,
+    // start marking so it completes before the old region is full
+    return free_cells <= limit + (capacity - limit) / 4;
+}
+
+void gc_policy_after_minor(TypeV_GC* gc, size_t allocated, size_t survived, size_t promoted, uint64_t pause_ns) {
+    TypeV_GCPolicy* policy = &gc->policy;
+    size_t limit = gc->nursery.limit_cells;
+    policy->last_minor_ns = pause_ns;
+    policy->allocated_since_major += allocated;
+
+    // the pause is proportional to the survivors: a shorter nursery lets fewer objects survive per GC.
+    // the nursery only grows while a fair share of it survives, giving those objects more time to die.
+    // a nursery still growing into its semispaces says nothing about the limit
+    if(pause_ns > policy->minor_target_ns) {
+        limit -= limit / 4;
+    }
+    else if(pause_ns < policy->minor_target_ns / 2 && (survived + promoted) * 16 >= allocated && allocated >= limit) {
+        limit += limit / 4;
+    }
+
+    if(limit < GC_POLICY_MIN_NURSERY_CELLS) {
+        limit = GC_POLICY_MIN_NURSERY_CELLS;
+    }
+    if(limit > NURSERY_MAX_CELLS) {
+        limit = NURSERY_MAX_CELLS;
+    }
+    gc->nursery.limit_cells = limit;
+
+    // survivors crowd the to-space and get copied over and over, promote them sooner
+    if(survived > limit / 2 && policy->promotion_age > GC_POLICY_MIN_PROMOTION_AGE) {
+        policy->promotion_age--;
+    }
+}
+
+size_t gc_policy_old_capacity_factor(TypeV_GC* gc, size_t live) {
+    size_t factor = gc->oldRegion.capacity_factor;
+    size_t headroom = 2 * gc_nursery_limit(gc);
+
+    // grow until the live set takes at most half of the region, leaving room for two nurseries of promotions
+    while(live * 2 > INITIAL_OLD_CELLS * factor || INITIAL_OLD_CELLS * factor - live < headroom) {
+        factor *= 2;
+    }
+
+    // shrink while the live set would take at most a quarter of the halved region
+    while(factor > 1 && live * 4 <= INITIAL_OLD_CELLS * (factor / 2) &&
+          INITIAL_OLD_CELLS * (factor / 2) - live >= headroom) {
+        factor /= 2;
+    }
+
+    return factor;
+}
+
+void gc_policy_after_major(TypeV_GC* gc, size_t occupied, size_t live) {
+    TypeV_GCPolicy* policy = &gc->policy;
+    policy->last_live_cells = live;
+    policy->allocated_since_major = 0;
+    policy->large_major_bytes = 2 * gc->los.bytes > gc->los.bytes + GC_POLICY_MIN_LARGE_GROWTH ?
+                                2 * gc->los.bytes : gc->los.bytes + GC_POLICY_MIN_LARGE_GROWTH;
+
+    if(occupied == 0) {
+        return;
+    }
+
+    // most of what was promoted died in the old region: objects are promoted too early.
+    // nearly everything survived: promoted objects are long-lived, stop copying them around the nursery
+    if(live * 2 < occupied && policy->promotion_age < GC_POLICY_MAX_PROMOTION_AGE) {
+        policy->promotion_age++;
+    }
+    else if(live * 10 > occupied * 9 && policy->promotion_age > GC_POLICY_MIN_PROMOTION_AGE) {
+        policy->promotion_age--;
+    }
+}
@@ -0,0 +1,88 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+#ifndef TYPE_V_POLICY_H
+#define TYPE_V_POLICY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct TypeV_GC;
+
+/**
+ * GC sizing policy. Decides, from what the collections measure:
+ * - the nursery allocation limit, from the minor GC pause against a target,
+ * - the promotion age, from to-space crowding and from how much of the old region dies,
+ * - when to collect the old region, and how large it should be afterwards.
+ * The old region grows when the live set needs it, and shrinks again once the live set drops,
+ * the pages it no longer uses are returned to the OS.
+ */
+
+/** Initial nursery allocation limit, in cells */
+#define GC_POLICY_INITIAL_NURSERY_CELLS (NURSERY_MAX_CELLS / 4)
+/** Smallest nursery allocation limit, in cells */
+#define GC_POLICY_MIN_NURSERY_CELLS (NURSERY_MAX_CELLS / 64)
+/** Default minor GC pause target, overridden by TYPEV_GC_MINOR_TARGET_US */
+#define GC_POLICY_MINOR_TARGET_US 10000
+/**
+ * Once the region has grown past GC_POLICY_IDLE_MAJOR_MIN_CELLS, a major GC also runs after the nursery
+ * has allocated this many times the occupied old cells, so a dropped live set is noticed even when nothing
+ * gets promoted anymore. The cost of that major GC is proportional to the occupied cells, amortized over
+ * the allocation.
+ */
+#define GC_POLICY_IDLE_MAJOR_RATIO 4
+/** Old regions up to this many cells (80 MB) are not worth shrinking */
+#define GC_POLICY_IDLE_MAJOR_MIN_CELLS 5242880
+/**
+ * Out-of-line array payloads held by old arrays are only released by a major GC. One runs once they
+ * have doubled since the last major GC, and at least this many bytes have been added.
+ */
+#define GC_POLICY_MIN_LARGE_GROWTH (64 * 1024 * 1024)
+/** Promotion age bounds */
+#define GC_POLICY_MIN_PROMOTION_AGE 1
+#define GC_POLICY_MAX_PROMOTION_AGE (GC_MAX_AGE - 1)
+
+typedef struct TypeV_GCPolicy {
+    uint64_t minor_target_ns;    // Minor GC pause target
+    uint8_t promotion_age;       // Minor GCs an object survives before promotion
+    uint64_t last_minor_ns;      // Duration of the last minor GC
+    size_t last_live_cells;      // Old cells found live by the last major GC
+    size_t allocated_since_major; // Nursery cells allocated since the last major GC
+    size_t large_major_bytes;    // Out-of-line payload bytes beyond which a major GC runs
+} TypeV_GCPolicy;
+
+void gc_policy_init(struct TypeV_GC* gc);
+
+/**
+ * @return 1 if the old region has to be collected before the next minor GC, either because
+ * it may not have room for the promotions, or because it may be holding memory the live set no longer needs
+ */
+uint8_t gc_policy_needs_major(struct TypeV_GC* gc);
+
+/** @return 1 if an incremental major mark should start now */
+uint8_t gc_policy_should_start_mark(struct TypeV_GC* gc);
+
+/**
+ * Feeds a finished minor GC to the policy, which adjusts the nursery limit and the promotion age.
+ * @param allocated nursery cells in use when the GC started
+ * @param survived cells copied to the to-space
+ * @param promoted cells promoted to the old region
+ */
+void gc_policy_after_minor(struct TypeV_GC* gc, size_t allocated, size_t survived, size_t promoted, uint64_t pause_ns);
+
+/**
+ * Picks the old region capacity factor for the compaction about to run: the live set
+ * takes at most half of the region, and leaves room for the promotions of two nurseries.
+ * @param live cells found live by the mark
+ */
+size_t gc_policy_old_capacity_factor(struct TypeV_GC* gc, size_t live);
+
+/**
+ * Feeds a finished major GC to the policy, which adjusts the promotion age.
+ * @param occupied old cells in use before the compaction
+ * @param live old cells left after it
+ */
+void gc_policy_after_major(struct TypeV_GC* gc, size_t occupied, size_t live);
+
+#endif //TYPE_V_POLICY_H
@@ -0,0 +1,101 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "sites.h"
+#include "gc.h"
+
+#define GC_SITES_INITIAL_CAPACITY 64
+
+static inline uint32_t gc_site_hash(uint64_t ip) {
+    ip ^= ip >> 33;
+    ip *= 0xff51afd7ed558ccdULL;
+    ip ^= ip >> 33;
+    return (uint32_t)ip;
+}
+
+void gc_sites_init(TypeV_AllocSites* sites) {
+    sites->capacity = GC_SITES_INITIAL_CAPACITY;
+    sites->count = 1;
+    sites->sites = calloc(sites->capacity, sizeof(TypeV_AllocSite));
+    sites->tableMask = GC_SITES_INITIAL_CAPACITY * 2 - 1;
+    sites->table = calloc(sites->tableMask + 1, sizeof(uint32_t));
+}
+
+void gc_sites_free(TypeV_AllocSites* sites) {
+    free(sites->sites);
+    free(sites->table);
+}
+
+static void gc_sites_insert(TypeV_AllocSites* sites, uint32_t id) {
+    uint32_t slot = gc_site_hash(sites->sites[id].ip) & sites->tableMask;
+    while(sites->table[slot] != 0) {
+        slot = (slot + 1) & sites->tableMask;
+    }
+    sites->table[slot] = id;
+}
+
+uint32_t gc_site_lookup(TypeV_AllocSites* sites, uint64_t ip) {
+    uint32_t slot = gc_site_hash(ip) & sites->tableMask;
+    while(sites->table[slot] != 0) {
+        uint32_t id = sites->table[slot];
+        if(sites->sites[id].ip == ip) {
+            return id;
+        }
+        slot = (slot + 1) & sites->tableMask;
+    }
+
+    if(sites->count == sites->capacity) {
+        // the table is kept at most half full
+        sites->capacity *= 2;
+        sites->sites = realloc(sites->sites, sites->capacity * sizeof(TypeV_AllocSite));
+        free(sites->table);
+        sites->tableMask = sites->capacity * 2 - 1;
+        sites->table = calloc(sites->tableMask + 1, sizeof(uint32_t));
+        for(uint32_t id = 1; id < sites->count; id++) {
+            gc_sites_insert(sites, id);
+        }
+    }
+
+    uint32_t id = sites->count++;
+    memset(&sites->sites[id], 0, sizeof(TypeV_AllocSite));
+    sites->sites[id].ip = ip;
+    gc_sites_insert(sites, id);
+    return id;
+}
+
+void gc_sites_after_minor(TypeV_AllocSites* sites) {
+    for(uint32_t id = 1; id < sites->count; id++) {
+        TypeV_AllocSite* site = &sites->sites[id];
+        if(!site->pretenure && site->allocated >= GC_PRETENURE_MIN_SAMPLES &&
+           (uint64_t)site->promoted * 100 >= (uint64_t)site->allocated * GC_PRETENURE_ENTER_PERCENT) {
+            gc_log("gc_sites_after_minor: Pretenuring site %llu", site->ip);
+            site->pretenure = 1;
+            site->pretenured = 0;
+            site->survived = 0;
+        }
+
+        // promotions lag allocations by PROMOTION_SURVIVAL_THRESHOLD collections, a decaying
+        // window smooths the ratio while still following phase changes
+        site->allocated /= 2;
+        site->promoted /= 2;
+    }
+}
+
+void gc_sites_after_major(TypeV_AllocSites* sites) {
+    for(uint32_t id = 1; id < sites->count; id++) {
+        TypeV_AllocSite* site = &sites->sites[id];
+        if(site->pretenure && site->pretenured >= GC_PRETENURE_MIN_SAMPLES &&
+           (uint64_t)site->survived * 100 < (uint64_t)site->pretenured * GC_PRETENURE_EXIT_PERCENT) {
+            gc_log("gc_sites_after_major: Site %llu back to the nursery", site->ip);
+            site->pretenure = 0;
+            site->allocated = 0;
+            site->promoted = 0;
+        }
+
+        site->pretenured = 0;
+        site->survived = 0;
+    }
+}
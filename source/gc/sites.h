@@ -0,0 +1,53 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+#ifndef TYPE_V_SITES_H
+#define TYPE_V_SITES_H
+
+#include <stdint.h>
+
+/**
+ * Allocation-site feedback, used to pretenure objects.
+ * Every struct, class and array allocation is attributed to the instruction (ip) which allocated it.
+ * Sites whose objects mostly get promoted allocate directly in the old region, and go back to the
+ * nursery once their old objects stop surviving major collections.
+ */
+
+/** Minimum number of samples before a site is (re)considered */
+#define GC_PRETENURE_MIN_SAMPLES 256
+/** A nursery site is pretenured once at least this percentage of its objects gets promoted */
+#define GC_PRETENURE_ENTER_PERCENT 80
+/** A pretenured site goes back to the nursery once less than this percentage of its objects survives a major GC */
+#define GC_PRETENURE_EXIT_PERCENT 30
+
+typedef struct TypeV_AllocSite {
+    uint64_t ip;                 // Allocating instruction
+    uint32_t allocated;          // Nursery allocations, decayed at every minor GC
+    uint32_t promoted;           // Promoted objects, decayed at every minor GC
+    uint32_t pretenured;         // Old region allocations since the last major GC
+    uint32_t survived;           // Of which still alive at the major GC
+    uint8_t pretenure;           // 1 while the site allocates in the old region
+} TypeV_AllocSite;
+
+typedef struct TypeV_AllocSites {
+    TypeV_AllocSite* sites;      // Site 0 is reserved, object headers use it for untracked objects
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t* table;             // Open addressing, ip -> site index, 0 for empty slots
+    uint32_t tableMask;
+} TypeV_AllocSites;
+
+void gc_sites_init(TypeV_AllocSites* sites);
+void gc_sites_free(TypeV_AllocSites* sites);
+
+/** Returns the site of an instruction, creating it on first use */
+uint32_t gc_site_lookup(TypeV_AllocSites* sites, uint64_t ip);
+
+/** Pretenures the sites whose objects mostly got promoted, and decays the nursery statistics */
+void gc_sites_after_minor(TypeV_AllocSites* sites);
+
+/** Sends pretenured sites whose objects died before the major GC back to the nursery */
+void gc_sites_after_major(TypeV_AllocSites* sites);
+
+#endif //TYPE_V_SITES_H
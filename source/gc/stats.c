@@ -0,0 +1,158 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stats.h"
+#include "gc.h"
+#include "../platform/threads.h"
+
+void gc_stats_init(TypeV_GC* gc) {
+    memset(&gc->stats, 0, sizeof(TypeV_GCStats));
+    for(uint32_t k = 0; k < GC_PAUSE_KINDS; k++) {
+        gc->stats.pauses[k].min_ns = UINT64_MAX;
+    }
+    gc->statsStartNs = typev_now_ns();
+    gc->nurseryBaseCells = 0;
+
+    gc->statsLog = NULL;
+    const char* path = getenv("TYPEV_GC_LOG");
+    if(path != NULL && path[0] != '\0') {
+        gc->statsLog = fopen(path, "a");
+        if(gc->statsLog == NULL) {
+            fprintf(stderr, "gc: cannot open TYPEV_GC_LOG file %s\n", path);
+        }
+        else {
+            // one write per line, so that the lines of several cores do not interleave
+            setvbuf(gc->statsLog, NULL, _IOLBF, 1024);
+        }
+    }
+}
+
+void gc_stats_free(TypeV_GC* gc) {
+    if(gc->statsLog != NULL) {
+        fclose(gc->statsLog);
+        gc->statsLog = NULL;
+    }
+}
+
+void gc_stats_record_pause(TypeV_GCStats* stats, TypeV_GCPauseKind kind, uint64_t pause_ns) {
+    TypeV_GCPauseStats* p = &stats->pauses[kind];
+    p->count++;
+    p->total_ns += pause_ns;
+    if(pause_ns < p->min_ns) {
+        p->min_ns = pause_ns;
+    }
+    if(pause_ns > p->max_ns) {
+        p->max_ns = pause_ns;
+    }
+
+    uint64_t us = pause_ns / 1000;
+    uint32_t bucket = 0;
+    while(us > 0 && bucket < GC_PAUSE_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    p->histogram[bucket]++;
+}
+
+void gc_stats_snapshot(TypeV_GC* gc, TypeV_GCStats* out) {
+    *out = gc->stats;
+    for(uint32_t k = 0; k < GC_PAUSE_KINDS; k++) {
+        if(out->pauses[k].count == 0) {
+            out->pauses[k].min_ns = 0;
+        }
+    }
+
+    // nursery allocations are accounted for at every minor GC, add the ones since the last
+    out->allocated_bytes += (uint64_t)(gc->nursery.cell_size - gc->nurseryBaseCells) * CELL_SIZE;
+    out->remembered = gc->rs.size;
+    out->finalize_pending = gc->finalizers.size - gc->finalizers.head;
+    out->nursery_used_bytes = (uint64_t)gc->nursery.cell_size * CELL_SIZE;
+    out->nursery_limit_bytes = (uint64_t)gc_nursery_limit(gc) * CELL_SIZE;
+    out->old_used_bytes = (uint64_t)gc->oldRegion.cell_size * CELL_SIZE;
+    out->old_capacity_bytes = (uint64_t)OLD_REGION_CELLS(gc) * CELL_SIZE;
+    out->old_live_bytes = (uint64_t)gc->policy.last_live_cells * CELL_SIZE;
+    out->promotion_age = gc->policy.promotion_age;
+    out->large_bytes = gc->los.bytes;
+}
+
+static uint64_t gc_stats_avg(const TypeV_GCPauseStats* p) {
+    return p->count ? p->total_ns / p->count : 0;
+}
+
+uint64_t gc_stats_get(const TypeV_GCStats* stats, uint32_t id) {
+    const TypeV_GCPauseStats* minor = &stats->pauses[GC_PAUSE_MINOR];
+    const TypeV_GCPauseStats* major = &stats->pauses[GC_PAUSE_MAJOR];
+    const TypeV_GCPauseStats* step = &stats->pauses[GC_PAUSE_MARK_STEP];
+
+    switch(id) {
+        case GC_STAT_MINOR_COUNT: return minor->count;
+        case GC_STAT_MAJOR_COUNT: return major->count;
+        case GC_STAT_MARK_STEP_COUNT: return step->count;
+        case GC_STAT_MINOR_PAUSE_MIN_NS: return minor->min_ns;
+        case GC_STAT_MINOR_PAUSE_AVG_NS: return gc_stats_avg(minor);
+        case GC_STAT_MINOR_PAUSE_MAX_NS: return minor->max_ns;
+        case GC_STAT_MAJOR_PAUSE_MIN_NS: return major->min_ns;
+        case GC_STAT_MAJOR_PAUSE_AVG_NS: return gc_stats_avg(major);
+        case GC_STAT_MAJOR_PAUSE_MAX_NS: return major->max_ns;
+        case GC_STAT_MARK_STEP_MIN_NS: return step->min_ns;
+        case GC_STAT_MARK_STEP_AVG_NS: return gc_stats_avg(step);
+        case GC_STAT_MARK_STEP_MAX_NS: return step->max_ns;
+        case GC_STAT_ALLOCATED_BYTES: return stats->allocated_bytes;
+        case GC_STAT_PRETENURED_BYTES: return stats->pretenured_bytes;
+        case GC_STAT_COPIED_BYTES: return stats->copied_bytes;
+        case GC_STAT_PROMOTED_BYTES: return stats->promoted_bytes;
+        case GC_STAT_FINALIZED: return stats->finalized;
+        case GC_STAT_FINALIZE_PENDING: return stats->finalize_pending;
+        case GC_STAT_REMEMBERED: return stats->remembered;
+        case GC_STAT_REMEMBERED_MAX: return stats->remembered_max;
+        case GC_STAT_NURSERY_USED_BYTES: return stats->nursery_used_bytes;
+        case GC_STAT_NURSERY_LIMIT_BYTES: return stats->nursery_limit_bytes;
+        case GC_STAT_OLD_USED_BYTES: return stats->old_used_bytes;
+        case GC_STAT_OLD_CAPACITY_BYTES: return stats->old_capacity_bytes;
+        case GC_STAT_OLD_LIVE_BYTES: return stats->old_live_bytes;
+        case GC_STAT_PROMOTION_AGE: return stats->promotion_age;
+        case GC_STAT_LARGE_BYTES: return stats->large_bytes;
+        default: return 0;
+    }
+}
+
+void gc_stats_log_minor(TypeV_Core* core, uint64_t pause_ns, size_t allocated, size_t survived, size_t promoted, size_t finalized) {
+    TypeV_GC* gc = core->gc;
+    if(gc->statsLog == NULL) {
+        return;
+    }
+
+    fprintf(gc->statsLog,
+            "{\"gc\":\"minor\",\"core\":%u,\"seq\":%llu,\"time_ms\":%.3f,\"pause_us\":%.1f,"
+            "\"nursery_bytes\":%llu,\"survived_bytes\":%llu,\"promoted_bytes\":%llu,\"finalized\":%zu,"
+            "\"remembered\":%zu,\"nursery_limit_bytes\":%llu,\"promotion_age\":%u,"
+            "\"old_used_bytes\":%llu,\"old_capacity_bytes\":%llu,\"large_bytes\":%llu}\n",
+            core->id, (unsigned long long)gc->stats.pauses[GC_PAUSE_MINOR].count,
+            (double)(typev_now_ns() - gc->statsStartNs) / 1e6, (double)pause_ns / 1e3,
+            (unsigned long long)allocated * CELL_SIZE, (unsigned long long)survived * CELL_SIZE,
+            (unsigned long long)promoted * CELL_SIZE, finalized,
+            gc->rs.size, (unsigned long long)gc_nursery_limit(gc) * CELL_SIZE, (unsigned)gc->policy.promotion_age,
+            (unsigned long long)gc->oldRegion.cell_size * CELL_SIZE, (unsigned long long)OLD_REGION_CELLS(gc) * CELL_SIZE,
+            (unsigned long long)gc->los.bytes);
+}
+
+void gc_stats_log_major(TypeV_Core* core, uint64_t pause_ns, uint8_t incremental, size_t occupied, size_t live, size_t finalized) {
+    TypeV_GC* gc = core->gc;
+    if(gc->statsLog == NULL) {
+        return;
+    }
+
+    fprintf(gc->statsLog,
+            "{\"gc\":\"major\",\"core\":%u,\"seq\":%llu,\"time_ms\":%.3f,\"pause_us\":%.1f,\"incremental\":%s,"
+            "\"occupied_bytes\":%llu,\"live_bytes\":%llu,\"finalized\":%zu,\"remembered\":%zu,"
+            "\"old_capacity_bytes\":%llu,\"promotion_age\":%u,\"large_bytes\":%llu}\n",
+            core->id, (unsigned long long)gc->stats.pauses[GC_PAUSE_MAJOR].count,
+            (double)(typev_now_ns() - gc->statsStartNs) / 1e6, (double)pause_ns / 1e3, incremental ? "true" : "false",
+            (unsigned long long)occupied * CELL_SIZE, (unsigned long long)live * CELL_SIZE, finalized, gc->rs.size,
+            (unsigned long long)OLD_REGION_CELLS(gc) * CELL_SIZE, (unsigned)gc->policy.promotion_age,
+            (unsigned long long)gc->los.bytes);
+}
@@ -0,0 +1,119 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+#ifndef TYPE_V_STATS_H
+#define TYPE_V_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct TypeV_Core;
+struct TypeV_GC;
+
+/**
+ * GC telemetry, always collected. Counters are cumulative since the GC was initialized,
+ * gauges (sizes) reflect the heap at the time of the snapshot.
+ * Setting TYPEV_GC_LOG to a file path also appends one JSON line per collection to that file.
+ */
+
+/** Pause histogram buckets: bucket 0 counts pauses under 1us, bucket i in [2^(i-1), 2^i) us, the last one is open-ended */
+#define GC_PAUSE_BUCKETS 24
+
+typedef enum {
+    GC_PAUSE_MINOR = 0,
+    GC_PAUSE_MAJOR,
+    GC_PAUSE_MARK_STEP,          // Incremental mark steps, see gc_set_pause_budget
+    GC_PAUSE_KINDS
+} TypeV_GCPauseKind;
+
+typedef struct TypeV_GCPauseStats {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t histogram[GC_PAUSE_BUCKETS];
+} TypeV_GCPauseStats;
+
+typedef struct TypeV_GCStats {
+    TypeV_GCPauseStats pauses[GC_PAUSE_KINDS];
+    uint64_t allocated_bytes;    // Nursery and old region allocations
+    uint64_t pretenured_bytes;   // Of which allocated directly in the old region
+    uint64_t copied_bytes;       // Survivors copied within the nursery, and old objects moved by compaction
+    uint64_t promoted_bytes;     // Objects moved from the nursery to the old region
+    uint64_t finalized;          // User objects whose destructor ran
+    uint64_t remembered;         // Current remembered set size
+    uint64_t remembered_max;     // Largest remembered set scanned by a minor GC
+    uint64_t nursery_used_bytes;
+    uint64_t nursery_limit_bytes;
+    uint64_t old_used_bytes;
+    uint64_t old_capacity_bytes;
+    uint64_t old_live_bytes;     // Old objects found live by the last major GC
+    uint64_t promotion_age;
+    uint64_t large_bytes;        // Out-of-line array payloads, see los.h
+    uint64_t finalize_pending;   // Dead user objects whose destructor is still queued
+} TypeV_GCStats;
+
+/** Single statistics, for callers which cannot read TypeV_GCStats directly (FFI) */
+typedef enum {
+    GC_STAT_MINOR_COUNT = 0,
+    GC_STAT_MAJOR_COUNT,
+    GC_STAT_MARK_STEP_COUNT,
+    GC_STAT_MINOR_PAUSE_MIN_NS,
+    GC_STAT_MINOR_PAUSE_AVG_NS,
+    GC_STAT_MINOR_PAUSE_MAX_NS,
+    GC_STAT_MAJOR_PAUSE_MIN_NS,
+    GC_STAT_MAJOR_PAUSE_AVG_NS,
+    GC_STAT_MAJOR_PAUSE_MAX_NS,
+    GC_STAT_MARK_STEP_MIN_NS,
+    GC_STAT_MARK_STEP_AVG_NS,
+    GC_STAT_MARK_STEP_MAX_NS,
+    GC_STAT_ALLOCATED_BYTES,
+    GC_STAT_PRETENURED_BYTES,
+    GC_STAT_COPIED_BYTES,
+    GC_STAT_PROMOTED_BYTES,
+    GC_STAT_FINALIZED,
+    GC_STAT_REMEMBERED,
+    GC_STAT_REMEMBERED_MAX,
+    GC_STAT_NURSERY_USED_BYTES,
+    GC_STAT_NURSERY_LIMIT_BYTES,
+    GC_STAT_OLD_USED_BYTES,
+    GC_STAT_OLD_CAPACITY_BYTES,
+    GC_STAT_OLD_LIVE_BYTES,
+    GC_STAT_PROMOTION_AGE,
+    GC_STAT_LARGE_BYTES,
+    GC_STAT_FINALIZE_PENDING,
+    GC_STAT_COUNT
+} TypeV_GCStatId;
+
+void gc_stats_init(struct TypeV_GC* gc);
+void gc_stats_free(struct TypeV_GC* gc);
+
+/** Adds a pause to the statistics of its kind */
+void gc_stats_record_pause(TypeV_GCStats* stats, TypeV_GCPauseKind kind, uint64_t pause_ns);
+
+/** Fills `out` with the counters and the current heap sizes */
+void gc_stats_snapshot(struct TypeV_GC* gc, TypeV_GCStats* out);
+
+/** Reads a single statistic from a snapshot, 0 for unknown ids */
+uint64_t gc_stats_get(const TypeV_GCStats* stats, uint32_t id);
+
+/**
+ * Writes the JSON line of a minor GC to the TYPEV_GC_LOG file, if any.
+ * @param allocated nursery cells in use when the GC started
+ * @param survived cells copied to the to-space
+ * @param promoted cells promoted to the old region
+ * @param finalized user objects found dead, their destructors are queued
+ */
+void gc_stats_log_minor(struct TypeV_Core* core, uint64_t pause_ns, size_t allocated, size_t survived, size_t promoted, size_t finalized);
+
+/**
+ * Writes the JSON line of a major GC to the TYPEV_GC_LOG file, if any.
+ * @param incremental 1 if the GC completed an incremental mark
+ * @param occupied old cells in use before the compaction
+ * @param live old cells left after it
+ * @param finalized user objects found dead, their destructors are queued
+ */
+void gc_stats_log_major(struct TypeV_Core* core, uint64_t pause_ns, uint8_t incremental, size_t occupied, size_t live, size_t finalized);
+
+#endif //TYPE_V_STATS_H
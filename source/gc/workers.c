@@ -0,0 +1,247 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "workers.h"
+#include "../platform/threads.h"
+
+typedef struct TypeV_GCWorkerPool {
+    TypeV_Mutex lock;            // Protects every field below
+    TypeV_Cond wake;             // Signaled when a new job is published
+    TypeV_Cond done;             // Signaled when the last helper finishes a job
+    TypeV_Mutex runLock;         // Held by the collector currently using the pool
+    uint32_t count;              // Configured number of workers, including the collecting thread
+    uint32_t started;            // Number of helper threads started so far
+    TypeV_Thread threads[GC_MAX_WORKERS];
+    uint64_t epoch;              // Incremented for every job
+    uint32_t pending;            // Helpers still running the current job
+    uint32_t jobWorkers;         // Number of workers taking part in the current job
+    TypeV_GCJob job;
+    void* ctx;
+} TypeV_GCWorkerPool;
+
+static TypeV_GCWorkerPool pool;
+static TypeV_Once poolOnce = TYPEV_ONCE_INIT;
+
+typedef struct {
+    uint32_t id;
+    uint64_t epoch;              // Epoch when the helper was started, the job to run is published after it
+} TypeV_GCWorkerArg;
+
+static void gc_workers_init(void) {
+    typev_mutex_init(&pool.lock);
+    typev_mutex_init(&pool.runLock);
+    typev_cond_init(&pool.wake);
+    typev_cond_init(&pool.done);
+    pool.started = 0;
+    pool.epoch = 0;
+    pool.pending = 0;
+
+    uint32_t count = typev_cpu_count();
+    if(count > GC_DEFAULT_WORKERS) {
+        count = GC_DEFAULT_WORKERS;
+    }
+
+    const char* env = getenv("TYPEV_GC_WORKERS");
+    if(env != NULL && atoi(env) > 0) {
+        count = (uint32_t)atoi(env);
+    }
+
+    pool.count = count > GC_MAX_WORKERS ? GC_MAX_WORKERS : count;
+}
+
+static void gc_worker_loop(void* arg) {
+    uint32_t id = ((TypeV_GCWorkerArg*)arg)->id;
+    uint64_t seen = ((TypeV_GCWorkerArg*)arg)->epoch;
+    free(arg);
+
+    typev_mutex_lock(&pool.lock);
+    while(1) {
+        while(pool.epoch == seen) {
+            typev_cond_wait(&pool.wake, &pool.lock);
+        }
+        seen = pool.epoch;
+
+        if(id < pool.jobWorkers) {
+            TypeV_GCJob job = pool.job;
+            void* ctx = pool.ctx;
+            uint32_t workers = pool.jobWorkers;
+            typev_mutex_unlock(&pool.lock);
+
+            job(id, workers, ctx);
+
+            typev_mutex_lock(&pool.lock);
+            if(--pool.pending == 0) {
+                typev_cond_signal(&pool.done);
+            }
+        }
+    }
+}
+
+void gc_workers_set_count(uint32_t count) {
+    typev_once(&poolOnce, gc_workers_init);
+    typev_mutex_lock(&pool.lock);
+    pool.count = count == 0 ? 1 : (count > GC_MAX_WORKERS ? GC_MAX_WORKERS : count);
+    typev_mutex_unlock(&pool.lock);
+}
+
+uint32_t gc_workers_get_count(void) {
+    typev_once(&poolOnce, gc_workers_init);
+    typev_mutex_lock(&pool.lock);
+    uint32_t count = pool.count;
+    typev_mutex_unlock(&pool.lock);
+    return count;
+}
+
+uint32_t gc_workers_run(TypeV_GCJob job, void* ctx, uint32_t max_workers) {
+    typev_once(&poolOnce, gc_workers_init);
+
+    if(!typev_mutex_trylock(&pool.runLock)) {
+        return 0;
+    }
+
+    typev_mutex_lock(&pool.lock);
+    uint32_t workers = pool.count < max_workers ? pool.count : max_workers;
+    if(workers <= 1) {
+        typev_mutex_unlock(&pool.lock);
+        typev_mutex_unlock(&pool.runLock);
+        return 0;
+    }
+
+    // start the missing helpers, they are never stopped
+    while(pool.started < workers - 1) {
+        TypeV_GCWorkerArg* arg = malloc(sizeof(TypeV_GCWorkerArg));
+        arg->id = pool.started + 1;
+        arg->epoch = pool.epoch;
+        if(typev_thread_create(&pool.threads[pool.started], gc_worker_loop, arg) != 0) {
+            free(arg);
+            break;
+        }
+        pool.started++;
+    }
+    workers = pool.started + 1 < workers ? pool.started + 1 : workers;
+    if(workers <= 1) {
+        typev_mutex_unlock(&pool.lock);
+        typev_mutex_unlock(&pool.runLock);
+        return 0;
+    }
+
+    pool.job = job;
+    pool.ctx = ctx;
+    pool.jobWorkers = workers;
+    pool.pending = workers - 1;
+    pool.epoch++;
+    typev_cond_broadcast(&pool.wake);
+    typev_mutex_unlock(&pool.lock);
+
+    job(0, workers, ctx);
+
+    typev_mutex_lock(&pool.lock);
+    while(pool.pending > 0) {
+        typev_cond_wait(&pool.done, &pool.lock);
+    }
+    typev_mutex_unlock(&pool.lock);
+
+    typev_mutex_unlock(&pool.runLock);
+    return workers;
+}
+
+
+/* ======================= DEQUE ======================= */
+
+#define GC_DEQUE_INITIAL_CAPACITY 1024
+
+static TypeV_MarkDequeBuffer* gc_deque_buffer_new(int64_t capacity) {
+    TypeV_MarkDequeBuffer* buffer = malloc(sizeof(TypeV_MarkDequeBuffer) + capacity * sizeof(_Atomic(TypeV_ObjectHeader*)));
+    buffer->capacity = capacity;
+    buffer->retired = NULL;
+    return buffer;
+}
+
+void gc_deque_init(TypeV_MarkDeque* deque) {
+    atomic_init(&deque->top, 0);
+    atomic_init(&deque->bottom, 0);
+    atomic_init(&deque->buffer, gc_deque_buffer_new(GC_DEQUE_INITIAL_CAPACITY));
+}
+
+void gc_deque_free(TypeV_MarkDeque* deque) {
+    TypeV_MarkDequeBuffer* buffer = atomic_load(&deque->buffer);
+    while(buffer != NULL) {
+        TypeV_MarkDequeBuffer* retired = buffer->retired;
+        free(buffer);
+        buffer = retired;
+    }
+}
+
+void gc_deque_push(TypeV_MarkDeque* deque, TypeV_ObjectHeader* obj) {
+    int64_t b = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t t = atomic_load_explicit(&deque->top, memory_order_acquire);
+    TypeV_MarkDequeBuffer* buffer = atomic_load_explicit(&deque->buffer, memory_order_relaxed);
+
+    if(b - t > buffer->capacity - 1) {
+        // grow, the old buffer may still be read by thieves, it is kept until the deque is freed
+        TypeV_MarkDequeBuffer* bigger = gc_deque_buffer_new(buffer->capacity * 2);
+        for(int64_t i = t; i < b; i++) {
+            atomic_store_explicit(&bigger->items[i % bigger->capacity],
+                                  atomic_load_explicit(&buffer->items[i % buffer->capacity], memory_order_relaxed),
+                                  memory_order_relaxed);
+        }
+        bigger->retired = buffer;
+        atomic_store_explicit(&deque->buffer, bigger, memory_order_release);
+        buffer = bigger;
+    }
+
+    atomic_store_explicit(&buffer->items[b % buffer->capacity], obj, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+}
+
+TypeV_ObjectHeader* gc_deque_take(TypeV_MarkDeque* deque) {
+    int64_t b = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    TypeV_MarkDequeBuffer* buffer = atomic_load_explicit(&deque->buffer, memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t t = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    TypeV_ObjectHeader* obj = NULL;
+    if(t <= b) {
+        obj = atomic_load_explicit(&buffer->items[b % buffer->capacity], memory_order_relaxed);
+        if(t == b) {
+            // last element, race against thieves
+            if(!atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+                obj = NULL;
+            }
+            atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+        }
+    }
+    else {
+        atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+    }
+
+    return obj;
+}
+
+TypeV_ObjectHeader* gc_deque_steal(TypeV_MarkDeque* deque) {
+    int64_t t = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t b = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+    if(t < b) {
+        TypeV_MarkDequeBuffer* buffer = atomic_load_explicit(&deque->buffer, memory_order_acquire);
+        TypeV_ObjectHeader* obj = atomic_load_explicit(&buffer->items[t % buffer->capacity], memory_order_relaxed);
+        if(!atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+            return NULL;
+        }
+        return obj;
+    }
+
+    return NULL;
+}
+
+uint8_t gc_deque_is_empty(TypeV_MarkDeque* deque) {
+    int64_t t = atomic_load_explicit(&deque->top, memory_order_acquire);
+    int64_t b = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    return b <= t;
+}
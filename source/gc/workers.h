@@ -0,0 +1,79 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+#ifndef TYPE_V_WORKERS_H
+#define TYPE_V_WORKERS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "gc.h"
+
+/**
+ * GC worker pool, shared by the collectors of all cores.
+ * The collecting thread always takes part in a job as worker 0, so a pool of N workers
+ * owns N-1 helper threads. Helpers are started lazily on the first parallel job.
+ */
+
+/** Upper bound on the worker count */
+#define GC_MAX_WORKERS 64
+
+/** Default number of workers when TYPEV_GC_WORKERS is not set, capped by the CPU count */
+#define GC_DEFAULT_WORKERS 8
+
+/**
+ * A job run by every worker of the pool.
+ * @param worker index of the running worker, in [0, workers)
+ * @param workers number of workers running the job
+ */
+typedef void (*TypeV_GCJob)(uint32_t worker, uint32_t workers, void* ctx);
+
+/**
+ * @brief Sets the number of GC workers, including the collecting thread.
+ * 1 disables parallel collection. Overrides the TYPEV_GC_WORKERS environment variable.
+ */
+void gc_workers_set_count(uint32_t count);
+
+/** @brief Returns the configured number of GC workers */
+uint32_t gc_workers_get_count(void);
+
+/**
+ * @brief Runs job(worker, workers, ctx) on at most max_workers workers and returns once all of them are done.
+ * @return the number of workers that ran the job, 0 if fewer than two workers are available
+ * or if the pool is already used by another collector, in which case the job was not run at all
+ */
+uint32_t gc_workers_run(TypeV_GCJob job, void* ctx, uint32_t max_workers);
+
+
+/**
+ * Work-stealing deque of objects (Chase-Lev). The owner pushes and takes at the bottom,
+ * other workers steal from the top.
+ */
+typedef struct TypeV_MarkDequeBuffer {
+    int64_t capacity;
+    struct TypeV_MarkDequeBuffer* retired; // Previous (smaller) buffer, freed with the deque
+    _Atomic(TypeV_ObjectHeader*) items[];
+} TypeV_MarkDequeBuffer;
+
+typedef struct TypeV_MarkDeque {
+    _Atomic int64_t top;
+    _Atomic int64_t bottom;
+    _Atomic(TypeV_MarkDequeBuffer*) buffer;
+} TypeV_MarkDeque;
+
+void gc_deque_init(TypeV_MarkDeque* deque);
+void gc_deque_free(TypeV_MarkDeque* deque);
+
+/** Owner only */
+void gc_deque_push(TypeV_MarkDeque* deque, TypeV_ObjectHeader* obj);
+
+/** Owner only, returns NULL when empty */
+TypeV_ObjectHeader* gc_deque_take(TypeV_MarkDeque* deque);
+
+/** Any worker, returns NULL when empty or when losing a race */
+TypeV_ObjectHeader* gc_deque_steal(TypeV_MarkDeque* deque);
+
+/** Approximate emptiness check, for termination detection */
+uint8_t gc_deque_is_empty(TypeV_MarkDeque* deque);
+
+#endif //TYPE_V_WORKERS_H
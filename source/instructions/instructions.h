@@ -23,6 +23,7 @@
 #include "../utils/log.h"
 #include "../vendor/libtable/table.h"
 #include "../engine.h"
+#include "../mailbox/mailbox.h"
 #include "../errors/errors.h"
 
 #define CORE_ASSERT(condition, message)
@@ -131,6 +132,9 @@ static inline uint64_t typev_memcpy_u64(const unsigned char *s, size_t size) {
 }
 
 static inline void divine_barrier(TypeV_Core* core, uint8_t* big, uint8_t* small) {
+    if(small == NULL) {
+        return;
+    }
     TypeV_ObjectHeader* big_obj = (TypeV_ObjectHeader*)(big - sizeof(TypeV_ObjectHeader));
     TypeV_ObjectHeader* small_obj = (TypeV_ObjectHeader*)(small - sizeof(TypeV_ObjectHeader));
 
@@ -489,6 +493,12 @@ static inline void s_copyf(TypeV_Core* core){
         ((char *) source->data) + source->fieldOffsets[sourceIndex],
         byteSize
     );
+
+    if(dest->pointerBitmask[destIndex / 8] & (1 << (destIndex % 8))) {
+        uintptr_t field;
+        typev_memcpy_aligned_8(&field, ((char *) dest->data) + dest->fieldOffsets[destIndex]);
+        divine_barrier(core, (uint8_t*)dest, (uint8_t*)field);
+    }
 }
 
 static inline void s_storef_const(TypeV_Core* core){
@@ -935,6 +945,9 @@ static inline void a_storef_reg(TypeV_Core* core){
     if(core->regs[index].u64 >= array->length) {
         core_panic(core, RT_ERROR_OUT_OF_BOUNDS, "Index out of bounds %d >= %d", core->regs[index].u64, array->length);
     }
+    if(array->storage == ARRAY_STORAGE_SHARED) {
+        core_panic(core, RT_ERROR_IMMUTABLE, "Cannot store into a shared array");
+    }
 
     ASSERT(core->regs[index].u64 < array->length, "Index out of bounds");
     typev_memcpy_unaligned(array->data + (core->regs[index].u64 * array->elementSize), &core->regs[source], byteSize);
@@ -969,6 +982,9 @@ static inline void a_rstoref_reg(TypeV_Core* core){
     if(core->regs[index].u64 > array->length) {
         core_panic(core, RT_ERROR_OUT_OF_BOUNDS, "Index out of bounds %d >= %d", core->regs[index].u64, array->length);
     }
+    if(array->storage == ARRAY_STORAGE_SHARED) {
+        core_panic(core, RT_ERROR_IMMUTABLE, "Cannot store into a shared array");
+    }
 
     uint64_t idx = core->regs[index].u64;
 
@@ -1004,6 +1020,9 @@ static inline void a_storef_const(TypeV_Core* core){
 
     TypeV_Array* array = (TypeV_Array*)core->regs[array_reg].ptr;
     ASSERT(core->regs[indexReg].u64 < array->length, "Index out of bounds");
+    if(array->storage == ARRAY_STORAGE_SHARED) {
+        core_panic(core, RT_ERROR_IMMUTABLE, "Cannot store into a shared array");
+    }
     typev_memcpy_unaligned(array->data + (core->regs[indexReg].u64 * array->elementSize), &core->constPtr[offset],
                            byteSize);
 }
@@ -2332,6 +2351,13 @@ static inline void halt(TypeV_Core* core) {
 
     uint32_t code = core->regs[code_reg].u32;
 
+    if(core->id != 1) {
+        // only the main core ends the process, the engine detaches and frees the others
+        core->exitCode = code;
+        core->state = CS_TERMINATED;
+        return;
+    }
+
     //core_gc_sweep_all(core);
     cleanup_gc(core);
     exit(code);
@@ -2344,7 +2370,7 @@ static inline void vm_health(TypeV_Core* core){
     uint8_t dest = core->codePtr[core->ip++];
     ASSERT(dest < MAX_REG, "Invalid register index");
 
-    core->regs[dest].u8 = core->engineRef->health;
+    core->regs[dest].u8 = engine_health(core->engineRef);
 }
 
 
@@ -2409,6 +2435,9 @@ static inline void closure_backup(TypeV_Core* core) {
 
     for(uint8_t i = 0; i < cl->envSize; i++) {
         cl->upvalues[i] = core->funcState->next->regs[i+offset];
+        if(IS_CLOSURE_UPVALUE_POINTER(cl->ptrFields, i)) {
+            divine_barrier(core, (uint8_t*)cl, (uint8_t*)cl->upvalues[i].ptr);
+        }
     }
 }
 
@@ -2545,4 +2574,178 @@ static inline void throw_user_rt(TypeV_Core* core) {
     core_panic_custom(core, (char*)arr->data);
 }
 
+static inline void spawn(TypeV_Core* core) {
+    const uint8_t dest = core->codePtr[core->ip++];
+    const uint8_t fn = core->codePtr[core->ip++];
+    ASSERT(dest < MAX_REG, "Invalid register index");
+    ASSERT(fn < MAX_REG, "Invalid register index");
+
+    core->regs[dest].u32 = engine_spawnCore(core->engineRef, core, core->regs[fn].ptr);
+    CLEAR_REG_PTR(core->funcState, dest);
+}
+
+static inline void msg_send(TypeV_Core* core) {
+    const uint8_t target = core->codePtr[core->ip++];
+    const uint8_t value = core->codePtr[core->ip++];
+    ASSERT(target < MAX_REG, "Invalid register index");
+    ASSERT(value < MAX_REG, "Invalid register index");
+
+    TypeV_Message* msg = mailbox_message_new(core, core->regs[value].u64, IS_REG_PTR(core->funcState, value) != 0);
+    engine_send(core->engineRef, core->regs[target].u32, msg);
+}
+
+static inline void msg_transfer(TypeV_Core* core) {
+    const uint8_t target = core->codePtr[core->ip++];
+    const uint8_t array = core->codePtr[core->ip++];
+    ASSERT(target < MAX_REG, "Invalid register index");
+    ASSERT(array < MAX_REG, "Invalid register index");
+
+    TypeV_Message* msg = mailbox_message_transfer(core, (TypeV_Array*)core->regs[array].ptr);
+    engine_send(core->engineRef, core->regs[target].u32, msg);
+}
+
+static inline void msg_deliver(TypeV_Core* core, uint8_t dest, TypeV_Message* msg) {
+    uint8_t isPointer = msg->isPointer;
+    core->regs[dest].u64 = mailbox_message_receive(core, msg);
+    if(isPointer) {
+        SET_REG_PTR(core->funcState, dest);
+    }
+    else {
+        CLEAR_REG_PTR(core->funcState, dest);
+    }
+}
+
+static inline void msg_recv(TypeV_Core* core) {
+    const uint8_t dest = core->codePtr[core->ip++];
+    ASSERT(dest < MAX_REG, "Invalid register index");
+
+    TypeV_Message* msg = mailbox_pop(core->mailbox);
+    if(msg == NULL) {
+        // announce the wait first, then look again: a message pushed meanwhile either shows up now,
+        // or its sender sees the flag and wakes the core up
+        atomic_store(&core->mailbox->parked, 1);
+        msg = mailbox_pop(core->mailbox);
+        if(msg == NULL) {
+            core->ip -= 2;
+            return;
+        }
+        atomic_store(&core->mailbox->parked, 0);
+    }
+    msg_deliver(core, dest, msg);
+}
+
+static inline void msg_try_recv(TypeV_Core* core) {
+    const uint8_t dest = core->codePtr[core->ip++];
+    const uint8_t ok = core->codePtr[core->ip++];
+    ASSERT(dest < MAX_REG, "Invalid register index");
+    ASSERT(ok < MAX_REG, "Invalid register index");
+
+    TypeV_Message* msg = mailbox_pop(core->mailbox);
+    core->regs[ok].u64 = msg != NULL;
+    CLEAR_REG_PTR(core->funcState, ok);
+    if(msg != NULL) {
+        msg_deliver(core, dest, msg);
+    }
+}
+
+static inline void a_share(TypeV_Core* core) {
+    const uint8_t dest = core->codePtr[core->ip++];
+    const uint8_t src = core->codePtr[core->ip++];
+    ASSERT(dest < MAX_REG, "Invalid register index");
+    ASSERT(src < MAX_REG, "Invalid register index");
+
+    core->regs[dest].ptr = core_array_share(core, (TypeV_Array*)core->regs[src].ptr);
+    SET_REG_PTR(core->funcState, dest);
+}
+
+static inline void sleep_ms(TypeV_Core* core) {
+    const uint8_t duration = core->codePtr[core->ip++];
+    ASSERT(duration < MAX_REG, "Invalid register index");
+
+    uint64_t ms = core->regs[duration].u64;
+    core->wakeAt = ms == 0 ? 0 : engine_clock() + (ms * 1000000ULL + ENGINE_CLOCK_TICK_NS - 1) / ENGINE_CLOCK_TICK_NS;
+}
+
+static inline void task_spawn(TypeV_Core* core) {
+    const uint8_t dest = core->codePtr[core->ip++];
+    const uint8_t fn = core->codePtr[core->ip++];
+    ASSERT(dest < MAX_REG, "Invalid register index");
+    ASSERT(fn < MAX_REG, "Invalid register index");
+
+    core->regs[dest].u32 = engine_spawnTask(core->engineRef, core, core->regs[fn].ptr);
+    CLEAR_REG_PTR(core->funcState, dest);
+}
+
+/**
+ * Ends a task with its result, which the engine hands to the joining core once the core is detached
+ */
+static inline void task_end(TypeV_Core* core, TypeV_Message* result) {
+    if(core->id == 1) {
+        // the main core is never a task, it has no result
+        cleanup_gc(core);
+        exit(0);
+    }
+    core->result = result;
+    core->exitCode = 0;
+    core->state = CS_TERMINATED;
+}
+
+static inline void task_return(TypeV_Core* core) {
+    const uint8_t value = core->codePtr[core->ip++];
+    ASSERT(value < MAX_REG, "Invalid register index");
+
+    if(core->joinerID == 0) {
+        task_end(core, NULL);
+        return;
+    }
+    task_end(core, mailbox_message_new(core, core->regs[value].u64, IS_REG_PTR(core->funcState, value) != 0));
+}
+
+static inline void task_transfer(TypeV_Core* core) {
+    const uint8_t array = core->codePtr[core->ip++];
+    ASSERT(array < MAX_REG, "Invalid register index");
+
+    if(core->joinerID == 0) {
+        task_end(core, NULL);
+        return;
+    }
+    task_end(core, mailbox_message_transfer(core, (TypeV_Array*)core->regs[array].ptr));
+}
+
+static inline void task_join(TypeV_Core* core) {
+    const uint8_t dest = core->codePtr[core->ip++];
+    const uint8_t task = core->codePtr[core->ip++];
+    const uint8_t ok = core->codePtr[core->ip++];
+    ASSERT(dest < MAX_REG, "Invalid register index");
+    ASSERT(task < MAX_REG, "Invalid register index");
+    ASSERT(ok < MAX_REG, "Invalid register index");
+
+    uint8_t pending;
+    TypeV_Message* msg = engine_task_join(core->engineRef, core, core->regs[task].u32, &pending);
+    if(msg == NULL) {
+        if(pending) {
+            core->ip -= 4;
+            return;
+        }
+        core->regs[dest].u64 = 0;
+        core->regs[ok].u64 = 0;
+        CLEAR_REG_PTR(core->funcState, dest);
+        CLEAR_REG_PTR(core->funcState, ok);
+        return;
+    }
+
+    core->regs[ok].u64 = msg->kind != MESSAGE_EXIT;
+    CLEAR_REG_PTR(core->funcState, ok);
+    msg_deliver(core, dest, msg);
+}
+
+static inline void core_class(TypeV_Core* core) {
+    const uint8_t sclass = core->codePtr[core->ip++];
+    const uint8_t weight = core->codePtr[core->ip++];
+    ASSERT(sclass < MAX_REG, "Invalid register index");
+    ASSERT(weight < MAX_REG, "Invalid register index");
+
+    engine_set_core_class(core, core->regs[sclass].u8, core->regs[weight].u8);
+}
+
 #endif //TYPE_V_INSTRUCTIONS_H
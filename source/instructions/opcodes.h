@@ -627,6 +627,96 @@ typedef enum TypeV_OpCode {
      */
     OP_THROW_USER_RT,
 
+    /**
+     * OP_SPAWN dest: R, fn: R
+     * Spawns a new core which starts running the function whose address is stored in fn, with no
+     * arguments. The new core shares the program, constants and globals of the current one, but has its
+     * own registers, stack and GC heap, and may run in parallel on another engine thread.
+     * Its ID is stored in dest (u32)
+     */
+    OP_SPAWN,
+
+    /**
+     * OP_MSG_SEND target: R, value: R
+     * Sends the value of register value to the core whose ID is stored in target (u32). If the register holds
+     * a pointer, the object graph it refers to is deep-copied into the message. Messages to a core which no
+     * longer exists are dropped
+     */
+    OP_MSG_SEND,
+
+    /**
+     * OP_MSG_RECV dest: R
+     * Receives the oldest message of the core mailbox into dest. If the mailbox is empty,
+     * the core waits, without using a thread, until a message arrives
+     */
+    OP_MSG_RECV,
+
+    /**
+     * OP_MSG_TRY_RECV dest: R, ok: R
+     * Same as OP_MSG_RECV but does not wait, ok (u8) is set to 1 if a message was received, 0 otherwise
+     */
+    OP_MSG_TRY_RECV,
+
+    /**
+     * OP_MSG_TRANSFER target: R, array: R
+     * Same as OP_MSG_SEND for an array of values, whose elements are moved to the receiver instead of copied.
+     * The array in register array is left empty
+     */
+    OP_MSG_TRANSFER,
+
+    /**
+     * OP_A_SHARE dest: R, src: R
+     * Creates a shared immutable copy of array src, which must not hold pointers, and stores it in dest.
+     * Sending it copies no element, storing into it is an error and growing it gives it a private copy
+     */
+    OP_A_SHARE,
+
+    /**
+     * OP_SLEEP duration: R
+     * Suspends the core for duration (u64) milliseconds, without using a thread. A zero duration gives the
+     * thread to another runnable core, if any
+     */
+    OP_SLEEP,
+
+    /**
+     * OP_CORE_CLASS class: R, weight: R
+     * Sets the scheduling class (u8, TypeV_SchedClass) and weight (u8) of the core, from the next time it
+     * is queued. Interactive cores run before the others, weights share the threads among the others.
+     * A zero weight is the default of the class. Cores spawned afterwards start with the same class and weight
+     */
+    OP_CORE_CLASS,
+
+    /**
+     * OP_TASK_SPAWN dest: R, fn: R
+     * Same as OP_SPAWN, but the new core is a task of the current one: the current core alone can join it,
+     * and receives its result once it ends. The task ID, its handle, is stored in dest (u32)
+     */
+    OP_TASK_SPAWN,
+
+    /**
+     * OP_TASK_RETURN value: R
+     * Ends the core with the value of register value as the result of the task. If the register holds a
+     * pointer, the object graph it refers to is deep-copied as OP_MSG_SEND does. On a core which is not a
+     * task, the value is dropped and the core ends as with OP_HALT and a zero exit code
+     */
+    OP_TASK_RETURN,
+
+    /**
+     * OP_TASK_TRANSFER array: R
+     * Same as OP_TASK_RETURN for an array of values, whose elements are moved to the joining core instead of
+     * copied, as OP_MSG_TRANSFER does
+     */
+    OP_TASK_TRANSFER,
+
+    /**
+     * OP_TASK_JOIN dest: R, task: R, ok: R
+     * Waits, without using a thread, until the task whose ID is stored in task (u32) ends. If it returned a
+     * result, it is stored in dest and ok (u8) is set to 1. If it ended otherwise (halt, crash, kill), its
+     * exit code (u32) is stored in dest and ok is set to 0. A task can be joined once, joining an ID which
+     * is not a task of the core sets dest and ok to 0 right away
+     */
+    OP_TASK_JOIN,
+
 }TypeV_OpCode;
 
 #endif //TYPE_V_OPCODES_H
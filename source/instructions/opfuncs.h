@@ -264,6 +264,18 @@ static op_func op_funcs[] = {
         &coroutine_finish,
         &throw_rt,
         &throw_user_rt,
+        &spawn,
+        &msg_send,
+        &msg_recv,
+        &msg_try_recv,
+        &msg_transfer,
+        &a_share,
+        &sleep_ms,
+        &core_class,
+        &task_spawn,
+        &task_return,
+        &task_transfer,
+        &task_join,
 };
 
 #endif //TYPE_V_OPFUNCS_H
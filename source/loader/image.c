@@ -0,0 +1,192 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include "image.h"
+#include "../assembler/assembler.h"
+#include "../platform/memory.h"
+
+// Segments of a version 1 image, in the order of their offsets in the header
+typedef enum {
+    IMAGE_V1_CONSTANT = 0,
+    IMAGE_V1_GLOBAL,
+    IMAGE_V1_TEMPLATE,
+    IMAGE_V1_OBJECT_KEYS,
+    IMAGE_V1_CODE,
+    IMAGE_V1_SEGMENTS
+} TypeV_ImageV1Segment;
+
+#define IMAGE_V1_HEADER_SIZE (IMAGE_V1_SEGMENTS * sizeof(uint64_t))
+
+// Object keys of an image which has none
+static const char image_no_object_keys[] = "{}";
+
+/**
+ * Reads the sections of a version 1 image: each segment runs up to the nearest following offset, the first
+ * of two segments at the same offset being the empty one
+ */
+static int image_read_v1(const char* path, const TypeV_FileMapping* file, TypeV_ImageSection sections[IMAGE_V1_SEGMENTS]) {
+    if(file->size < IMAGE_V1_HEADER_SIZE) {
+        fprintf(stderr, "Invalid image %s: %zu bytes, smaller than its header\n", path, file->size);
+        return 1;
+    }
+
+    uint64_t offsets[IMAGE_V1_SEGMENTS];
+    memcpy(offsets, file->data, sizeof(offsets));
+    for(uint32_t i = 0; i < IMAGE_V1_SEGMENTS; i++) {
+        if(offsets[i] < IMAGE_V1_HEADER_SIZE || offsets[i] > file->size) {
+            fprintf(stderr, "Invalid image %s: segment %u at offset %llu, outside of the %zu bytes file\n",
+                    path, i, (unsigned long long)offsets[i], file->size);
+            return 1;
+        }
+    }
+
+    for(uint32_t i = 0; i < IMAGE_V1_SEGMENTS; i++) {
+        uint64_t end = file->size;
+        for(uint32_t j = 0; j < IMAGE_V1_SEGMENTS; j++) {
+            uint8_t after = offsets[j] > offsets[i] || (offsets[j] == offsets[i] && j > i);
+            if(after && offsets[j] < end) {
+                end = offsets[j];
+            }
+        }
+        memset(&sections[i], 0, sizeof(TypeV_ImageSection));
+        sections[i].kind = IMAGE_SECTION_CONSTANT + i;
+        sections[i].offset = offsets[i];
+        sections[i].size = end - offsets[i];
+        sections[i].alignment = 1;
+    }
+    return 0;
+}
+
+/**
+ * Reads the sections of a version 2 image, only the known ones. Missing sections are left empty
+ * @param sections Indexed by kind - 1
+ */
+static int image_read_v2(const char* path, const TypeV_FileMapping* file, TypeV_ImageSection sections[IMAGE_V1_SEGMENTS]) {
+    TypeV_ImageHeader header;
+    if(file->size < sizeof(header)) {
+        fprintf(stderr, "Invalid image %s: %zu bytes, smaller than its header\n", path, file->size);
+        return 1;
+    }
+    memcpy(&header, file->data, sizeof(header));
+    if(header.version != IMAGE_VERSION) {
+        fprintf(stderr, "Unsupported image %s: version %u, this VM runs versions 1 and %u\n", path, header.version, IMAGE_VERSION);
+        return 1;
+    }
+    if(header.flags != 0) {
+        fprintf(stderr, "Unsupported image %s: header flags 0x%x, none are defined\n", path, header.flags);
+        return 1;
+    }
+    if(header.headerSize < sizeof(header) || header.sectionSize < sizeof(TypeV_ImageSection) ||
+       header.headerSize + (uint64_t)header.sectionCount * header.sectionSize > file->size) {
+        fprintf(stderr, "Invalid image %s: section table outside of the %zu bytes file\n", path, file->size);
+        return 1;
+    }
+
+    memset(sections, 0, IMAGE_V1_SEGMENTS * sizeof(TypeV_ImageSection));
+    for(uint16_t k = 0; k < header.sectionCount; k++) {
+        TypeV_ImageSection section;
+        memcpy(&section, file->data + header.headerSize + (size_t)k * header.sectionSize, sizeof(section));
+        if(section.kind < IMAGE_SECTION_CONSTANT || section.kind > IMAGE_SECTION_CODE) {
+            continue;
+        }
+
+        if(section.offset > file->size || section.size > file->size - section.offset) {
+            fprintf(stderr, "Invalid image %s: section %u at [%llu, +%llu), outside of the %zu bytes file\n", path,
+                    section.kind, (unsigned long long)section.offset, (unsigned long long)section.size, file->size);
+            return 1;
+        }
+        if(section.alignment == 0 || (section.alignment & (section.alignment - 1)) != 0 ||
+           section.alignment > IMAGE_MAX_ALIGNMENT || section.offset % section.alignment != 0) {
+            fprintf(stderr, "Invalid image %s: section %u at offset %llu, not aligned to %u\n", path,
+                    section.kind, (unsigned long long)section.offset, section.alignment);
+            return 1;
+        }
+        if(section.reserved != 0) {
+            fprintf(stderr, "Invalid image %s: section %u has reserved field 0x%x, must be 0\n", path, section.kind, section.reserved);
+            return 1;
+        }
+        if(section.flags & IMAGE_SECTION_ALIGNED_OPERANDS) {
+            fprintf(stderr, "Unsupported image %s: code with aligned operands, which this VM does not decode yet\n", path);
+            return 1;
+        }
+        if(section.flags != 0) {
+            fprintf(stderr, "Unsupported image %s: section %u has flags 0x%x, none are defined\n", path, section.kind, section.flags);
+            return 1;
+        }
+        if(sections[section.kind - 1].kind != 0) {
+            fprintf(stderr, "Invalid image %s: section %u appears twice\n", path, section.kind);
+            return 1;
+        }
+        sections[section.kind - 1] = section;
+    }
+
+    if(sections[IMAGE_SECTION_CODE - 1].kind == 0) {
+        fprintf(stderr, "Invalid image %s: no code section\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+int typev_image_map(const char* path, TypeV_ASM_Program* program) {
+    TypeV_FileMapping file;
+    if(typev_file_map(path, &file) != 0) {
+        perror("Error opening file");
+        return 1;
+    }
+
+    // indexed by kind - 1, in the order of the version 1 segments
+    TypeV_ImageSection sections[IMAGE_V1_SEGMENTS];
+    uint8_t version = 1;
+    if(file.size >= IMAGE_MAGIC_SIZE && memcmp(file.data, IMAGE_MAGIC, IMAGE_MAGIC_SIZE) == 0) {
+        version = IMAGE_VERSION;
+    }
+    if((version == 1 ? image_read_v1(path, &file, sections) : image_read_v2(path, &file, sections)) != 0) {
+        typev_file_close(&file);
+        typev_file_unmap(&file);
+        return 1;
+    }
+
+    const TypeV_ImageSection* globals = &sections[IMAGE_SECTION_GLOBAL - 1];
+    uint8_t* globalPool = (uint8_t*)file.data + globals->offset;
+    if(globals->size > 0) {
+        globalPool = typev_file_map_private(&file, globals->offset, globals->size);
+        if(globalPool == NULL) {
+            perror("Error mapping globals");
+            typev_file_close(&file);
+            typev_file_unmap(&file);
+            return 1;
+        }
+    }
+    typev_file_close(&file);
+
+    const TypeV_ImageSection* keys = &sections[IMAGE_SECTION_OBJECT_KEYS - 1];
+    program->version = version;
+    program->constPool = (uint8_t*)file.data + sections[IMAGE_SECTION_CONSTANT - 1].offset;
+    program->constPoolSize = sections[IMAGE_SECTION_CONSTANT - 1].size;
+    program->globalPool = globalPool;
+    program->globalPoolSize = globals->size;
+    program->templatePool = (uint8_t*)file.data + sections[IMAGE_SECTION_TEMPLATE - 1].offset;
+    program->templatePoolSize = sections[IMAGE_SECTION_TEMPLATE - 1].size;
+    program->objKeysPool = keys->size > 0 ? (uint8_t*)file.data + keys->offset : (uint8_t*)image_no_object_keys;
+    program->objKeysPoolSize = keys->size > 0 ? keys->size : sizeof(image_no_object_keys) - 1;
+    program->codePool = (uint8_t*)file.data + sections[IMAGE_SECTION_CODE - 1].offset;
+    program->codePoolSize = sections[IMAGE_SECTION_CODE - 1].size;
+    program->image = file.data;
+    program->imageSize = file.size;
+    program->globalOffset = globals->offset;
+    return 0;
+}
+
+void typev_image_unmap(TypeV_ASM_Program* program) {
+    if(program->globalPoolSize > 0) {
+        typev_file_unmap_private(program->globalPool, program->globalOffset, program->globalPoolSize);
+    }
+    TypeV_FileMapping file = {.data = program->image, .size = program->imageSize};
+    typev_file_unmap(&file);
+    program->image = NULL;
+    program->globalPool = NULL;
+    program->globalPoolSize = 0;
+}
@@ -0,0 +1,91 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+#ifndef TYPE_V_IMAGE_H
+#define TYPE_V_IMAGE_H
+
+#include <stdint.h>
+
+struct TypeV_ASM_Program;
+
+/**
+ * .tcv program images. All integers are little-endian.
+ *
+ * Version 1 is five uint64_t offsets, of the constant, global, template, object keys and code segments, followed
+ * by the segments. Each one runs up to the next offset, the last one up to the end of the file.
+ *
+ * Version 2 starts with a TypeV_ImageHeader. The section table follows at headerSize bytes from the start of the
+ * file, sectionCount entries of sectionSize bytes each, see TypeV_ImageSection. Each section starts at a multiple
+ * of its alignment, a power of two of at most IMAGE_MAX_ALIGNMENT bytes, which it keeps once loaded. Loaders skip
+ * the sections whose kind they do not know, as well as the header and section fields past the ones they know,
+ * so that sections and fields can be added without breaking them. The header flags and the flags and reserved
+ * field of the known sections must be 0: they change how the image is read, a loader rejects what it does not
+ * know there. A version 2 image needs a code section, the other sections are empty when missing.
+ *
+ * Images are mapped, not read: see typev_image_map.
+ */
+
+/** First bytes of a version 2 image. Read as the first offset of a version 1 image, it lies far past its end */
+#define IMAGE_MAGIC "\x7fTCV"
+#define IMAGE_MAGIC_SIZE 4
+
+#define IMAGE_VERSION 2
+
+/** Alignment sections can ask for, mappings keep it as long as it does not exceed the page size */
+#define IMAGE_MAX_ALIGNMENT 4096
+
+typedef struct TypeV_ImageHeader {
+    uint8_t magic[IMAGE_MAGIC_SIZE]; ///< IMAGE_MAGIC
+    uint16_t version;                ///< IMAGE_VERSION
+    uint16_t sectionCount;
+    uint16_t headerSize;             ///< Offset of the section table
+    uint16_t sectionSize;            ///< Size of a section table entry
+    uint32_t flags;                  ///< None defined yet, images with any set are rejected
+} TypeV_ImageHeader;
+
+typedef enum {
+    IMAGE_SECTION_CONSTANT = 1,
+    IMAGE_SECTION_GLOBAL = 2,
+    IMAGE_SECTION_TEMPLATE = 3,
+    IMAGE_SECTION_OBJECT_KEYS = 4,
+    IMAGE_SECTION_CODE = 5,
+} TypeV_ImageSectionKind;
+
+typedef enum {
+    /**
+     * Code only: the 2, 4 and 8 byte operands of every instruction sit at an offset from the start of the
+     * section which is a multiple of their size, the compiler pads instructions to that end. Reserved for that
+     * encoding: the instruction handlers do not skip the padding yet, images setting it are rejected
+     */
+    IMAGE_SECTION_ALIGNED_OPERANDS = 1 << 0,
+} TypeV_ImageSectionFlags;
+
+typedef struct TypeV_ImageSection {
+    uint32_t kind;                   ///< TypeV_ImageSectionKind
+    uint32_t flags;                  ///< TypeV_ImageSectionFlags, none is supported yet, must be 0
+    uint64_t offset;                 ///< From the start of the file
+    uint64_t size;
+    uint32_t alignment;              ///< Power of two, at most IMAGE_MAX_ALIGNMENT, offset is a multiple of it
+    uint32_t reserved;               ///< Must be 0
+} TypeV_ImageSection;
+
+/**
+ * Maps a version 1 or 2 image. Code, constants, templates and object keys are read in place from a read-only
+ * mapping of the file, shared through the page cache by every process running it. Globals are written to, they
+ * get a copy-on-write mapping of their own. Every offset and size is checked against the file size, errors are
+ * reported on stderr. The image stays mapped until typev_image_unmap.
+ * @param path
+ * @param program Set to the segments of the image, and its version
+ * @return 0 on success, 1 if the file cannot be mapped or is not a valid image
+ */
+int typev_image_map(const char* path, struct TypeV_ASM_Program* program);
+
+/**
+ * Unmaps an image mapped by typev_image_map, once no core runs its code anymore. The pools of the program are
+ * no longer valid afterwards
+ * @param program
+ */
+void typev_image_unmap(struct TypeV_ASM_Program* program);
+
+#endif //TYPE_V_IMAGE_H
@@ -0,0 +1,413 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "mailbox.h"
+#include "../core.h"
+#include "../gc/gc.h"
+#include "../gc/mark.h"
+#include "../gc/los.h"
+#include "../errors/errors.h"
+
+/**
+ * Message layout: the objects are stored in index order, each one as a copy of its header and payload
+ * (cells * CELL_SIZE bytes), followed for arrays with an out-of-line payload by their length * elementSize
+ * bytes of elements, padded to a cell. Pointer slots hold the index + 1 of their target, 0 for null.
+ * Shared arrays keep pointing at their buffer, the message holds a reference to it.
+ */
+
+void mailbox_init(TypeV_Mailbox* mailbox) {
+    atomic_init(&mailbox->stub.next, NULL);
+    atomic_init(&mailbox->head, &mailbox->stub);
+    mailbox->tail = &mailbox->stub;
+    atomic_init(&mailbox->parked, 0);
+    mailbox->results = NULL;
+    mailbox->resultsTail = NULL;
+}
+
+void mailbox_free(TypeV_Mailbox* mailbox) {
+    TypeV_Message* msg;
+    while((msg = mailbox_pop(mailbox)) != NULL) {
+        mailbox_message_free(msg);
+    }
+    while(mailbox->results != NULL) {
+        msg = mailbox->results;
+        mailbox->results = atomic_load_explicit(&msg->next, memory_order_relaxed);
+        mailbox_message_free(msg);
+    }
+    mailbox->resultsTail = NULL;
+}
+
+void mailbox_push(TypeV_Mailbox* mailbox, TypeV_Message* msg) {
+    atomic_store_explicit(&msg->next, NULL, memory_order_relaxed);
+    TypeV_Message* prev = atomic_exchange_explicit(&mailbox->head, msg, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, msg, memory_order_release);
+}
+
+TypeV_Message* mailbox_pop(TypeV_Mailbox* mailbox) {
+    TypeV_Message* tail = mailbox->tail;
+    TypeV_Message* next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    if(tail == &mailbox->stub) {
+        if(next == NULL) {
+            return NULL;
+        }
+        mailbox->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&next->next, memory_order_acquire);
+    }
+
+    if(next != NULL) {
+        mailbox->tail = next;
+        return tail;
+    }
+
+    // tail is the last message, unless a producer is between its swap and its link
+    if(tail != atomic_load_explicit(&mailbox->head, memory_order_acquire)) {
+        return NULL;
+    }
+
+    // put the stub back behind it, so that tail can be handed out
+    mailbox_push(mailbox, &mailbox->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if(next != NULL) {
+        mailbox->tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
+
+
+/* ======================= COPY ======================= */
+
+typedef struct TypeV_CopyMap {
+    TypeV_ObjectHeader** keys;   // Open addressing, NULL for free slots
+    uint32_t* indices;
+    size_t capacity;             // Power of two
+    TypeV_ObjectHeader** objects; // Objects in index order, also the scan queue
+    size_t count;
+    size_t objectsCapacity;
+    size_t bytes;                // Size of the message data
+    TypeV_Core* core;
+} TypeV_CopyMap;
+
+static inline size_t copy_map_slot(TypeV_CopyMap* map, TypeV_ObjectHeader* obj) {
+    return (size_t)(((uintptr_t)obj >> 4) * 0x9E3779B97F4A7C15ULL) & (map->capacity - 1);
+}
+
+/** Payload storage of an array, ARRAY_STORAGE_INLINE for other objects */
+static inline uint8_t copy_storage(TypeV_ObjectHeader* obj) {
+    return obj->type == OT_ARRAY ? ((TypeV_Array*)(obj + 1))->storage : ARRAY_STORAGE_INLINE;
+}
+
+/** Whether the message carries a copy of an out-of-line payload, shared ones are referenced instead */
+static inline uint8_t copy_is_outofline(TypeV_ObjectHeader* obj) {
+    uint8_t storage = copy_storage(obj);
+    return storage == ARRAY_STORAGE_HEAP || storage == ARRAY_STORAGE_LARGE;
+}
+
+/** Bytes of elements a message carries after an array record */
+static inline size_t copy_outofline_bytes(TypeV_ObjectHeader* obj) {
+    if(!copy_is_outofline(obj)) {
+        return 0;
+    }
+    TypeV_Array* array = (TypeV_Array*)(obj + 1);
+    return array->length * array->elementSize;
+}
+
+static inline size_t copy_round_cell(size_t bytes) {
+    return (bytes + CELL_SIZE - 1) & ~(size_t)(CELL_SIZE - 1);
+}
+
+static void copy_map_grow(TypeV_CopyMap* map) {
+    TypeV_ObjectHeader** keys = map->keys;
+    uint32_t* indices = map->indices;
+    size_t capacity = map->capacity;
+
+    map->capacity *= 2;
+    map->keys = calloc(map->capacity, sizeof(TypeV_ObjectHeader*));
+    map->indices = malloc(map->capacity * sizeof(uint32_t));
+    for(size_t k = 0; k < capacity; k++) {
+        if(keys[k] != NULL) {
+            size_t slot = copy_map_slot(map, keys[k]);
+            while(map->keys[slot] != NULL) {
+                slot = (slot + 1) & (map->capacity - 1);
+            }
+            map->keys[slot] = keys[k];
+            map->indices[slot] = indices[k];
+        }
+    }
+    free(keys);
+    free(indices);
+}
+
+/** Returns the index of an object, adding it to the message the first time it is seen */
+static uint32_t copy_map_index(TypeV_CopyMap* map, TypeV_ObjectHeader* obj) {
+    size_t slot = copy_map_slot(map, obj);
+    while(map->keys[slot] != NULL) {
+        if(map->keys[slot] == obj) {
+            return map->indices[slot];
+        }
+        slot = (slot + 1) & (map->capacity - 1);
+    }
+
+    if(obj->type == OT_COROUTINE || obj->type == OT_USER_OBJECT) {
+        core_panic(map->core, RT_ERROR_NOT_SENDABLE, "%s objects cannot be sent to another core",
+                   obj->type == OT_COROUTINE ? "Coroutine" : "User");
+    }
+
+    uint32_t index = (uint32_t)map->count;
+    map->keys[slot] = obj;
+    map->indices[slot] = index;
+
+    if(map->count == map->objectsCapacity) {
+        map->objectsCapacity *= 2;
+        map->objects = realloc(map->objects, map->objectsCapacity * sizeof(TypeV_ObjectHeader*));
+    }
+    map->objects[map->count++] = obj;
+    map->bytes += GC_OBJ_BYTES(obj) + copy_round_cell(copy_outofline_bytes(obj));
+
+    if(map->count * 2 > map->capacity) {
+        copy_map_grow(map);
+    }
+    return index;
+}
+
+static uint8_t copy_discover_slot(void* ctx, void* slot) {
+    uintptr_t ptr;
+    memcpy(&ptr, slot, sizeof(uintptr_t));
+    if(ptr != 0) {
+        copy_map_index((TypeV_CopyMap*)ctx, GET_OBJ_HEADER(ptr));
+    }
+    return 0;
+}
+
+static uint8_t copy_encode_slot(void* ctx, void* slot) {
+    uintptr_t ptr;
+    memcpy(&ptr, slot, sizeof(uintptr_t));
+    if(ptr != 0) {
+        ptr = (uintptr_t)copy_map_index((TypeV_CopyMap*)ctx, GET_OBJ_HEADER(ptr)) + 1;
+        memcpy(slot, &ptr, sizeof(uintptr_t));
+    }
+    return 0;
+}
+
+static uint8_t copy_decode_slot(void* ctx, void* slot) {
+    uintptr_t ptr;
+    memcpy(&ptr, slot, sizeof(uintptr_t));
+    if(ptr != 0) {
+        ptr = (uintptr_t)(((TypeV_ObjectHeader**)ctx)[ptr - 1] + 1);
+        memcpy(slot, &ptr, sizeof(uintptr_t));
+    }
+    return 0;
+}
+
+TypeV_Message* mailbox_message_new(TypeV_Core* core, uint64_t value, uint8_t isPointer) {
+    if(!isPointer || value == 0) {
+        TypeV_Message* msg = malloc(sizeof(TypeV_Message));
+        msg->sender = core->id;
+        msg->kind = MESSAGE_COPY;
+        msg->count = 0;
+        msg->value = value;
+        msg->isPointer = isPointer;
+        msg->size = 0;
+        return msg;
+    }
+
+    TypeV_CopyMap map;
+    map.capacity = 64;
+    map.keys = calloc(map.capacity, sizeof(TypeV_ObjectHeader*));
+    map.indices = malloc(map.capacity * sizeof(uint32_t));
+    map.objectsCapacity = 16;
+    map.objects = malloc(map.objectsCapacity * sizeof(TypeV_ObjectHeader*));
+    map.count = 0;
+    map.bytes = 0;
+    map.core = core;
+
+    // breadth-first, the object list is the queue
+    copy_map_index(&map, GET_OBJ_HEADER(value));
+    for(size_t k = 0; k < map.count; k++) {
+        gc_visit_object_slots(map.objects[k], copy_discover_slot, &map);
+    }
+
+    // the receiver allocates all the objects at once, in its nursery
+    size_t cells = 0;
+    for(size_t k = 0; k < map.count; k++) {
+        cells += map.objects[k]->cells;
+    }
+    if(cells > NURSERY_MAX_CELLS) {
+        core_panic(core, RT_ERROR_ENTITY_TOO_LARGE, "Message of %zu objects is too large to be sent", map.count);
+    }
+
+    TypeV_Message* msg = malloc(sizeof(TypeV_Message) + map.bytes);
+    msg->sender = core->id;
+    msg->kind = MESSAGE_COPY;
+    msg->count = (uint32_t)map.count;
+    msg->value = 1;
+    msg->isPointer = 1;
+    msg->size = map.bytes;
+
+    uint8_t* p = msg->data;
+    for(size_t k = 0; k < map.count; k++) {
+        TypeV_ObjectHeader* obj = map.objects[k];
+        TypeV_ObjectHeader* copy = (TypeV_ObjectHeader*)p;
+        size_t bytes = GC_OBJ_BYTES(obj);
+        size_t outOfLine = copy_outofline_bytes(obj);
+
+        memcpy(copy, obj, bytes);
+        gc_recompute_pointers(copy);
+        if(copy_is_outofline(copy)) {
+            TypeV_Array* array = (TypeV_Array*)(copy + 1);
+            memcpy(p + bytes, array->data, outOfLine);
+            array->data = p + bytes;
+        }
+        else if(copy_storage(copy) == ARRAY_STORAGE_SHARED) {
+            gc_shared_buffer_retain(gc_shared_buffer_of(((TypeV_Array*)(copy + 1))->data));
+        }
+        gc_visit_object_slots(copy, copy_encode_slot, &map);
+
+        p += bytes + copy_round_cell(outOfLine);
+    }
+
+    free(map.keys);
+    free(map.indices);
+    free(map.objects);
+    return msg;
+}
+
+TypeV_Message* mailbox_message_exit(uint32_t sender, uint32_t exitCode) {
+    TypeV_Message* msg = malloc(sizeof(TypeV_Message));
+    msg->sender = sender;
+    msg->kind = MESSAGE_EXIT;
+    msg->count = 0;
+    msg->value = exitCode;
+    msg->isPointer = 0;
+    msg->size = 0;
+    return msg;
+}
+
+TypeV_Message* mailbox_message_transfer(TypeV_Core* core, TypeV_Array* array) {
+    if(array == NULL) {
+        core_panic(core, RT_ERROR_NULL_POINTER, "Cannot transfer null array");
+    }
+    if(array->isPointerContainer) {
+        core_panic(core, RT_ERROR_NOT_SENDABLE, "Arrays of pointers cannot be transferred, only copied");
+    }
+
+    TypeV_Message* msg = malloc(sizeof(TypeV_Message) + sizeof(TypeV_Array));
+    msg->sender = core->id;
+    msg->kind = MESSAGE_TRANSFER;
+    msg->count = 0;
+    msg->value = 0;
+    msg->isPointer = 1;
+    msg->size = sizeof(TypeV_Array);
+
+    TypeV_Array* record = (TypeV_Array*)msg->data;
+    *record = *array;
+
+    size_t bytes;
+    uint8_t storage;
+    void* data = gc_array_storage_detach(core, array, &bytes, &storage);
+    if(data == NULL) {
+        // inline payloads move with their array, they are small enough to be copied out
+        bytes = array->length * array->elementSize;
+        data = malloc(bytes ? bytes : 1);
+        memcpy(data, array->data, bytes);
+        storage = ARRAY_STORAGE_HEAP;
+        array->length = 0;
+    }
+    record->data = data;
+    record->capacity = bytes;
+    record->storage = storage;
+    return msg;
+}
+
+void mailbox_message_free(TypeV_Message* msg) {
+    if(msg->kind == MESSAGE_TRANSFER) {
+        TypeV_Array* record = (TypeV_Array*)msg->data;
+        gc_array_storage_release(record->data, record->capacity, record->storage);
+    }
+    else {
+        uint8_t* p = msg->data;
+        for(uint32_t k = 0; k < msg->count; k++) {
+            TypeV_ObjectHeader* copy = (TypeV_ObjectHeader*)p;
+            if(copy_storage(copy) == ARRAY_STORAGE_SHARED) {
+                gc_shared_buffer_release(gc_shared_buffer_of(((TypeV_Array*)(copy + 1))->data));
+            }
+            p += GC_OBJ_BYTES(copy) + copy_round_cell(copy_outofline_bytes(copy));
+        }
+    }
+    free(msg);
+}
+
+uint64_t mailbox_message_receive(TypeV_Core* core, TypeV_Message* msg) {
+    if(msg->kind == MESSAGE_TRANSFER) {
+        TypeV_Array* record = (TypeV_Array*)msg->data;
+        TypeV_Array* array = (TypeV_Array*)core_array_alloc(core, 0, 0, record->elementSize);
+        gc_array_storage_attach(core, array, record->data, record->capacity, record->storage);
+        array->length = record->length;
+        array->uid = record->uid;
+        free(msg);
+        return (uint64_t)(uintptr_t)array;
+    }
+
+    if(msg->count == 0) {
+        uint64_t value = msg->value;
+        free(msg);
+        return value;
+    }
+
+    size_t* sizes = malloc(msg->count * sizeof(size_t));
+    TypeV_ObjectHeader** objects = malloc(msg->count * sizeof(TypeV_ObjectHeader*));
+
+    uint8_t* p = msg->data;
+    for(uint32_t k = 0; k < msg->count; k++) {
+        TypeV_ObjectHeader* copy = (TypeV_ObjectHeader*)p;
+        sizes[k] = GC_OBJ_BYTES(copy);
+        p += sizes[k] + copy_round_cell(copy_outofline_bytes(copy));
+    }
+
+    // a single allocation, so that no collection moves the objects before they are linked
+    gc_alloc_group(core, sizes, msg->count, objects);
+
+    p = msg->data;
+    for(uint32_t k = 0; k < msg->count; k++) {
+        TypeV_ObjectHeader* copy = (TypeV_ObjectHeader*)p;
+        TypeV_ObjectHeader* obj = objects[k];
+        size_t outOfLine = copy_outofline_bytes(copy);
+
+        obj->type = copy->type;
+        memcpy(obj + 1, copy + 1, sizes[k] - sizeof(TypeV_ObjectHeader));
+        gc_recompute_pointers(obj);
+
+        if(copy_is_outofline(copy)) {
+            TypeV_Array* array = (TypeV_Array*)(obj + 1);
+            array->storage = ARRAY_STORAGE_INLINE;
+            if(!gc_array_storage_alloc(core, array, outOfLine)) {
+                core_panic(core, RT_ERROR_OOM, "Could not allocate %zu bytes for a received array", outOfLine);
+            }
+            memcpy(array->data, p + sizes[k], outOfLine);
+        }
+        else if(copy_storage(copy) == ARRAY_STORAGE_SHARED) {
+            // the reference of the message goes to the array
+            TypeV_Array* array = (TypeV_Array*)(obj + 1);
+            array->storage = ARRAY_STORAGE_INLINE;
+            gc_array_storage_attach(core, array, ((TypeV_Array*)(copy + 1))->data, array->capacity, ARRAY_STORAGE_SHARED);
+        }
+
+        p += sizes[k] + copy_round_cell(outOfLine);
+    }
+
+    for(uint32_t k = 0; k < msg->count; k++) {
+        gc_visit_object_slots(objects[k], copy_decode_slot, objects);
+    }
+
+    uint64_t value = (uint64_t)(uintptr_t)(objects[msg->value - 1] + 1);
+    free(sizes);
+    free(objects);
+    free(msg);
+    return value;
+}
@@ -0,0 +1,100 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+#ifndef TYPE_V_MAILBOX_H
+#define TYPE_V_MAILBOX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+struct TypeV_Core;
+struct TypeV_Array;
+
+/**
+ * Message passing between cores. Every core owns a mailbox, a lock-free multi-producer single-consumer
+ * queue (Vyukov): any core may push, only the owner pops.
+ *
+ * Cores do not share heaps, so a message carries a flat copy of the object graph it was sent with.
+ * The sender copies every object reachable from the sent value into one malloc'd buffer, pointers
+ * being replaced by object indices. The receiver allocates the whole graph at once in its own heap
+ * and links it back. Coroutines and user objects hold state outside of the heap and cannot be sent.
+ * Shared arrays are not copied, the message and then the receiver take a reference to their buffer.
+ *
+ * Arrays of values can be transferred instead of copied: the payload changes owner without being copied,
+ * and the sender is left with an empty array.
+ *
+ * The result of a task, a core spawned by OP_TASK_SPAWN, is a message too. It is not queued but kept in the
+ * mailbox of the spawning core until that core joins the task.
+ */
+
+typedef enum TypeV_MessageKind {
+    MESSAGE_COPY = 0,            // Copy of a value and the object graph it refers to
+    MESSAGE_TRANSFER,            // Array whose payload is moved, data holds a TypeV_Array owning it
+    MESSAGE_EXIT,                // End of a task which returned no result, value holds its exit code
+} TypeV_MessageKind;
+
+typedef struct TypeV_Message {
+    _Atomic(struct TypeV_Message*) next;
+    uint32_t sender;             // ID of the sending core
+    uint8_t kind;                // TypeV_MessageKind
+    uint32_t count;              // Number of objects in data, 0 for a scalar message
+    uint64_t value;              // Scalar value, or index + 1 of the root object, 0 for null
+    uint8_t isPointer;           // Whether value refers to an object
+    size_t size;                 // Bytes used in data
+    _Alignas(16) uint8_t data[]; // Object records, see mailbox.c
+} TypeV_Message;
+
+typedef struct TypeV_Mailbox {
+    _Atomic(TypeV_Message*) head; // Last pushed message, producers swap it
+    TypeV_Message* tail;          // Next message to pop, owned by the receiver
+    TypeV_Message stub;
+    _Atomic uint8_t parked;       // Set by a receiver about to wait, cleared by the sender which wakes it
+    TypeV_Message* results;       // Results of the tasks which ended and were not joined yet, oldest first, protected by the engine lock
+    TypeV_Message* resultsTail;
+} TypeV_Mailbox;
+
+void mailbox_init(TypeV_Mailbox* mailbox);
+
+/** Frees the messages and task results which were never received */
+void mailbox_free(TypeV_Mailbox* mailbox);
+
+/** Frees a message which will not be received, along with the payloads it owns */
+void mailbox_message_free(TypeV_Message* msg);
+
+/** Enqueues a message, safe from any thread */
+void mailbox_push(TypeV_Mailbox* mailbox, TypeV_Message* msg);
+
+/**
+ * Dequeues the oldest message, owner only.
+ * @return NULL if the mailbox is empty, or if the message pushed last is not linked in yet
+ */
+TypeV_Message* mailbox_pop(TypeV_Mailbox* mailbox);
+
+/**
+ * Copies `value` and, if it is a pointer, the object graph it refers to, into a new message.
+ * Panics if the graph holds a coroutine or a user object.
+ */
+TypeV_Message* mailbox_message_new(struct TypeV_Core* core, uint64_t value, uint8_t isPointer);
+
+/**
+ * Creates the result of a task which ended without returning one.
+ * @param sender ID of the task core
+ * @param exitCode
+ */
+TypeV_Message* mailbox_message_exit(uint32_t sender, uint32_t exitCode);
+
+/**
+ * Moves the payload of `array` into a new message, leaving `array` empty.
+ * Panics if the array holds pointers.
+ */
+TypeV_Message* mailbox_message_transfer(struct TypeV_Core* core, struct TypeV_Array* array);
+
+/**
+ * Rebuilds the content of a message in the heap of `core` and frees the message.
+ * @return the scalar value, or the address of the copied root object
+ */
+uint64_t mailbox_message_receive(struct TypeV_Core* core, TypeV_Message* msg);
+
+#endif //TYPE_V_MAILBOX_H
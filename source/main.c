@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 
 #include "utils/log.h"
@@ -7,6 +8,7 @@
 
 #include "engine.h"
 #include "platform/platform.h"
+#include "loader/image.h"
 #include "instructions/instructions.h"
 #include "assembler/assembler.h"
 #include "api/typev_api.h"
@@ -28,7 +30,6 @@ char* read_file(char* src){
     return buffer;
 }
 
-uint8_t *readSegment(FILE *file, uint64_t offset, size_t size);
 char* replace_with_src_map(const char* filepath);
 
 int main(int argc, char **argv) {
@@ -49,57 +50,17 @@ int main(int argc, char **argv) {
     }
 
 
-    FILE *file = fopen(filePath, "rb");
-    if (file == NULL) {
-        perror("Error opening file");
+    TypeV_ASM_Program program = {0};
+    if (typev_image_map(filePath, &program) != 0) {
         return 1;
     }
 
-    // Read offsets
-    uint64_t constantOffset, globalOffset, templateOffset, objectKeysOffset, codeOffset;
-    fread(&constantOffset, sizeof(uint64_t), 1, file);
-    fread(&globalOffset, sizeof(uint64_t), 1, file);
-    fread(&templateOffset, sizeof(uint64_t), 1, file);
-    fread(&objectKeysOffset, sizeof(uint64_t), 1, file);
-    fread(&codeOffset, sizeof(uint64_t), 1, file);
-
-    // Calculate segment sizes
-    size_t constantSize = globalOffset - constantOffset;
-    size_t globalSize = templateOffset - globalOffset;
-    size_t templateSize = codeOffset - templateOffset;
-    size_t objectKeysSize = codeOffset - objectKeysOffset;
-    fseek(file, 0, SEEK_END);
-    size_t codeSize = ftell(file) - codeOffset;
-
-    // Read segments
-    uint8_t *constantSegment = readSegment(file, constantOffset, constantSize);
-    uint8_t *globalSegment = readSegment(file, globalOffset, globalSize);
-    uint8_t *templateSegment = readSegment(file, templateOffset, templateSize);
-    uint8_t *objectKeysSegment = readSegment(file, objectKeysOffset, objectKeysSize);
-    uint8_t *codeSegment = readSegment(file, codeOffset, codeSize);
-
-    fclose(file);
-
     typev_env_init(srcMapFile);
     //typev_env_log();
 
     TypeV_Engine engine;
     engine_init(&engine, argc-readArgs, argv+readArgs);
 
-    TypeV_ASM_Program program = {
-            .codePool = codeSegment,
-            .codePoolSize = codeSize,
-            .constPool = constantSegment,
-            .constPoolSize = constantSize,
-            .templatePool = templateSegment,
-            .templatePoolSize = templateSize,
-            .globalPool = globalSegment,
-            .globalPoolSize = globalSize,
-            .objKeysPool = objectKeysSegment,
-            .objKeysPoolSize = objectKeysSize,
-            .version = 0
-    };
-
     //debug_program(&program);
 
     engine_setmain(&engine, program.codePool, program.codePoolSize,
@@ -110,35 +71,19 @@ int main(int argc, char **argv) {
                    1024, 1024);
 
 
+    // kill -USR1 <pid> dumps the scheduling statistics
+    sched_stats_listen(&engine);
+
     engine_run(&engine);
 
     uint32_t exitCode = engine.mainCoreExitCode;
 
     //engine_deallocate(&engine);
-    //free_program(program);
-
-
-    // Use the segment pointers...
-    // Remember to free them after use
-    //free(constantSegment);
-    //free(globalSegment);
-    //free(codeSegment);
+    typev_image_unmap(&program);
 
     return exitCode;
 }
 
-uint8_t *readSegment(FILE *file, uint64_t offset, size_t size) {
-    uint8_t *buffer = (uint8_t *)malloc(size);
-    if (buffer == NULL) {
-        perror("Memory allocation failed");
-        exit(1);
-    }
-    fseek(file, offset, SEEK_SET);
-    fread(buffer, 1, size, file);
-    return buffer;
-}
-
-
 // Function to replace the file name and extension with "src_map.map.txt"
 char* replace_with_src_map(const char* filepath) {
     if (filepath == NULL) {
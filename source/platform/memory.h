@@ -0,0 +1,212 @@
+/**
+ * Type-V Virtual Machine
+ * Author: praisethemoon
+ * memory.h: Page-level memory management, mmap on POSIX systems and VirtualAlloc on Windows, and file mappings
+ */
+
+#ifndef TYPE_V_MEMORY_H
+#define TYPE_V_MEMORY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static inline size_t typev_page_size(void) {
+#if defined(_WIN32) || defined(_WIN64)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (size_t)info.dwPageSize;
+#else
+    long size = sysconf(_SC_PAGESIZE);
+    return size > 0 ? (size_t)size : 4096;
+#endif
+}
+
+/**
+ * @brief Maps `size` bytes of zeroed, page-aligned memory. Pages are only backed once touched.
+ * @return NULL on failure
+ */
+static inline void* typev_pages_alloc(size_t size) {
+#if defined(_WIN32) || defined(_WIN64)
+    return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return ptr == MAP_FAILED ? NULL : ptr;
+#endif
+}
+
+/** @brief Unmaps memory returned by typev_pages_alloc */
+static inline void typev_pages_free(void* ptr, size_t size) {
+    if(ptr == NULL) {
+        return;
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+    munmap(ptr, size);
+#endif
+}
+
+/**
+ * @brief Returns the physical pages fully inside [ptr, ptr + size) to the OS. The range stays mapped,
+ * its contents are lost and it may be used again right away.
+ */
+static inline void typev_pages_discard(void* ptr, size_t size) {
+    size_t page = typev_page_size();
+    uintptr_t start = ((uintptr_t)ptr + page - 1) & ~(uintptr_t)(page - 1);
+    uintptr_t end = ((uintptr_t)ptr + size) & ~(uintptr_t)(page - 1);
+    if(end <= start) {
+        return;
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    VirtualAlloc((void*)start, end - start, MEM_RESET, PAGE_READWRITE);
+#else
+    madvise((void*)start, end - start, MADV_DONTNEED);
+#endif
+}
+
+/**
+ * @brief A file mapped read-only. Its pages come from the OS page cache, shared by every process mapping
+ * the same file and only read from disk once touched.
+ */
+typedef struct TypeV_FileMapping {
+    const uint8_t* data;         ///< File content, NULL for an empty file
+    size_t size;
+#if defined(_WIN32) || defined(_WIN64)
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+} TypeV_FileMapping;
+
+/**
+ * @brief Maps a whole file read-only. The file stays open until typev_file_close, for typev_file_map_private
+ * @return 0 on success, -1 if the file cannot be opened or mapped
+ */
+static inline int typev_file_map(const char* path, TypeV_FileMapping* map) {
+    map->data = NULL;
+    map->size = 0;
+#if defined(_WIN32) || defined(_WIN64)
+    map->mapping = NULL;
+    map->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(map->file == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(map->file, &size)) {
+        CloseHandle(map->file);
+        return -1;
+    }
+    map->size = (size_t)size.QuadPart;
+    if(map->size == 0) {
+        return 0;
+    }
+    map->mapping = CreateFileMappingA(map->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(map->mapping == NULL) {
+        CloseHandle(map->file);
+        return -1;
+    }
+    map->data = MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, 0);
+    if(map->data == NULL) {
+        CloseHandle(map->mapping);
+        CloseHandle(map->file);
+        return -1;
+    }
+#else
+    map->fd = open(path, O_RDONLY);
+    if(map->fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if(fstat(map->fd, &st) != 0) {
+        close(map->fd);
+        return -1;
+    }
+    map->size = (size_t)st.st_size;
+    if(map->size == 0) {
+        return 0;
+    }
+    void* data = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, map->fd, 0);
+    if(data == MAP_FAILED) {
+        close(map->fd);
+        return -1;
+    }
+    map->data = data;
+#endif
+    return 0;
+}
+
+/**
+ * @brief Maps `size` bytes of a mapped file from `offset` again, writable and copy-on-write: pages are shared
+ * with the page cache until written, writes stay private to the process. The range must lie within the file.
+ * @return the mapping of the range, NULL on failure
+ */
+static inline uint8_t* typev_file_map_private(TypeV_FileMapping* map, uint64_t offset, size_t size) {
+#if defined(_WIN32) || defined(_WIN64)
+    // views start at a multiple of the allocation granularity
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    uint64_t start = offset - offset % info.dwAllocationGranularity;
+    uint8_t* view = MapViewOfFile(map->mapping, FILE_MAP_COPY, (DWORD)(start >> 32), (DWORD)start, (SIZE_T)(offset - start + size));
+    return view == NULL ? NULL : view + (offset - start);
+#else
+    uint64_t start = offset - offset % typev_page_size();
+    void* view = mmap(NULL, offset - start + size, PROT_READ | PROT_WRITE, MAP_PRIVATE, map->fd, (off_t)start);
+    return view == MAP_FAILED ? NULL : (uint8_t*)view + (offset - start);
+#endif
+}
+
+/**
+ * @brief Closes the file of a mapping, the mappings made from it stay valid
+ */
+static inline void typev_file_close(TypeV_FileMapping* map) {
+#if defined(_WIN32) || defined(_WIN64)
+    if(map->mapping != NULL) {
+        CloseHandle(map->mapping);
+    }
+    CloseHandle(map->file);
+#else
+    close(map->fd);
+#endif
+}
+
+/**
+ * @brief Unmaps the whole file mapping made by typev_file_map, the file being closed or not
+ */
+static inline void typev_file_unmap(TypeV_FileMapping* map) {
+    if(map->data == NULL) {
+        return;
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    UnmapViewOfFile(map->data);
+#else
+    munmap((void*)map->data, map->size);
+#endif
+    map->data = NULL;
+}
+
+/**
+ * @brief Unmaps a view made by typev_file_map_private, given the same offset and size
+ */
+static inline void typev_file_unmap_private(uint8_t* view, uint64_t offset, size_t size) {
+#if defined(_WIN32) || defined(_WIN64)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    UnmapViewOfFile(view - offset % info.dwAllocationGranularity);
+    (void)size;
+#else
+    uint64_t shift = offset % typev_page_size();
+    munmap(view - shift, shift + size);
+#endif
+}
+
+#endif //TYPE_V_MEMORY_H
@@ -0,0 +1,262 @@
+/**
+ * Type-V Virtual Machine
+ * Author: praisethemoon
+ * threads.h: Minimal threading layer, pthreads on POSIX systems and the Win32 API on Windows
+ */
+
+#ifndef TYPE_V_THREADS_H
+#define TYPE_V_THREADS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+
+typedef HANDLE TypeV_Thread;
+typedef SRWLOCK TypeV_Mutex;
+typedef CONDITION_VARIABLE TypeV_Cond;
+typedef INIT_ONCE TypeV_Once;
+#define TYPEV_ONCE_INIT INIT_ONCE_STATIC_INIT
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+typedef pthread_t TypeV_Thread;
+typedef pthread_mutex_t TypeV_Mutex;
+typedef pthread_cond_t TypeV_Cond;
+typedef pthread_once_t TypeV_Once;
+#define TYPEV_ONCE_INIT PTHREAD_ONCE_INIT
+#endif
+
+#if defined(_MSC_VER)
+#define TYPEV_THREAD_LOCAL __declspec(thread)
+#else
+#define TYPEV_THREAD_LOCAL _Thread_local
+#endif
+
+typedef void (*TypeV_ThreadFunc)(void* arg);
+
+typedef struct {
+    TypeV_ThreadFunc fn;
+    void* arg;
+} TypeV_ThreadStart;
+
+#if defined(_WIN32) || defined(_WIN64)
+static DWORD WINAPI typev_thread_trampoline(LPVOID param) {
+    TypeV_ThreadStart start = *(TypeV_ThreadStart*)param;
+    free(param);
+    start.fn(start.arg);
+    return 0;
+}
+
+static BOOL CALLBACK typev_once_trampoline(PINIT_ONCE once, PVOID param, PVOID* ctx) {
+    ((void (*)(void))param)();
+    return TRUE;
+}
+#else
+static void* typev_thread_trampoline(void* param) {
+    TypeV_ThreadStart start = *(TypeV_ThreadStart*)param;
+    free(param);
+    start.fn(start.arg);
+    return NULL;
+}
+#endif
+
+/**
+ * @brief Starts a new OS thread running fn(arg)
+ * @return 0 on success
+ */
+static inline int typev_thread_create(TypeV_Thread* thread, TypeV_ThreadFunc fn, void* arg) {
+    TypeV_ThreadStart* start = malloc(sizeof(TypeV_ThreadStart));
+    start->fn = fn;
+    start->arg = arg;
+#if defined(_WIN32) || defined(_WIN64)
+    *thread = CreateThread(NULL, 0, typev_thread_trampoline, start, 0, NULL);
+    return *thread == NULL;
+#else
+    int err = pthread_create(thread, NULL, typev_thread_trampoline, start);
+    if(err) {
+        free(start);
+    }
+    return err;
+#endif
+}
+
+static inline void typev_thread_join(TypeV_Thread thread) {
+#if defined(_WIN32) || defined(_WIN64)
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+}
+
+static inline void typev_thread_yield(void) {
+#if defined(_WIN32) || defined(_WIN64)
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+static inline void typev_once(TypeV_Once* once, void (*fn)(void)) {
+#if defined(_WIN32) || defined(_WIN64)
+    InitOnceExecuteOnce(once, typev_once_trampoline, (PVOID)fn, NULL);
+#else
+    pthread_once(once, fn);
+#endif
+}
+
+static inline void typev_mutex_init(TypeV_Mutex* mutex) {
+#if defined(_WIN32) || defined(_WIN64)
+    InitializeSRWLock(mutex);
+#else
+    pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+static inline void typev_mutex_destroy(TypeV_Mutex* mutex) {
+#if !defined(_WIN32) && !defined(_WIN64)
+    pthread_mutex_destroy(mutex);
+#endif
+}
+
+static inline void typev_mutex_lock(TypeV_Mutex* mutex) {
+#if defined(_WIN32) || defined(_WIN64)
+    AcquireSRWLockExclusive(mutex);
+#else
+    pthread_mutex_lock(mutex);
+#endif
+}
+
+/** @return 1 if the lock was acquired */
+static inline uint8_t typev_mutex_trylock(TypeV_Mutex* mutex) {
+#if defined(_WIN32) || defined(_WIN64)
+    return TryAcquireSRWLockExclusive(mutex) != 0;
+#else
+    return pthread_mutex_trylock(mutex) == 0;
+#endif
+}
+
+static inline void typev_mutex_unlock(TypeV_Mutex* mutex) {
+#if defined(_WIN32) || defined(_WIN64)
+    ReleaseSRWLockExclusive(mutex);
+#else
+    pthread_mutex_unlock(mutex);
+#endif
+}
+
+static inline void typev_cond_init(TypeV_Cond* cond) {
+#if defined(_WIN32) || defined(_WIN64)
+    InitializeConditionVariable(cond);
+#elif defined(__APPLE__)
+    pthread_cond_init(cond, NULL);
+#else
+    // timed waits measure the monotonic clock, so that changing the system time does not affect them
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+#endif
+}
+
+static inline void typev_cond_destroy(TypeV_Cond* cond) {
+#if !defined(_WIN32) && !defined(_WIN64)
+    pthread_cond_destroy(cond);
+#endif
+}
+
+static inline void typev_cond_wait(TypeV_Cond* cond, TypeV_Mutex* mutex) {
+#if defined(_WIN32) || defined(_WIN64)
+    SleepConditionVariableSRW(cond, mutex, INFINITE, 0);
+#else
+    pthread_cond_wait(cond, mutex);
+#endif
+}
+
+/**
+ * @brief Waits on a condition for at most `timeoutNs` nanoseconds. Like typev_cond_wait, it may return
+ * early without having been signaled
+ */
+static inline void typev_cond_timedwait(TypeV_Cond* cond, TypeV_Mutex* mutex, uint64_t timeoutNs) {
+#if defined(_WIN32) || defined(_WIN64)
+    uint64_t ms = (timeoutNs + 999999) / 1000000;
+    SleepConditionVariableSRW(cond, mutex, ms >= INFINITE ? INFINITE - 1 : (DWORD)ms, 0);
+#elif defined(__APPLE__)
+    struct timespec ts;
+    ts.tv_sec = (time_t)(timeoutNs / 1000000000ULL);
+    ts.tv_nsec = (long)(timeoutNs % 1000000000ULL);
+    pthread_cond_timedwait_relative_np(cond, mutex, &ts);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t nsec = (uint64_t)ts.tv_nsec + timeoutNs % 1000000000ULL;
+    ts.tv_sec += (time_t)(timeoutNs / 1000000000ULL + nsec / 1000000000ULL);
+    ts.tv_nsec = (long)(nsec % 1000000000ULL);
+    pthread_cond_timedwait(cond, mutex, &ts);
+#endif
+}
+
+static inline void typev_cond_signal(TypeV_Cond* cond) {
+#if defined(_WIN32) || defined(_WIN64)
+    WakeConditionVariable(cond);
+#else
+    pthread_cond_signal(cond);
+#endif
+}
+
+static inline void typev_cond_broadcast(TypeV_Cond* cond) {
+#if defined(_WIN32) || defined(_WIN64)
+    WakeAllConditionVariable(cond);
+#else
+    pthread_cond_broadcast(cond);
+#endif
+}
+
+/** @brief Number of logical processors available to the process */
+static inline uint32_t typev_cpu_count(void) {
+#if defined(_WIN32) || defined(_WIN64)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (uint32_t)info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (uint32_t)n : 1;
+#endif
+}
+
+/** @brief Monotonic clock, in nanoseconds */
+static inline uint64_t typev_now_ns(void) {
+#if defined(_WIN32) || defined(_WIN64)
+    LARGE_INTEGER freq, counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)((double)counter.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/** @brief CPU time used by the calling thread, in nanoseconds */
+static inline uint64_t typev_thread_cpu_ns(void) {
+#if defined(_WIN32) || defined(_WIN64)
+    FILETIME creation, exit, kernel, user;
+    GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+    uint64_t k = ((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+    uint64_t u = ((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime;
+    return (k + u) * 100;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+#endif //TYPE_V_THREADS_H
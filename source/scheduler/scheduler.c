@@ -0,0 +1,153 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+#include <stdlib.h>
+#include "scheduler.h"
+#include "../engine.h"
+
+void sched_runq_init(TypeV_RunQueue* queue) {
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    for(uint32_t k = 0; k < SCHED_RUNQ_SIZE; k++) {
+        atomic_init(&queue->slots[k], NULL);
+    }
+}
+
+uint8_t sched_runq_push(TypeV_RunQueue* queue, TypeV_CoreIterator* iter) {
+    uint32_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    if(tail - head >= SCHED_RUNQ_SIZE) {
+        return 0;
+    }
+    atomic_store_explicit(&queue->slots[tail & (SCHED_RUNQ_SIZE - 1)], iter, memory_order_relaxed);
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+TypeV_CoreIterator* sched_runq_pop(TypeV_RunQueue* queue) {
+    uint32_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    while(1) {
+        uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        if(tail == head) {
+            return NULL;
+        }
+        TypeV_CoreIterator* iter = atomic_load_explicit(&queue->slots[head & (SCHED_RUNQ_SIZE - 1)], memory_order_relaxed);
+        // thieves move head too, a failed exchange reloads it
+        if(atomic_compare_exchange_weak_explicit(&queue->head, &head, head + 1, memory_order_acq_rel, memory_order_acquire)) {
+            return iter;
+        }
+    }
+}
+
+TypeV_CoreIterator* sched_runq_steal(TypeV_RunQueue* queue, TypeV_RunQueue* victim) {
+    TypeV_CoreIterator* batch[SCHED_RUNQ_SIZE / 2];
+    uint32_t count;
+
+    uint32_t head = atomic_load_explicit(&victim->head, memory_order_acquire);
+    while(1) {
+        uint32_t tail = atomic_load_explicit(&victim->tail, memory_order_acquire);
+        count = tail - head;
+        count = count - count / 2;
+        if(count == 0) {
+            return NULL;
+        }
+        if(count > SCHED_RUNQ_SIZE / 2) {
+            // head and tail were read at different times, the victim moved meanwhile
+            head = atomic_load_explicit(&victim->head, memory_order_acquire);
+            continue;
+        }
+        for(uint32_t k = 0; k < count; k++) {
+            batch[k] = atomic_load_explicit(&victim->slots[(head + k) & (SCHED_RUNQ_SIZE - 1)], memory_order_relaxed);
+        }
+        // the slots read are ours once head is moved past them
+        if(atomic_compare_exchange_weak_explicit(&victim->head, &head, head + count, memory_order_acq_rel, memory_order_acquire)) {
+            break;
+        }
+    }
+
+    // queue is empty, the batch fits
+    for(uint32_t k = 1; k < count; k++) {
+        sched_runq_push(queue, batch[k]);
+    }
+    return batch[0];
+}
+
+
+static inline uint32_t sched_table_slot(TypeV_CoreTable* table, uint32_t coreID) {
+    return (coreID * 0x9E3779B1u) & (table->capacity - 1);
+}
+
+void sched_table_init(TypeV_CoreTable* table) {
+    table->capacity = 64;
+    table->count = 0;
+    table->slots = calloc(table->capacity, sizeof(TypeV_CoreIterator*));
+}
+
+void sched_table_free(TypeV_CoreTable* table) {
+    free(table->slots);
+    table->slots = NULL;
+    table->count = 0;
+}
+
+static void sched_table_put(TypeV_CoreTable* table, TypeV_CoreIterator* iter) {
+    uint32_t slot = sched_table_slot(table, iter->core->id);
+    while(table->slots[slot] != NULL) {
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+    table->slots[slot] = iter;
+}
+
+void sched_table_insert(TypeV_CoreTable* table, TypeV_CoreIterator* iter) {
+    if((table->count + 1) * 2 > table->capacity) {
+        TypeV_CoreIterator** slots = table->slots;
+        uint32_t capacity = table->capacity;
+        table->capacity *= 2;
+        table->slots = calloc(table->capacity, sizeof(TypeV_CoreIterator*));
+        for(uint32_t k = 0; k < capacity; k++) {
+            if(slots[k] != NULL) {
+                sched_table_put(table, slots[k]);
+            }
+        }
+        free(slots);
+    }
+    sched_table_put(table, iter);
+    table->count++;
+}
+
+TypeV_CoreIterator* sched_table_find(TypeV_CoreTable* table, uint32_t coreID) {
+    uint32_t slot = sched_table_slot(table, coreID);
+    while(table->slots[slot] != NULL) {
+        if(table->slots[slot]->core->id == coreID) {
+            return table->slots[slot];
+        }
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+    return NULL;
+}
+
+void sched_table_remove(TypeV_CoreTable* table, uint32_t coreID) {
+    uint32_t mask = table->capacity - 1;
+    uint32_t slot = sched_table_slot(table, coreID);
+    while(table->slots[slot] != NULL && table->slots[slot]->core->id != coreID) {
+        slot = (slot + 1) & mask;
+    }
+    if(table->slots[slot] == NULL) {
+        return;
+    }
+
+    // shift the following entries back, so that no probe sequence has a hole
+    uint32_t hole = slot;
+    uint32_t next = (hole + 1) & mask;
+    while(table->slots[next] != NULL) {
+        uint32_t home = sched_table_slot(table, table->slots[next]->core->id);
+        // the entry may fill the hole if its home is not cyclically within (hole, next]
+        if(((next - home) & mask) >= ((next - hole) & mask)) {
+            table->slots[hole] = table->slots[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    table->slots[hole] = NULL;
+    table->count--;
+}
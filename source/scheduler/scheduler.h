@@ -0,0 +1,114 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+#ifndef TYPE_V_SCHEDULER_H
+#define TYPE_V_SCHEDULER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+struct TypeV_CoreIterator;
+
+/**
+ * Work-stealing run queues, the scheme of the Go runtime. Every engine thread owns a bounded ring of runnable
+ * cores: it pushes and pops them without locking, while threads which ran out of work steal half of the ring
+ * from another one. Cores made runnable outside of the engine threads, and those a full ring cannot take,
+ * go to a global queue, protected by the engine run lock.
+ *
+ * Each core has a scheduling class and a weight. Interactive cores have run queues of their own, on every
+ * thread and globally, which are always looked at first, and a core of another class running on a thread
+ * gives it up at its next safepoint check once an interactive core waits. Other cores share the threads
+ * in proportion to their weight: a core runs weight * ENGINE_SLICE_POLLS safepoint polls before it lets
+ * a waiting core have its thread. Strict priority means that busy interactive cores starve the others.
+ *
+ * The core table maps core IDs to living cores, for message delivery. It is protected by the engine lock.
+ */
+
+/** Capacity of a thread run queue, must be a power of two */
+#define SCHED_RUNQ_SIZE 256
+
+/** Scheduling state of a core */
+typedef enum {
+    SCHED_QUEUED = 0,            // In a run queue, or about to be put in one
+    SCHED_RUNNING,               // Taken by an engine thread
+    SCHED_WAITING,               // Waiting for a message, in no queue
+} TypeV_SchedState;
+
+/** Scheduling class of a core, spawned cores start with the class and weight of their parent */
+typedef enum {
+    SCHED_CLASS_INTERACTIVE = 0, // Latency sensitive, runs before any other core
+    SCHED_CLASS_NORMAL,          // Default
+    SCHED_CLASS_BATCH,           // Throughput, low weight by default
+    SCHED_CLASS_COUNT
+} TypeV_SchedClass;
+
+/** Weight of a core, when set to 0 */
+#define SCHED_WEIGHT_INTERACTIVE 1
+#define SCHED_WEIGHT_NORMAL 4
+#define SCHED_WEIGHT_BATCH 1
+#define SCHED_WEIGHT_MAX 64
+
+/** Run queue levels, interactive cores are queued apart from the others */
+typedef enum {
+    SCHED_LEVEL_INTERACTIVE = 0,
+    SCHED_LEVEL_SHARED,
+    SCHED_LEVELS
+} TypeV_SchedLevel;
+
+static inline uint8_t sched_class_level(uint8_t sclass) {
+    return sclass == SCHED_CLASS_INTERACTIVE ? SCHED_LEVEL_INTERACTIVE : SCHED_LEVEL_SHARED;
+}
+
+/** Weight a class gives by default */
+static inline uint8_t sched_class_weight(uint8_t sclass) {
+    switch(sclass) {
+        case SCHED_CLASS_INTERACTIVE: return SCHED_WEIGHT_INTERACTIVE;
+        case SCHED_CLASS_BATCH: return SCHED_WEIGHT_BATCH;
+        default: return SCHED_WEIGHT_NORMAL;
+    }
+}
+
+typedef struct TypeV_RunQueue {
+    _Atomic uint32_t head;       // Next core to run, moved by the owner and by thieves
+    _Atomic uint32_t tail;       // Next free slot, moved by the owner only
+    _Atomic(struct TypeV_CoreIterator*) slots[SCHED_RUNQ_SIZE];
+} TypeV_RunQueue;
+
+void sched_runq_init(TypeV_RunQueue* queue);
+
+/** Number of queued cores, approximate unless called by the owner */
+static inline uint32_t sched_runq_size(TypeV_RunQueue* queue) {
+    return atomic_load(&queue->tail) - atomic_load(&queue->head);
+}
+
+/**
+ * Appends a core, owner only.
+ * @return 0 if the queue is full
+ */
+uint8_t sched_runq_push(TypeV_RunQueue* queue, struct TypeV_CoreIterator* iter);
+
+/** Takes the oldest core, owner only. NULL if the queue is empty */
+struct TypeV_CoreIterator* sched_runq_pop(TypeV_RunQueue* queue);
+
+/**
+ * Moves half of the cores of `victim` to `queue`, which must be empty and owned by the caller.
+ * @return one of the stolen cores, to be run right away, or NULL if there was nothing to steal
+ */
+struct TypeV_CoreIterator* sched_runq_steal(TypeV_RunQueue* queue, TypeV_RunQueue* victim);
+
+
+typedef struct TypeV_CoreTable {
+    struct TypeV_CoreIterator** slots; // Open addressing, NULL for free slots
+    uint32_t capacity;           // Power of two
+    uint32_t count;
+} TypeV_CoreTable;
+
+void sched_table_init(TypeV_CoreTable* table);
+void sched_table_free(TypeV_CoreTable* table);
+void sched_table_insert(TypeV_CoreTable* table, struct TypeV_CoreIterator* iter);
+struct TypeV_CoreIterator* sched_table_find(TypeV_CoreTable* table, uint32_t coreID);
+void sched_table_remove(TypeV_CoreTable* table, uint32_t coreID);
+
+#endif //TYPE_V_SCHEDULER_H
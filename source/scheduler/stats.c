@@ -0,0 +1,216 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "stats.h"
+#include "../engine.h"
+#include "../platform/threads.h"
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <signal.h>
+#endif
+
+void sched_stats_init(TypeV_CoreStats* stats) {
+    atomic_init(&stats->instructions, 0);
+    atomic_init(&stats->polls, 0);
+    atomic_init(&stats->slices, 0);
+    atomic_init(&stats->run_ns, 0);
+    atomic_init(&stats->cpu_ns, 0);
+    atomic_init(&stats->wait_ns, 0);
+    atomic_init(&stats->wait_max_ns, 0);
+    atomic_init(&stats->gc_ns, 0);
+    stats->created_ns = typev_now_ns();
+}
+
+void sched_stats_class_init(TypeV_SchedClassStats* stats) {
+    atomic_init(&stats->slices, 0);
+    atomic_init(&stats->wait_ns, 0);
+    atomic_init(&stats->wait_max_ns, 0);
+    for(uint32_t k = 0; k < SCHED_LATENCY_BUCKETS; k++) {
+        atomic_init(&stats->histogram[k], 0);
+    }
+}
+
+void sched_stats_class_record(TypeV_SchedClassStats* stats, uint64_t wait_ns) {
+    // shared by every thread, the relaxed additions are cheap next to a time slice
+    atomic_fetch_add_explicit(&stats->slices, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->wait_ns, wait_ns, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&stats->wait_max_ns, memory_order_relaxed);
+    while(wait_ns > max && !atomic_compare_exchange_weak(&stats->wait_max_ns, &max, wait_ns));
+
+    uint64_t us = wait_ns / 1000;
+    uint32_t bucket = 0;
+    while(us > 0 && bucket < SCHED_LATENCY_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    atomic_fetch_add_explicit(&stats->histogram[bucket], 1, memory_order_relaxed);
+}
+
+uint64_t sched_stats_core_get(TypeV_Core* core, uint32_t id) {
+    TypeV_CoreStats* stats = &core->stats;
+    switch(id) {
+        case CORE_STAT_INSTRUCTIONS: return atomic_load(&stats->instructions);
+        case CORE_STAT_SLICES: return atomic_load(&stats->slices);
+        case CORE_STAT_RUN_NS: return atomic_load(&stats->run_ns);
+        case CORE_STAT_CPU_NS: return atomic_load(&stats->cpu_ns);
+        case CORE_STAT_WAIT_NS: return atomic_load(&stats->wait_ns);
+        case CORE_STAT_WAIT_MAX_NS: return atomic_load(&stats->wait_max_ns);
+        case CORE_STAT_GC_NS: return atomic_load(&stats->gc_ns);
+        case CORE_STAT_AGE_NS: return typev_now_ns() - stats->created_ns;
+        case CORE_STAT_CLASS: return atomic_load(&core->sclass);
+        case CORE_STAT_WEIGHT: return atomic_load(&core->weight);
+        case CORE_STAT_POLLS: return atomic_load(&stats->polls);
+        default: return 0;
+    }
+}
+
+uint64_t sched_stats_engine_get(TypeV_Engine* engine, uint32_t id) {
+    switch(id) {
+        case ENGINE_STAT_HEALTH: return engine_health(engine);
+        case ENGINE_STAT_THREADS: return engine->threadCount;
+        case ENGINE_STAT_IDLE_THREADS: return atomic_load(&engine->idleWorkers);
+        case ENGINE_STAT_CORES: return atomic_load(&engine->coreCount);
+        case ENGINE_STAT_RUNNING: return atomic_load(&engine->runningCoresCount);
+        case ENGINE_STAT_QUEUED: return atomic_load(&engine->queuedCoresCount);
+        case ENGINE_STAT_WAITING: return atomic_load(&engine->parkedCoresCount);
+        case ENGINE_STAT_SLEEPING: return atomic_load(&engine->sleepingCoresCount);
+        case ENGINE_STAT_WAIT_MAX_NS: return atomic_load(&engine->healthWaitMaxNs);
+        default: return 0;
+    }
+}
+
+uint64_t sched_stats_latency_get(TypeV_Engine* engine, uint32_t sclass, uint32_t bucket) {
+    if(sclass >= SCHED_CLASS_COUNT || bucket >= SCHED_LATENCY_BUCKETS) {
+        return 0;
+    }
+    return atomic_load(&engine->classStats[sclass].histogram[bucket]);
+}
+
+static const char* sched_stats_health_name(TypeV_EngineHealth health) {
+    switch(health) {
+        case EH_OK: return "ok";
+        case EH_SLUGGISH: return "sluggish";
+        case EH_UNHEALTHY: return "unhealthy";
+        case EH_ZOMBIE: return "zombie";
+        default: return "unknown";
+    }
+}
+
+static const char* sched_stats_class_name(uint8_t sclass) {
+    switch(sclass) {
+        case SCHED_CLASS_INTERACTIVE: return "interactive";
+        case SCHED_CLASS_NORMAL: return "normal";
+        case SCHED_CLASS_BATCH: return "batch";
+        default: return "unknown";
+    }
+}
+
+static const char* sched_stats_state_name(uint8_t state) {
+    switch(state) {
+        case SCHED_QUEUED: return "queued";
+        case SCHED_RUNNING: return "running";
+        case SCHED_WAITING: return "waiting";
+        default: return "unknown";
+    }
+}
+
+void sched_stats_dump(TypeV_Engine* engine, FILE* out) {
+    uint64_t now = typev_now_ns();
+    TypeV_EngineHealth health = engine_health(engine);
+
+    fprintf(out,
+            "{\"stats\":\"engine\",\"time_ms\":%.3f,\"health\":\"%s\",\"wait_max_us\":%.1f,\"threads\":%u,"
+            "\"idle_threads\":%u,\"cores\":%u,\"running\":%u,\"queued\":%u,\"waiting\":%u,\"sleeping\":%u}\n",
+            (double)(now - engine->startNs) / 1e6, sched_stats_health_name(health),
+            (double)atomic_load(&engine->healthWaitMaxNs) / 1e3, engine->threadCount,
+            atomic_load(&engine->idleWorkers), atomic_load(&engine->coreCount),
+            atomic_load(&engine->runningCoresCount), atomic_load(&engine->queuedCoresCount),
+            atomic_load(&engine->parkedCoresCount), atomic_load(&engine->sleepingCoresCount));
+
+    for(uint32_t k = 0; k < SCHED_CLASS_COUNT; k++) {
+        TypeV_SchedClassStats* stats = &engine->classStats[k];
+        fprintf(out, "{\"stats\":\"class\",\"class\":\"%s\",\"slices\":%llu,\"wait_ms\":%.3f,\"wait_max_us\":%.1f,\"histogram\":[",
+                sched_stats_class_name(k), (unsigned long long)atomic_load(&stats->slices),
+                (double)atomic_load(&stats->wait_ns) / 1e6, (double)atomic_load(&stats->wait_max_ns) / 1e3);
+        for(uint32_t bucket = 0; bucket < SCHED_LATENCY_BUCKETS; bucket++) {
+            fprintf(out, bucket == 0 ? "%llu" : ",%llu", (unsigned long long)atomic_load(&stats->histogram[bucket]));
+        }
+        fprintf(out, "]}\n");
+    }
+
+    // threads are freed when engine_run returns, under the run lock
+    typev_mutex_lock(&engine->runLock);
+    for(uint32_t k = 0; engine->workers != NULL && k < engine->workerCount; k++) {
+        TypeV_Worker* worker = &engine->workers[k];
+        fprintf(out, "{\"stats\":\"thread\",\"id\":%u,\"slices\":%u,\"cpu_ms\":%.3f}\n", worker->id,
+                atomic_load(&worker->tick), (double)atomic_load(&worker->cpu_ns) / 1e6);
+    }
+    typev_mutex_unlock(&engine->runLock);
+
+    // the engine lock keeps cores from being freed meanwhile
+    typev_mutex_lock(&engine->lock);
+    for(TypeV_CoreIterator* iter = engine->coreIterator; iter != NULL; iter = iter->next) {
+        TypeV_CoreStats* stats = &iter->core->stats;
+        fprintf(out,
+                "{\"stats\":\"core\",\"id\":%u,\"state\":\"%s\",\"class\":\"%s\",\"weight\":%u,\"age_ms\":%.3f,\"instructions\":%llu,\"polls\":%llu,\"slices\":%llu,"
+                "\"run_ms\":%.3f,\"cpu_ms\":%.3f,\"wait_ms\":%.3f,\"wait_max_us\":%.1f,\"gc_ms\":%.3f}\n",
+                iter->core->id, sched_stats_state_name(atomic_load(&iter->sched)),
+                sched_stats_class_name(atomic_load(&iter->core->sclass)), atomic_load(&iter->core->weight),
+                (double)(now - stats->created_ns) / 1e6,
+                (unsigned long long)atomic_load(&stats->instructions), (unsigned long long)atomic_load(&stats->polls),
+                (unsigned long long)atomic_load(&stats->slices),
+                (double)atomic_load(&stats->run_ns) / 1e6, (double)atomic_load(&stats->cpu_ns) / 1e6,
+                (double)atomic_load(&stats->wait_ns) / 1e6, (double)atomic_load(&stats->wait_max_ns) / 1e3,
+                (double)atomic_load(&stats->gc_ns) / 1e6);
+    }
+    typev_mutex_unlock(&engine->lock);
+    fflush(out);
+}
+
+void sched_stats_report(TypeV_Engine* engine) {
+    const char* path = getenv("TYPEV_ENGINE_STATS");
+    if(path == NULL || path[0] == '\0') {
+        sched_stats_dump(engine, stderr);
+        return;
+    }
+
+    FILE* out = fopen(path, "a");
+    if(out == NULL) {
+        fprintf(stderr, "engine: cannot open TYPEV_ENGINE_STATS file %s\n", path);
+        return;
+    }
+    sched_stats_dump(engine, out);
+    fclose(out);
+}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+static void sched_stats_listener(void* arg) {
+    TypeV_Engine* engine = arg;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+
+    int sig;
+    while(sigwait(&set, &sig) == 0) {
+        sched_stats_report(engine);
+    }
+}
+#endif
+
+void sched_stats_listen(TypeV_Engine* engine) {
+#if !defined(_WIN32) && !defined(_WIN64)
+    // only the listener takes the signal, the threads started from now on inherit the mask
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    TypeV_Thread thread;
+    if(typev_thread_create(&thread, sched_stats_listener, engine) != 0) {
+        pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+    }
+#endif
+}
@@ -0,0 +1,132 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+#ifndef TYPE_V_SCHEDULER_STATS_H
+#define TYPE_V_SCHEDULER_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdatomic.h>
+
+struct TypeV_Core;
+struct TypeV_Engine;
+
+/**
+ * Scheduling telemetry, always collected. Every core accounts for the instructions it ran and for its time on
+ * and off a thread, the engine derives its health from how long runnable cores wait for a thread.
+ * Counters are cumulative since the core was created. The thread running a core adds to them at the end of
+ * each time slice, they can be read from any thread.
+ *
+ * Counting instructions costs an increment per dispatch, so cores only count them in builds with
+ * TYPEV_ENGINE_INSTRUCTION_STATS defined. They always count safepoint polls, which come for free from the
+ * budget of their time slice.
+ *
+ * Wall time is read once per time slice. Reading the CPU time of a thread is a system call on most platforms,
+ * so per-core CPU time is only measured when TYPEV_ENGINE_CPU_STATS is set. Engine threads always sample
+ * their own CPU time, at health updates and before they wait for work.
+ *
+ * Waits for a thread are also accounted per scheduling class, engine-wide, with a latency histogram.
+ *
+ * A dump of every statistic, one JSON line for the engine, each class, each thread and each core, is written
+ * on demand: through the FFI, or on SIGUSR1 once sched_stats_listen was called. It goes to the file named by
+ * TYPEV_ENGINE_STATS, stderr if unset.
+ */
+
+typedef struct TypeV_CoreStats {
+    _Atomic uint64_t instructions;   // Instructions executed, 0 unless built with TYPEV_ENGINE_INSTRUCTION_STATS
+    _Atomic uint64_t polls;          // Safepoint polls run: backward jumps and calls
+    _Atomic uint64_t slices;         // Times the core was given a thread
+    _Atomic uint64_t run_ns;         // Wall time spent on a thread, GC pauses included
+    _Atomic uint64_t cpu_ns;         // CPU time spent on a thread, 0 unless TYPEV_ENGINE_CPU_STATS is set
+    _Atomic uint64_t wait_ns;        // Time spent runnable, waiting for a thread
+    _Atomic uint64_t wait_max_ns;    // Longest of those waits
+    _Atomic uint64_t gc_ns;          // Time spent in GC pauses
+    uint64_t created_ns;             // Monotonic time the core was created at
+} TypeV_CoreStats;
+
+/** Run queue latency histogram buckets: bucket 0 counts waits under 1us, bucket i in [2^(i-1), 2^i) us, the last one is open-ended */
+#define SCHED_LATENCY_BUCKETS 24
+
+/** Waits for a thread of the cores of a scheduling class */
+typedef struct TypeV_SchedClassStats {
+    _Atomic uint64_t slices;         // Times a core of the class was given a thread
+    _Atomic uint64_t wait_ns;        // Time spent runnable, waiting for a thread
+    _Atomic uint64_t wait_max_ns;    // Longest of those waits
+    _Atomic uint64_t histogram[SCHED_LATENCY_BUCKETS];
+} TypeV_SchedClassStats;
+
+/** Single statistics of a core, for callers which cannot read TypeV_CoreStats directly (FFI) */
+typedef enum {
+    CORE_STAT_INSTRUCTIONS = 0,
+    CORE_STAT_SLICES,
+    CORE_STAT_RUN_NS,
+    CORE_STAT_CPU_NS,
+    CORE_STAT_WAIT_NS,
+    CORE_STAT_WAIT_MAX_NS,
+    CORE_STAT_GC_NS,
+    CORE_STAT_AGE_NS,
+    CORE_STAT_CLASS,                 // TypeV_SchedClass
+    CORE_STAT_WEIGHT,
+    CORE_STAT_POLLS,
+    CORE_STAT_COUNT
+} TypeV_CoreStatId;
+
+/** Engine-wide statistics */
+typedef enum {
+    ENGINE_STAT_HEALTH = 0,          // TypeV_EngineHealth
+    ENGINE_STAT_THREADS,
+    ENGINE_STAT_IDLE_THREADS,
+    ENGINE_STAT_CORES,
+    ENGINE_STAT_RUNNING,
+    ENGINE_STAT_QUEUED,
+    ENGINE_STAT_WAITING,             // Cores waiting for a message
+    ENGINE_STAT_SLEEPING,
+    ENGINE_STAT_WAIT_MAX_NS,         // Longest wait for a thread over the last health interval
+    ENGINE_STAT_COUNT
+} TypeV_EngineStatId;
+
+void sched_stats_init(TypeV_CoreStats* stats);
+
+/** Adds to a counter, for the thread running the core only */
+static inline void sched_stats_add(_Atomic uint64_t* counter, uint64_t value) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+/** Raises a maximum, for the thread running the core only */
+static inline void sched_stats_max(_Atomic uint64_t* counter, uint64_t value) {
+    if(value > atomic_load_explicit(counter, memory_order_relaxed)) {
+        atomic_store_explicit(counter, value, memory_order_relaxed);
+    }
+}
+
+void sched_stats_class_init(TypeV_SchedClassStats* stats);
+
+/** Accounts for a wait of a core of the class, from any thread */
+void sched_stats_class_record(TypeV_SchedClassStats* stats, uint64_t wait_ns);
+
+/** Reads a single statistic of a core, 0 for unknown ids */
+uint64_t sched_stats_core_get(struct TypeV_Core* core, uint32_t id);
+
+/** Reads a single engine-wide statistic, 0 for unknown ids */
+uint64_t sched_stats_engine_get(struct TypeV_Engine* engine, uint32_t id);
+
+/**
+ * Reads a bucket of the run queue latency histogram of a class, see SCHED_LATENCY_BUCKETS
+ * @return the number of waits in the bucket, 0 for unknown classes and buckets
+ */
+uint64_t sched_stats_latency_get(struct TypeV_Engine* engine, uint32_t sclass, uint32_t bucket);
+
+/** Writes the statistics of the engine, of its scheduling classes, of its threads and of every living core to `out` */
+void sched_stats_dump(struct TypeV_Engine* engine, FILE* out);
+
+/** Writes the statistics to the TYPEV_ENGINE_STATS file, or to stderr */
+void sched_stats_report(struct TypeV_Engine* engine);
+
+/**
+ * Writes a report every time the process receives SIGUSR1, from a dedicated thread. Must be called before
+ * engine_run, so that the engine threads inherit the signal mask. No-op on Windows.
+ */
+void sched_stats_listen(struct TypeV_Engine* engine);
+
+#endif //TYPE_V_SCHEDULER_STATS_H
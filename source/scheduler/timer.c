@@ -0,0 +1,122 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+#include <string.h>
+#include "timer.h"
+
+#define SCHED_WHEEL_MASK (SCHED_WHEEL_SLOTS - 1)
+// Ticks covered by the whole wheel, timers further away go to the last slot of the top level and move again
+#define SCHED_WHEEL_RANGE (1ULL << (SCHED_WHEEL_BITS * SCHED_WHEEL_LEVELS))
+
+void sched_wheel_init(TypeV_TimerWheel* wheel, uint64_t now) {
+    wheel->now = now;
+    wheel->count = 0;
+    memset(wheel->slots, 0, sizeof(wheel->slots));
+}
+
+/**
+ * Puts a timer in the slot matching its distance to the current tick, or in `due` if it has no distance left
+ */
+static void sched_wheel_place(TypeV_TimerWheel* wheel, TypeV_Timer* timer, TypeV_Timer** due) {
+    if(timer->expires <= wheel->now) {
+        timer->next = *due;
+        *due = timer;
+        return;
+    }
+
+    uint64_t expires = timer->expires;
+    uint64_t delta = expires - wheel->now;
+    if(delta >= SCHED_WHEEL_RANGE) {
+        expires = wheel->now + SCHED_WHEEL_RANGE - 1;
+        delta = SCHED_WHEEL_RANGE - 1;
+    }
+
+    uint32_t level = 0;
+    while(level < SCHED_WHEEL_LEVELS - 1 && delta >= (1ULL << (SCHED_WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+
+    TypeV_Timer** slot = &wheel->slots[level][(expires >> (SCHED_WHEEL_BITS * level)) & SCHED_WHEEL_MASK];
+    timer->next = *slot;
+    *slot = timer;
+}
+
+void sched_wheel_add(TypeV_TimerWheel* wheel, TypeV_Timer* timer) {
+    // due timers wait in the slot of the next tick
+    TypeV_Timer* due = NULL;
+    sched_wheel_place(wheel, timer, &due);
+    if(due != NULL) {
+        TypeV_Timer** slot = &wheel->slots[0][(wheel->now + 1) & SCHED_WHEEL_MASK];
+        due->next = *slot;
+        *slot = due;
+    }
+    wheel->count++;
+}
+
+uint64_t sched_wheel_next(TypeV_TimerWheel* wheel) {
+    if(wheel->count == 0) {
+        return UINT64_MAX;
+    }
+
+    uint64_t next = UINT64_MAX;
+    for(uint32_t level = 0; level < SCHED_WHEEL_LEVELS; level++) {
+        uint32_t shift = SCHED_WHEEL_BITS * level;
+        uint64_t current = wheel->now >> shift;
+        for(uint64_t k = 1; k <= SCHED_WHEEL_SLOTS; k++) {
+            if(wheel->slots[level][(current + k) & SCHED_WHEEL_MASK] != NULL) {
+                uint64_t start = (current + k) << shift;
+                if(start < next) {
+                    next = start;
+                }
+                break;
+            }
+        }
+    }
+    return next;
+}
+
+TypeV_Timer* sched_wheel_advance(TypeV_TimerWheel* wheel, uint64_t now) {
+    TypeV_Timer* due = NULL;
+
+    while(wheel->now < now) {
+        // no slot holds a timer before the next one, skip the ticks in between
+        uint64_t next = sched_wheel_next(wheel);
+        if(next > now) {
+            wheel->now = now;
+            break;
+        }
+        wheel->now = next;
+
+        // the slots of the levels above whose range starts now move down
+        for(uint32_t level = 1; level < SCHED_WHEEL_LEVELS; level++) {
+            uint32_t shift = SCHED_WHEEL_BITS * level;
+            if(wheel->now & ((1ULL << shift) - 1)) {
+                break;
+            }
+            TypeV_Timer** slot = &wheel->slots[level][(wheel->now >> shift) & SCHED_WHEEL_MASK];
+            TypeV_Timer* timer = *slot;
+            *slot = NULL;
+            while(timer != NULL) {
+                TypeV_Timer* following = timer->next;
+                sched_wheel_place(wheel, timer, &due);
+                timer = following;
+            }
+        }
+
+        TypeV_Timer** slot = &wheel->slots[0][wheel->now & SCHED_WHEEL_MASK];
+        TypeV_Timer* timer = *slot;
+        *slot = NULL;
+        while(timer != NULL) {
+            TypeV_Timer* following = timer->next;
+            timer->next = due;
+            due = timer;
+            timer = following;
+        }
+    }
+
+    for(TypeV_Timer* timer = due; timer != NULL; timer = timer->next) {
+        wheel->count--;
+    }
+    return due;
+}
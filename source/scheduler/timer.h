@@ -0,0 +1,53 @@
+//
+// Created by praisethemoon on 19.10.26.
+//
+
+#ifndef TYPE_V_TIMER_H
+#define TYPE_V_TIMER_H
+
+#include <stdint.h>
+
+/**
+ * Hierarchical timer wheel (Varghese and Lauck, the scheme of the Linux kernel timers). Level 0 has one slot
+ * per tick for the next 64 ticks, each level above has slots 64 times as wide. A timer goes to the lowest
+ * level whose range covers its deadline, and is moved down a level each time the wheel reaches its slot,
+ * so adding a timer is O(1) and each one is moved at most once per level.
+ *
+ * Ticks are an abstract unit, the engine uses milliseconds of the monotonic clock. Timers are intrusive
+ * and the wheel does no locking, the engine protects it with its run lock.
+ */
+
+#define SCHED_WHEEL_BITS 6
+#define SCHED_WHEEL_SLOTS (1 << SCHED_WHEEL_BITS)
+#define SCHED_WHEEL_LEVELS 4
+
+typedef struct TypeV_Timer {
+    struct TypeV_Timer* next;
+    uint64_t expires;            // Tick at which the timer is due
+} TypeV_Timer;
+
+typedef struct TypeV_TimerWheel {
+    uint64_t now;                // Last tick processed
+    uint32_t count;              // Pending timers
+    TypeV_Timer* slots[SCHED_WHEEL_LEVELS][SCHED_WHEEL_SLOTS];
+} TypeV_TimerWheel;
+
+void sched_wheel_init(TypeV_TimerWheel* wheel, uint64_t now);
+
+/** Adds a timer, its expires field must be set. A timer already due fires on the next advance */
+void sched_wheel_add(TypeV_TimerWheel* wheel, TypeV_Timer* timer);
+
+/**
+ * Moves the wheel to tick `now`.
+ * @return the timers due by then, linked through their next field
+ */
+TypeV_Timer* sched_wheel_advance(TypeV_TimerWheel* wheel, uint64_t now);
+
+/**
+ * Lower bound of the tick at which the next timer is due: exact for timers less than 64 ticks away, the
+ * start of their slot for the others.
+ * @return UINT64_MAX if no timer is pending
+ */
+uint64_t sched_wheel_next(TypeV_TimerWheel* wheel);
+
+#endif //TYPE_V_TIMER_H
@@ -12,6 +12,7 @@
 #include "datetime.h"
 #include "vendor/yy.h"
 #include "../../source/core.h"
+#include "../../source/engine.h"
 #include "../../source/api/typev_api.h"
 #include "../../source/errors/errors.h"
 
@@ -696,6 +697,60 @@ void _dt_toLocalTime(TypeV_Core* core){
     typev_api_return_u16(core, local.year);
 }
 
+void _gc_stat(TypeV_Core* core){
+    uint8_t id = typev_api_stack_pop_u8(core);
+    typev_api_return_u64(core, typev_api_gc_stat(core, id));
+}
+
+void _gc_pauseHistogram(TypeV_Core* core){
+    uint8_t kind = typev_api_stack_pop_u8(core);
+    uint8_t bucket = typev_api_stack_pop_u8(core);
+    typev_api_return_u64(core, typev_api_gc_pause_histogram(core, kind, bucket));
+}
+
+void _core_stat(TypeV_Core* core){
+    uint8_t id = typev_api_stack_pop_u8(core);
+    typev_api_return_u64(core, typev_api_core_stat(core, id));
+}
+
+void _engine_stat(TypeV_Core* core){
+    uint8_t id = typev_api_stack_pop_u8(core);
+    typev_api_return_u64(core, typev_api_engine_stat(core, id));
+}
+
+void _engine_dumpStats(TypeV_Core* core){
+    typev_api_engine_stats_dump(core);
+}
+
+void _core_setClass(TypeV_Core* core){
+    uint8_t sclass = typev_api_stack_pop_u8(core);
+    uint8_t weight = typev_api_stack_pop_u8(core);
+    typev_api_core_set_class(core, sclass, weight);
+}
+
+void _engine_latencyHistogram(TypeV_Core* core){
+    uint8_t sclass = typev_api_stack_pop_u8(core);
+    uint8_t bucket = typev_api_stack_pop_u8(core);
+    typev_api_return_u64(core, typev_api_sched_latency_histogram(core, sclass, bucket));
+}
+
+void _parallel_for(TypeV_Core* core){
+    // called again each time a chunk ends, until all of them did
+    if(!typev_api_parallel_pending(core)) {
+        TypeV_Closure* closure = (TypeV_Closure*)typev_api_stack_pop_ptr(core);
+        uint64_t start = typev_api_stack_pop_u64(core);
+        uint64_t end = typev_api_stack_pop_u64(core);
+        uint32_t chunks = typev_api_stack_pop_u32(core);
+        TypeV_Array* out = typev_api_stack_pop_array(core);
+        typev_api_parallel_for(core, closure, start, end, chunks, out);
+    }
+
+    uint8_t status = typev_api_parallel_wait(core);
+    if(status != PARALLEL_PENDING) {
+        typev_api_return_u8(core, status == PARALLEL_DONE);
+    }
+}
+
 
 
 static TypeV_FFIFunc stdcore_lib[] = {
@@ -747,6 +802,20 @@ static TypeV_FFIFunc stdcore_lib[] = {
         _dt_getDayOfWeek,
         _dt_toLocalTime,
 
+        // gc
+        _gc_stat,
+        _gc_pauseHistogram,
+
+        // scheduler
+        _core_stat,
+        _engine_stat,
+        _engine_dumpStats,
+        _core_setClass,
+        _engine_latencyHistogram,
+
+        // parallel
+        _parallel_for,
+
         NULL
 };
 